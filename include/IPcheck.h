@@ -12,6 +12,7 @@
 
 struct Client;
 struct irc_in_addr;
+struct StatDesc;
 
 /*
  * Prototypes
@@ -25,5 +26,7 @@ extern void IPcheck_connect_succeeded(struct Client *cptr);
 extern int IPcheck_remote_connect(struct Client *cptr, int is_burst);
 extern void IPcheck_disconnect(struct Client *cptr);
 extern unsigned short IPcheck_nr(struct Client* cptr);
+extern void IPcheck_stats(struct Client *to, const struct StatDesc *sd,
+                          char *param);
 
 #endif /* INCLUDED_ipcheck_h */
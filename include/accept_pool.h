@@ -0,0 +1,38 @@
+/*
+ * IRC - Internet Relay Chat, include/accept_pool.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/** @file
+ * @brief Optional threads that accept connections on listening ports.
+ * @version $Id$
+ */
+#ifndef INCLUDED_accept_pool_h
+#define INCLUDED_accept_pool_h
+
+struct Client;
+struct Listener;
+struct irc_in_addr;
+
+/*
+ * Prototypes
+ */
+extern int  accept_pool_running(void);
+extern void accept_pool_update(void);
+extern void accept_pool_forget(struct Listener* listener);
+extern void accept_pool_throttle(const struct irc_in_addr* addr);
+extern void accept_pool_report(struct Client* to);
+
+#endif /* INCLUDED_accept_pool_h */
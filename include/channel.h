@@ -36,6 +36,8 @@
 
 struct SLink;
 struct Client;
+struct MemberHash;
+struct BanIndex;
 
 /*
  * General defines
@@ -157,6 +159,7 @@ typedef enum ChannelGetType {
 #define LISTARG_SHOWSECRET      0x0002
 #define LISTARG_NEGATEWILDCARD  0x0004
 #define LISTARG_SHOWMODES       0x0008
+#define LISTARG_DEFAULT         0x0010  /**< LIST given without arguments */
 
 /**
  * Maximum acceptable lag time in seconds: A channel younger than
@@ -272,14 +275,20 @@ struct Ban {
 struct Channel {
   struct Channel*    next;	/**< next channel in the global channel list */
   struct Channel*    prev;	/**< previous channel */
-  struct Channel*    hnext;	/**< Next channel in the hash table */
+  struct Channel*    hnext;	/**< NULL if in the hash table, else this */
+  struct Channel*    size_next;	/**< next channel in the same size bucket */
+  struct Channel**   size_prev_p;	/**< what points to us in the size index */
   struct DestructEvent* destruct_event;	
   time_t             creationtime; /**< Creation time of this channel */
   time_t             topic_time;   /**< Modification time of the topic */
   unsigned int       users;	   /**< Number of clients on this channel */
+  unsigned int       size_bucket;  /**< Size index bucket holding us */
   struct Membership* members;	   /**< Pointer to the clients on this channel*/
+  struct MemberHash* member_hash;  /**< Members by client, or NULL */
   struct SLink*      invites;	   /**< List of invites on this channel */
   struct Ban*        banlist;      /**< List of bans on this channel */
+  struct BanIndex*   ban_index;    /**< Compiled banlist, or NULL */
+  unsigned int       ban_epoch;    /**< Changed whenever banlist changes */
   struct Mode        mode;	   /**< This channels mode */
   char               topic[TOPICLEN + 1]; /**< Channels topic */
   char               topic_nick[NICKLEN + 1]; /**< Nick of the person who set
@@ -290,6 +299,8 @@ struct Channel {
 				     */
 };
 
+struct ListCache;
+
 /** Information about a /list in progress */
 struct ListingArgs {
   time_t max_time;
@@ -299,8 +310,14 @@ struct ListingArgs {
   unsigned int flags;
   time_t max_topic_time;
   time_t min_topic_time;
-  unsigned int bucket;
+  struct Channel *chptr;          /**< Next channel to examine */
   char wildcard[CHANNELLEN];
+  struct Channel **found;         /**< Channels selected by user count */
+  unsigned int nfound;            /**< Number of entries in found */
+  unsigned int pos;               /**< Next index in found or offset in cache */
+  struct ListCache *cache;        /**< Shared default listing being sent */
+  struct ListingArgs *next;       /**< Next listing in progress */
+  struct ListingArgs **prev_p;    /**< What points to us */
 };
 
 struct ModeBuf {
@@ -454,6 +471,9 @@ extern void joinbuf_join(struct JoinBuf *jbuf, struct Channel *chan,
 extern int joinbuf_flush(struct JoinBuf *jbuf);
 extern struct Ban *make_ban(const char *banstr);
 extern struct Ban *find_ban(struct Client *cptr, struct Ban *banlist);
+extern struct Ban *find_channel_ban(struct Client *cptr, struct Channel *chptr);
+extern void ban_ident_invalidate(struct Client *cptr);
+extern void ban_ident_flush(void);
 extern int apply_ban(struct Ban **banlist, struct Ban *newban, int free);
 extern void free_ban(struct Ban *ban);
 
@@ -49,6 +49,8 @@
 struct ConfItem;
 struct Listener;
 struct ListingArgs;
+struct WhoListing;
+struct BurstCursor;
 struct SLink;
 struct Server;
 struct User;
@@ -155,6 +157,7 @@ enum Flag
     FLAG_BURST_ACK,                 /**< Server is waiting for eob ack */
     FLAG_IPCHECK,                   /**< Added or updated IPregistry data */
     FLAG_IAUTH_STATS,               /**< Wanted IAuth statistics */
+    FLAG_SENDQ_DEFERRED,            /**< Flush deferred to end of loop pass */
     FLAG_LOCOP,                     /**< Local operator -- SRB */
     FLAG_SERVNOTICE,                /**< server notices such as kill */
     FLAG_OPER,                      /**< Operator */
@@ -209,6 +212,8 @@ struct Connection
                                         from. */
   struct SLink*       con_confs;     /**< Associated configuration records. */
   struct ListingArgs* con_listing;   /**< Current LIST status. */
+  struct WhoListing*  con_who;       /**< Current WHO status. */
+  struct BurstCursor* con_burst;     /**< Netburst being sent. */
   unsigned int        con_max_sendq; /**< cached max send queue for client */
   unsigned int        con_ping_freq; /**< cached ping freq */
   unsigned short      con_lastsq;    /**< # 2k blocks when sendqueued
@@ -242,7 +247,7 @@ struct Client {
   unsigned long  cli_magic;       /**< magic number */
   struct Client* cli_next;        /**< link in GlobalClientList */
   struct Client* cli_prev;        /**< link in GlobalClientList */
-  struct Client* cli_hnext;       /**< link in hash table bucket or this */
+  struct Client* cli_hnext;       /**< NULL if in hash table, else this */
   struct Connection* cli_connect; /**< Connection structure associated with us */
   struct User*   cli_user;        /**< Defined if this client is a user */
   struct Server* cli_serv;        /**< Defined if this client is a server */
@@ -252,6 +257,7 @@ struct Client {
   time_t         cli_firsttime;   /**< time client was created */
   time_t         cli_lastnick;    /**< TimeStamp on nick */
   int            cli_marker;      /**< /who processing marker */
+  unsigned long  cli_serial;      /**< order of addition to GlobalClientList */
   struct Flags   cli_flags;       /**< client flags */
   unsigned int   cli_hopcount;    /**< number of servers to this 0 = local */
   struct irc_in_addr cli_ip;      /**< Real IP of client */
@@ -272,7 +278,7 @@ struct Client {
 #define cli_next(cli)		((cli)->cli_next)
 /** Get global previous client. */
 #define cli_prev(cli)		((cli)->cli_prev)
-/** Get next client in hash bucket chain. */
+/** Get hash table marker (NULL while client is in the hash table). */
 #define cli_hnext(cli)		((cli)->cli_hnext)
 /** Get connection associated with client. */
 #define cli_connect(cli)	((cli)->cli_connect)
@@ -296,6 +302,8 @@ struct Client {
 #define cli_lastnick(cli)	((cli)->cli_lastnick)
 /** Get WHO marker for client. */
 #define cli_marker(cli)		((cli)->cli_marker)
+/** Get order in which client was added to GlobalClientList. */
+#define cli_serial(cli)		((cli)->cli_serial)
 /** Get flags flagset for client. */
 #define cli_flags(cli)		((cli)->cli_flags)
 /** Get hop count to client. */
@@ -355,6 +363,10 @@ struct Client {
 #define cli_handler(cli)	con_handler(cli_connect(cli))
 /** Get LIST status for client. */
 #define cli_listing(cli)	con_listing(cli_connect(cli))
+/** Get WHO status for client. */
+#define cli_who(cli)		con_who(cli_connect(cli))
+/** Get netburst status for client. */
+#define cli_burst(cli)		con_burst(cli_connect(cli))
 /** Get cached max SendQ for client. */
 #define cli_max_sendq(cli)	con_max_sendq(cli_connect(cli))
 /** Get ping frequency for client. */
@@ -432,6 +444,10 @@ struct Client {
 #define con_handler(con)	((con)->con_handler)
 /** Get the LIST status for the connection. */
 #define con_listing(con)	((con)->con_listing)
+/** Get the WHO status for the connection. */
+#define con_who(con)		((con)->con_who)
+/** Get the netburst status for the connection. */
+#define con_burst(con)		((con)->con_burst)
 /** Get the maximum permitted SendQ size for the connection. */
 #define con_max_sendq(con)	((con)->con_max_sendq)
 /** Get the ping frequency for the connection. */
@@ -87,6 +87,8 @@ enum GlineAction {
 #define GLINE_LIFETIME	0x2000	/**< Record lifetime update */
 #define GLINE_REASON	0x4000	/**< Reason update */
 
+#define GLINE_PENDING	0x8000	/**< Queued for enforcement against local clients. */
+
 /** Controllable flags that can be set on an actual G-line. */
 #define GLINE_MASK	(GLINE_ACTIVE | GLINE_BADCHAN | GLINE_LOCAL | GLINE_REALNAME)
 /** Mask for G-line activity flags. */
@@ -136,6 +138,7 @@ extern int gline_destroy(struct Client *cptr, struct Client *sptr,
 			 struct Gline *gline);
 extern struct Gline *gline_find(char *userhost, unsigned int flags);
 extern struct Gline *gline_lookup(struct Client *cptr, unsigned int flags);
+extern void gline_init(void);
 extern void gline_free(struct Gline *gline);
 extern void gline_burst(struct Client *cptr);
 extern int gline_resend(struct Client *cptr, struct Gline *gline);
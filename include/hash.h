@@ -24,19 +24,16 @@
 #ifndef INCLUDED_hash_h
 #define INCLUDED_hash_h
 
+#ifndef INCLUDED_sys_types_h
+#include <sys/types.h>          /* size_t */
+#define INCLUDED_sys_types_h
+#endif
+
 struct Client;
 struct Channel;
+struct ListingArgs;
 struct StatDesc;
 
-/*
- * general defines
- */
-
-/** Size of client and channel hash tables.
- * Both must be of the same size.
- */
-#define HASHSIZE                32000
-
 /*
  * Structures
  */
@@ -84,12 +81,22 @@ extern struct Client *hSeekClient(const char *name, int TMask);
 extern struct Channel *hSeekChannel(const char *name);
 
 extern int m_hash(struct Client *cptr, struct Client *sptr, int parc, char *parv[]);
+extern void hash_stats(struct Client* to, const struct StatDesc* sd,
+                       char* param);
+extern size_t hash_count_memory(unsigned int *cl_slots,
+                                unsigned int *ch_slots);
 
 extern int isNickJuped(const char *nick);
 extern int addNickJupes(const char *nicks);
 extern void clearNickJupes(void);
 extern void stats_nickjupes(struct Client* to, const struct StatDesc* sd,
 			    char* param);
+extern void list_start_channels(struct Client *cptr,
+                                const struct ListingArgs *args);
 extern void list_next_channels(struct Client *cptr);
+extern void list_end_channels(struct Client *cptr);
+extern void list_forget_channel(struct Channel *chptr);
+extern void list_size_channel(struct Channel *chptr);
+extern void list_drop_cache(void);
 
 #endif /* INCLUDED_hash_h */
@@ -0,0 +1,34 @@
+/** @file ident_cache.h
+ * @brief Cache of ident (RFC 1413) lookup outcomes by source network.
+ * @version $Id$
+ */
+#ifndef INCLUDED_ident_cache_h
+#define INCLUDED_ident_cache_h
+
+#ifndef INCLUDED_sys_types_h
+#include <sys/types.h>          /* time_t */
+#define INCLUDED_sys_types_h
+#endif
+
+struct Client;
+struct irc_in_addr;
+struct StatDesc;
+
+/** Ways an ident lookup can end. */
+enum IdentOutcome {
+  IDENT_ANSWERED,  /**< The ident server sent a reply. */
+  IDENT_REFUSED,   /**< The connection was refused or closed at once. */
+  IDENT_TIMEDOUT   /**< Nothing came back before AUTH_TIMEOUT. */
+};
+
+/*
+ * Prototypes
+ */
+extern int ident_cache_skip(const struct irc_in_addr *addr);
+extern void ident_cache_record(const struct irc_in_addr *addr,
+                               enum IdentOutcome outcome, time_t wait);
+extern void ident_cache_resize(void);
+extern void ident_cache_stats(struct Client *to, const struct StatDesc *sd,
+                              char *param);
+
+#endif /* INCLUDED_ident_cache_h */
@@ -30,6 +30,10 @@
 #include <sys/types.h>	/* time_t */
 #define INCLUDED_sys_types_h
 #endif
+#ifndef INCLUDED_stdint_h
+#include <stdint.h>	/* uint64_t */
+#define INCLUDED_stdint_h
+#endif
 
 struct Event;
 
@@ -200,11 +204,101 @@ struct Event {
 /** Retrieve the Timer that generated the Event \a ev. */
 #define ev_timer(ev)	((ev)->ev_gen.gen_timer)
 
+/** Callback for work run once at the end of each event loop pass. */
+typedef void (*TickCallBack)(void);
+
+/** Handler for work deferred to the end of an event loop pass. */
+struct Tick {
+  struct Tick*	 tk_next;	/**< next tick handler */
+  TickCallBack	 tk_call;	/**< function to call */
+};
+
+/** Number of expiration time bits indexing the innermost timer wheel. */
+#define TIMER_NEAR_BITS		8
+/** Number of expiration time bits indexing each outer timer wheel. */
+#define TIMER_FAR_BITS		6
+/** Number of outer timer wheels. */
+#define TIMER_FAR_LEVELS	3
+/** Number of one-second slots in the innermost timer wheel. */
+#define TIMER_NEAR_SIZE		(1 << TIMER_NEAR_BITS)
+/** Number of slots in each outer timer wheel. */
+#define TIMER_FAR_SIZE		(1 << TIMER_FAR_BITS)
+
+/** Hierarchical timing wheel holding all pending timers.
+ * Timers due within TIMER_NEAR_SIZE seconds sit in a one-second slot
+ * of the innermost wheel.  Later timers sit in a coarser slot of an
+ * outer wheel and are moved inward each time the innermost wheel wraps.
+ */
+struct TimerWheel {
+  time_t	    tw_now;	/**< next second to be processed */
+  struct GenHeader* tw_due;	/**< timers already due */
+  struct GenHeader* tw_near[TIMER_NEAR_SIZE]; /**< timers due soon */
+  struct GenHeader* tw_far[TIMER_FAR_LEVELS][TIMER_FAR_SIZE];
+				/**< timers due later */
+  struct GenHeader* tw_overflow; /**< timers beyond the outermost wheel */
+};
+
+/** Timer queue statistics. */
+struct TimerStats {
+  unsigned int	ts_pending;	/**< timers currently queued */
+  unsigned long	ts_enqueued;	/**< timers placed on the wheel */
+  unsigned long	ts_expired;	/**< timers that expired */
+  unsigned long	ts_cascaded;	/**< timers moved to an inner wheel */
+  unsigned long	ts_rebased;	/**< wheel rebuilds after clock jumps */
+};
+
+/** Number of recent event loop stalls remembered. */
+#define LOOP_STALL_RING		16
+/** Number of callbacks recorded as top contributors to a stall. */
+#define LOOP_STALL_TOP		3
+/** Number of distinct event callbacks whose run time is tracked. */
+#define LOOP_CALLBACK_MAX	128
+
+/** Run time accumulated by one event callback (or other loop work).
+ * All times are wall clock microseconds, excluding time spent in
+ * events generated and executed from inside the callback.
+ */
+struct CallbackStats {
+  EventCallBack	cs_call;	/**< callback function */
+  const char*	cs_name;	/**< callback name, if known */
+  unsigned long	cs_calls;	/**< number of calls */
+  unsigned long	cs_max;		/**< longest single call */
+  uint64_t	cs_total;	/**< total time in all calls */
+  unsigned long	cs_pass;	/**< time spent in the current loop pass */
+  unsigned long	cs_pass_seq;	/**< loop pass that cs_pass belongs to */
+  struct CallbackStats* cs_pass_next; /**< next entry used in the pass */
+};
+
+/** Description of one slow event loop pass. */
+struct LoopStall {
+  time_t	ls_when;	/**< when the pass finished */
+  unsigned long	ls_usec;	/**< busy time of the pass */
+  unsigned long	ls_events;	/**< events executed during the pass */
+  unsigned long	ls_other;	/**< time not attributed to any callback */
+  const struct CallbackStats* ls_top[LOOP_STALL_TOP]; /**< top contributors */
+  unsigned long	ls_top_usec[LOOP_STALL_TOP]; /**< their time in the pass */
+};
+
+/** Event loop timing statistics kept for the stall profiler. */
+struct LoopStats {
+  unsigned long	ls_passes;	/**< completed event loop passes */
+  unsigned long	ls_stalls;	/**< passes over FEAT_STALL_THRESHOLD */
+  uint64_t	ls_busy;	/**< total busy time of all passes */
+  unsigned int	ls_ncallbacks;	/**< number of entries in ls_callbacks */
+  struct CallbackStats ls_callbacks[LOOP_CALLBACK_MAX]; /**< per callback */
+  struct CallbackStats ls_types[ET_DESTROY + 1]; /**< per event type */
+  struct CallbackStats ls_timers; /**< timer wheel upkeep in timer_run() */
+  struct CallbackStats ls_ticks;  /**< handlers run by tick_run() */
+  struct LoopStall ls_worst;	/**< slowest pass seen */
+  struct LoopStall ls_ring[LOOP_STALL_RING]; /**< most recent stalls */
+  unsigned int	ls_ring_next;	/**< next ls_ring entry to overwrite */
+};
+
 /** List of all event generators. */
 struct Generators {
   struct GenHeader* g_socket;	/**< list of socket generators */
   struct GenHeader* g_signal;	/**< list of signal generators */
-  struct GenHeader* g_timer;	/**< list of timer generators */
+  struct TimerWheel g_timer;	/**< wheel of timer generators */
 };
 
 /** Returns 1 if successfully initialized, 0 if not.
@@ -276,6 +370,11 @@ void gen_dequeue(void* arg);
 void event_init(int max_sockets);
 void event_loop(void);
 void event_generate(enum EventType type, void* arg, int data);
+void event_pass_start(void);
+void event_name_callback(EventCallBack call, const char* name);
+const struct LoopStats* loop_stats(void);
+const char* loop_callback_name(const struct CallbackStats* cs);
+void loop_stall_describe(char* buf, size_t len, const struct LoopStall* stall);
 
 struct Timer* timer_init(struct Timer* timer);
 void timer_add(struct Timer* timer, EventCallBack call, void* data,
@@ -283,8 +382,11 @@ void timer_add(struct Timer* timer, EventCallBack call, void* data,
 void timer_del(struct Timer* timer);
 void timer_chg(struct Timer* timer, enum TimerType type, time_t value);
 void timer_run(void);
-/** Retrieve the next timer's expiration time from Generators \a gen. */
-#define timer_next(gen)	((gen)->g_timer ? ((struct Timer*)(gen)->g_timer)->t_expire : 0)
+time_t timer_next(struct Generators* gen);
+const struct TimerStats* timer_stats(void);
+
+void tick_add(struct Tick* tick, TickCallBack call);
+void tick_run(void);
 
 void signal_add(struct Signal* signal, EventCallBack call, void* data,
 		int sig);
@@ -297,6 +399,21 @@ void socket_events(struct Socket* sock, unsigned int events);
 
 const char* engine_name(void);
 
+/* Remember callback names for the stall profiler as they are registered */
+
+/** Add a timer, recording the name of \a call for loop_stats(). */
+#define timer_add_named(timer, call, data, type, value)			      \
+	(event_name_callback((call), #call),				      \
+	 timer_add((timer), (call), (data), (type), (value)))
+/** Add a signal, recording the name of \a call for loop_stats(). */
+#define signal_add_named(signal, call, data, sig)			      \
+	(event_name_callback((call), #call),				      \
+	 signal_add((signal), (call), (data), (sig)))
+/** Add a socket, recording the name of \a call for loop_stats(). */
+#define socket_add_named(sock, call, data, state, events, fd)		      \
+	(event_name_callback((call), #call),				      \
+	 socket_add((sock), (call), (data), (state), (events), (fd)))
+
 #ifdef DEBUGMODE
 /* These routines pretty-print names for states and types for debug printing */
 
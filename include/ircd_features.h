@@ -34,6 +34,8 @@ extern struct Client his;
 enum Feature {
   /* Misc. features */
   FEAT_LOG,
+  FEAT_LOG_ASYNC,
+  FEAT_LOG_BUFFER_SIZE,
   FEAT_DOMAINNAME,
   FEAT_RELIABLE_CLOCK,
   FEAT_BUFFERPOOL,
@@ -50,6 +52,7 @@ enum Feature {
   FEAT_NODNS,
   FEAT_RANDOM_SEED,
   FEAT_DEFAULT_LIST_PARAM,
+  FEAT_LIST_CACHE,
   FEAT_NICKNAMEHISTORYLENGTH,
   FEAT_HOST_HIDING,
   FEAT_HIDDEN_HOST,
@@ -83,6 +86,7 @@ enum Feature {
   FEAT_IPCHECK_48_CLONE_LIMIT,
   FEAT_IPCHECK_48_CLONE_PERIOD,
   FEAT_IPCHECK_CLONE_DELAY,
+  FEAT_IPCHECK_IPV6_PREFIX,
   FEAT_CHANNELLEN,
 
   /* Some misc. default paths */
@@ -94,9 +98,20 @@ enum Feature {
   FEAT_TOS_SERVER,
   FEAT_TOS_CLIENT,
   FEAT_POLLS_PER_LOOP,
+  FEAT_ACCEPT_THREADS,
+  FEAT_STALL_THRESHOLD,
+  FEAT_BURST_BUDGET,
+  FEAT_SENDQ_COALESCE,
   FEAT_IRCD_RES_RETRIES,
   FEAT_IRCD_RES_TIMEOUT,
+  FEAT_IRCD_RES_CACHE_SIZE,
+  FEAT_IRCD_RES_CACHE_TTL,
+  FEAT_IRCD_RES_NEGATIVE_TTL,
   FEAT_AUTH_TIMEOUT,
+  FEAT_IDENT_CACHE_SIZE,
+  FEAT_IDENT_CACHE_DECAY,
+  FEAT_IDENT_SKIP_TIMEOUTS,
+  FEAT_IAUTH_BATCH,
   FEAT_ANNOUNCE_INVITES,
 
   /* features that affect all operators */
@@ -140,6 +155,10 @@ enum Feature {
   FEAT_HIS_STATS_y,
   FEAT_HIS_STATS_z,
   FEAT_HIS_STATS_IAUTH,
+  FEAT_HIS_STATS_HASH,
+  FEAT_HIS_STATS_IPCHECK,
+  FEAT_HIS_STATS_IDENT,
+  FEAT_HIS_STATS_LOGS,
   FEAT_HIS_WEBIRC,
   FEAT_HIS_WHOIS_SERVERNAME,
   FEAT_HIS_WHOIS_IDLETIME,
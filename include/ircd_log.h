@@ -32,6 +32,7 @@
 #endif
 
 struct Client;
+struct StatDesc;
 
 /* WARNING WARNING WARNING -- Order is important; these enums are
  * used as indexes into arrays.
@@ -64,6 +65,7 @@ enum LogSys {
   LS_RESOLVER,   /**< DNS resolver errors. */
   LS_SOCKET,     /**< Unexpected socket operation errors. */
   LS_IAUTH,      /**< IAuth status. */
+  LS_STALL,      /**< Event loop stalls. */
   LS_DEBUG,      /**< Debug messages. */
   LS_LAST_SYSTEM /**< Count of valid LogSys values. */
 };
@@ -111,6 +113,10 @@ extern void log_feature_unmark(void);
 extern int log_feature_mark(int flag);
 extern void log_feature_report(struct Client *to, int flag);
 
+extern void log_async_update(void);
+extern void log_report_buffers(struct Client *to, const struct StatDesc *sd,
+			       char *param);
+
 extern int log_inassert;
 
 #endif /* INCLUDED_ircd_log_h */
@@ -43,6 +43,10 @@ extern IOResult os_send_nonb(int fd, const char* buf, unsigned int length,
                         unsigned int* length_out);
 extern IOResult os_sendv_nonb(int fd, struct MsgQ* buf,
 			      unsigned int* len_in, unsigned int* len_out);
+extern IOResult os_sendcopy_nonb(int fd, struct MsgQ* buf,
+				 unsigned int* len_in, unsigned int* len_out);
+extern int os_iov_max(void);
+extern unsigned int os_sendcopy_size(void);
 extern IOResult os_recvfrom_nonb(int fd, char* buf, unsigned int len,
                                  unsigned int* length_out,
                                  struct irc_sockaddr* from_out);
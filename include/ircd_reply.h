@@ -25,12 +25,15 @@
 #define INCLUDED_ircd_reply_h
 
 struct Client;
+struct MsgTemplate;
 
 extern int protocol_violation(struct Client* cptr, const char* pattern, ...);
 extern int need_more_params(struct Client* cptr, const char* cmd);
 extern int send_reply(struct Client* to, int reply, ...);
+extern int template_reply(struct MsgTemplate* tpl, int reply, ...);
 
 #define SND_EXPLICIT	0x40000000	/**< first arg is a pattern to use */
+#define TPL_NICK	"\n"	/**< template_reply() arg for recipient's nick */
 
 #endif /* INCLUDED_ircd_reply_h */
 
@@ -34,6 +34,7 @@ extern const char* ircd_ntoa_r(char* buf, const struct irc_in_addr* addr);
 extern int ipmask_parse(const char *in, struct irc_in_addr *mask, unsigned char *bits_ptr);
 extern char*       host_from_uh(char* buf, const char* userhost, size_t len);
 extern char*       ircd_strtok(char** save, char* str, char* fs);
+extern const char* ircd_find_eol(const char* start, const char* end);
 
 extern char*       canonize(char* buf);
 
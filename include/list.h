@@ -54,6 +54,7 @@ extern void free_client(struct Client *cptr);
 extern struct Server *make_server(struct Client *cptr);
 extern void remove_client_from_list(struct Client *cptr);
 extern void add_client_to_list(struct Client *cptr);
+extern void move_client_to_list_head(struct Client *cptr);
 extern struct DLink *add_dlink(struct DLink **lpp, struct Client *cp);
 extern void remove_dlink(struct DLink **lpp, struct DLink *lp);
 extern struct ConfItem *make_conf(int type);
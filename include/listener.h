@@ -80,6 +80,8 @@ struct Listener {
 #define listener_active(LISTENER) FlagHas(&(LISTENER)->flags, LISTEN_ACTIVE)
 #define listener_webirc(LISTENER) FlagHas(&(LISTENER)->flags, LISTEN_WEBIRC)
 
+extern struct Listener* ListenerPollList;
+
 extern void        add_listener(int port, const char* vaddr_ip, 
                                 const char* mask,
                                 const struct ListenerFlags *flags);
@@ -91,6 +93,8 @@ extern void        mark_listeners_closing(void);
 extern void show_ports(struct Client* client, const struct StatDesc* sd,
                        char* param);
 extern void        release_listener(struct Listener* listener);
+extern void        reject_connection(int fd, const char* msg);
+extern void        watch_listeners(int in_loop);
 
 #endif /* INCLUDED_listener_h */
 
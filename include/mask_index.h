@@ -0,0 +1,72 @@
+/** @file mask_index.h
+ * @brief Index of host and IP masks for fast ban lookups.
+ * @version $Id$
+ */
+#ifndef INCLUDED_mask_index_h
+#define INCLUDED_mask_index_h
+
+#ifndef INCLUDED_sys_types_h
+#include <sys/types.h>          /* size_t */
+#define INCLUDED_sys_types_h
+#endif
+
+struct irc_in_addr;
+struct MaskNode;
+struct MaskHost;
+struct MaskEntry;
+
+/** Kinds of mask kept in a MaskIndex. */
+enum MaskKind {
+  MASK_KIND_IP,         /**< CIDR mask, kept in the prefix trie. */
+  MASK_KIND_EXACT,      /**< Hostname without wildcards. */
+  MASK_KIND_SUFFIX,     /**< Hostname mask of the form *.domain. */
+  MASK_KIND_WILD,       /**< Anything else; checked linearly. */
+  MASK_KIND_COUNT       /**< Number of mask kinds. */
+};
+
+/** Hash table of hostname keys. */
+struct MaskHostTable {
+  struct MaskHost **mt_buckets; /**< Hash chains. */
+  unsigned int mt_mask;         /**< Number of buckets minus one. */
+  unsigned int mt_count;        /**< Number of keys in the table. */
+};
+
+/** Index of masks, each carrying an opaque pointer for its owner. */
+struct MaskIndex {
+  struct MaskNode *mi_root;           /**< Root of the CIDR prefix trie. */
+  struct MaskHostTable mi_exact;      /**< Exact hostnames. */
+  struct MaskHostTable mi_suffix;     /**< Domain suffixes from *.domain masks. */
+  struct MaskEntry *mi_wild;          /**< Masks that need a linear check. */
+  unsigned int mi_count[MASK_KIND_COUNT]; /**< Number of entries of each kind. */
+  unsigned int mi_nodes;              /**< Number of trie nodes. */
+};
+
+/** Callback that decides whether an indexed entry applies.
+ * @param[in] data Owner's pointer passed to mask_index_add().
+ * @param[in] ctx Context pointer passed to mask_index_find().
+ * @return Non-zero if the entry matches.
+ */
+typedef int (*MaskIndexCheck)(void *data, void *ctx);
+
+/*
+ * Prototypes
+ */
+extern enum MaskKind mask_index_add(struct MaskIndex *mi, const char *host,
+                                    const struct irc_in_addr *addr,
+                                    unsigned char bits, void *data,
+                                    unsigned long order);
+extern void mask_index_del(struct MaskIndex *mi, const char *host,
+                           const struct irc_in_addr *addr,
+                           unsigned char bits, void *data);
+extern void *mask_index_find(const struct MaskIndex *mi, const char *host,
+                             const struct irc_in_addr *addr,
+                             MaskIndexCheck check, void *ctx);
+extern void *mask_index_find_hosts(const struct MaskIndex *mi,
+                                   const char *const *hosts,
+                                   unsigned int nhosts,
+                                   const struct irc_in_addr *addr,
+                                   MaskIndexCheck check, void *ctx);
+extern void mask_index_clear(struct MaskIndex *mi);
+extern size_t mask_index_memory(const struct MaskIndex *mi);
+
+#endif /* INCLUDED_mask_index_h */
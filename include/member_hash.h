@@ -0,0 +1,31 @@
+/** @file member_hash.h
+ * @brief Hash tables of the memberships of large channels and clients.
+ * @version $Id$
+ */
+#ifndef INCLUDED_member_hash_h
+#define INCLUDED_member_hash_h
+
+#ifndef INCLUDED_sys_types_h
+#include <sys/types.h>          /* size_t */
+#define INCLUDED_sys_types_h
+#endif
+
+struct Membership;
+struct MemberHash;
+
+/** Number of users at which a channel gets a member hash table. */
+#define MEMBER_HASH_CHANNEL_MIN 32
+
+/** Number of channels at which a client gets a channel hash table. */
+#define MEMBER_HASH_CLIENT_MIN  16
+
+/*
+ * Prototypes
+ */
+extern struct Membership *member_hash_find(const struct MemberHash *mh,
+                                           const void *key);
+extern void member_hash_link(struct Membership *member);
+extern void member_hash_unlink(struct Membership *member);
+extern size_t member_hash_memory(unsigned int *count);
+
+#endif /* INCLUDED_member_hash_h */
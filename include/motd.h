@@ -38,6 +38,7 @@
 #endif
 
 struct Client;
+struct MsgTemplate;
 struct TRecord;
 struct StatDesc;
 
@@ -79,6 +80,8 @@ struct MotdCache {
   int			maxcount; /**< Number of lines allocated for message. */
   struct tm		modtime;  /**< Last modification time from file. */
   int			count;    /**< Actual number of lines used in message. */
+  struct MsgTemplate*	forward;  /**< Full MOTD for local users, if built. */
+  struct MsgTemplate*	signon;   /**< Short signon notice, if built. */
   char			motd[1][MOTD_LINESIZE]; /**< Message body. */
 };
 
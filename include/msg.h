@@ -26,6 +26,10 @@
 #ifndef INCLUDED_ircd_handler_h
 #include "ircd_handler.h"
 #endif
+#ifndef INCLUDED_stdint_h
+#include <stdint.h>            /* uint64_t */
+#define INCLUDED_stdint_h
+#endif
 
 struct Client;
 
@@ -390,6 +394,29 @@ struct Client;
  * Structures
  */
 
+/** Number of buckets in a command latency histogram. */
+#define MSG_LATENCY_BUCKETS      24
+/** Bucket 0 of a command latency histogram counts calls that took
+ * fewer than 2 to the power of (MSG_LATENCY_SHIFT + 1) timer ticks;
+ * each later bucket covers twice the span of the one before it.
+ */
+#define MSG_LATENCY_SHIFT        7
+
+/** Where a message came from, for latency accounting. */
+enum MessageSource {
+  MSG_FROM_CLIENT,            /**< parsed by parse_client() */
+  MSG_FROM_SERVER,            /**< parsed by parse_server() */
+  MSG_SOURCE_COUNT            /**< number of message sources */
+};
+
+/** Latency histogram for one command from one kind of source. */
+struct MessageLatency {
+  unsigned int calls;         /**< number of timed handler calls */
+  unsigned int buckets[MSG_LATENCY_BUCKETS]; /**< log2-scale histogram */
+  uint64_t total;             /**< total timer ticks spent in handler */
+  uint64_t max;               /**< longest handler call, in ticks */
+};
+
 /** Information on how to parse a message. */
 struct Message {
   char *cmd;                  /**< command string */
@@ -409,6 +436,8 @@ struct Message {
    * UNREGISTERED, CLIENT, SERVER, OPER, SERVICE, LAST
    */
   MessageHandler handlers[LAST_HANDLER_TYPE];
+  /** Handler latency, by source. */
+  struct MessageLatency latency[MSG_SOURCE_COUNT];
 };
 
 extern struct Message msgtab[];
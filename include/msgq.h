@@ -56,6 +56,20 @@ struct MsgQ {
   struct MsgQList prio;		/**< Priority Msg queue */
 };
 
+/** Pre-formatted text for many local clients, kept as shared MsgBuf
+ * pieces with slots where each recipient's nick is spliced in.
+ */
+struct MsgTemplate {
+  struct MsgBuf **parts;	/**< Text pieces; NULL marks a nick slot */
+  unsigned int count;		/**< Number of entries used in parts */
+  unsigned int size;		/**< Number of entries allocated in parts */
+  unsigned int length;		/**< Bytes of text, not counting nicks */
+  unsigned int slots;		/**< Number of nick slots */
+  unsigned int lines;		/**< Number of lines in the template */
+  unsigned int pending;		/**< Bytes of text waiting in pend */
+  char pend[BUFSIZE];		/**< Text not yet put into a piece */
+};
+
 /** Returns the current number of bytes stored in \a mq. */
 #define MsgQLength(mq) ((mq)->length)
 
@@ -74,6 +88,8 @@ extern void msgq_init(struct MsgQ *mq);
 extern void msgq_delete(struct MsgQ *mq, unsigned int length);
 extern int msgq_mapiov(const struct MsgQ *mq, struct iovec *iov, int count,
 		       unsigned int *len);
+extern unsigned int msgq_copy(const struct MsgQ *mq, char *buf,
+			      unsigned int size);
 extern struct MsgBuf *msgq_make(struct Client *dest, const char *format, ...);
 extern struct MsgBuf *msgq_vmake(struct Client *dest, const char *format,
 				 va_list args);
@@ -81,10 +97,18 @@ extern void msgq_append(struct Client *dest, struct MsgBuf *mb,
 			const char *format, ...);
 extern void msgq_clean(struct MsgBuf *mb);
 extern void msgq_add(struct MsgQ *mq, struct MsgBuf *mb, int prio);
+extern void msgq_move(struct MsgQ *dest, struct MsgQ *src);
 extern void msgq_count_memory(struct Client *cptr,
                               size_t *msg_alloc, size_t *msg_used);
 extern void msgq_histogram(struct Client *cptr, const struct StatDesc *sd,
                            char *param);
 extern unsigned int msgq_bufleft(struct MsgBuf *mb);
+extern void msgq_tpl_init(struct MsgTemplate *tpl);
+extern void msgq_tpl_text(struct MsgTemplate *tpl, const char *text,
+			  unsigned int length);
+extern void msgq_tpl_nick(struct MsgTemplate *tpl);
+extern void msgq_tpl_clear(struct MsgTemplate *tpl);
+extern void msgq_tpl_add(struct MsgQ *mq, struct MsgTemplate *tpl,
+			 const char *nick);
 
 #endif /* INCLUDED_msgq_h */
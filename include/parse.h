@@ -6,6 +6,7 @@
 #define INCLUDED_parse_h
 
 struct Client;
+struct StatDesc;
 struct s_map;
 
 /*
@@ -15,6 +16,8 @@ struct s_map;
 extern int parse_client(struct Client *cptr, char *buffer, char *bufend);
 extern int parse_server(struct Client *cptr, char *buffer, char *bufend);
 extern void initmsgtree(void);
+extern void report_command_latency(struct Client *to,
+                                   const struct StatDesc *sd, char *param);
 
 extern int register_mapping(struct s_map *map);
 extern int unregister_mapping(struct s_map *map);
@@ -60,10 +60,12 @@ extern struct irc_sockaddr VirtualHost_dns_v6;
  * Proto types
  */
 extern unsigned int deliver_it(struct Client *cptr, struct MsgQ *buf);
+extern void deliver_report(struct Client *to);
 extern int connect_server(struct ConfItem* aconf, struct Client* by);
 extern int  net_close_unregistered_connections(struct Client* source);
 extern void close_connection(struct Client *cptr);
-extern void add_connection(struct Listener* listener, int fd);
+extern void add_connection(struct Listener* listener, int fd,
+                           const struct irc_sockaddr* addr);
 extern int  read_message(time_t delay);
 extern void init_server_identity(void);
 extern void close_connections(int close_stderr);
@@ -9,8 +9,10 @@
 #define INCLUDED_sys_types_h
 #endif
 
+struct Channel;
 struct ConfItem;
 struct Client;
+struct MsgQ;
 
 extern unsigned int max_connection_count;
 extern unsigned int max_client_count;
@@ -22,6 +24,12 @@ extern int exit_new_server(struct Client* cptr, struct Client* sptr,
                            const char* host, time_t timestamp, const char* fmt, ...);
 extern int a_kills_b_too(struct Client *a, struct Client *b);
 extern int server_estab(struct Client *cptr, struct ConfItem *aconf);
+extern void server_burst_next(struct Client *cptr);
+extern int server_burst_sent(struct Client *cptr, struct Client *acptr);
+extern struct MsgQ *server_burst_held(struct Client *cptr);
+extern void server_burst_end(struct Client *cptr);
+extern void server_burst_forget_client(struct Client *acptr);
+extern void server_burst_forget_channel(struct Channel *chptr);
 
 
 #endif /* INCLUDED_s_serv_h */
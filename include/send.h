@@ -17,6 +17,7 @@ struct Channel;
 struct Client;
 struct DBuf;
 struct MsgBuf;
+struct MsgTemplate;
 
 /*
  * Prototypes
@@ -24,7 +25,9 @@ struct MsgBuf;
 extern struct SLink *opsarray[];
 
 extern void send_buffer(struct Client* to, struct MsgBuf* buf, int prio);
+extern void send_template(struct Client* to, struct MsgTemplate* tpl);
 
+extern void send_init(void);
 extern void kill_highest_sendq(int servers_too);
 extern void flush_connections(struct Client* cptr);
 extern void send_queued(struct Client *to);
@@ -37,6 +37,9 @@ struct Client;
 struct User;
 struct Membership;
 struct SLink;
+struct UserIndexNode;
+struct MemberHash;
+struct BanIdent;
 
 /** Describes a server on the network. */
 struct Server {
@@ -67,8 +70,10 @@ struct Server {
 struct User {
   struct Client*     server;         /**< client structure of server */
   struct Membership* channel;        /**< chain of channel pointer blocks */
+  struct MemberHash* chan_hash;      /**< channel blocks by channel, or NULL */
   struct SLink*      invited;        /**< chain of invite pointer blocks */
   struct Ban*        silence;        /**< chain of silence pointer blocks */
+  struct BanIdent*   banident;       /**< names compared against bans, or NULL */
   char*              away;           /**< pointer to away message */
   time_t             last;           /**< last time user sent a message */
   unsigned int       refcnt;         /**< Number of times this block is referenced */
@@ -84,6 +89,9 @@ struct User {
   char               realhost[HOSTLEN + 1];   /**< actual hostname */
   char               account[ACCOUNTLEN + 1]; /**< IRC account name */
   time_t	     acc_create;              /**< IRC account timestamp */
+  struct UserIndexNode* ipnode;       /**< Entry in the IP address index */
+  struct UserIndexNode* hostnode[2];  /**< Entries in the hostname index */
+  struct UserIndexNode* accountnode;  /**< Entry in the account index */
 };
 
 #endif /* INCLUDED_struct_h */
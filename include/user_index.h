@@ -0,0 +1,82 @@
+/** @file user_index.h
+ * @brief Indexes of users by IP address, hostname and account.
+ * @version $Id$
+ */
+#ifndef INCLUDED_user_index_h
+#define INCLUDED_user_index_h
+
+#ifndef INCLUDED_ircd_defs_h
+#include "ircd_defs.h"          /* HOSTLEN */
+#endif
+#ifndef INCLUDED_sys_types_h
+#include <sys/types.h>          /* size_t */
+#define INCLUDED_sys_types_h
+#endif
+
+struct Client;
+struct irc_in_addr;
+struct UserIndexNode;
+
+/** Maximum number of levels in a UserIndex skip list. */
+#define USER_INDEX_LEVELS 16
+
+/** Longest key kept in a UserIndex. */
+#define USER_INDEX_KEYLEN HOSTLEN
+
+/** Node flag: key is the user's real hostname. */
+#define USER_INDEX_REALHOST 0x01
+/** Node flag: key is the user's displayed hostname. */
+#define USER_INDEX_SHOWNHOST 0x02
+
+/** Ordered index of users by a binary key. */
+struct UserIndex {
+  struct UserIndexNode *ui_head[USER_INDEX_LEVELS]; /**< First node at each level. */
+  unsigned int ui_count;        /**< Number of nodes. */
+  unsigned long ui_gen;         /**< Changed whenever a node is added or removed. */
+  size_t ui_memory;             /**< Bytes allocated for nodes. */
+};
+
+/** Position in a search of a UserIndex for keys with a given prefix.
+ * A cursor stays valid while the index changes: if any node was
+ * added or removed since the last step, the search resumes after
+ * the last key returned.
+ */
+struct UserIndexCursor {
+  const struct UserIndex *uc_index; /**< Index being searched. */
+  struct UserIndexNode *uc_node;    /**< Next node to look at. */
+  unsigned long uc_gen;         /**< ui_gen when uc_node was found. */
+  void *uc_last;                /**< Data of last node returned, or NULL. */
+  unsigned int uc_lastlen;      /**< Length of uc_lastkey. */
+  unsigned int uc_bits;         /**< Number of bits of uc_prefix that must match. */
+  unsigned int uc_flags;        /**< Node flags to accept (0 for any). */
+  unsigned char uc_prefix[USER_INDEX_KEYLEN + 1]; /**< Key prefix searched for. */
+  unsigned char uc_lastkey[USER_INDEX_KEYLEN + 1]; /**< Key of last node returned. */
+};
+
+/*
+ * Prototypes
+ */
+extern struct UserIndexNode *user_index_insert(struct UserIndex *ui,
+                                               const void *key,
+                                               unsigned int len,
+                                               unsigned int flags,
+                                               void *data);
+extern void user_index_remove(struct UserIndex *ui, struct UserIndexNode *node);
+extern void user_index_seek(const struct UserIndex *ui,
+                            struct UserIndexCursor *uc, const void *prefix,
+                            unsigned int bits, unsigned int flags);
+extern void *user_index_next(struct UserIndexCursor *uc);
+
+extern void user_index_add(struct Client *cptr);
+extern void user_index_del(struct Client *cptr);
+extern void user_index_update(struct Client *cptr);
+extern void user_index_ip_seek(struct UserIndexCursor *uc,
+                               const struct irc_in_addr *addr,
+                               unsigned char bits);
+extern const char *user_index_host_seek(struct UserIndexCursor *uc,
+                                        const char *mask, unsigned int flags);
+extern int user_index_account_seek(struct UserIndexCursor *uc,
+                                   const char *mask);
+extern size_t user_index_memory(unsigned int *count);
+
+#endif /* INCLUDED_user_index_h */
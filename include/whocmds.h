@@ -4,6 +4,12 @@
  */
 #ifndef INCLUDED_whocmds_h
 #define INCLUDED_whocmds_h
+#ifndef INCLUDED_ircd_defs_h
+#include "ircd_defs.h"          /* BUFSIZE */
+#endif
+#ifndef INCLUDED_res_h
+#include "res.h"                /* struct irc_in_addr */
+#endif
 
 struct Client;
 struct Channel;
@@ -83,10 +89,33 @@ struct Channel;
 /** Maximum number of lines to send in response to a /WHOIS. */
 #define MAX_WHOIS_LINES 50
 
+/** Longest literal run of a /WHO mask kept for prefiltering. */
+#define WHO_LITERAL_LEN 32
+
+/** A /WHO mask compiled once for matching against many users. */
+struct WhoMatch {
+  int wm_matchsel;                /**< WHO_FIELD_* values the mask applies to. */
+  int wm_minlen;                  /**< Minimum length of a matching string. */
+  int wm_litlen;                  /**< Length of wm_literal. */
+  unsigned char wm_ibits;         /**< Prefix length of wm_imask. */
+  struct irc_in_addr wm_imask;    /**< IP mask, for WHO_FIELD_NIP. */
+  char wm_literal[WHO_LITERAL_LEN + 1]; /**< Text every match contains. */
+  char wm_cmask[BUFSIZE];         /**< Mask compiled by matchcomp(). */
+};
+
 /*
  * Prototypes
  */
 extern void do_who(struct Client* sptr, struct Client* acptr, struct Channel* repchan,
                    int fields, char* qrt);
+extern void who_match_init(struct WhoMatch* wm, const char* mask, int matchsel);
+extern int who_match(const struct WhoMatch* wm, struct Client* sptr,
+                     struct Client* acptr);
+extern void who_start(struct Client* sptr, const struct WhoMatch* wm,
+                      int bitsel, int fields, const char* qrt, int counter,
+                      int marker, const char* mask);
+extern void who_next(struct Client* sptr);
+extern void who_end(struct Client* sptr, int reply);
+extern void who_forget_client(struct Client* acptr);
 
 #endif /* INCLUDED_whocmds_h */
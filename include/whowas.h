@@ -26,29 +26,31 @@
 #include <sys/types.h>        /* size_t */
 #define INCLUDED_sys_types_h
 #endif
+#ifndef INCLUDED_ircd_defs_h
+#include "ircd_defs.h"        /* NICKLEN */
+#endif
 
 struct Client;
+struct WhowasChunk;
 
 /*
  * General defines
  */
 
-#define BITS_PER_COL            3   /**< Magic number used by whowas hash function. */
-#define BITS_PER_COL_MASK       0x7 /**< Mask with #BITS_PER_COL least significant bits set. */
-#define WW_MAX_INITIAL          16  /**< Magic number used by whowas hash function. */
-
-#define MAX_SUB (1 << BITS_PER_COL) /**< Magic number used by whowas hash function. */
-#define WW_MAX_INITIAL_MASK (WW_MAX_INITIAL - 1) /**< Magic number used by whowas hash function. */
-#define WW_MAX (WW_MAX_INITIAL * MAX_SUB) /**< Size of whowas hash table. */
+#define WW_CHUNK        128 /**< Number of whowas entries allocated at once. */
+#define WW_HASH_MIN     64  /**< Smallest size of whowas nick hash table. */
 
 /*
  * Structures
  */
 
-/** Tracks previously used nicknames. */
+/** Tracks previously used nicknames.
+ * The strings other than #name are interned and shared between
+ * entries; they must not be modified or freed by users of the entry.
+ */
 struct Whowas {
   unsigned int hashv;           /**< Hash value for nickname. */
-  char *name;                   /**< Client's old nickname. */
+  char name[NICKLEN + 1];       /**< Client's old nickname. */
   char *username;               /**< Client's username. */
   char *hostname;               /**< Client's hostname. */
   char *realhost;               /**< Client's real hostname. */
@@ -61,22 +63,22 @@ struct Whowas {
   struct Whowas **hprevnextp;   /**< Pointer to previous next pointer. */
   struct Whowas *cnext;         /**< Next entry with the same 'online' pointer. */
   struct Whowas **cprevnextp;   /**< Pointer to previous next pointer. */
-  struct Whowas *wnext;		/**< Next entry in whowas linked list. */
-  struct Whowas *wprev;		/**< Pointer to previous next pointer. */
+  struct Whowas *wnext;		/**< Next entry in whowas or free list. */
+  struct Whowas *wprev;		/**< Previous entry in whowas or free list. */
+  struct WhowasChunk *chunk;    /**< Arena chunk holding this entry. */
 };
 
 /*
  * Proto types
  */
-extern struct Whowas* whowashash[];
-
-extern unsigned int hash_whowas_name(const char *name);
+extern struct Whowas *whowas_bucket(const char *nick);
 
 extern struct Client *get_history(const char *nick);
 extern void add_history(struct Client *cptr, int still_on);
 extern void off_history(const struct Client *cptr);
 extern void initwhowas(void);
-extern void count_whowas_memory(int *wwu, size_t *wwm, int *wwa, size_t *wwam);
+extern void count_whowas_memory(int *wwu, int *wwa, unsigned int *wws,
+                                size_t *wwsm, size_t *wwm);
 
 extern void whowas_realloc(void);
 
@@ -32,9 +32,13 @@
 #include "ircd_events.h"
 #include "ircd_features.h"
 #include "ircd_log.h"
+#include "ircd_reply.h"
 #include "ircd_string.h"    /* ircd_ntoa */
+#include "numeric.h"
+#include "random.h"         /* ircrandom */
 #include "res.h"            /* irc_in_addr_is_ipv4 */
 #include "s_debug.h"        /* Debug */
+#include "s_stats.h"
 #include "s_user.h"         /* TARGET_DELAY */
 #include "send.h"
 
@@ -47,28 +51,43 @@ struct IPTargetEntry {
   unsigned char targets[MAXTARGETS]; /**< Array of recent targets. */
 };
 
-/** Stores recent information about a particular IP address. */
+/** Kinds of registry entries. */
+enum IPRegistryKind {
+  IPREG_ADDR4, /**< Counts clients from one IPv4 address. */
+  IPREG_ADDR6, /**< Counts clients from one IPv6 prefix. */
+  IPREG_NET48  /**< Counts connection attempts from an IPv6 /48 block. */
+};
+
+/** Stores recent information about a particular IP address or IPv6
+ * /48 block.
+ */
 struct IPRegistryEntry {
-  struct IPRegistryEntry*  next;   /**< Next entry in the hash chain. */
+  struct IPRegistryEntry*  wnext;  /**< Next entry in the same expiry wheel slot. */
+  struct IPRegistryEntry** wprevnextp; /**< Link to this entry in the wheel, or NULL. */
   struct IPTargetEntry*    target; /**< Recent targets, if any. */
-  struct irc_in_addr       addr;   /**< IP address for this user. */
-  int		           last_connect; /**< Last connection attempt timestamp. */
+  struct irc_in_addr       addr;   /**< Address, masked to #bits. */
+  unsigned int             last_connect; /**< Last connection attempt timestamp. */
+  unsigned int             hashv;  /**< Hash value of address and kind. */
   unsigned short           connected; /**< Number of currently connected clients. */
-  unsigned char            attempts; /**< Number of recent connection attempts. */
+  unsigned short           attempts; /**< Number of recent connection attempts. */
+  unsigned char            bits;   /**< Number of significant bits in #addr. */
+  unsigned char            kind;   /**< Kind of entry (IPRegistryKind). */
 };
 
-/** Stores information about an IPv6/48 block's recent connections. */
-struct IPRegistry48 {
-  struct IPRegistry48* next;     /**< Next entry in the hash chain. */
-  int              last_connect; /**< Last connection attempt timestamp. */
-  uint16_t             addr[3];  /**< 48 MSBs of IP address. */
-  unsigned short       attempts; /**< Number of recent connection attempts. */
-};
-
-/** Size of hash table (must be a power of two). */
-#define IP_REGISTRY_TABLE_SIZE 0x10000
+/** Smallest size of the registry hash table (must be a power of two). */
+#define IP_REGISTRY_TABLE_MIN 256
+/** Seconds covered by each slot of the expiry wheel. */
+#define IP_REGISTRY_TICK 16
+/** Seconds after which an idle entry is forgotten. */
+#define IP_REGISTRY_EXPIRE 600
+/** Seconds after which an idle entry's free targets are forgotten. */
+#define IP_REGISTRY_EXPIRE_TARGETS 120
+/** Number of slots in the expiry wheel (must cover #IP_REGISTRY_EXPIRE). */
+#define IP_REGISTRY_WHEEL 64
+/** Number of wheel ticks over which throttle decisions are averaged. */
+#define IP_REGISTRY_RATE_TICKS 4
 /** Report current time for tracking in IPRegistryEntry::last_connect. */
-#define NOW ((unsigned short)(CurrentTime & 0xffff))
+#define NOW ((unsigned int) CurrentTime)
 /** Time from \a x until now, in seconds. */
 #define CONNECTED_SINCE(x) (NOW - (x))
 
@@ -83,14 +102,36 @@ struct IPRegistry48 {
 /** Macro for easy access to configured IPcheck clone delay. */
 #define IPCHECK_CLONE_DELAY feature_int(FEAT_IPCHECK_CLONE_DELAY)
 
-/** Hash table for storing IPRegistryEntry entries. */
-static struct IPRegistryEntry* hashTable[IP_REGISTRY_TABLE_SIZE];
-/** Hash table for storing IPRegistry48 entries. */
-static struct IPRegistry48* hashTable48[IP_REGISTRY_TABLE_SIZE];
+/** Open-addressed hash table of all registry entries. */
+static struct {
+  struct IPRegistryEntry** slots; /**< Slots, linearly probed. */
+  unsigned int mask;            /**< Number of slots minus one. */
+  unsigned int count;           /**< Number of entries. */
+  unsigned int seed;            /**< Random seed for the hash function. */
+  unsigned int v6count;         /**< Number of IPv6 address entries. */
+  unsigned int prefixes[129];   /**< Number of IPv6 address entries per prefix length. */
+} ipTable;
+/** Expiry wheel of idle registry entries. */
+static struct IPRegistryEntry* ipWheel[IP_REGISTRY_WHEEL];
+/** Number of the next wheel tick to process. */
+static unsigned int ipWheelTick;
+/** Registry statistics for /STATS ipcheck. */
+static struct {
+  unsigned long lookups;        /**< Number of lookups. */
+  unsigned long hits;           /**< Number of lookups that found an entry. */
+  unsigned long probes;         /**< Number of slots examined by lookups. */
+  unsigned long created;        /**< Number of entries created. */
+  unsigned long expired;        /**< Number of entries expired. */
+  unsigned long resizes;        /**< Number of times the table was resized. */
+  unsigned long accepted;       /**< Number of local connections accepted. */
+  unsigned long throttled;      /**< Number of local connections refused. */
+  unsigned int rate_accepted[IP_REGISTRY_RATE_TICKS]; /**< Recent accepts per tick. */
+  unsigned int rate_throttled[IP_REGISTRY_RATE_TICKS]; /**< Recent refusals per tick. */
+} ipStats;
 /** List of allocated but unused IPRegistryEntry structs. */
 static struct IPRegistryEntry* freeList;
-/** List of allocated but unused IPRegistry48 structs. */
-static struct IPRegistry48* freeList48;
+/** Number of allocated IPRegistryEntry structs. */
+static unsigned int ipAllocated;
 /** Periodic timer to look for too-old registry entries. */
 static struct Timer expireTimer;
 /** List of IPv4 net blocks exempt from IPcheck. */
@@ -98,95 +139,211 @@ static struct Ban *exceptIPv4;
 /** List of IPv6 net blocks exempt from IPcheck. */
 static struct Ban *exceptIPv6;
 
+/** Get the configured prefix length for IPv6 address entries.
+ * @return Number of bits, between 32 and 128.
+ */
+static unsigned int ip_registry_prefix(void)
+{
+  int bits = feature_int(FEAT_IPCHECK_IPV6_PREFIX);
+
+  if (bits < 32)
+    return 32;
+  if (bits > 128)
+    return 128;
+  return bits;
+}
+
+/** Mask an address to its first \a bits bits.
+ * @param[out] out Receives masked address.
+ * @param[in] in IP address to mask.
+ * @param[in] bits Number of bits to keep.
+ */
+static void ip_registry_mask(struct irc_in_addr *out, const struct irc_in_addr *in, unsigned int bits)
+{
+  unsigned int ii;
+
+  for (ii = 0; ii < 8; ii++, bits = bits > 16 ? bits - 16 : 0)
+    out->in6_16[ii] = (bits >= 16) ? in->in6_16[ii]
+      : (bits ? in->in6_16[ii] & htons(0xffff << (16 - bits)) : 0);
+}
+
 /** Convert IP addresses to canonical form for comparison.  IPv4
  * addresses are translated into 6to4 form; IPv6 addresses are
- * truncated to their /64 prefix.
+ * truncated to the configured prefix.
  *
- * @param[out] out Receives canonical format for address.
+ * @param[in,out] entry Registry entry whose address, bits and kind to set.
  * @param[in] in IP address to canonicalize.
  */
-static void ip_registry_canonicalize(struct irc_in_addr *out, const struct irc_in_addr *in)
-{
-    if (irc_in_addr_is_ipv4(in)) {
-        out->in6_16[0] = htons(0x2002);
-        out->in6_16[1] = in->in6_16[6];
-        out->in6_16[2] = in->in6_16[7];
-        out->in6_16[3] = 0;
-    } else {
-        out->in6_16[0] = in->in6_16[0];
-        out->in6_16[1] = in->in6_16[1];
-        out->in6_16[2] = in->in6_16[2];
-        out->in6_16[3] = in->in6_16[3];
-    }
-
-    out->in6_16[4] = out->in6_16[5] = 0;
-    out->in6_16[6] = out->in6_16[7] = 0;
+static void ip_registry_canonicalize(struct IPRegistryEntry *entry, const struct irc_in_addr *in)
+{
+  if (irc_in_addr_is_ipv4(in)) {
+    memset(&entry->addr, 0, sizeof(entry->addr));
+    entry->addr.in6_16[0] = htons(0x2002);
+    entry->addr.in6_16[1] = in->in6_16[6];
+    entry->addr.in6_16[2] = in->in6_16[7];
+    entry->bits = 48;
+    entry->kind = IPREG_ADDR4;
+  } else {
+    entry->bits = ip_registry_prefix();
+    entry->kind = IPREG_ADDR6;
+    ip_registry_mask(&entry->addr, in, entry->bits);
+  }
 }
 
-/** Calculate hash value for an IP address.
- * @param[in] ip Address to hash; must be in canonical form.
+/** Calculate hash value for a registry key.
+ * @param[in] ip Address to hash; must be masked.
+ * @param[in] kind Kind of entry.
  * @return Hash value for address.
  */
-static unsigned int ip_registry_hash(const struct irc_in_addr *ip)
+static unsigned int ip_registry_hash(const struct irc_in_addr *ip, unsigned int kind)
 {
-  unsigned int res;
-  /* Only use the first 64 bits of address, since the last 64 bits
-   * tend to be under user control. */
-  res = ip->in6_16[0] ^ ip->in6_16[1] ^ ip->in6_16[2] ^ ip->in6_16[3];
-  return res & (IP_REGISTRY_TABLE_SIZE - 1);
+  unsigned int hash = ipTable.seed ^ kind, ii;
+
+  for (ii = 0; ii < 8; ii++)
+    hash = (hash ^ ip->in6_16[ii]) * 16777619U;
+  return hash ^ (hash >> 15);
+}
+
+/** Look up a registry entry.
+ * @param[in] ip Masked address to search for.
+ * @param[in] bits Number of significant bits in \a ip.
+ * @param[in] kind Kind of entry.
+ * @param[out] slot_out If not NULL, receives the slot where the entry
+ *   is or would be stored.
+ * @return Matching registry entry, or NULL if none exists.
+ */
+static struct IPRegistryEntry* ip_registry_lookup(const struct irc_in_addr *ip, unsigned int bits, unsigned int kind, unsigned int *slot_out)
+{
+  struct IPRegistryEntry* entry = 0;
+  unsigned int hashv = ip_registry_hash(ip, kind);
+  unsigned int slot = hashv & ipTable.mask;
+
+  ipStats.lookups++;
+  while ((entry = ipTable.slots[slot])) {
+    ipStats.probes++;
+    if (entry->hashv == hashv && entry->kind == kind && entry->bits == bits
+        && !memcmp(&entry->addr, ip, sizeof(*ip))) {
+      ipStats.hits++;
+      break;
+    }
+    slot = (slot + 1) & ipTable.mask;
+  }
+  if (slot_out)
+    *slot_out = slot;
+  return entry;
 }
 
 /** Find an IP registry entry if one exists for the IP address.
  *
- * If \a ip canonicalizes to a 6to4 mapped IPv6 address, use the first
- * 48 bits to detect matches.  Otherwise use the first 64 bits.
+ * If \a ip is an IPv4 address, use its 6to4 mapping.  Otherwise use
+ * the configured IPv6 prefix, falling back to other prefix lengths
+ * that entries were created with before the prefix was changed.
  *
  * @param[in] ip IP address to search for.
  * @return Matching registry entry, or NULL if none exists.
  */
 static struct IPRegistryEntry* ip_registry_find(const struct irc_in_addr *ip)
 {
-  struct irc_in_addr canon;
+  struct IPRegistryEntry key;
   struct IPRegistryEntry* entry;
-  int bits;
+  unsigned int bits;
+
+  ip_registry_canonicalize(&key, ip);
+  entry = ip_registry_lookup(&key.addr, key.bits, key.kind, 0);
+  if (entry || key.kind != IPREG_ADDR6
+      || ipTable.prefixes[key.bits] == ipTable.v6count)
+    return entry;
+
+  for (bits = 32; bits <= 128 && !entry; bits++)
+    if (ipTable.prefixes[bits] && bits != key.bits) {
+      ip_registry_mask(&key.addr, ip, bits);
+      entry = ip_registry_lookup(&key.addr, bits, IPREG_ADDR6, 0);
+    }
+  return entry;
+}
 
-  ip_registry_canonicalize(&canon, ip);
-  bits = (canon.in6_16[0] == htons(0x2002)) ? 48 : 64;
-  entry = hashTable[ip_registry_hash(&canon)];
-  for ( ; entry; entry = entry->next) {
-    if (ipmask_check(&canon, &entry->addr, bits))
-      break;
+/** Resize the registry hash table.
+ * @param[in] size New number of slots (a power of two).
+ */
+static void ip_registry_resize(unsigned int size)
+{
+  struct IPRegistryEntry** old = ipTable.slots;
+  unsigned int ii, slot, oldsize = ipTable.mask + 1;
+
+  ipTable.slots = (struct IPRegistryEntry**) MyCalloc(size, sizeof(*ipTable.slots));
+  ipTable.mask = size - 1;
+  ipStats.resizes++;
+  if (!old)
+    return;
+
+  for (ii = 0; ii < oldsize; ii++) {
+    if (!old[ii])
+      continue;
+    for (slot = old[ii]->hashv & ipTable.mask; ipTable.slots[slot];
+         slot = (slot + 1) & ipTable.mask)
+      ;
+    ipTable.slots[slot] = old[ii];
   }
-  return entry;
+  MyFree(old);
 }
 
 /** Add an IP registry entry to the hash table.
- * @param[in] entry Registry entry to add.
+ * @param[in] entry Registry entry to add; its address, bits and kind
+ *   must be set.
  */
 static void ip_registry_add(struct IPRegistryEntry* entry)
 {
-  unsigned int bucket = ip_registry_hash(&entry->addr);
-  entry->next = hashTable[bucket];
-  hashTable[bucket] = entry;
+  unsigned int slot;
+
+  if ((ipTable.count + 1) * 2 > ipTable.mask + 1)
+    ip_registry_resize((ipTable.mask + 1) * 2);
+
+  entry->hashv = ip_registry_hash(&entry->addr, entry->kind);
+  for (slot = entry->hashv & ipTable.mask; ipTable.slots[slot];
+       slot = (slot + 1) & ipTable.mask)
+    assert(ipTable.slots[slot] != entry);
+  ipTable.slots[slot] = entry;
+  ipTable.count++;
+  if (entry->kind == IPREG_ADDR6) {
+    ipTable.v6count++;
+    ipTable.prefixes[entry->bits]++;
+  }
+  ipStats.created++;
 }
 
 /** Remove an IP registry entry from the hash table.
- * @param[in] entry Registry entry to add.
+ * @param[in] entry Registry entry to remove.
  */
 static void ip_registry_remove(struct IPRegistryEntry* entry)
 {
-  unsigned int bucket = ip_registry_hash(&entry->addr);
-  if (hashTable[bucket] == entry)
-    hashTable[bucket] = entry->next;
-  else {
-    struct IPRegistryEntry* prev = hashTable[bucket];
-    for ( ; prev; prev = prev->next) {
-      if (prev->next == entry) {
-        prev->next = entry->next;
-        break;
-      }
+  struct IPRegistryEntry* other;
+  unsigned int slot, next, home;
+
+  for (slot = entry->hashv & ipTable.mask; ipTable.slots[slot] != entry;
+       slot = (slot + 1) & ipTable.mask)
+    assert(ipTable.slots[slot] != 0);
+
+  /* Move later entries of the same run back into the gap if their
+   * probe sequence passes through it.
+   */
+  for (next = slot; (other = ipTable.slots[next = (next + 1) & ipTable.mask]); ) {
+    home = other->hashv & ipTable.mask;
+    if (slot <= next ? (home <= slot || home > next)
+        : (home <= slot && home > next)) {
+      ipTable.slots[slot] = other;
+      slot = next;
     }
   }
+  ipTable.slots[slot] = 0;
+  ipTable.count--;
+  if (entry->kind == IPREG_ADDR6) {
+    ipTable.v6count--;
+    ipTable.prefixes[entry->bits]--;
+  }
+
+  if (ipTable.count * 8 < ipTable.mask + 1
+      && ipTable.mask + 1 > IP_REGISTRY_TABLE_MIN)
+    ip_registry_resize((ipTable.mask + 1) / 2);
 }
 
 /** Allocate a new IP registry entry.
@@ -197,9 +354,11 @@ static struct IPRegistryEntry* ip_registry_new_entry(void)
 {
   struct IPRegistryEntry* entry = freeList;
   if (entry)
-    freeList = entry->next;
-  else
+    freeList = entry->wnext;
+  else {
     entry = (struct IPRegistryEntry*) MyMalloc(sizeof(struct IPRegistryEntry));
+    ipAllocated++;
+  }
 
   assert(0 != entry);
   memset(entry, 0, sizeof(struct IPRegistryEntry));
@@ -217,10 +376,57 @@ static void ip_registry_delete_entry(struct IPRegistryEntry* entry)
 {
   if (entry->target)
     MyFree(entry->target);
-  entry->next = freeList;
+  entry->wnext = freeList;
   freeList = entry;
 }
 
+/** Increment a connection attempt counter, saturating at the limit of
+ * the counter used by that kind of entry.
+ * @param[in,out] entry Registry entry to update.
+ */
+static void ip_registry_attempt(struct IPRegistryEntry* entry)
+{
+  if (entry->attempts < (entry->kind == IPREG_NET48 ? 65535 : 255))
+    entry->attempts++;
+}
+
+/** Take an entry off the expiry wheel.
+ * @param[in] entry Registry entry to unschedule.
+ */
+static void ip_registry_unschedule(struct IPRegistryEntry* entry)
+{
+  if (!entry->wprevnextp)
+    return;
+  if (entry->wnext)
+    entry->wnext->wprevnextp = entry->wprevnextp;
+  *entry->wprevnextp = entry->wnext;
+  entry->wprevnextp = 0;
+}
+
+/** Put an idle entry on the expiry wheel at the tick where it needs to
+ * be looked at next: when its free targets or the whole entry become
+ * stale.  Entries are not moved when they are used again; the expiry
+ * pass reschedules them if they are not stale yet.
+ * @param[in] entry Registry entry to schedule.
+ */
+static void ip_registry_schedule(struct IPRegistryEntry* entry)
+{
+  unsigned int tick;
+
+  ip_registry_unschedule(entry);
+  tick = (entry->last_connect + (entry->target ? IP_REGISTRY_EXPIRE_TARGETS
+                                : IP_REGISTRY_EXPIRE)) / IP_REGISTRY_TICK + 1;
+  if ((int) (tick - ipWheelTick) < 0)
+    tick = ipWheelTick;
+  else if (tick - ipWheelTick >= IP_REGISTRY_WHEEL)
+    tick = ipWheelTick + IP_REGISTRY_WHEEL - 1;
+
+  entry->wprevnextp = &ipWheel[tick % IP_REGISTRY_WHEEL];
+  if ((entry->wnext = *entry->wprevnextp))
+    entry->wnext->wprevnextp = &entry->wnext;
+  *entry->wprevnextp = entry;
+}
+
 /** Update free target count for \a entry.
  * @param[in,out] entry IP registry entry to update.
  */
@@ -238,123 +444,128 @@ static unsigned int ip_registry_update_free_targets(struct IPRegistryEntry* entr
 }
 
 /** Check whether all or part of \a entry needs to be expired.
- * If the entry is at least 600 seconds stale, free the entire thing.
- * If it is at least 120 seconds stale, expire its free targets list.
+ * If the entry is at least #IP_REGISTRY_EXPIRE seconds stale, free the
+ * entire thing.  If it is at least #IP_REGISTRY_EXPIRE_TARGETS seconds
+ * stale, expire its free targets list.
+ * Otherwise, or if the entry is still in use, leave it alone; idle
+ * entries go back on the expiry wheel.
  * @param[in] entry Registry entry to check for expiration.
  */
 static void ip_registry_expire_entry(struct IPRegistryEntry* entry)
 {
+  if (entry->kind != IPREG_NET48 && entry->connected)
+    return;
+
   /*
    * Don't touch this number, it has statistical significance
    * XXX - blah blah blah
    */
-  if (CONNECTED_SINCE(entry->last_connect) > 600) {
+  if (CONNECTED_SINCE(entry->last_connect) > IP_REGISTRY_EXPIRE) {
     /*
      * expired
      */
     Debug((DEBUG_DNS, "IPcheck expiring registry for %s (no clients connected).", ircd_ntoa(&entry->addr)));
     ip_registry_remove(entry);
     ip_registry_delete_entry(entry);
+    ipStats.expired++;
+    return;
   }
-  else if (CONNECTED_SINCE(entry->last_connect) > 120 && 0 != entry->target) {
+  else if (CONNECTED_SINCE(entry->last_connect) > IP_REGISTRY_EXPIRE_TARGETS
+           && 0 != entry->target) {
     /*
      * Expire storage of targets
      */
     MyFree(entry->target);
     entry->target = 0;
   }
-}
-
-/** Calculate hash value for an IP address's /48 block.
- * @param[in] ip Address to hash; must be an IPv6 address.
- * @return Hash value for address.
- */
-static unsigned int ip_48_hash(const struct irc_in_addr *ip)
-{
-  unsigned int res;
-  res = ip->in6_16[0] ^ ip->in6_16[1] ^ ip->in6_16[2];
-  return res & (IP_REGISTRY_TABLE_SIZE - 1);
+  ip_registry_schedule(entry);
 }
 
 /** Find or create an IPv6 /48 entry for the IP address.
  * @param[in] ip IPv6 address to search for.
  * @return Matching registry entry (possibly newly created).
  */
-static struct IPRegistry48* ip_48_find(const struct irc_in_addr *ip)
+static struct IPRegistryEntry* ip_48_find(const struct irc_in_addr *ip)
 {
-  struct IPRegistry48* entry;
-  unsigned int idx;
-
-  /* Does it exist in the chain? */
-  idx = ip_48_hash(ip);
-  for (entry = hashTable48[idx]; entry; entry = entry->next) {
-    if ((ip->in6_16[0] == entry->addr[0])
-        && (ip->in6_16[1] == entry->addr[1])
-        && (ip->in6_16[2] == entry->addr[2]))
-      goto done;
-  }
+  struct IPRegistryEntry* entry;
+  struct irc_in_addr canon;
 
-  /* Where do we get the next entry? */
-  entry = freeList48;
-  if (entry)
-    freeList48 = entry->next;
-  else
-    entry = MyMalloc(sizeof(*entry));
+  ip_registry_mask(&canon, ip, 48);
+  if ((entry = ip_registry_lookup(&canon, 48, IPREG_NET48, 0)))
+    return entry;
 
-  /* Initialize this entry. */
-  entry->last_connect = NOW;
-  entry->addr[0]  = ip->in6_16[0];
-  entry->addr[1]  = ip->in6_16[1];
-  entry->addr[2]  = ip->in6_16[2];
+  entry = ip_registry_new_entry();
+  memcpy(&entry->addr, &canon, sizeof(entry->addr));
+  entry->bits = 48;
+  entry->kind = IPREG_NET48;
+  entry->connected = 0;
   entry->attempts = 0;
-
-  /* Link it into the hash table. */
-  entry->next = hashTable48[idx];
-  hashTable48[idx] = entry;
-
-done:
+  ip_registry_add(entry);
+  ip_registry_schedule(entry);
   return entry;
 }
 
-/** Periodic timer callback to check for expired registry entries.
+/** Periodic timer callback to expire registry entries whose wheel
+ * slots have come due.
  * @param[in] ev Timer event (ignored).
  */
 static void ip_registry_expire(struct Event* ev)
 {
-  int i;
   struct IPRegistryEntry* entry;
-  struct IPRegistryEntry* entry_next;
+  struct IPRegistryEntry* list;
+  unsigned int now_tick = NOW / IP_REGISTRY_TICK;
+  unsigned int rate;
 
   assert(ET_EXPIRE == ev_type(ev));
   assert(0 != ev_timer(ev));
 
-  for (i = 0; i < IP_REGISTRY_TABLE_SIZE; ++i) {
-    for (entry = hashTable[i]; entry; entry = entry_next) {
-      entry_next = entry->next;
-      if (0 == entry->connected)
-        ip_registry_expire_entry(entry);
+  if (now_tick - ipWheelTick > IP_REGISTRY_WHEEL)
+    ipWheelTick = now_tick - IP_REGISTRY_WHEEL;
+
+  for (; (int) (now_tick - ipWheelTick) >= 0; ipWheelTick++) {
+    /* Detach the slot so that rescheduled entries are not seen again. */
+    list = ipWheel[ipWheelTick % IP_REGISTRY_WHEEL];
+    ipWheel[ipWheelTick % IP_REGISTRY_WHEEL] = 0;
+    if (list)
+      list->wprevnextp = &list;
+    while ((entry = list)) {
+      ip_registry_unschedule(entry);
+      ip_registry_expire_entry(entry);
     }
-  }
 
-  for (i = 0; i < IP_REGISTRY_TABLE_SIZE; ++i) {
-    struct IPRegistry48** prev_p;
-    struct IPRegistry48* entry;
+    rate = (ipWheelTick + 1) % IP_REGISTRY_RATE_TICKS;
+    ipStats.rate_accepted[rate] = 0;
+    ipStats.rate_throttled[rate] = 0;
+  }
+}
 
-    for (prev_p = &hashTable48[i]; (entry = *prev_p); ) {
-      if (CONNECTED_SINCE(entry->last_connect) > 600) {
-        *prev_p = entry->next;
-        entry->next = freeList48;
-        freeList48 = entry;
-      } else
-        prev_p = &entry->next;
-    }
+/** Note the outcome of a local connection check.
+ * @param[in] accepted Non-zero if the connection was accepted.
+ * @return \a accepted.
+ */
+static int ip_registry_decision(int accepted)
+{
+  unsigned int rate = (NOW / IP_REGISTRY_TICK) % IP_REGISTRY_RATE_TICKS;
+
+  if (accepted) {
+    ipStats.accepted++;
+    ipStats.rate_accepted[rate]++;
+  } else {
+    ipStats.throttled++;
+    ipStats.rate_throttled[rate]++;
   }
+  return accepted;
 }
 
 /** Initialize the IPcheck subsystem. */
 void IPcheck_init(void)
 {
-  timer_add(timer_init(&expireTimer), ip_registry_expire, 0, TT_PERIODIC, 60);
+  ipTable.seed = ircrandom();
+  ip_registry_resize(IP_REGISTRY_TABLE_MIN);
+  ipStats.resizes = 0;
+  ipWheelTick = NOW / IP_REGISTRY_TICK;
+  timer_add_named(timer_init(&expireTimer), ip_registry_expire, 0, TT_PERIODIC,
+                  IP_REGISTRY_TICK);
 }
 
 /** Reset IPcheck configurable settings. */
@@ -421,6 +632,7 @@ static int ip_registry_is_exempt(const struct irc_in_addr *addr)
     if (ipmask_check(addr, &list->address, list->addrbits))   {
       return 1;
     }
+    list = list->next;
   }
 
   return 0;
@@ -440,19 +652,18 @@ static int ip_registry_check_local(const struct irc_in_addr *addr, time_t* next_
   unsigned int free_targets = STARTTARGETS;
 
   if (ip_registry_is_exempt(addr)) {
-    return 1;
+    return ip_registry_decision(1);
   }
 
   entry = ip_registry_find(addr);
   if (!irc_in_addr_is_ipv4(addr)) {
-    struct IPRegistry48* entry_48 = ip_48_find(addr);
+    struct IPRegistryEntry* entry_48 = ip_48_find(addr);
 
     if (CONNECTED_SINCE(entry_48->last_connect) > IPCHECK_48_CLONE_PERIOD)
       entry_48->attempts = 0;
 
     entry_48->last_connect = NOW;
-    if (0 == ++entry_48->attempts)
-      --entry_48->attempts;
+    ip_registry_attempt(entry_48);
 
 #ifndef NOTHROTTLE
     if ((entry_48->attempts >= IPCHECK_48_CLONE_LIMIT)
@@ -466,6 +677,8 @@ static int ip_registry_check_local(const struct irc_in_addr *addr, time_t* next_
           entry->connected--;
           entry = NULL;
         }
+        else
+          ip_registry_unschedule(entry);
       }
       goto reject;
     }
@@ -474,10 +687,10 @@ static int ip_registry_check_local(const struct irc_in_addr *addr, time_t* next_
 
   if (0 == entry) {
     entry       = ip_registry_new_entry();
-    ip_registry_canonicalize(&entry->addr, addr);
+    ip_registry_canonicalize(entry, addr);
     ip_registry_add(entry);
     Debug((DEBUG_DNS, "IPcheck added new registry for local connection from %s.", ircd_ntoa(&entry->addr)));
-    return 1;
+    return ip_registry_decision(1);
   }
   /* Note that this also counts server connects.
    * It is hard and not interesting, to change that.
@@ -487,8 +700,9 @@ static int ip_registry_check_local(const struct irc_in_addr *addr, time_t* next_
   {
     entry->connected--;
     Debug((DEBUG_DNS, "IPcheck refusing local connection from %s: counter overflow.", ircd_ntoa(&entry->addr)));
-    return 0;
+    return ip_registry_decision(0);
   }
+  ip_registry_unschedule(entry);
 
   if (CONNECTED_SINCE(entry->last_connect) > IPCHECK_CLONE_PERIOD)
     entry->attempts = 0;
@@ -496,8 +710,7 @@ static int ip_registry_check_local(const struct irc_in_addr *addr, time_t* next_
   free_targets = ip_registry_update_free_targets(entry);
   entry->last_connect = NOW;
 
-  if (0 == ++entry->attempts)   /* Check for overflow */
-    --entry->attempts;
+  ip_registry_attempt(entry);
 
   if (entry->attempts < IPCHECK_CLONE_LIMIT) {
     if (next_target_out)
@@ -512,14 +725,15 @@ reject:
     if (entry)
     {
       assert(entry->connected > 0);
-      --entry->connected;
+      if (0 == --entry->connected)
+        ip_registry_schedule(entry);
     }
     Debug((DEBUG_DNS, "IPcheck refusing local connection from %s: too fast.", ircd_ntoa(addr)));
-    return 0;
+    return ip_registry_decision(0);
   }
 #endif
   Debug((DEBUG_DNS, "IPcheck accepting local connection from %s.", ircd_ntoa(&entry->addr)));
-  return 1;
+  return ip_registry_decision(1);
 }
 
 /** Check whether a connection from a remote client should be allowed.
@@ -548,18 +762,17 @@ static int ip_registry_check_remote(struct Client* cptr, int is_burst)
   }
 
   if (!irc_in_addr_is_ipv4(&cli_ip(cptr))) {
-    struct IPRegistry48* entry_48 = ip_48_find(&cli_ip(cptr));
+    struct IPRegistryEntry* entry_48 = ip_48_find(&cli_ip(cptr));
     if (CONNECTED_SINCE(entry_48->last_connect) > IPCHECK_48_CLONE_PERIOD)
       entry_48->attempts = 0;
-    if (0 == ++entry_48->attempts)
-      --entry_48->attempts;
+    ip_registry_attempt(entry_48);
     entry_48->last_connect = NOW;
   }
 
   entry = ip_registry_find(&cli_ip(cptr));
   if (0 == entry) {
     entry = ip_registry_new_entry();
-    ip_registry_canonicalize(&entry->addr, &cli_ip(cptr));
+    ip_registry_canonicalize(entry, &cli_ip(cptr));
     if (is_burst)
       entry->attempts = 0;
     ip_registry_add(entry);
@@ -571,15 +784,11 @@ static int ip_registry_check_remote(struct Client* cptr, int is_burst)
     Debug((DEBUG_DNS, "IPcheck refusing remote connection from %s: counter overflow.", ircd_ntoa(&entry->addr)));
     return 0;
   }
+  ip_registry_unschedule(entry);
   if (CONNECTED_SINCE(entry->last_connect) > IPCHECK_CLONE_PERIOD)
     entry->attempts = 0;
   if (!is_burst) {
-    if (0 == ++entry->attempts) {
-      /*
-       * Check for overflow
-       */
-      --entry->attempts;
-    }
+    ip_registry_attempt(entry);
     ip_registry_update_free_targets(entry);
     entry->last_connect = NOW;
   }
@@ -598,7 +807,7 @@ static void ip_registry_connect_fail(const struct irc_in_addr *addr, int disconn
   struct IPRegistryEntry* entry = ip_registry_find(addr);
 
   if (!irc_in_addr_is_ipv4(addr)) {
-    struct IPRegistry48* entry_48 = ip_48_find(addr);
+    struct IPRegistryEntry* entry_48 = ip_48_find(addr);
     if (0 == --entry_48->attempts)
       ++entry_48->attempts;
   }
@@ -610,7 +819,8 @@ static void ip_registry_connect_fail(const struct irc_in_addr *addr, int disconn
     }
     if (disconnect) {
       assert(entry->connected > 0);
-      entry->connected--;
+      if (0 == --entry->connected)
+        ip_registry_schedule(entry);
     }
   }
 }
@@ -716,6 +926,8 @@ static void ip_registry_disconnect(struct Client *cptr)
     if (free_targets < entry->target->count)
       entry->target->count = free_targets;
   }
+  if (0 == entry->connected)
+    ip_registry_schedule(entry);
 }
 
 /** Find number of clients from a particular IP address.
@@ -797,3 +1009,49 @@ unsigned short IPcheck_nr(struct Client *cptr)
   assert(0 != cptr);
   return ip_registry_count(&cli_ip(cptr));
 }
+
+/** Report IPcheck registry statistics.
+ * @param[in] to Client requesting statistics.
+ * @param[in] sd Stats descriptor for request (ignored).
+ * @param[in] param Extra parameter from user (ignored).
+ */
+void IPcheck_stats(struct Client *to, const struct StatDesc *sd, char *param)
+{
+  unsigned long accepted = 0, throttled = 0;
+  unsigned int ii, secs, counts[IPREG_NET48 + 1] = { 0 };
+
+  for (ii = 0; ii <= ipTable.mask; ii++)
+    if (ipTable.slots[ii])
+      counts[ipTable.slots[ii]->kind]++;
+  /* The current tick is partly over; the others are complete. */
+  for (ii = 0; ii < IP_REGISTRY_RATE_TICKS; ii++) {
+    accepted += ipStats.rate_accepted[ii];
+    throttled += ipStats.rate_throttled[ii];
+  }
+  secs = (IP_REGISTRY_RATE_TICKS - 1) * IP_REGISTRY_TICK
+    + NOW % IP_REGISTRY_TICK + 1;
+
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":IPcheck: slots %u entries %u (IPv4 %u IPv6 %u /48 %u) "
+             "load %u%% resizes %lu", ipTable.mask + 1, ipTable.count,
+             counts[IPREG_ADDR4], counts[IPREG_ADDR6], counts[IPREG_NET48],
+             ipTable.count * 100 / (ipTable.mask + 1), ipStats.resizes);
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":IPcheck: lookups %lu hits %lu (%lu%%) avg probes %lu.%02lu "
+             "created %lu expired %lu", ipStats.lookups, ipStats.hits,
+             ipStats.lookups ? ipStats.hits * 100 / ipStats.lookups : 0,
+             ipStats.lookups ? ipStats.probes / ipStats.lookups : 0,
+             ipStats.lookups ? (ipStats.probes * 100 / ipStats.lookups) % 100 : 0,
+             ipStats.created, ipStats.expired);
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":IPcheck: accepted %lu throttled %lu; last %us: accepted "
+             "%lu.%02lu/s throttled %lu.%02lu/s", ipStats.accepted,
+             ipStats.throttled, secs, accepted / secs,
+             accepted * 100 / secs % 100, throttled / secs,
+             throttled * 100 / secs % 100);
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":IPcheck: memory %zu (%u entries allocated, %zu table)",
+             ipAllocated * sizeof(struct IPRegistryEntry)
+             + (ipTable.mask + 1) * sizeof(*ipTable.slots), ipAllocated,
+             (ipTable.mask + 1) * sizeof(*ipTable.slots));
+}
@@ -0,0 +1,780 @@
+/*
+ * IRC - Internet Relay Chat, ircd/accept_pool.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/** @file
+ * @brief Optional threads that accept connections on listening ports.
+ * @version $Id$
+ *
+ * When FEAT_ACCEPT_THREADS is non-zero, the listening sockets are taken
+ * out of the main event loop and polled by a pool of acceptor threads
+ * instead.  The threads accept(), set up the new sockets, and turn
+ * away connections that the main loop would refuse outright.  The rest
+ * are passed to the main loop through a bounded lock-free queue with
+ * many producers and one consumer, and an eventfd (or pipe) wakes the
+ * main loop to drain it.
+ *
+ * The threads never touch Listener structures or other ircd state.
+ * They work from a snapshot of the listening sockets that the main
+ * thread publishes under a mutex.  Whenever a listening socket is about
+ * to be closed, the main thread publishes a new snapshot and waits
+ * for every thread to pick it up, so no thread can still be polling
+ * the old descriptor.
+ */
+#include "config.h"
+
+#include "accept_pool.h"
+#include "client.h"
+#include "ircd.h"
+#include "ircd_alloc.h"
+#include "ircd_events.h"
+#include "ircd_features.h"
+#include "ircd_log.h"
+#include "ircd_osdep.h"
+#include "ircd_reply.h"
+#include "ircd_snprintf.h"
+#include "listener.h"
+#include "match.h"
+#include "numeric.h"
+#include "res.h"
+#include "s_bsd.h"
+#include "s_misc.h"
+#include "send.h"
+#include "sys.h"
+
+/* #include <assert.h> -- Now using assert in ircd_log.h */
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(HAVE_PTHREADS) && defined(HAVE_PTHREAD_H) && defined(HAVE_POLL_H) \
+    && defined(__GNUC__)
+/** Acceptor threads can be built on this system. */
+#define ACCEPT_THREADS
+#endif
+
+#ifdef ACCEPT_THREADS
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+/** Number of cells in the handoff queue; must be a power of two. */
+#define ACCEPT_QUEUE_SIZE	1024
+/** Number of entries in the throttled address cache; must be a power
+ * of two.
+ */
+#define ACCEPT_THROTTLE_SIZE	4096
+/** Throttle entry for address hash \a hash, expiring at \a expire. */
+#define THROTTLE_ENTRY(hash, expire) \
+  (((uint64_t) (hash) << 32) | (unsigned int) (expire))
+/** Maximum number of connections a thread accepts from one socket
+ * before polling again.
+ */
+#define ACCEPT_BURST		64
+/** Upper limit on FEAT_ACCEPT_THREADS. */
+#define ACCEPT_MAX_THREADS	64
+
+/** One listening socket as seen by the acceptor threads. */
+struct AcceptPort {
+  int                 ap_fd;          /**< Listening socket. */
+  struct Listener*    ap_listener;    /**< Owner; never dereferenced by threads. */
+  struct irc_in_addr  ap_mask;        /**< Copy of the listener's address mask. */
+  unsigned char       ap_mask_bits;   /**< Number of bits in ap_mask. */
+  unsigned char       ap_active;      /**< Non-zero if the listener is active. */
+  unsigned char       ap_ipcheck;     /**< Non-zero if clients are IPcheck'ed. */
+};
+
+/** Everything the acceptor threads need, published as one unit. */
+struct AcceptSnapshot {
+  unsigned int        as_count;       /**< Number of listening sockets. */
+  struct AcceptPort*  as_ports;       /**< Listening sockets. */
+  struct pollfd*      as_pollfds;     /**< as_count + 1 pollfds per thread. */
+  int                 as_maxclients;  /**< Highest usable descriptor plus one. */
+  char                as_inuse[BUFSIZE];    /**< "All connections in use" error. */
+  int                 as_inuse_len;   /**< Length of as_inuse. */
+  char                as_inactive[BUFSIZE]; /**< "Use another port" error. */
+  int                 as_inactive_len; /**< Length of as_inactive. */
+};
+
+/** One accepted connection waiting for the main loop. */
+struct AcceptCell {
+  unsigned long       ac_seq;         /**< Sequence number for the queue. */
+  int                 ac_fd;          /**< Accepted descriptor. */
+  struct Listener*    ac_listener;    /**< Listener it arrived on. */
+  struct irc_sockaddr ac_addr;        /**< Peer address. */
+};
+
+/** State for one acceptor thread. */
+struct AcceptThread {
+  pthread_t           at_thread;      /**< Thread handle. */
+  unsigned int        at_index;       /**< Index into the pool. */
+  unsigned int        at_acked;       /**< Last snapshot generation seen. */
+  int                 at_ctl[2];      /**< Wakeup descriptors (read, write). */
+};
+
+/** Counters kept by the acceptor threads. */
+enum AcceptCounter {
+  AC_ACCEPTED,        /**< Connections handed to the main loop. */
+  AC_ALL_INUSE,       /**< Rejected: all connections in use. */
+  AC_INACTIVE,        /**< Rejected: listener shutting down. */
+  AC_BAD_IP,          /**< Rejected: address not allowed on port. */
+  AC_BAD_SOCKET,      /**< Rejected: socket setup failed. */
+  AC_THROTTLED,       /**< Rejected: address recently throttled. */
+  AC_QUEUE_FULL,      /**< Rejected: handoff queue full. */
+  AC_COUNT            /**< Number of counters. */
+};
+
+/** The acceptor thread pool. */
+static struct {
+  pthread_mutex_t        lock;        /**< Protects snapshot and generation. */
+  pthread_cond_t         cond;        /**< Signalled when a thread acks. */
+  struct AcceptSnapshot* snapshot;    /**< Current snapshot. */
+  unsigned int           generation;  /**< Snapshot generation. */
+  int                    stopping;    /**< Non-zero to make threads exit. */
+  struct AcceptThread*   threads;     /**< Running threads. */
+  unsigned int           count;       /**< Number of running threads. */
+  int                    wake[2];     /**< Main loop wakeup (read, write). */
+  struct Socket          wake_sock;   /**< Event loop socket for wake[0]. */
+  int                    signalled;   /**< Non-zero if wake[1] was written. */
+  unsigned long          enqueue_pos; /**< Next queue cell to fill. */
+  unsigned long          dequeue_pos; /**< Next queue cell to drain. */
+  struct AcceptCell      queue[ACCEPT_QUEUE_SIZE]; /**< Handoff queue. */
+  uint64_t               throttle[ACCEPT_THROTTLE_SIZE];
+                                      /**< Recently throttled addresses. */
+  time_t                 throttle_period; /**< Lifetime of throttle entries. */
+  unsigned long          counters[AC_COUNT]; /**< Since last drain. */
+  unsigned long          totals[AC_COUNT];   /**< Since startup. */
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, 0,
+           { -1, -1 } };
+
+/** Throttle message, as in add_connection(). */
+static const char throttle_message[] =
+  "ERROR :Your host is trying to (re)connect too fast -- throttled\r\n";
+
+/** Create a wakeup channel.
+ * @param[out] fds Receives read and write descriptors (which may be
+ * the same descriptor).
+ * @return Non-zero on success.
+ */
+static int
+wake_open(int fds[2])
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  if ((fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK)) >= 0)
+    return 1;
+#endif
+  if (pipe(fds))
+    return 0;
+  if (!os_set_nonblocking(fds[0]) || !os_set_nonblocking(fds[1])) {
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+  }
+  return 1;
+}
+
+/** Close a wakeup channel.
+ * @param[in,out] fds Descriptors from wake_open().
+ */
+static void
+wake_close(int fds[2])
+{
+  close(fds[0]);
+  if (fds[1] != fds[0])
+    close(fds[1]);
+  fds[0] = fds[1] = -1;
+}
+
+/** Signal a wakeup channel.
+ * @param[in] fds Descriptors from wake_open().
+ */
+static void
+wake_signal(int fds[2])
+{
+  unsigned long long one = 1;
+  int res;
+
+  if (fds[1] == fds[0])
+    res = write(fds[1], &one, sizeof(one));
+  else
+    res = write(fds[1], &one, 1);
+  (void) res; /* a full pipe is already signalled */
+}
+
+/** Consume all pending wakeups on a channel.
+ * @param[in] fds Descriptors from wake_open().
+ */
+static void
+wake_drain(int fds[2])
+{
+  char buf[64];
+
+  while (read(fds[0], buf, sizeof(buf)) > 0)
+    ;
+}
+
+/** Hash an address for the throttle cache.
+ * @param[in] addr Address to hash.
+ * @return Non-zero 32-bit hash value.
+ */
+static unsigned int
+throttle_hash(const struct irc_in_addr* addr)
+{
+  unsigned int hash = 2166136261u;
+  int ii;
+
+  for (ii = 0; ii < 8; ii++)
+    hash = (hash ^ addr->in6_16[ii]) * 16777619u;
+  return hash ? hash : 1;
+}
+
+/** Check whether an address was recently throttled.  If so, the entry
+ * is refreshed, just as IPcheck refreshes its registry entry on each
+ * attempt.
+ * @param[in] addr Address to check.
+ * @return Non-zero if the connection should be throttled.
+ */
+static int
+throttle_check(const struct irc_in_addr* addr)
+{
+  unsigned int hash = throttle_hash(addr);
+  uint64_t* slot = &pool.throttle[hash & (ACCEPT_THROTTLE_SIZE - 1)];
+  uint64_t entry = __atomic_load_n(slot, __ATOMIC_RELAXED);
+  unsigned int now = (unsigned int) __atomic_load_n(&CurrentTime,
+                                                     __ATOMIC_RELAXED);
+  unsigned int expire = (unsigned int) entry;
+
+  if ((unsigned int) (entry >> 32) != hash || (int) (expire - now) <= 0)
+    return 0;
+  expire = now + (unsigned int) pool.throttle_period;
+  __atomic_compare_exchange_n(slot, &entry,
+                              THROTTLE_ENTRY(hash, expire), 0,
+                              __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  return 1;
+}
+
+/** Add an accepted connection to the handoff queue.
+ * @param[in] fd Accepted descriptor.
+ * @param[in] listener Listener it arrived on.
+ * @param[in] addr Peer address.
+ * @return Non-zero on success, zero if the queue is full.
+ */
+static int
+queue_push(int fd, struct Listener* listener, const struct irc_sockaddr* addr)
+{
+  unsigned long pos = __atomic_load_n(&pool.enqueue_pos, __ATOMIC_RELAXED);
+  struct AcceptCell* cell;
+  long diff;
+
+  for (;;) {
+    cell = &pool.queue[pos & (ACCEPT_QUEUE_SIZE - 1)];
+    diff = (long) __atomic_load_n(&cell->ac_seq, __ATOMIC_ACQUIRE) - (long) pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&pool.enqueue_pos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0)
+      return 0; /* queue is full */
+    else
+      pos = __atomic_load_n(&pool.enqueue_pos, __ATOMIC_RELAXED);
+  }
+
+  cell->ac_fd = fd;
+  cell->ac_listener = listener;
+  memcpy(&cell->ac_addr, addr, sizeof(cell->ac_addr));
+  __atomic_store_n(&cell->ac_seq, pos + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/** Take the oldest connection off the handoff queue.  Only the main
+ * thread may call this.
+ * @param[out] out Receives the queued connection.
+ * @return Non-zero if a connection was dequeued.
+ */
+static int
+queue_pop(struct AcceptCell* out)
+{
+  unsigned long pos = pool.dequeue_pos;
+  struct AcceptCell* cell = &pool.queue[pos & (ACCEPT_QUEUE_SIZE - 1)];
+
+  if (__atomic_load_n(&cell->ac_seq, __ATOMIC_ACQUIRE) != pos + 1)
+    return 0;
+  memcpy(out, cell, sizeof(*out));
+  __atomic_store_n(&cell->ac_seq, pos + ACCEPT_QUEUE_SIZE, __ATOMIC_RELEASE);
+  pool.dequeue_pos = pos + 1;
+  return 1;
+}
+
+/** Send an error to a connection and close it, from a thread.
+ * @param[in] fd Descriptor to close.
+ * @param[in] msg Message to send.
+ * @param[in] len Length of \a msg.
+ * @param[in] counter Counter to increment.
+ */
+static void
+thread_reject(int fd, const char* msg, int len, enum AcceptCounter counter)
+{
+  if (len)
+    send(fd, msg, len, 0);
+  close(fd);
+  __atomic_fetch_add(&pool.counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/** Accept connections on one listening socket.
+ * @param[in] snap Snapshot the port belongs to.
+ * @param[in] port Listening socket to accept on.
+ */
+static void
+thread_accept(const struct AcceptSnapshot* snap, const struct AcceptPort* port)
+{
+  struct irc_sockaddr addr;
+  int fd, count;
+
+  for (count = 0; count < ACCEPT_BURST; count++) {
+    if ((fd = os_accept(port->ap_fd, &addr)) < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return; /* EAGAIN, or another thread got there first */
+    }
+
+    if (fd >= snap->as_maxclients)
+      thread_reject(fd, snap->as_inuse, snap->as_inuse_len, AC_ALL_INUSE);
+    else if (!port->ap_active)
+      thread_reject(fd, snap->as_inactive, snap->as_inactive_len, AC_INACTIVE);
+    else if (!ipmask_check(&addr.addr, &port->ap_mask, port->ap_mask_bits))
+      thread_reject(fd, snap->as_inactive, snap->as_inactive_len, AC_BAD_IP);
+    else if (!os_set_nonblocking(fd))
+      thread_reject(fd, 0, 0, AC_BAD_SOCKET);
+    else if (port->ap_ipcheck && throttle_check(&addr.addr))
+      thread_reject(fd, throttle_message, sizeof(throttle_message) - 1,
+                    AC_THROTTLED);
+    else {
+      os_disable_options(fd);
+      if (!queue_push(fd, port->ap_listener, &addr))
+        thread_reject(fd, snap->as_inuse, snap->as_inuse_len, AC_QUEUE_FULL);
+      else if (!__atomic_exchange_n(&pool.signalled, 1, __ATOMIC_SEQ_CST))
+        wake_signal(pool.wake);
+    }
+  }
+}
+
+/** Main function for an acceptor thread.
+ * @param[in] arg Pointer to the thread's AcceptThread.
+ * @return NULL.
+ */
+static void*
+accept_thread(void* arg)
+{
+  struct AcceptThread* at = arg;
+  struct AcceptSnapshot* snap = 0;
+  struct pollfd* pfd = 0;
+  unsigned int gen = 0, ii;
+
+  for (;;) {
+    /* pick up a new snapshot, if there is one */
+    if (__atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE) != gen || !snap) {
+      pthread_mutex_lock(&pool.lock);
+      if (pool.stopping) {
+        pthread_mutex_unlock(&pool.lock);
+        break;
+      }
+      snap = pool.snapshot;
+      gen = at->at_acked = pool.generation;
+      pthread_cond_broadcast(&pool.cond);
+      pthread_mutex_unlock(&pool.lock);
+
+      pfd = snap->as_pollfds + at->at_index * (snap->as_count + 1);
+      pfd[0].fd = at->at_ctl[0];
+      pfd[0].events = POLLIN;
+      for (ii = 0; ii < snap->as_count; ii++) {
+        pfd[ii + 1].fd = snap->as_ports[ii].ap_fd;
+        pfd[ii + 1].events = POLLIN;
+      }
+    }
+
+    if (poll(pfd, snap->as_count + 1, -1) < 0)
+      continue;
+
+    if (pfd[0].revents)
+      wake_drain(at->at_ctl);
+    for (ii = 0; ii < snap->as_count; ii++)
+      if (pfd[ii + 1].revents)
+        thread_accept(snap, &snap->as_ports[ii]);
+  }
+
+  return 0;
+}
+
+/** Build a snapshot of the current listening sockets.
+ * @param[in] threads Number of threads that will use the snapshot.
+ * @return Newly allocated snapshot.
+ */
+static struct AcceptSnapshot*
+snapshot_build(unsigned int threads)
+{
+  struct AcceptSnapshot* snap;
+  struct Listener* listener;
+  struct AcceptPort* port;
+  unsigned int count = 0;
+
+  for (listener = ListenerPollList; listener; listener = listener->next)
+    count += (listener->fd_v4 >= 0) + (listener->fd_v6 >= 0);
+
+  snap = (struct AcceptSnapshot*) MyCalloc(1, sizeof(*snap));
+  snap->as_ports = (struct AcceptPort*) MyCalloc(count + 1, sizeof(*port));
+  snap->as_pollfds = (struct pollfd*) MyCalloc((count + 1) * threads,
+                                               sizeof(struct pollfd));
+  snap->as_maxclients = MAXCLIENTS;
+  snap->as_inuse_len = ircd_snprintf(0, snap->as_inuse, sizeof(snap->as_inuse),
+                                     ":%s ERROR :All connections in use\r\n",
+                                     cli_name(&me));
+  snap->as_inactive_len = ircd_snprintf(0, snap->as_inactive,
+                                        sizeof(snap->as_inactive),
+                                        ":%s ERROR :Use another port\r\n",
+                                        cli_name(&me));
+
+  for (listener = ListenerPollList; listener; listener = listener->next) {
+    int fds[2], ii;
+
+    fds[0] = listener->fd_v4;
+    fds[1] = listener->fd_v6;
+    for (ii = 0; ii < 2; ii++) {
+      if (fds[ii] < 0)
+        continue;
+      port = &snap->as_ports[snap->as_count++];
+      port->ap_fd = fds[ii];
+      port->ap_listener = listener;
+      memcpy(&port->ap_mask, &listener->mask, sizeof(port->ap_mask));
+      port->ap_mask_bits = listener->mask_bits;
+      port->ap_active = listener_active(listener) ? 1 : 0;
+      port->ap_ipcheck = !listener_server(listener) && !listener_webirc(listener);
+    }
+  }
+
+  return snap;
+}
+
+/** Free a snapshot.
+ * @param[in] snap Snapshot to free.
+ */
+static void
+snapshot_free(struct AcceptSnapshot* snap)
+{
+  if (!snap)
+    return;
+  MyFree(snap->as_ports);
+  MyFree(snap->as_pollfds);
+  MyFree(snap);
+}
+
+/** Publish a new snapshot and wait for every thread to pick it up.
+ * @param[in] snap Snapshot to publish, or NULL to stop the threads.
+ */
+static void
+snapshot_publish(struct AcceptSnapshot* snap)
+{
+  struct AcceptSnapshot* old;
+  unsigned int ii, gen;
+
+  pthread_mutex_lock(&pool.lock);
+  old = pool.snapshot;
+  if (snap)
+    pool.snapshot = snap;
+  else
+    pool.stopping = 1;
+  gen = pool.generation + 1;
+  __atomic_store_n(&pool.generation, gen, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (ii = 0; ii < pool.count; ii++)
+    wake_signal(pool.threads[ii].at_ctl);
+
+  if (!snap) { /* threads are exiting */
+    for (ii = 0; ii < pool.count; ii++)
+      pthread_join(pool.threads[ii].at_thread, 0);
+    pool.stopping = 0;
+    pool.snapshot = 0;
+  } else {
+    pthread_mutex_lock(&pool.lock);
+    for (ii = 0; ii < pool.count; ii++)
+      while (pool.threads[ii].at_acked != gen)
+        pthread_cond_wait(&pool.cond, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  snapshot_free(old);
+}
+
+/** Stop all acceptor threads. */
+static void
+pool_stop(void)
+{
+  unsigned int ii;
+
+  if (!pool.count)
+    return;
+  snapshot_publish(0);
+  for (ii = 0; ii < pool.count; ii++)
+    wake_close(pool.threads[ii].at_ctl);
+  MyFree(pool.threads);
+  pool.threads = 0;
+  pool.count = 0;
+}
+
+/** Start acceptor threads.
+ * @param[in] count Number of threads to start.
+ */
+static void
+pool_start(unsigned int count)
+{
+  sigset_t all, old;
+  unsigned int ii;
+
+  pool.threads = (struct AcceptThread*) MyCalloc(count, sizeof(*pool.threads));
+  pool.snapshot = snapshot_build(count);
+  memset(pool.throttle, 0, sizeof(pool.throttle));
+
+  /* the threads should never handle signals */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  for (ii = 0; ii < count; ii++) {
+    struct AcceptThread* at = &pool.threads[ii];
+
+    at->at_index = ii;
+    at->at_acked = 0;
+    if (!wake_open(at->at_ctl))
+      break;
+    if (pthread_create(&at->at_thread, 0, accept_thread, at)) {
+      wake_close(at->at_ctl);
+      break;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+
+  if ((pool.count = ii) < count)
+    log_write(LS_SYSTEM, L_ERROR, 0, "Only started %u of %u acceptor threads",
+              ii, count);
+}
+
+/** Hand connections queued by the acceptor threads to the main loop.
+ * @param[in] ev Wakeup socket event.
+ */
+static void
+accept_pool_callback(struct Event* ev)
+{
+  struct AcceptCell cell;
+  unsigned long count;
+  unsigned int ii;
+
+  assert(0 != ev_socket(ev));
+
+  if (ev_type(ev) != ET_READ)
+    return;
+
+  wake_drain(pool.wake);
+  __atomic_store_n(&pool.signalled, 0, __ATOMIC_SEQ_CST);
+
+  /* fold the threads' rejection counts into the server statistics */
+  for (ii = 0; ii < AC_COUNT; ii++) {
+    count = __atomic_exchange_n(&pool.counters[ii], 0, __ATOMIC_RELAXED);
+    pool.totals[ii] += count;
+    switch (ii) {
+    case AC_ALL_INUSE: case AC_QUEUE_FULL:
+      ServerStats->is_all_inuse += count;
+      break;
+    case AC_INACTIVE: ServerStats->is_inactive += count; break;
+    case AC_BAD_IP: ServerStats->is_bad_ip += count; break;
+    case AC_BAD_SOCKET: ServerStats->is_bad_socket += count; break;
+    case AC_THROTTLED: ServerStats->is_throttled += count; break;
+    }
+  }
+
+  while (queue_pop(&cell)) {
+    if (!cell.ac_listener || !listener_active(cell.ac_listener)) {
+      ++ServerStats->is_inactive;
+      reject_connection(cell.ac_fd, "Use another port");
+      continue;
+    }
+    cell.ac_listener->last_accept = CurrentTime;
+    ++ServerStats->is_ac;
+    ++pool.totals[AC_ACCEPTED];
+    add_connection(cell.ac_listener, cell.ac_fd, &cell.ac_addr);
+  }
+}
+
+/** Report whether acceptor threads are handling the listening sockets.
+ * @return Non-zero if acceptor threads are running.
+ */
+int
+accept_pool_running(void)
+{
+  return pool.count > 0;
+}
+
+/** Bring the acceptor threads in line with FEAT_ACCEPT_THREADS and the
+ * current set of listening sockets.  This is called after the
+ * configuration is read, when the feature changes, and before a
+ * listening socket is closed.
+ */
+void
+accept_pool_update(void)
+{
+  unsigned int want = feature_int(FEAT_ACCEPT_THREADS);
+
+  if (want > ACCEPT_MAX_THREADS)
+    want = ACCEPT_MAX_THREADS;
+
+  if (want && pool.wake[0] < 0) {
+    unsigned int ii;
+
+    for (ii = 0; ii < ACCEPT_QUEUE_SIZE; ii++)
+      pool.queue[ii].ac_seq = ii;
+    if (!wake_open(pool.wake)) {
+      log_write(LS_SYSTEM, L_ERROR, 0, "Unable to create acceptor thread "
+                "wakeup descriptor: %m");
+      return;
+    }
+    if (!socket_add_named(&pool.wake_sock, accept_pool_callback, 0, SS_NOTSOCK,
+                          SOCK_EVENT_READABLE, pool.wake[0])) {
+      wake_close(pool.wake);
+      return;
+    }
+  }
+
+  pool.throttle_period = feature_int(FEAT_IPCHECK_CLONE_PERIOD);
+
+  if (want != pool.count) {
+    pool_stop();
+    if (want)
+      pool_start(want);
+  } else if (pool.count)
+    snapshot_publish(snapshot_build(pool.count));
+
+  /* let the main loop watch the listeners only if no thread does */
+  watch_listeners(!pool.count);
+}
+
+/** Make sure connections the acceptor threads queued for a listener
+ * are not handed to the main loop.  This must be called before the
+ * listener is freed, and after its sockets were closed (which makes
+ * the threads stop using them).
+ * @param[in] listener Listener that is going away.
+ */
+void
+accept_pool_forget(struct Listener* listener)
+{
+  struct AcceptCell* cell;
+  unsigned long pos;
+
+  /* Every connection queued from the listener's sockets is already
+   * published, since the threads have moved on to a snapshot without
+   * them.
+   */
+  for (pos = pool.dequeue_pos; ; pos++) {
+    cell = &pool.queue[pos & (ACCEPT_QUEUE_SIZE - 1)];
+    if (__atomic_load_n(&cell->ac_seq, __ATOMIC_ACQUIRE) != pos + 1)
+      break;
+    if (cell->ac_listener == listener)
+      cell->ac_listener = 0;
+  }
+}
+
+/** Remember that IPcheck throttled an address, so the acceptor threads
+ * can turn it away without waking the main loop.
+ * @param[in] addr Address that was throttled.
+ */
+void
+accept_pool_throttle(const struct irc_in_addr* addr)
+{
+  unsigned int hash;
+
+  if (!pool.count)
+    return;
+  hash = throttle_hash(addr);
+  __atomic_store_n(&pool.throttle[hash & (ACCEPT_THROTTLE_SIZE - 1)],
+                   THROTTLE_ENTRY(hash, CurrentTime + pool.throttle_period),
+                   __ATOMIC_RELAXED);
+}
+
+/** Report acceptor thread statistics.
+ * @param[in] to Client requesting statistics.
+ */
+void
+accept_pool_report(struct Client* to)
+{
+  if (!pool.count && !pool.totals[AC_ACCEPTED])
+    return;
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":Acceptor threads: %u running, %lu accepted, %lu throttled, "
+             "%lu queue full, %lu other rejects", pool.count,
+             pool.totals[AC_ACCEPTED], pool.totals[AC_THROTTLED],
+             pool.totals[AC_QUEUE_FULL],
+             pool.totals[AC_ALL_INUSE] + pool.totals[AC_INACTIVE]
+             + pool.totals[AC_BAD_IP] + pool.totals[AC_BAD_SOCKET]);
+}
+
+#else /* !ACCEPT_THREADS */
+
+/** Report whether acceptor threads are handling the listening sockets.
+ * @return Zero; acceptor threads are not supported.
+ */
+int
+accept_pool_running(void)
+{
+  return 0;
+}
+
+/** Warn if acceptor threads were requested but are not supported. */
+void
+accept_pool_update(void)
+{
+  if (feature_int(FEAT_ACCEPT_THREADS))
+    log_write(LS_SYSTEM, L_WARNING, 0, "ACCEPT_THREADS is set, but this "
+              "server was built without thread support");
+}
+
+/** Forget a listener (nothing to do without acceptor threads).
+ * @param[in] listener Listener that is going away.
+ */
+void
+accept_pool_forget(struct Listener* listener)
+{
+}
+
+/** Remember a throttled address (nothing to do without acceptor threads).
+ * @param[in] addr Address that was throttled.
+ */
+void
+accept_pool_throttle(const struct irc_in_addr* addr)
+{
+}
+
+/** Report acceptor thread statistics (nothing to report).
+ * @param[in] to Client requesting statistics.
+ */
+void
+accept_pool_report(struct Client* to)
+{
+}
+
+#endif /* ACCEPT_THREADS */
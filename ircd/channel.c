@@ -37,7 +37,9 @@
 #include "ircd_snprintf.h"
 #include "ircd_string.h"
 #include "list.h"
+#include "mask_index.h"
 #include "match.h"
+#include "member_hash.h"
 #include "msg.h"
 #include "msgq.h"
 #include "numeric.h"
@@ -47,6 +49,7 @@
 #include "s_conf.h"
 #include "s_debug.h"
 #include "s_misc.h"
+#include "s_serv.h"
 #include "s_user.h"
 #include "send.h"
 #include "struct.h"
@@ -72,6 +75,8 @@ static size_t bans_alloc;
 /** Number of ban structures in use. */
 static size_t bans_inuse;
 
+static void ban_index_free(struct Channel *chptr);
+
 #if !defined(NDEBUG)
 /** return the length (>=0) of a chain of links.
  * @param lp	pointer to the start of the linked list
@@ -153,9 +158,10 @@ void bans_send_meminfo(struct Client *cptr)
 
 /** return the struct Membership* that represents a client on a channel
  * This function finds a struct Membership* which holds the state about
- * a client on a specific channel.  The code is smart enough to iterate
- * over the channels a user is in, or the users in a channel to find the
- * user depending on which is likely to be more efficient.
+ * a client on a specific channel.  Large channels and clients on many
+ * channels have hash tables of their memberships; otherwise the code
+ * iterates over the channels a user is in, or the users in a channel
+ * to find the user depending on which is likely to be more efficient.
  *
  * @param chptr	pointer to the channel struct
  * @param cptr pointer to the client struct
@@ -174,11 +180,18 @@ struct Membership* find_member_link(struct Channel* chptr, const struct Client*
   /* Servers don't have member links */
   if (IsServer(cptr)||IsMe(cptr))
      return 0;
-  
+
+  if ((cli_user(cptr))->chan_hash)
+    return member_hash_find((cli_user(cptr))->chan_hash, chptr);
+  if (chptr->member_hash)
+    return member_hash_find(chptr->member_hash, cptr);
+
   /* +k users are typically on a LOT of channels.  So we iterate over who
    * is in the channel.  X/W are +k and are in about 5800 channels each.
    * however there are typically no more than 1000 people in a channel
-   * at a time.
+   * at a time.  (X and W are on enough channels to have their own
+   * channel hash table, checked above, so this is only reached for
+   * services on a few channels whose members are not hashed either.)
    */
   if (IsChannelService(cptr)) {
     m = chptr->members;
@@ -253,10 +266,12 @@ int sub1_from_channel(struct Channel* chptr)
   {
     assert(0 != chptr->members);
     --chptr->users;
+    list_size_channel(chptr);
     return 1;
   }
 
   chptr->users = 0;
+  list_size_channel(chptr);
 
   /*
    * Also channels without Apass set need to be kept alive,
@@ -287,6 +302,7 @@ int sub1_from_channel(struct Channel* chptr)
       free_ban(link);
     }
     chptr->banlist = NULL;
+    ban_index_free(chptr);
 
     /* Immediately destruct empty -A channels if not using apass. */
     if (!feature_bool(FEAT_OPLEVELS))
@@ -330,6 +346,9 @@ int destruct_channel(struct Channel* chptr)
     next = ban->next;
     free_ban(ban);
   }
+  ban_index_free(chptr);
+  list_forget_channel(chptr);
+  server_burst_forget_channel(chptr);
   if (chptr->prev)
     chptr->prev->next = chptr->next;
   else
@@ -363,55 +382,118 @@ struct Membership* find_channel_member(struct Client* cptr, struct Channel* chpt
   return (member && !IsZombie(member)) ? member : 0;
 }
 
-/** Searches for a ban from a ban list that matches a user.
- * @param[in] cptr The client to test.
- * @param[in] banlist The list of bans to test.
- * @return Pointer to a matching ban, or NULL if none exit.
+/** Names of a user that are compared against bans. */
+struct BanIdent {
+  unsigned int bi_gen;                  /**< banIdentGen when filled in */
+  const char  *bi_althost;              /**< Alternate host, or NULL */
+  char         bi_nu[NICKLEN + USERLEN + 2]; /**< nick!user */
+  char         bi_iphost[SOCKIPLEN + 1];     /**< Text form of IP address */
+  char         bi_acchost[HOSTLEN + 1];      /**< account.hidden-host */
+};
+
+/** Current generation of BanIdent contents; zero is never valid. */
+static unsigned int banIdentGen = 1;
+
+/** Make every user's ban names be built again, because
+ * FEAT_HIDDEN_HOST changed.
  */
-struct Ban *find_ban(struct Client *cptr, struct Ban *banlist)
+void ban_ident_flush(void)
 {
-  char        nu[NICKLEN + USERLEN + 2];
-  char        tmphost[HOSTLEN + 1];
-  char        iphost[SOCKIPLEN + 1];
-  char       *hostmask;
-  char       *sr;
-  struct Ban *found;
+  if (++banIdentGen == 0)
+    ++banIdentGen;
+}
+
+/** Make a user's ban names be built again, because the user's nick,
+ * host or account changed.
+ * @param[in] cptr User whose names changed.
+ */
+void ban_ident_invalidate(struct Client *cptr)
+{
+  if (cli_user(cptr) && cli_user(cptr)->banident)
+    cli_user(cptr)->banident->bi_gen = 0;
+}
+
+/** Get the names of a user that are compared against bans, building
+ * them if they are out of date.
+ * @param[in] cptr User to look up.
+ * @return Names of the user.
+ */
+static const struct BanIdent *ban_ident(struct Client *cptr)
+{
+  struct User *user = cli_user(cptr);
+  struct BanIdent *bi = user->banident;
+
+  if (bi && bi->bi_gen == banIdentGen)
+    return bi;
+  if (!bi)
+    bi = user->banident = (struct BanIdent*) MyMalloc(sizeof(*bi));
 
   /* Build nick!user and alternate host names. */
-  ircd_snprintf(0, nu, sizeof(nu), "%s!%s",
-                cli_name(cptr), cli_user(cptr)->username);
-  ircd_ntoa_r(iphost, &cli_ip(cptr));
+  ircd_snprintf(0, bi->bi_nu, sizeof(bi->bi_nu), "%s!%s",
+                cli_name(cptr), user->username);
+  ircd_ntoa_r(bi->bi_iphost, &cli_ip(cptr));
   if (!IsAccount(cptr))
-    sr = NULL;
+    bi->bi_althost = NULL;
   else if (HasHiddenHost(cptr))
-    sr = cli_user(cptr)->realhost;
+    bi->bi_althost = user->realhost;
   else
   {
-    ircd_snprintf(0, tmphost, HOSTLEN, "%s.%s",
-                  cli_user(cptr)->account, feature_str(FEAT_HIDDEN_HOST));
-    sr = tmphost;
+    ircd_snprintf(0, bi->bi_acchost, HOSTLEN, "%s.%s",
+                  user->account, feature_str(FEAT_HIDDEN_HOST));
+    bi->bi_althost = bi->bi_acchost;
   }
+  bi->bi_gen = banIdentGen;
+  return bi;
+}
+
+/** Check whether one ban matches a user.
+ * @param[in] ban Ban to check.
+ * @param[in] cptr User to check.
+ * @param[in] bi Names of \a cptr from ban_ident().
+ * @return Non-zero if the ban matches.
+ */
+static int ban_matches(struct Ban *ban, struct Client *cptr,
+                       const struct BanIdent *bi)
+{
+  char *hostmask;
+  int res;
+
+  /* Compare nick!user portion of ban. */
+  ban->banstr[ban->nu_len] = '\0';
+  res = match(ban->banstr, bi->bi_nu);
+  ban->banstr[ban->nu_len] = '@';
+  if (res)
+    return 0;
+  /* Compare host portion of ban. */
+  hostmask = ban->banstr + ban->nu_len + 1;
+  return ((ban->flags & BAN_IPMASK)
+          && ipmask_check(&cli_ip(cptr), &ban->address, ban->addrbits))
+    || !match(hostmask, cli_user(cptr)->host)
+    || !match(hostmask, bi->bi_iphost)
+    || (bi->bi_althost && !match(hostmask, bi->bi_althost));
+}
+
+/** Searches for a ban from a ban list that matches a user.
+ * @param[in] cptr The client to test.
+ * @param[in] banlist The list of bans to test.
+ * @return Pointer to a matching ban, or NULL if none exit.
+ */
+struct Ban *find_ban(struct Client *cptr, struct Ban *banlist)
+{
+  const struct BanIdent *bi;
+  struct Ban *found;
+
+  if (!banlist)
+    return NULL;
+  bi = ban_ident(cptr);
 
   /* Walk through ban list. */
   for (found = NULL; banlist; banlist = banlist->next) {
-    int res;
     /* If we have found a positive ban already, only consider exceptions. */
     if (found && !(banlist->flags & BAN_EXCEPTION))
       continue;
-    /* Compare nick!user portion of ban. */
-    banlist->banstr[banlist->nu_len] = '\0';
-    res = match(banlist->banstr, nu);
-    banlist->banstr[banlist->nu_len] = '@';
-    if (res)
+    if (!ban_matches(banlist, cptr, bi))
       continue;
-    /* Compare host portion of ban. */
-    hostmask = banlist->banstr + banlist->nu_len + 1;
-    if (!((banlist->flags & BAN_IPMASK)
-         && ipmask_check(&cli_ip(cptr), &banlist->address, banlist->addrbits))
-        && match(hostmask, cli_user(cptr)->host)
-        && match(hostmask, iphost)
-        && !(sr && !match(hostmask, sr)))
-        continue;
     /* If an exception matches, no ban can match. */
     if (banlist->flags & BAN_EXCEPTION)
       return NULL;
@@ -421,6 +503,125 @@ struct Ban *find_ban(struct Client *cptr, struct Ban *banlist)
   return found;
 }
 
+/** Number of bans at which a channel's ban list is compiled. */
+#define BAN_INDEX_MIN 16
+
+/** Compiled form of a channel's ban list. */
+struct BanIndex {
+  unsigned int     bx_epoch;    /**< Channel::ban_epoch when compiled */
+  int              bx_linear;   /**< Too few bans to be worth indexing */
+  struct MaskIndex bx_bans;     /**< Positive bans */
+  struct MaskIndex bx_excepts;  /**< Exceptions */
+};
+
+/** User being compared against a compiled ban list. */
+struct BanCheck {
+  struct Client         *bc_cptr; /**< User to check */
+  const struct BanIdent *bc_bi;   /**< Names of bc_cptr */
+};
+
+/** MaskIndexCheck callback for compiled ban lists.
+ * @param[in] data Ban from the index.
+ * @param[in] ctx BanCheck for the user.
+ * @return Non-zero if the ban matches.
+ */
+static int ban_index_check(void *data, void *ctx)
+{
+  struct BanCheck *bc = ctx;
+
+  return ban_matches(data, bc->bc_cptr, bc->bc_bi);
+}
+
+/** Free a channel's compiled ban list.
+ * @param[in] chptr Channel whose ban list was compiled.
+ */
+static void ban_index_free(struct Channel *chptr)
+{
+  if (chptr->ban_index) {
+    mask_index_clear(&chptr->ban_index->bx_bans);
+    mask_index_clear(&chptr->ban_index->bx_excepts);
+    MyFree(chptr->ban_index);
+    chptr->ban_index = NULL;
+  }
+}
+
+/** Compile a channel's ban list if it changed since it was last
+ * compiled.  IP masks without wildcards go into the prefix trie of a
+ * MaskIndex; other host masks are indexed by name where possible.
+ * The first ban in the list gets the highest order, so the index
+ * finds the same ban as find_ban().
+ * @param[in] chptr Channel to compile.
+ * @return Compiled ban list.
+ */
+static struct BanIndex *ban_index_get(struct Channel *chptr)
+{
+  struct BanIndex *bx = chptr->ban_index;
+  struct Ban *ban;
+  const char *host;
+  unsigned long order;
+
+  if (bx && bx->bx_epoch == chptr->ban_epoch)
+    return bx;
+  ban_index_free(chptr);
+  bx = chptr->ban_index = (struct BanIndex*) MyCalloc(1, sizeof(*bx));
+  bx->bx_epoch = chptr->ban_epoch;
+
+  for (order = 0, ban = chptr->banlist; ban; ban = ban->next)
+    order++;
+  if (order < BAN_INDEX_MIN) {
+    bx->bx_linear = 1;
+    return bx;
+  }
+
+  for (ban = chptr->banlist; ban; ban = ban->next, order--) {
+    host = (ban->banstr[ban->nu_len] == '@') ?
+      ban->banstr + ban->nu_len + 1 : NULL;
+    if (host && (ban->flags & BAN_IPMASK) && !strpbrk(host, "*?\\"))
+      mask_index_add((ban->flags & BAN_EXCEPTION) ? &bx->bx_excepts
+                     : &bx->bx_bans, NULL, &ban->address, ban->addrbits,
+                     ban, order);
+    else
+      mask_index_add((ban->flags & BAN_EXCEPTION) ? &bx->bx_excepts
+                     : &bx->bx_bans, host, NULL, 0, ban, order);
+  }
+  return bx;
+}
+
+/** Searches for a ban on a channel that matches a user.
+ * Long ban lists are compiled into an index the first time they are
+ * searched after a change.
+ * @param[in] cptr The client to test.
+ * @param[in] chptr The channel whose bans to test.
+ * @return Pointer to a matching ban, or NULL if none exist.
+ */
+struct Ban *find_channel_ban(struct Client *cptr, struct Channel *chptr)
+{
+  struct BanIndex *bx;
+  struct BanCheck bc;
+  const char *hosts[3];
+  unsigned int nhosts;
+
+  if (!chptr->banlist)
+    return NULL;
+  bx = ban_index_get(chptr);
+  if (bx->bx_linear)
+    return find_ban(cptr, chptr->banlist);
+
+  bc.bc_cptr = cptr;
+  bc.bc_bi = ban_ident(cptr);
+  nhosts = 0;
+  hosts[nhosts++] = cli_user(cptr)->host;
+  hosts[nhosts++] = bc.bc_bi->bi_iphost;
+  if (bc.bc_bi->bi_althost)
+    hosts[nhosts++] = bc.bc_bi->bi_althost;
+
+  if (mask_index_find_hosts(&bx->bx_excepts, hosts, nhosts, &cli_ip(cptr),
+                            ban_index_check, &bc))
+    return NULL;
+  return mask_index_find_hosts(&bx->bx_bans, hosts, nhosts, &cli_ip(cptr),
+                               ban_index_check, &bc);
+}
+
 /**
  * This function returns true if the user is banned on the said channel.
  * This function will check the ban cache if applicable, otherwise will
@@ -435,7 +636,7 @@ static int is_banned(struct Membership* member)
     return IsBanned(member);
 
   SetBanValid(member);
-  if (find_ban(member->user, member->channel->banlist)) {
+  if (find_channel_ban(member->user, member->channel)) {
     SetBanned(member);
     return 1;
   } else {
@@ -490,7 +691,9 @@ void add_user_to_channel(struct Channel* chptr, struct Client* who,
     if (chptr->destruct_event)
       remove_destruct_event(chptr);
     ++chptr->users;
+    list_size_channel(chptr);
     ++((cli_user(who))->joined);
+    member_hash_link(member);
   }
 }
 
@@ -505,6 +708,7 @@ static int remove_member_from_channel(struct Membership* member)
   struct Channel* chptr;
   assert(0 != member);
   chptr = member->channel;
+  member_hash_unlink(member);
   /*
    * unlink channel member list
    */
@@ -760,7 +964,7 @@ int client_can_send_to_channel(struct Client *cptr, struct Channel *chptr, int r
     return 0;
 
   /* Finally, you cannot speak if you are banned. */
-  return !find_ban(cptr, chptr->banlist);
+  return !find_channel_ban(cptr, chptr);
 }
 
 /** Returns the name of a channel that prevents the user from changing nick.
@@ -987,8 +1191,11 @@ void send_channel_modes(struct Client *cptr, struct Channel *chptr)
           if (OpLevel(member) < MAXOPLEVEL)
             send_oplevels = 1;
 	}
-	/* Only handle the members with the flags that we are interested in. */
-        if ((member->status & CHFL_VOICED_OR_OPPED) == current_flags[flag_cnt])
+	/* Only handle the members with the flags that we are interested in,
+	 * and leave out users whose NICK is still held back by a burst
+	 * (their JOIN is held back along with it). */
+        if ((member->status & CHFL_VOICED_OR_OPPED) == current_flags[flag_cnt]
+            && (!cli_burst(cptr) || server_burst_sent(cptr, member->user)))
 	{
 	  if (msgq_bufleft(mb) < NUMNICKLEN + 3 + MAXOPLEVELDIGITS)
 	    /* The 3 + MAXOPLEVELDIGITS is a possible ",:v999". */
@@ -1275,6 +1482,7 @@ struct Channel *get_channel(struct Client *cptr, char *chname, ChannelGetType fl
     chptr->creationtime = MyUser(cptr) ? TStime() : (time_t) 0;
     GlobalChannelList = chptr;
     hAddChannel(chptr);
+    list_size_channel(chptr);
   }
   return chptr;
 }
@@ -2170,7 +2378,7 @@ modebuf_extract(struct ModeBuf *mbuf, char *buf)
 /** Simple function to invalidate a channel's ban cache.
  *
  * This function marks all members of the channel as being neither
- * banned nor banned.
+ * banned nor banned, and makes the ban list be compiled again.
  *
  * @param chan	The channel to operate on.
  */
@@ -2179,6 +2387,7 @@ mode_ban_invalidate(struct Channel *chan)
 {
   struct Membership *member;
 
+  chan->ban_epoch++;
   for (member = chan->members; member; member = member->next_member)
     ClearBanValid(member);
 }
@@ -27,6 +27,7 @@
 #include "ircd_chattr.h"
 #include "ircd_features.h"
 #include "ircd_log.h"
+#include "ircd_string.h"
 #include "send.h"
 #include "sys.h"       /* MIN */
 
@@ -343,6 +344,7 @@ unsigned int dbuf_getmsg(struct DBuf *dyn, char *buf, unsigned int length)
   struct DBufBuffer *db;
   char *start;
   char *end;
+  const char *eol;
   unsigned int count;
   unsigned int copied = 0;
 
@@ -367,8 +369,10 @@ unsigned int dbuf_getmsg(struct DBuf *dyn, char *buf, unsigned int length)
   while (length > 0)
   {
     end = IRCD_MIN(db->end, (start + length));
-    while (start < end && !IsEol(*start))
-      *buf++ = *start++;
+    eol = ircd_find_eol(start, end);
+    memcpy(buf, start, eol - start);
+    buf += eol - start;
+    start = (char *) eol;
 
     count = start - db->start;
     if (start < end)
@@ -317,14 +317,15 @@ engine_loop(struct Generators* gen)
     polls_used = ioctl(devpoll_fd, DP_POLL, &dopoll);
 
     CurrentTime = time(0); /* set current time... */
+    event_pass_start(); /* and start timing the pass */
 
     if (polls_used < 0) {
       if (errno != EINTR) { /* ignore interrupts */
 	/* Log the poll error */
 	log_write(LS_SOCKET, L_ERROR, 0, "ioctl(DP_POLL) error: %m");
 	if (!errors++)
-	  timer_add(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
-		    ERROR_EXPIRE_TIME);
+	  timer_add_named(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
+			  ERROR_EXPIRE_TIME);
 	else if (errors > DEVPOLL_ERROR_THRESHOLD) /* too many errors... */
 	  server_restart("too many /dev/poll errors");
       }
@@ -448,6 +449,7 @@ engine_loop(struct Generators* gen)
     }
 
     timer_run(); /* execute any pending timers */
+    tick_run(); /* and any work deferred to the end of the pass */
   }
 }
 
@@ -182,11 +182,17 @@ engine_set_events(struct Socket *sock, unsigned new_events)
 static void
 engine_delete(struct Socket *sock)
 {
+  struct epoll_event evt;
   int ii;
 
   assert(0 != sock);
   Debug((DEBUG_ENGINE, "epoll: Deleting socket %d [%p], state %s",
 	 s_fd(sock), sock, state_to_name(s_state(sock))));
+  /* Closing a descriptor removes it from the epoll set, but listening
+   * sockets may stay open for acceptor threads (see accept_pool.c).
+   */
+  if (s_state(sock) == SS_LISTENING)
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s_fd(sock), &evt);
   /* Drop any unprocessed events citing this socket. */
   for (ii = 0; ii < events_used; ii++) {
     if (events[ii].data.ptr == sock) {
@@ -220,13 +226,14 @@ engine_loop(struct Generators *gen)
            CurrentTime, wait));
     events_used = epoll_wait(epoll_fd, events, events_count, wait);
     CurrentTime = time(0);
+    event_pass_start();
 
     if (events_used < 0) {
       if (errno != EINTR) {
         log_write(LS_SOCKET, L_ERROR, 0, "epoll() error: %m");
         if (!errors++)
-          timer_add(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
-                    ERROR_EXPIRE_TIME);
+          timer_add_named(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
+                          ERROR_EXPIRE_TIME);
         else if (errors > EPOLL_ERROR_THRESHOLD)
           server_restart("too many epoll errors");
       }
@@ -280,6 +287,7 @@ engine_loop(struct Generators *gen)
       gen_ref_dec(sock);
     }
     timer_run();
+    tick_run();
   }
   MyFree(events);
 }
@@ -290,6 +290,12 @@ engine_delete(struct Socket* sock)
 
   sockList[s_fd(sock)] = 0;
 
+  /* Closing a descriptor removes its filters, but listening sockets
+   * may stay open for acceptor threads (see accept_pool.c).
+   */
+  if (s_state(sock) == SS_LISTENING)
+    set_or_clear(sock, state_to_events(s_state(sock), s_events(sock)), 0);
+
   /* Drop any unprocessed events citing this socket. */
   for (ii = 0; ii < events_used; ii++) {
     if (events[ii].ident == s_fd(sock)) {
@@ -334,14 +340,15 @@ engine_loop(struct Generators* gen)
                          wait.tv_sec < 0 ? 0 : &wait);
 
     CurrentTime = time(0); /* set current time... */
+    event_pass_start(); /* and start timing the pass */
 
     if (events_used < 0) {
       if (errno != EINTR) { /* ignore kevent interrupts */
 	/* Log the kqueue error */
 	log_write(LS_SOCKET, L_ERROR, 0, "kevent() error: %m");
 	if (!errors++)
-	  timer_add(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
-		    ERROR_EXPIRE_TIME);
+	  timer_add_named(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
+			  ERROR_EXPIRE_TIME);
 	else if (errors > KQUEUE_ERROR_THRESHOLD) /* too many errors... */
 	  server_restart("too many kevent errors");
       }
@@ -433,6 +440,7 @@ engine_loop(struct Generators* gen)
     }
 
     timer_run(); /* execute any pending timers */
+    tick_run(); /* and any work deferred to the end of the pass */
   }
 }
 
@@ -291,14 +291,15 @@ engine_loop(struct Generators* gen)
     nfds = poll(pollfdList, poll_count, wait);
 
     CurrentTime = time(0); /* set current time... */
+    event_pass_start(); /* and start timing the pass */
 
     if (nfds < 0) {
       if (errno != EINTR) { /* ignore poll interrupts */
 	/* Log the poll error */
 	log_write(LS_SOCKET, L_ERROR, 0, "poll() error: %m");
 	if (!errors++)
-	  timer_add(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
-		    ERROR_EXPIRE_TIME);
+	  timer_add_named(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
+			  ERROR_EXPIRE_TIME);
 	else if (errors > POLL_ERROR_THRESHOLD) /* too many errors... */
 	  server_restart("too many poll errors");
       }
@@ -423,6 +424,7 @@ engine_loop(struct Generators* gen)
     }
 
     timer_run(); /* execute any pending timers */
+    tick_run(); /* and any work deferred to the end of the pass */
   }
 }
 
@@ -284,14 +284,15 @@ engine_loop(struct Generators* gen)
 		  wait.tv_sec < 0 ? 0 : &wait);
 
     CurrentTime = time(0); /* set current time... */
+    event_pass_start(); /* and start timing the pass */
 
     if (nfds < 0) {
       if (errno != EINTR) { /* ignore select interrupts */
 	/* Log the select error */
 	log_write(LS_SOCKET, L_ERROR, 0, "select() error: %m");
 	if (!errors++)
-	  timer_add(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
-		    ERROR_EXPIRE_TIME);
+	  timer_add_named(timer_init(&clear_error), error_clear, 0, TT_PERIODIC,
+			  ERROR_EXPIRE_TIME);
 	else if (errors > SELECT_ERROR_THRESHOLD) /* too many errors... */
 	  server_restart("too many select errors");
       }
@@ -407,6 +408,7 @@ engine_loop(struct Generators* gen)
     }
 
     timer_run(); /* execute any pending timers */
+    tick_run(); /* and any work deferred to the end of the pass */
   }
 }
 
@@ -28,11 +28,13 @@
 #include "client.h"
 #include "ircd.h"
 #include "ircd_alloc.h"
+#include "ircd_events.h"
 #include "ircd_features.h"
 #include "ircd_log.h"
 #include "ircd_reply.h"
 #include "ircd_snprintf.h"
 #include "ircd_string.h"
+#include "mask_index.h"
 #include "match.h"
 #include "numeric.h"
 #include "s_bsd.h"
@@ -42,6 +44,7 @@
 #include "send.h"
 #include "struct.h"
 #include "sys.h"
+#include "user_index.h"
 #include "msg.h"
 #include "numnicks.h"
 #include "numeric.h"
@@ -70,6 +73,20 @@ struct Gline* GlobalGlineList  = 0;
 /** List of BadChan G-lines. */
 struct Gline* BadChanGlineList = 0;
 
+/** Index of #GlobalGlineList by host and IP mask. */
+static struct MaskIndex GlineIndex;
+/** Order given to the most recently indexed G-line. */
+static unsigned long GlineSerial;
+
+/** G-lines waiting for gline_enforce(). */
+static struct {
+  struct Gline **glines;	/**< Queued G-lines (NULL if freed). */
+  unsigned int count;		/**< Number of entries used. */
+  unsigned int size;		/**< Number of entries allocated. */
+} GlinePending;
+/** Runs gline_enforce() at the end of each event loop pass. */
+static struct Tick GlineTick;
+
 /** Iterate through \a list of G-lines.  Use this like a for loop,
  * i.e., follow it with braces and use whatever you passed as \a gl
  * as a single G-line to be acted upon.
@@ -131,6 +148,13 @@ canon_userhost(char *userhost, char **user_p, char **host_p, char *def_user)
   }
 }
 
+/** Address to index user G-line \a gline under, or NULL if it is not an IP mask. */
+#define gline_index_addr(gline) \
+  (GlineIsIpMask(gline) ? &(gline)->gl_addr : NULL)
+/** Prefix length to index user G-line \a gline under. */
+#define gline_index_bits(gline) \
+  (GlineIsIpMask(gline) ? (gline)->gl_bits : 0)
+
 /** Create a Gline structure.
  * @param[in] user User part of mask.
  * @param[in] host Host part of mask (NULL if not applicable).
@@ -182,76 +206,233 @@ make_gline(char *user, char *host, char *reason, time_t expire, time_t lastmod,
     if (GlobalGlineList)
       GlobalGlineList->gl_prev_p = &gline->gl_next;
     GlobalGlineList = gline;
+
+    /* newest G-line gets the highest order, like the head of the list */
+    mask_index_add(&GlineIndex, gline->gl_host, gline_index_addr(gline),
+                   gline_index_bits(gline), gline, ++GlineSerial);
   }
 
   return gline;
 }
 
-/** Check local clients against a new G-line.
- * If the G-line is inactive or a badchan, return immediately.
- * Otherwise, if any users match it, disconnect them.
- * @param[in] cptr Peer connect that sent the G-line.
- * @param[in] sptr Client that originated the G-line.
- * @param[in] gline New G-line to check.
- * @return Zero, unless \a sptr G-lined himself, in which case CPTR_KILLED.
+/** Client details compared against G-lines by gline_check(). */
+struct GlineMatch {
+  struct Client *cptr;		/**< Client being checked. */
+  const char   *host;		/**< Host name to match host G-lines against. */
+  unsigned int	flags;		/**< GLINE_GLOBAL and/or GLINE_LASTMOD. */
+};
+
+/** Check whether a user G-line applies to a client.
+ * Expired G-lines are deactivated as gliter() would do; records past
+ * their lifetime are skipped and left for the next gliter() pass to
+ * free, since freeing one would modify #GlineIndex under our feet.
+ * @param[in] data G-line to check.
+ * @param[in] ctx Client details (struct GlineMatch).
+ * @return Non-zero if the G-line is active and matches.
  */
 static int
-do_gline(struct Client *cptr, struct Client *sptr, struct Gline *gline)
+gline_check(void *data, void *ctx)
 {
-  struct Client *acptr;
-  int fd, retval = 0, tval;
+  struct Gline *gline = data;
+  struct GlineMatch *gm = ctx;
+  struct Client *cptr = gm->cptr;
 
-  if (feature_bool(FEAT_DISABLE_GLINES))
-    return 0; /* G-lines are disabled */
+  if (gline->gl_lifetime <= TStime() ||
+      (gline->gl_expire < TStime() - ONE_MONTH &&
+       gline->gl_lastmod < TStime() - ONE_MONTH))
+    return 0;
+  if (gline->gl_expire <= TStime()) {
+    gline->gl_flags &= ~GLINE_ACTIVE;
+    gline->gl_state = GLOCAL_GLOBAL;
+  }
 
-  if (GlineIsBadChan(gline)) /* no action taken on badchan glines */
+  if ((gm->flags & GLINE_GLOBAL && gline->gl_flags & GLINE_LOCAL) ||
+      (gm->flags & GLINE_LASTMOD && !gline->gl_lastmod))
     return 0;
-  if (!GlineIsActive(gline)) /* no action taken on inactive glines */
+
+  if (GlineIsRealName(gline)) {
+    Debug((DEBUG_DEBUG,"realname gline: '%s' '%s'",gline->gl_user,cli_info(cptr)));
+    if (match(gline->gl_user+2, cli_info(cptr)) != 0)
+      return 0;
+  }
+  else {
+    if (match(gline->gl_user, (cli_user(cptr))->username) != 0)
+      return 0;
+
+    if (GlineIsIpMask(gline)) {
+      if (!ipmask_check(&cli_ip(cptr), &gline->gl_addr, gline->gl_bits))
+        return 0;
+    }
+    else {
+      if (match(gline->gl_host, gm->host) != 0)
+        return 0;
+    }
+  }
+  return GlineIsActive(gline);
+}
+
+/** Start a search of the user indexes for users a G-line could hit.
+ * @param[in] gline User G-line.
+ * @param[out] uc Cursor to initialize.
+ * @return Non-zero if the search was started, zero if the G-line's
+ * mask cannot be searched for.
+ */
+static int
+gline_seek(struct Gline *gline, struct UserIndexCursor *uc)
+{
+  if (GlineIsRealName(gline) || !gline->gl_host)
     return 0;
+  if (GlineIsIpMask(gline)) {
+    user_index_ip_seek(uc, &gline->gl_addr, gline->gl_bits);
+    return 1;
+  }
+  return user_index_host_seek(uc, gline->gl_host, USER_INDEX_REALHOST) != 0;
+}
 
-  for (fd = HighestFd; fd >= 0; --fd) {
-    /*
-     * get the users!
-     */
-    if ((acptr = LocalClientArray[fd])) {
-      if (!cli_user(acptr))
-	continue;
+/** Compare two client pointers for qsort().
+ * @param[in] a_ Pointer to first client pointer.
+ * @param[in] b_ Pointer to second client pointer.
+ * @return Less than, equal to or greater than zero.
+ */
+static int
+gline_cmp_client(const void *a_, const void *b_)
+{
+  unsigned long a = (unsigned long) *(struct Client * const *)a_;
+  unsigned long b = (unsigned long) *(struct Client * const *)b_;
 
-      if (GlineIsRealName(gline)) { /* Realname Gline */
-	Debug((DEBUG_DEBUG,"Realname Gline: %s %s",(cli_info(acptr)),
-					gline->gl_user+2));
-        if (match(gline->gl_user+2, cli_info(acptr)) != 0)
-            continue;
-        Debug((DEBUG_DEBUG,"Matched!"));
-      } else { /* Host/IP gline */
-        if (match(gline->gl_user, (cli_user(acptr))->username) != 0)
-          continue;
-
-        if (GlineIsIpMask(gline)) {
-          if (!ipmask_check(&cli_ip(acptr), &gline->gl_addr, gline->gl_bits))
-            continue;
-        }
-        else {
-          if (match(gline->gl_host, cli_sockhost(acptr)) != 0)
-            continue;
-        }
-      }
+  return (a > b) - (a < b);
+}
+
+/** Disconnect a local client if it matches a queued G-line.
+ * @param[in] mi Index of queued G-lines.
+ * @param[in] acptr Local client to check.
+ */
+static void
+gline_enforce_client(const struct MaskIndex *mi, struct Client *acptr)
+{
+  struct GlineMatch gm;
+  struct Gline *gline;
+
+  gm.cptr = acptr;
+  gm.host = cli_sockhost(acptr);
+  gm.flags = 0;
+  if (!(gline = mask_index_find(mi, gm.host, &cli_ip(acptr),
+                                gline_check, &gm)))
+    return;
+
+  /* ok, here's one that got G-lined */
+  send_reply(acptr, SND_EXPLICIT | ERR_YOUREBANNEDCREEP, ":%s",
+             gline->gl_reason);
+
+  /* let the ops know about it */
+  sendto_opmask_butone(0, SNO_GLINE, "G-line active for %s",
+                       get_client_name(acptr, SHOW_IP));
+
+  /* and get rid of him */
+  exit_client_msg(acptr, acptr, &me, "G-lined (%s)", gline->gl_reason);
+}
 
-      /* ok, here's one that got G-lined */
-      send_reply(acptr, SND_EXPLICIT | ERR_YOUREBANNEDCREEP, ":%s",
-      	   gline->gl_reason);
+/** Disconnect local clients that match G-lines queued by do_gline().
+ * The queued G-lines are put in a temporary index.  When every one
+ * of them names an IP mask or a host mask with a literal end, the
+ * users they could hit are looked up in the user indexes; otherwise
+ * one pass over the local clients enforces all of them, however many
+ * arrived since the last pass.
+ */
+static void
+gline_enforce(void)
+{
+  struct UserIndexCursor uc;
+  struct MaskIndex mi;
+  struct Client **found = 0;
+  struct Client *acptr;
+  struct Gline *gline;
+  unsigned int nfound = 0;
+  unsigned int size = 0;
+  unsigned int ii;
+  int indexed = 1;
+  int fd;
 
-      /* let the ops know about it */
-      sendto_opmask_butone(0, SNO_GLINE, "G-line active for %s",
-                           get_client_name(acptr, SHOW_IP));
+  if (!GlinePending.count)
+    return;
 
-      /* and get rid of him */
-      if ((tval = exit_client_msg(cptr, acptr, &me, "G-lined (%s)",
-          gline->gl_reason)))
-        retval = tval; /* retain killed status */
+  memset(&mi, 0, sizeof(mi));
+  for (ii = 0; ii < GlinePending.count; ii++) {
+    if (!(gline = GlinePending.glines[ii]))
+      continue; /* freed while it was queued */
+    gline->gl_flags &= ~GLINE_PENDING;
+    mask_index_add(&mi, gline->gl_host, gline_index_addr(gline),
+                   gline_index_bits(gline), gline, ii + 1);
+    if (!indexed || !(indexed = gline_seek(gline, &uc)))
+      continue;
+    while ((acptr = user_index_next(&uc))) {
+      if (!MyConnect(acptr))
+        continue;
+      if (nfound == size) {
+        size = size ? size * 2 : 64;
+        found = MyRealloc(found, size * sizeof(*found));
+      }
+      found[nfound++] = acptr;
+    }
+  }
+  GlinePending.count = 0;
+
+  if (feature_bool(FEAT_DISABLE_GLINES)) /* disabled while queued */
+    nfound = 0;
+  else if (!indexed) {
+    for (fd = HighestFd; fd >= 0; --fd) {
+      /*
+       * get the users!
+       */
+      if ((acptr = LocalClientArray[fd]) && cli_user(acptr))
+        gline_enforce_client(&mi, acptr);
     }
+    nfound = 0;
   }
-  return retval;
+
+  /* A user may be found by more than one G-line; check them once */
+  if (nfound)
+    qsort(found, nfound, sizeof(*found), gline_cmp_client);
+  for (ii = 0; ii < nfound; ii++)
+    if (!ii || found[ii] != found[ii - 1])
+      gline_enforce_client(&mi, found[ii]);
+
+  if (found)
+    MyFree(found);
+  mask_index_clear(&mi);
+}
+
+/** Queue a new or newly active G-line to be checked against local clients.
+ * If the G-line is inactive or a badchan, return immediately.
+ * Otherwise it is enforced by gline_enforce() at the end of the
+ * current event loop pass, together with any other G-lines that
+ * arrive before then.
+ * @param[in] gline New G-line to check.
+ * @return Zero.
+ */
+static int
+do_gline(struct Gline *gline)
+{
+  if (feature_bool(FEAT_DISABLE_GLINES))
+    return 0; /* G-lines are disabled */
+
+  if (GlineIsBadChan(gline)) /* no action taken on badchan glines */
+    return 0;
+  if (!GlineIsActive(gline)) /* no action taken on inactive glines */
+    return 0;
+  if (gline->gl_flags & GLINE_PENDING) /* already queued */
+    return 0;
+
+  if (GlinePending.count == GlinePending.size) {
+    GlinePending.size = GlinePending.size ? GlinePending.size * 2 : 16;
+    GlinePending.glines = (struct Gline **)
+      MyRealloc(GlinePending.glines,
+                GlinePending.size * sizeof(*GlinePending.glines));
+  }
+  GlinePending.glines[GlinePending.count++] = gline;
+  gline->gl_flags |= GLINE_PENDING;
+
+  return 0;
 }
 
 /**
@@ -350,37 +531,43 @@ gline_propagate(struct Client *cptr, struct Client *sptr, struct Gline *gline)
   return 0;
 }
 
-/** Count number of users who match \a mask.
- * @param[in] mask user\@host or user\@ip mask to check.
+/** Count number of users who match a user\@host mask.
+ * Users are matched the way gline_check() would match them: by
+ * address when \a host is an IP mask, and by real hostname
+ * otherwise.  Both kinds of mask are looked up in the user indexes
+ * when they can be.
+ * @param[in] user Username mask to check.
+ * @param[in] host Hostname or IP mask to check.
  * @param[in] flags Bitmask possibly containing the value GLINE_LOCAL, to limit searches to this server.
  * @return Count of matching users.
  */
 static int
-count_users(char *mask, int flags)
+count_users(const char *user, const char *host, int flags)
 {
+  struct UserIndexCursor uc;
   struct irc_in_addr ipmask;
   struct Client *acptr;
   int count = 0;
   int ipmask_valid;
-  char namebuf[USERLEN + HOSTLEN + 2];
-  char ipbuf[USERLEN + SOCKIPLEN + 2];
+  int indexed;
   unsigned char ipmask_len;
 
-  ipmask_valid = ipmask_parse(mask, &ipmask, &ipmask_len);
-  for (acptr = GlobalClientList; acptr; acptr = cli_next(acptr)) {
+  if ((ipmask_valid = ipmask_parse(host, &ipmask, &ipmask_len)))
+    user_index_ip_seek(&uc, &ipmask, ipmask_len);
+  indexed = ipmask_valid
+    || user_index_host_seek(&uc, host, USER_INDEX_REALHOST);
+
+  for (acptr = indexed ? user_index_next(&uc) : GlobalClientList; acptr;
+       acptr = indexed ? user_index_next(&uc) : cli_next(acptr)) {
     if (!IsUser(acptr))
       continue;
     if ((flags & GLINE_LOCAL) && !MyConnect(acptr))
       continue;
+    if (match(user, cli_user(acptr)->username))
+      continue;
 
-    ircd_snprintf(0, namebuf, sizeof(namebuf), "%s@%s",
-		  cli_user(acptr)->username, cli_user(acptr)->realhost);
-    ircd_snprintf(0, ipbuf, sizeof(ipbuf), "%s@%s", cli_user(acptr)->username,
-		  ircd_ntoa(&cli_ip(acptr)));
-
-    if (!match(mask, namebuf)
-        || !match(mask, ipbuf)
-        || (ipmask_valid && ipmask_check(&cli_ip(acptr), &ipmask, ipmask_len)))
+    if (ipmask_valid ? ipmask_check(&cli_ip(acptr), &ipmask, ipmask_len)
+        : !match(host, cli_user(acptr)->realhost))
       count++;
   }
 
@@ -427,7 +614,7 @@ count_realnames(const char *mask)
  * @param[in] lastmod Last modification time of G-line.
  * @param[in] lifetime Lifetime of G-line.
  * @param[in] flags Bitwise combination of GLINE_* flags.
- * @return Zero or CPTR_KILLED, depending on whether \a sptr is suicidal.
+ * @return Zero.
  */
 int
 gline_add(struct Client *cptr, struct Client *sptr, char *userhost,
@@ -499,7 +686,7 @@ gline_add(struct Client *cptr, struct Client *sptr, char *userhost,
 	break;
       }
 
-      if ((tmp = count_users(uhmask, flags)) >=
+      if ((tmp = count_users(user, host, flags)) >=
 	  feature_int(FEAT_GLINEMAXUSERCOUNT) && !(flags & GLINE_OPERFORCE))
 	return send_reply(sptr, ERR_TOOMANYUSERS, tmp);
     }
@@ -557,7 +744,7 @@ gline_add(struct Client *cptr, struct Client *sptr, char *userhost,
 
   gline_propagate(cptr, sptr, agline);
 
-  return do_gline(cptr, sptr, agline); /* knock off users if necessary */
+  return do_gline(agline); /* knock off users if necessary */
 }
 
 /** Activate a currently inactive G-line.
@@ -566,7 +753,7 @@ gline_add(struct Client *cptr, struct Client *sptr, char *userhost,
  * @param[in] gline G-line to activate.
  * @param[in] lastmod New value for last modification timestamp.
  * @param[in] flags 0 if the activation should be propagated, GLINE_LOCAL if not.
- * @return Zero, unless \a sptr had a death wish (in which case CPTR_KILLED).
+ * @return Zero.
  */
 int
 gline_activate(struct Client *cptr, struct Client *sptr, struct Gline *gline,
@@ -615,7 +802,7 @@ gline_activate(struct Client *cptr, struct Client *sptr, struct Gline *gline,
   if (!(flags & GLINE_LOCAL)) /* don't propagate local changes */
     gline_propagate(cptr, sptr, gline);
 
-  return do_gline(cptr, sptr, gline);
+  return do_gline(gline);
 }
 
 /** Deactivate a G-line.
@@ -700,7 +887,7 @@ gline_deactivate(struct Client *cptr, struct Client *sptr, struct Gline *gline,
  * @param[in] lastmod Last modification time of G-line.
  * @param[in] lifetime Lifetime of G-line.
  * @param[in] flags Bitwise combination of GLINE_* flags.
- * @return Zero or CPTR_KILLED, depending on whether \a sptr is suicidal.
+ * @return Zero.
  */
 int
 gline_modify(struct Client *cptr, struct Client *sptr, struct Gline *gline,
@@ -891,7 +1078,7 @@ gline_modify(struct Client *cptr, struct Client *sptr, struct Gline *gline,
 			  gline->gl_lifetime, gline->gl_reason);
 
   /* OK, let's do the G-line... */
-  return do_gline(cptr, sptr, gline);
+  return do_gline(gline);
 }
 
 /** Destroy a local G-line.
@@ -986,6 +1173,9 @@ gline_find(char *userhost, unsigned int flags)
 }
 
 /** Find a matching G-line for a user.
+ * Only G-lines whose host or IP mask could match are examined; when
+ * several match, the most recently added one wins, as it would at the
+ * head of #GlobalGlineList.
  * @param[in] cptr Client to compare against.
  * @param[in] flags Bitwise combination of GLINE_GLOBAL and/or
  * GLINE_LASTMOD to limit matches.
@@ -994,39 +1184,20 @@ gline_find(char *userhost, unsigned int flags)
 struct Gline *
 gline_lookup(struct Client *cptr, unsigned int flags)
 {
-  struct Gline *gline;
-  struct Gline *sgline;
-
-  gliter(GlobalGlineList, gline, sgline) {
-    if ((flags & GLINE_GLOBAL && gline->gl_flags & GLINE_LOCAL) ||
-        (flags & GLINE_LASTMOD && !gline->gl_lastmod))
-      continue;
+  struct GlineMatch gm;
 
-    if (GlineIsRealName(gline)) {
-      Debug((DEBUG_DEBUG,"realname gline: '%s' '%s'",gline->gl_user,cli_info(cptr)));
-      if (match(gline->gl_user+2, cli_info(cptr)) != 0)
-        continue;
-    }
-    else {
-      if (match(gline->gl_user, (cli_user(cptr))->username) != 0)
-        continue;
+  gm.cptr = cptr;
+  gm.host = cli_user(cptr)->realhost;
+  gm.flags = flags;
+  return mask_index_find(&GlineIndex, cli_user(cptr)->realhost,
+                         &cli_ip(cptr), gline_check, &gm);
+}
 
-      if (GlineIsIpMask(gline)) {
-        if (!ipmask_check(&cli_ip(cptr), &gline->gl_addr, gline->gl_bits))
-          continue;
-      }
-      else {
-        if (match(gline->gl_host, (cli_user(cptr))->realhost) != 0)
-          continue;
-      }
-    }
-    if (GlineIsActive(gline))
-      return gline;
-  }
-  /*
-   * No Glines matched
-   */
-  return 0;
+/** Initialize the G-line subsystem. */
+void
+gline_init(void)
+{
+  tick_add(&GlineTick, gline_enforce);
 }
 
 /** Delink and free a G-line.
@@ -1037,6 +1208,18 @@ gline_free(struct Gline *gline)
 {
   assert(0 != gline);
 
+  if (gline->gl_flags & GLINE_PENDING) {
+    unsigned int ii;
+
+    for (ii = 0; ii < GlinePending.count; ii++)
+      if (GlinePending.glines[ii] == gline)
+        GlinePending.glines[ii] = NULL;
+  }
+
+  if (!GlineIsBadChan(gline))
+    mask_index_del(&GlineIndex, gline->gl_host, gline_index_addr(gline),
+                   gline_index_bits(gline), gline);
+
   *gline->gl_prev_p = gline->gl_next; /* squeeze this gline out */
   if (gline->gl_next)
     gline->gl_next->gl_prev_p = gline->gl_prev_p;
@@ -1215,5 +1398,7 @@ gline_memory_count(size_t *gl_size)
     *gl_size += gline->gl_reason ? (strlen(gline->gl_reason) + 1) : 0;
   }
 
+  *gl_size += mask_index_memory(&GlineIndex);
+
   return gl;
 }
@@ -26,13 +26,16 @@
 #include "channel.h"
 #include "ircd_alloc.h"
 #include "ircd_chattr.h"
+#include "ircd_features.h"
 #include "ircd_log.h"
 #include "ircd_reply.h"
+#include "ircd_snprintf.h"
 #include "ircd_string.h"
 #include "ircd.h"
 #include "match.h"
 #include "msg.h"
 #include "numeric.h"
+#include "querycmds.h"
 #include "random.h"
 #include "send.h"
 #include "struct.h"
@@ -48,122 +51,384 @@
  * @brief Hash table management.
  * @version $Id$
  *
- * This file used to use some very complicated hash function.  Now it
- * uses CRC-32, but effectively remaps each input byte according to a
- * table initialized at startup.
+ * Clients and channels are kept in open-addressed tables with linear
+ * probing.  Each slot stores the full 32-bit hash value of its entry
+ * next to the entry pointer, so that probing only touches the entry
+ * itself when the stored hash matches.  Tables double in size when
+ * they pass 75% load; instead of rehashing everything at once, the
+ * entries of the old slot array are moved over a few slots at a time
+ * by subsequent insertions and removals, and lookups consult both
+ * arrays until the move is complete.
  */
 
+/** Marker stored in a slot whose entry was removed. */
+static char hash_deleted;
+/** Pointer value for a removed slot (keeps probe sequences intact). */
+#define HASH_DELETED ((void *) &hash_deleted)
+
+/** Initial (and minimum) number of slots in a table; a power of two. */
+#define HASH_MIN_SIZE     4096
+/** Number of old slots moved to the new array per insert or removal. */
+#define HASH_MIGRATE_STEP 16
+
+/** One slot of an open-addressed hash table. */
+struct HashSlot {
+  unsigned int hs_hash;       /**< full hash value of the entry */
+  void *hs_ptr;               /**< entry, NULL if empty, or HASH_DELETED */
+};
+
+/** Open-addressed, incrementally resized hash table. */
+struct HashTable {
+  const char *ht_name;        /**< name used in statistics output */
+  struct HashSlot *ht_slots;  /**< current slot array */
+  unsigned int ht_mask;       /**< number of slots in ht_slots, minus one */
+  unsigned int ht_count;      /**< live entries in ht_slots */
+  unsigned int ht_deleted;    /**< removed-entry markers in ht_slots */
+  struct HashSlot *ht_old;    /**< slot array being migrated (or NULL) */
+  unsigned int ht_oldmask;    /**< number of slots in ht_old, minus one */
+  unsigned int ht_oldcount;   /**< live entries left in ht_old */
+  unsigned int ht_oldpos;     /**< next slot of ht_old to migrate */
+  unsigned long ht_lookups;   /**< number of lookups performed */
+  unsigned long ht_probes;    /**< number of slots examined by lookups */
+  unsigned int ht_resizes;    /**< number of times the table was resized */
+};
+
+/** Iterator over the slots that may hold entries for one hash value. */
+struct HashProbe {
+  struct HashTable *hp_table; /**< table being searched */
+  struct HashSlot *hp_slots;  /**< slot array being searched */
+  unsigned int hp_mask;       /**< mask for hp_slots */
+  unsigned int hp_pos;        /**< next slot to examine */
+  unsigned int hp_hash;       /**< hash value being searched for */
+};
+
 /** Hash table for clients. */
-static struct Client *clientTable[HASHSIZE];
+static struct HashTable clientTable = { "Client" };
 /** Hash table for channels. */
-static struct Channel *channelTable[HASHSIZE];
-/** CRC-32 update table. */
-static uint32_t crc32hash[256];
+static struct HashTable channelTable = { "Channel" };
+/** Random seed for the hash function. */
+static uint32_t hash_seed;
 
-/** Initialize the map used by the hash function. */
-void init_hash(void)
+/** Allocate the slot array for a table.
+ * @param[in] size Number of slots (a power of two).
+ * @return Newly allocated, empty slot array.
+ */
+static struct HashSlot *hash_alloc_slots(unsigned int size)
 {
-  unsigned int ii, jj, rand, poly;
+  struct HashSlot *slots;
 
-  /* First calculate a normal CRC-32 table. */
-  for (ii = 0, poly = 0xedb88320; ii < 256; ii++)
-  {
-    rand = ii;
-    for (jj = 0; jj < 8; jj++)
-      rand = (rand & 1) ? poly ^ (rand >> 1) : rand >> 1;
-    crc32hash[ii] = rand;
+  slots = (struct HashSlot *) MyMalloc(size * sizeof(*slots));
+  memset(slots, 0, size * sizeof(*slots));
+  return slots;
+}
+
+/** Initialize an empty hash table.
+ * @param[in,out] ht Table to initialize.
+ */
+static void hash_table_init(struct HashTable *ht)
+{
+  ht->ht_slots = hash_alloc_slots(HASH_MIN_SIZE);
+  ht->ht_mask = HASH_MIN_SIZE - 1;
+}
+
+/** Store an entry into the first free slot of its probe sequence.
+ * @param[in] slots Slot array to store into.
+ * @param[in] mask Mask for \a slots.
+ * @param[in] hashv Hash value of the entry.
+ * @param[in] ptr Entry to store.
+ * @return Non-zero if a removed-entry marker was reused.
+ */
+static int hash_place(struct HashSlot *slots, unsigned int mask,
+                      unsigned int hashv, void *ptr)
+{
+  unsigned int pos;
+
+  for (pos = hashv & mask; slots[pos].hs_ptr && slots[pos].hs_ptr != HASH_DELETED;
+       pos = (pos + 1) & mask)
+    ;
+  slots[pos].hs_hash = hashv;
+  if (slots[pos].hs_ptr) {
+    slots[pos].hs_ptr = ptr;
+    return 1;
   }
+  slots[pos].hs_ptr = ptr;
+  return 0;
+}
 
-  /* Now reorder the hash table. */
-  for (ii = 0, rand = 0; ii < 256; ii++)
-  {
-    if (!rand)
-      rand = ircrandom();
-    poly = ii + rand % (256 - ii);
-    jj = crc32hash[ii];
-    crc32hash[ii] = crc32hash[poly];
-    crc32hash[poly] = jj;
-    rand >>= 8;
+/** Move up to \a count slots from the old slot array to the current one.
+ * @param[in,out] ht Table being migrated.
+ * @param[in] count Maximum number of old slots to migrate.
+ */
+static void hash_migrate(struct HashTable *ht, unsigned int count)
+{
+  struct HashSlot *slot;
+
+  if (!ht->ht_old)
+    return;
+
+  for (; count > 0 && ht->ht_oldpos <= ht->ht_oldmask; --count) {
+    slot = &ht->ht_old[ht->ht_oldpos++];
+    if (!slot->hs_ptr || slot->hs_ptr == HASH_DELETED)
+      continue;
+    if (hash_place(ht->ht_slots, ht->ht_mask, slot->hs_hash, slot->hs_ptr))
+      ht->ht_deleted--;
+    /* Lookups still probe the old array, so leave a marker behind. */
+    slot->hs_ptr = HASH_DELETED;
+    ht->ht_count++;
+    ht->ht_oldcount--;
+  }
+
+  if (ht->ht_oldpos > ht->ht_oldmask || !ht->ht_oldcount) {
+    MyFree(ht->ht_old);
+    ht->ht_old = 0;
+    ht->ht_oldmask = 0;
+    ht->ht_oldpos = 0;
+    ht->ht_oldcount = 0;
+  }
+}
+
+/** Start moving a table to a new slot array if it is getting full.
+ * @param[in,out] ht Table to check.
+ */
+static void hash_check_size(struct HashTable *ht)
+{
+  unsigned int size = ht->ht_mask + 1;
+  unsigned int live;
+
+  if ((ht->ht_count + ht->ht_oldcount + ht->ht_deleted + 1) * 4 < size * 3)
+    return;
+
+  /* Finish any migration still in progress before starting another. */
+  hash_migrate(ht, ~0u);
+
+  /* Grow if the table is really full, else just shed the markers. */
+  live = ht->ht_count + 1;
+  if (live * 2 >= size)
+    size <<= 1;
+
+  ht->ht_old = ht->ht_slots;
+  ht->ht_oldmask = ht->ht_mask;
+  ht->ht_oldcount = ht->ht_count;
+  ht->ht_oldpos = 0;
+  ht->ht_slots = hash_alloc_slots(size);
+  ht->ht_mask = size - 1;
+  ht->ht_count = 0;
+  ht->ht_deleted = 0;
+  ht->ht_resizes++;
+}
+
+/** Add an entry to a hash table.
+ * @param[in,out] ht Table to add to.
+ * @param[in] hashv Hash value of the entry's name.
+ * @param[in] ptr Entry to add.
+ */
+static void hash_add(struct HashTable *ht, unsigned int hashv, void *ptr)
+{
+  hash_check_size(ht);
+  hash_migrate(ht, HASH_MIGRATE_STEP);
+  if (hash_place(ht->ht_slots, ht->ht_mask, hashv, ptr))
+    ht->ht_deleted--;
+  ht->ht_count++;
+}
+
+/** Remove an entry from one slot array.
+ * @param[in] slots Slot array to search.
+ * @param[in] mask Mask for \a slots.
+ * @param[in] hashv Hash value of the entry's name.
+ * @param[in] ptr Entry to remove.
+ * @return Non-zero if the entry was found and removed.
+ */
+static int hash_unplace(struct HashSlot *slots, unsigned int mask,
+                        unsigned int hashv, void *ptr)
+{
+  unsigned int pos;
+
+  for (pos = hashv & mask; slots[pos].hs_ptr; pos = (pos + 1) & mask)
+    if (slots[pos].hs_ptr == ptr) {
+      /* A slot followed by an empty one can simply become empty. */
+      slots[pos].hs_ptr = slots[(pos + 1) & mask].hs_ptr ? HASH_DELETED : 0;
+      return slots[pos].hs_ptr ? 2 : 1;
+    }
+  return 0;
+}
+
+/** Remove an entry from a hash table.
+ * @param[in,out] ht Table to remove from.
+ * @param[in] hashv Hash value of the entry's name.
+ * @param[in] ptr Entry to remove.
+ * @return Zero if the entry was found and removed, -1 if not found.
+ */
+static int hash_del(struct HashTable *ht, unsigned int hashv, void *ptr)
+{
+  int res, found = 0;
+
+  if ((res = hash_unplace(ht->ht_slots, ht->ht_mask, hashv, ptr))) {
+    ht->ht_count--;
+    if (res == 2)
+      ht->ht_deleted++;
+    found = 1;
+  }
+  /* Clear the old array too, so lookups can never see the entry there. */
+  if (ht->ht_old && hash_unplace(ht->ht_old, ht->ht_oldmask, hashv, ptr)) {
+    if (!found)
+      ht->ht_oldcount--;
+    found = 1;
+  }
+  if (!found)
+    return -1;
+
+  hash_migrate(ht, HASH_MIGRATE_STEP);
+  return 0;
+}
+
+/** Start iterating over the entries that have a particular hash value.
+ * @param[out] hp Iterator to initialize.
+ * @param[in] ht Table to search.
+ * @param[in] hashv Hash value to look for.
+ */
+static void hash_probe_start(struct HashProbe *hp, struct HashTable *ht,
+                             unsigned int hashv)
+{
+  hp->hp_table = ht;
+  hp->hp_slots = ht->ht_slots;
+  hp->hp_mask = ht->ht_mask;
+  hp->hp_pos = hashv & ht->ht_mask;
+  hp->hp_hash = hashv;
+  ht->ht_lookups++;
+}
+
+/** Return the next entry with the iterator's hash value.
+ * @param[in,out] hp Iterator to advance.
+ * @return Next candidate entry, or NULL when there are no more.
+ */
+static void *hash_probe_next(struct HashProbe *hp)
+{
+  struct HashSlot *slot;
+
+  while (1) {
+    hp->hp_table->ht_probes++;
+    slot = &hp->hp_slots[hp->hp_pos];
+    hp->hp_pos = (hp->hp_pos + 1) & hp->hp_mask;
+    if (!slot->hs_ptr) {
+      /* End of this array; continue in the old one if migrating. */
+      if (hp->hp_slots == hp->hp_table->ht_old || !hp->hp_table->ht_old)
+        return 0;
+      hp->hp_slots = hp->hp_table->ht_old;
+      hp->hp_mask = hp->hp_table->ht_oldmask;
+      hp->hp_pos = hp->hp_hash & hp->hp_mask;
+    } else if (slot->hs_hash == hp->hp_hash && slot->hs_ptr != HASH_DELETED)
+      return slot->hs_ptr;
+  }
+}
+
+/** Report statistics for one table.
+ * @param[in] to Client requesting statistics.
+ * @param[in] ht Table to report on.
+ */
+static void hash_report(struct Client *to, struct HashTable *ht)
+{
+  unsigned long total = 0;
+  unsigned int max = 0, dist, pos, size = ht->ht_mask + 1;
+
+  /* Measure the distance of every entry from its home slot. */
+  for (pos = 0; pos < size; pos++) {
+    if (!ht->ht_slots[pos].hs_ptr || ht->ht_slots[pos].hs_ptr == HASH_DELETED)
+      continue;
+    dist = (pos - ht->ht_slots[pos].hs_hash) & ht->ht_mask;
+    total += dist + 1;
+    if (dist + 1 > max)
+      max = dist + 1;
   }
+
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":%s: slots %u entries %u deleted %u load %u%% resizes %u",
+             ht->ht_name, size, ht->ht_count, ht->ht_deleted,
+             (ht->ht_count + ht->ht_deleted) * 100 / size, ht->ht_resizes);
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":%s: probe length avg %lu.%02lu max %u; lookups %lu avg "
+             "probes %lu.%02lu", ht->ht_name,
+             ht->ht_count ? total / ht->ht_count : 0,
+             ht->ht_count ? (total * 100 / ht->ht_count) % 100 : 0, max,
+             ht->ht_lookups,
+             ht->ht_lookups ? ht->ht_probes / ht->ht_lookups : 0,
+             ht->ht_lookups ? (ht->ht_probes * 100 / ht->ht_lookups) % 100 : 0);
+  if (ht->ht_old)
+    send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+               ":%s: migrating from %u slots, %u entries left, at slot %u",
+               ht->ht_name, ht->ht_oldmask + 1, ht->ht_oldcount,
+               ht->ht_oldpos);
+}
+
+/** Initialize the hash function and the client and channel tables. */
+void init_hash(void)
+{
+  hash_seed = ircrandom();
+  hash_table_init(&clientTable);
+  hash_table_init(&channelTable);
 }
 
 /** Output type of hash function. */
 typedef unsigned int HASHREGS;
 
 /** Calculate hash value for a string.
+ * This is a case-insensitive FNV-1a with a random starting value and a
+ * final mixing step, so the low bits used to pick a slot depend on
+ * every input character.
  * @param[in] n String to hash.
  * @return Hash value for string.
  */
 static HASHREGS strhash(const char *n)
 {
-  HASHREGS hash = crc32hash[ToLower(*n++) & 255];
-  while (*n)
-    hash = (hash >> 8) ^ crc32hash[(hash ^ ToLower(*n++)) & 255];
-  return hash % HASHSIZE;
+  HASHREGS hash = hash_seed ^ 2166136261u;
+
+  while (*n) {
+    hash ^= (unsigned char) ToLower(*n++);
+    hash *= 16777619u;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
 }
 
 /************************** Externally visible functions ********************/
 
-/* Optimization note: in these functions I supposed that the CSE optimization
- * (Common Subexpression Elimination) does its work decently, this means that
- * I avoided introducing new variables to do the work myself and I did let
- * the optimizer play with more free registers, actual tests proved this
- * solution to be faster than doing things like tmp2=tmp->hnext... and then
- * use tmp2 myself which would have given less freedom to the optimizer.
- */
-
-/** Prepend a client to the appropriate hash bucket.
+/** Add a client to the client hash table.
  * @param[in] cptr Client to add to hash table.
  * @return Zero.
  */
 int hAddClient(struct Client *cptr)
 {
-  HASHREGS hashv = strhash(cli_name(cptr));
-
-  cli_hnext(cptr) = clientTable[hashv];
-  clientTable[hashv] = cptr;
+  hash_add(&clientTable, strhash(cli_name(cptr)), cptr);
+  cli_hnext(cptr) = 0;
 
   return 0;
 }
 
-/** Prepend a channel to the appropriate hash bucket.
+/** Add a channel to the channel hash table.
  * @param[in] chptr Channel to add to hash table.
  * @return Zero.
  */
 int hAddChannel(struct Channel *chptr)
 {
-  HASHREGS hashv = strhash(chptr->chname);
-
-  chptr->hnext = channelTable[hashv];
-  channelTable[hashv] = chptr;
+  hash_add(&channelTable, strhash(chptr->chname), chptr);
+  chptr->hnext = 0;
 
   return 0;
 }
 
-/** Remove a client from its hash bucket.
+/** Remove a client from the client hash table.
  * @param[in] cptr Client to remove from hash table.
  * @return Zero if the client is found and removed, -1 if not found.
  */
 int hRemClient(struct Client *cptr)
 {
-  HASHREGS hashv = strhash(cli_name(cptr));
-  struct Client *tmp = clientTable[hashv];
-
-  if (tmp == cptr) {
-    clientTable[hashv] = cli_hnext(cptr);
-    cli_hnext(cptr) = cptr;
-    return 0;
-  }
-
-  while (tmp) {
-    if (cli_hnext(tmp) == cptr) {
-      cli_hnext(tmp) = cli_hnext(cli_hnext(tmp));
-      cli_hnext(cptr) = cptr;
-      return 0;
-    }
-    tmp = cli_hnext(tmp);
-  }
-  return -1;
+  if (hash_del(&clientTable, strhash(cli_name(cptr)), cptr))
+    return -1;
+  cli_hnext(cptr) = cptr;
+  return 0;
 }
 
 /** Rename a client in the hash table.
@@ -173,102 +438,59 @@ int hRemClient(struct Client *cptr)
  */
 int hChangeClient(struct Client *cptr, const char *newname)
 {
-  HASHREGS newhash = strhash(newname);
-
   assert(0 != cptr);
   hRemClient(cptr);
 
-  cli_hnext(cptr) = clientTable[newhash];
-  clientTable[newhash] = cptr;
+  hash_add(&clientTable, strhash(newname), cptr);
+  cli_hnext(cptr) = 0;
   return 0;
 }
 
-/** Remove a channel from its hash bucket.
+/** Remove a channel from the channel hash table.
  * @param[in] chptr Channel to remove from hash table.
  * @return Zero if the channel is found and removed, -1 if not found.
  */
 int hRemChannel(struct Channel *chptr)
 {
-  HASHREGS hashv = strhash(chptr->chname);
-  struct Channel *tmp = channelTable[hashv];
-
-  if (tmp == chptr) {
-    channelTable[hashv] = chptr->hnext;
-    chptr->hnext = chptr;
-    return 0;
-  }
-
-  while (tmp) {
-    if (tmp->hnext == chptr) {
-      tmp->hnext = tmp->hnext->hnext;
-      chptr->hnext = chptr;
-      return 0;
-    }
-    tmp = tmp->hnext;
-  }
-
-  return -1;
+  if (hash_del(&channelTable, strhash(chptr->chname), chptr))
+    return -1;
+  chptr->hnext = chptr;
+  return 0;
 }
 
 /** Find a client by name, filtered by status mask.
- * If a client is found, it is moved to the top of its hash bucket.
  * @param[in] name Client name to search for.
  * @param[in] TMask Bitmask of status bits, any of which are needed to match.
  * @return Matching client, or NULL if none.
  */
 struct Client* hSeekClient(const char *name, int TMask)
 {
-  HASHREGS hashv      = strhash(name);
-  struct Client *cptr = clientTable[hashv];
-
-  if (cptr) {
-    if (0 == (cli_status(cptr) & TMask) || 0 != ircd_strcmp(name, cli_name(cptr))) {
-      struct Client* prev;
-      while (prev = cptr, cptr = cli_hnext(cptr)) {
-        if ((cli_status(cptr) & TMask) && (0 == ircd_strcmp(name, cli_name(cptr)))) {
-          cli_hnext(prev) = cli_hnext(cptr);
-          cli_hnext(cptr) = clientTable[hashv];
-          clientTable[hashv] = cptr;
-          break;
-        }
-      }
-    }
-  }
+  struct HashProbe hp;
+  struct Client *cptr;
+
+  hash_probe_start(&hp, &clientTable, strhash(name));
+  while ((cptr = hash_probe_next(&hp)))
+    if ((cli_status(cptr) & TMask) && 0 == ircd_strcmp(name, cli_name(cptr)))
+      break;
   return cptr;
 }
 
 /** Find a channel by name.
- * If a channel is found, it is moved to the top of its hash bucket.
  * @param[in] name Channel name to search for.
  * @return Matching channel, or NULL if none.
  */
 struct Channel* hSeekChannel(const char *name)
 {
-  HASHREGS hashv = strhash(name);
-  struct Channel *chptr = channelTable[hashv];
-
-  if (chptr) {
-    if (0 != ircd_strcmp(name, chptr->chname)) {
-      struct Channel* prev;
-      while (prev = chptr, chptr = chptr->hnext) {
-        if (0 == ircd_strcmp(name, chptr->chname)) {
-          prev->hnext = chptr->hnext;
-          chptr->hnext = channelTable[hashv];
-          channelTable[hashv] = chptr;
-          break;
-        }
-      }
-    }
-  }
-  return chptr;
+  struct HashProbe hp;
+  struct Channel *chptr;
 
+  hash_probe_start(&hp, &channelTable, strhash(name));
+  while ((chptr = hash_probe_next(&hp)))
+    if (0 == ircd_strcmp(name, chptr->chname))
+      break;
+  return chptr;
 }
 
-/* I will add some useful(?) statistics here one of these days,
-   but not for DEBUGMODE: just to let the admins play with it,
-   coders are able to SIGCORE the server and look into what goes
-   on themselves :-) */
-
 /** Report hash table statistics to a client.
  * @param[in] cptr Client that sent us this message.
  * @param[in] sptr Client that originated the message.
@@ -278,49 +500,45 @@ struct Channel* hSeekChannel(const char *name)
  */
 int m_hash(struct Client *cptr, struct Client *sptr, int parc, char *parv[])
 {
-  int max_chain = 0;
-  int buckets   = 0;
-  int count     = 0;
-  struct Client*  cl;
-  struct Channel* ch;
-  int i;
-  
   sendcmdto_one(&me, CMD_NOTICE, sptr, "%C :Hash Table Statistics", sptr);
+  sendcmdto_one(&me, CMD_NOTICE, sptr, "%C :Client: entries: %u slots: %u",
+                sptr, clientTable.ht_count + clientTable.ht_oldcount,
+                clientTable.ht_mask + 1);
+  sendcmdto_one(&me, CMD_NOTICE, sptr, "%C :Channel: entries: %u slots: %u",
+                sptr, channelTable.ht_count + channelTable.ht_oldcount,
+                channelTable.ht_mask + 1);
+  return 0;
+}
 
-  for (i = 0; i < HASHSIZE; ++i) {
-    if ((cl = clientTable[i])) {
-      int len = 0;
-      ++buckets;
-      for ( ; cl; cl = cli_hnext(cl))
-        ++len; 
-      if (len > max_chain)
-        max_chain = len;
-      count += len;
-    }
-  } 
-
-  sendcmdto_one(&me, CMD_NOTICE, sptr, "%C :Client: entries: %d buckets: %d "
-		"max chain: %d", sptr, count, buckets, max_chain);
-
-  buckets = 0;
-  count   = 0;
-  max_chain = 0;
-
-  for (i = 0; i < HASHSIZE; ++i) {
-    if ((ch = channelTable[i])) {
-      int len = 0;
-      ++buckets;
-      for ( ; ch; ch = ch->hnext)
-        ++len; 
-      if (len > max_chain)
-        max_chain = len;
-      count += len;
-    }
-  } 
+/** Report detailed hash table statistics.
+ * @param[in] to Client requesting statistics.
+ * @param[in] sd Stats descriptor for request (ignored).
+ * @param[in] param Extra parameter from user (ignored).
+ */
+void
+hash_stats(struct Client* to, const struct StatDesc* sd, char* param)
+{
+  hash_report(to, &clientTable);
+  hash_report(to, &channelTable);
+}
 
-  sendcmdto_one(&me, CMD_NOTICE, sptr, "%C :Channel: entries: %d buckets: %d "
-		"max chain: %d", sptr, count, buckets, max_chain);
-  return 0;
+/** Count memory used by the client and channel hash tables.
+ * @param[out] cl_slots Receives number of client table slots.
+ * @param[out] ch_slots Receives number of channel table slots.
+ * @return Number of bytes allocated for both tables.
+ */
+size_t hash_count_memory(unsigned int *cl_slots, unsigned int *ch_slots)
+{
+  size_t total;
+
+  *cl_slots = clientTable.ht_mask + 1;
+  *ch_slots = channelTable.ht_mask + 1;
+  total = (*cl_slots + *ch_slots) * sizeof(struct HashSlot);
+  if (clientTable.ht_old)
+    total += (clientTable.ht_oldmask + 1) * sizeof(struct HashSlot);
+  if (channelTable.ht_old)
+    total += (channelTable.ht_oldmask + 1) * sizeof(struct HashSlot);
+  return total;
 }
 
 /* Nick jupe utilities, these are in a static hash table with entry/bucket
@@ -423,59 +641,367 @@ stats_nickjupes(struct Client* to, const struct StatDesc* sd, char* param)
       send_reply(to, RPL_STATSJLINE, jupeTable[i]);
 }
 
+/** Number of buckets in the channel size index.  Channels with fewer
+ * than 64 users each have a bucket for their exact user count; larger
+ * channels share one bucket for each power of two.
+ */
+#define SIZE_BUCKETS 90
+
+/** Channels in each size bucket. */
+static struct Channel *sizeTable[SIZE_BUCKETS];
+/** Number of channels in each size bucket. */
+static unsigned int sizeCount[SIZE_BUCKETS];
+
+/** Shared formatted copy of the default channel list. */
+struct ListCache {
+  unsigned int refcnt;            /**< Listings using this copy, plus one if current */
+  time_t expire;                  /**< Time after which it is rebuilt */
+  char *buf;                      /**< NUL-terminated RPL_LIST parameters */
+  size_t used;                    /**< Bytes used in buf */
+  size_t size;                    /**< Bytes allocated for buf */
+};
+
+/** Current copy of the default channel list, or NULL. */
+static struct ListCache *listCache;
+
+/** Listings in progress, so that destroyed channels can be skipped. */
+static struct ListingArgs *listings;
+
+/** Find the size index bucket for a user count.
+ * @param[in] users Number of users in a channel.
+ * @return Index into sizeTable.
+ */
+static unsigned int size_bucket(unsigned int users)
+{
+  unsigned int bucket;
+
+  if (users < 64)
+    return users;
+  for (bucket = 57; users; users >>= 1)
+    bucket++;
+  return bucket;
+}
+
+/** File a channel in the size index after its user count changes.
+ * @param[in] chptr Channel that was created, joined or parted.
+ */
+void list_size_channel(struct Channel *chptr)
+{
+  unsigned int bucket = size_bucket(chptr->users);
+
+  if (chptr->size_prev_p) {
+    if (chptr->size_bucket == bucket)
+      return;
+    if (chptr->size_next)
+      chptr->size_next->size_prev_p = chptr->size_prev_p;
+    *chptr->size_prev_p = chptr->size_next;
+    sizeCount[chptr->size_bucket]--;
+  }
+  chptr->size_bucket = bucket;
+  if ((chptr->size_next = sizeTable[bucket]))
+    sizeTable[bucket]->size_prev_p = &chptr->size_next;
+  chptr->size_prev_p = &sizeTable[bucket];
+  sizeTable[bucket] = chptr;
+  sizeCount[bucket]++;
+}
+
+/** Check whether a channel matches the filters of a listing.
+ * Visibility to the listing client is not checked.
+ * @param[in] args Listing parameters.
+ * @param[in] chptr Channel to check.
+ * @return Non-zero if the channel should be listed.
+ */
+static int list_match_channel(const struct ListingArgs *args,
+                              struct Channel *chptr)
+{
+  return chptr->users > args->min_users
+    && chptr->users < args->max_users
+    && chptr->creationtime > args->min_time
+    && chptr->creationtime < args->max_time
+    && (!args->wildcard[0] || (args->flags & LISTARG_NEGATEWILDCARD) ||
+        (!match(args->wildcard, chptr->chname)))
+    && (!(args->flags & LISTARG_NEGATEWILDCARD) ||
+        match(args->wildcard, chptr->chname))
+    && (!(args->flags & LISTARG_TOPICLIMITS)
+        || (chptr->topic[0]
+            && chptr->topic_time > args->min_topic_time
+            && chptr->topic_time < args->max_topic_time));
+}
+
+/** Send one channel to a listing client.
+ * @param[in] cptr Client to send the list to.
+ * @param[in] args Listing parameters.
+ * @param[in] chptr Channel to send.
+ */
+static void list_send_channel(struct Client *cptr,
+                              const struct ListingArgs *args,
+                              struct Channel *chptr)
+{
+  if (args->flags & LISTARG_SHOWMODES) {
+    char modebuf[MODEBUFLEN];
+    char parabuf[MODEBUFLEN];
+
+    modebuf[0] = modebuf[1] = parabuf[0] = '\0';
+    channel_modes(cptr, modebuf, parabuf, sizeof(parabuf), chptr, NULL);
+    send_reply(cptr, RPL_LIST | SND_EXPLICIT, "%s %u %s %s :%s",
+               chptr->chname, chptr->users, modebuf, parabuf, chptr->topic);
+  } else {
+    send_reply(cptr, RPL_LIST, chptr->chname, chptr->users, chptr->topic);
+  }
+}
+
+/** Release a listing's reference to a shared channel list.
+ * @param[in] lc Shared list to release.
+ */
+static void list_release_cache(struct ListCache *lc)
+{
+  if (--lc->refcnt == 0) {
+    MyFree(lc->buf);
+    MyFree(lc);
+  }
+}
+
+/** Forget the current shared copy of the default channel list.
+ * Listings still sending it keep their reference.
+ */
+void list_drop_cache(void)
+{
+  if (listCache) {
+    list_release_cache(listCache);
+    listCache = NULL;
+  }
+}
+
+/** Get an up to date shared copy of the default channel list,
+ * building it if needed.
+ * @param[in] args Default listing parameters.
+ * @return Shared list with a reference held for the caller.
+ */
+static struct ListCache *list_get_cache(const struct ListingArgs *args)
+{
+  struct ListCache *lc;
+  struct Channel *chptr;
+  char buf[CHANNELLEN + TOPICLEN + 16];
+  size_t len;
+
+  if (listCache && listCache->expire > CurrentTime) {
+    listCache->refcnt++;
+    return listCache;
+  }
+  list_drop_cache();
+
+  lc = (struct ListCache*) MyMalloc(sizeof(struct ListCache));
+  lc->refcnt = 2;
+  lc->expire = CurrentTime + feature_int(FEAT_LIST_CACHE);
+  lc->size = 4096;
+  lc->used = 0;
+  lc->buf = (char*) MyMalloc(lc->size);
+  for (chptr = GlobalChannelList; chptr; chptr = chptr->next) {
+    if (!PubChannel(chptr) || !list_match_channel(args, chptr))
+      continue;
+    len = ircd_snprintf(0, buf, sizeof(buf), "%s %u :%s", chptr->chname,
+                        chptr->users, chptr->topic) + 1;
+    if (lc->used + len > lc->size) {
+      while (lc->used + len > lc->size)
+        lc->size *= 2;
+      lc->buf = (char*) MyRealloc(lc->buf, lc->size);
+    }
+    memcpy(lc->buf + lc->used, buf, len);
+    lc->used += len;
+  }
+  listCache = lc;
+  return lc;
+}
+
+/** Compare two channel pointers for qsort() and bsearch().
+ * @param[in] a_ Pointer to first channel pointer.
+ * @param[in] b_ Pointer to second channel pointer.
+ * @return Less than, equal to or greater than zero.
+ */
+static int list_cmp_channel(const void *a_, const void *b_)
+{
+  unsigned long a = (unsigned long) *(struct Channel * const *) a_;
+  unsigned long b = (unsigned long) *(struct Channel * const *) b_;
+
+  return (a > b) - (a < b);
+}
+
+/** Collect the channels whose user counts might match a listing,
+ * if that is much cheaper than walking every channel.
+ * @param[in] la Listing to collect channels for.
+ */
+static void list_collect(struct ListingArgs *la)
+{
+  struct Channel *chptr;
+  unsigned int lo, hi, ii, total;
+
+  lo = size_bucket(la->min_users + 1);
+  hi = size_bucket(la->max_users - 1);
+  if (lo <= 1 && hi == SIZE_BUCKETS - 1)
+    return;
+  for (total = 0, ii = lo; ii <= hi; ii++)
+    total += sizeCount[ii];
+  if (total >= UserStats.channels / 2)
+    return;
+
+  la->found = (struct Channel**) MyMalloc((total + 1) * sizeof(*la->found));
+  for (ii = lo; ii <= hi; ii++)
+    for (chptr = sizeTable[ii]; chptr; chptr = chptr->size_next)
+      la->found[la->nfound++] = chptr;
+  assert(la->nfound == total);
+  qsort(la->found, la->nfound, sizeof(*la->found), list_cmp_channel);
+}
+
+/** Start sending the channel list to a client.
+ * Listings limited to a range of user counts only visit the channels
+ * in the matching buckets of the size index.  The public part of the
+ * default listing comes from a shared copy built at most once every
+ * LIST_CACHE seconds.
+ * @param[in] cptr Client to send the list to.
+ * @param[in] args Parameters of the listing (copied).
+ */
+void list_start_channels(struct Client *cptr, const struct ListingArgs *args)
+{
+  struct ListingArgs *la;
+  struct Membership *member;
+
+  assert(0 == cli_listing(cptr));
+
+  la = (struct ListingArgs*) MyMalloc(sizeof(struct ListingArgs));
+  memcpy(la, args, sizeof(struct ListingArgs));
+  la->chptr = NULL;
+  la->found = NULL;
+  la->nfound = la->pos = 0;
+  la->cache = NULL;
+  if ((la->flags & LISTARG_DEFAULT)
+      && !(la->flags & (LISTARG_SHOWSECRET | LISTARG_SHOWMODES))
+      && feature_int(FEAT_LIST_CACHE) > 0) {
+    /* The shared copy only has public channels; send the others now. */
+    for (member = cli_user(cptr)->channel; member;
+         member = member->next_channel)
+      if (!IsZombie(member) && !PubChannel(member->channel)
+          && list_match_channel(la, member->channel))
+        list_send_channel(cptr, la, member->channel);
+    la->cache = list_get_cache(la);
+  } else {
+    list_collect(la);
+    if (!la->found)
+      la->chptr = GlobalChannelList;
+  }
+  if ((la->next = listings))
+    listings->prev_p = &la->next;
+  la->prev_p = &listings;
+  listings = la;
+  cli_listing(cptr) = la;
+
+  list_next_channels(cptr);
+}
+
+/** Stop sending the channel list to a client.
+ * @param[in] cptr Client whose listing should be released.
+ */
+void list_end_channels(struct Client *cptr)
+{
+  struct ListingArgs *la = cli_listing(cptr);
+
+  if (!la)
+    return;
+  if (la->next)
+    la->next->prev_p = la->prev_p;
+  *la->prev_p = la->next;
+  if (la->cache)
+    list_release_cache(la->cache);
+  MyFree(la->found);
+  MyFree(la);
+  cli_listing(cptr) = NULL;
+}
+
+/** Advance any listing that is about to visit a channel being destroyed,
+ * and remove the channel from the size index.
+ * @param[in] chptr Channel that is being removed from #GlobalChannelList.
+ */
+void list_forget_channel(struct Channel *chptr)
+{
+  struct ListingArgs *la;
+  struct Channel **pos;
+
+  for (la = listings; la; la = la->next) {
+    if (la->chptr == chptr)
+      la->chptr = chptr->next;
+    if (la->found
+        && (pos = bsearch(&chptr, la->found, la->nfound, sizeof(*la->found),
+                          list_cmp_channel))) {
+      /* drop it, keeping the rest sorted */
+      if (pos < la->found + la->pos)
+        la->pos--;
+      la->nfound--;
+      memmove(pos, pos + 1, (la->found + la->nfound - pos) * sizeof(*pos));
+    }
+  }
+
+  if (chptr->size_prev_p) {
+    if (chptr->size_next)
+      chptr->size_next->size_prev_p = chptr->size_prev_p;
+    *chptr->size_prev_p = chptr->size_next;
+    sizeCount[chptr->size_bucket]--;
+    chptr->size_prev_p = NULL;
+  }
+}
+
 /** Send more channels to a client in mid-LIST.
  * @param[in] cptr Client to send the list to.
  */
 void list_next_channels(struct Client *cptr)
 {
-  struct ListingArgs *args;
+  struct ListingArgs *args = cli_listing(cptr);
   struct Channel *chptr;
+  const char *entry;
+  int done;
+
+  if (args->cache) {
+    /* Send entries from the shared copy of the default list. */
+    while (args->pos < args->cache->used) {
+      entry = args->cache->buf + args->pos;
+      args->pos += strlen(entry) + 1;
+      send_reply(cptr, RPL_LIST | SND_EXPLICIT, "%s", entry);
+
+      /* If client sendq is more than half full, stop. */
+      if (MsgQLength(&cli_sendQ(cptr)) > cli_max_sendq(cptr) / 2)
+        break;
+    }
+    done = args->pos >= args->cache->used;
+  } else {
+    for (;;) {
+      /* Take the next channel from the size index or the channel list. */
+      if (args->found) {
+        if (args->pos >= args->nfound)
+          break;
+        chptr = args->found[args->pos++];
+      } else {
+        if (!(chptr = args->chptr))
+          break;
+        args->chptr = chptr->next;
+      }
 
-  /* Walk consecutive buckets until we hit the end. */
-  for (args = cli_listing(cptr); args->bucket < HASHSIZE; args->bucket++)
-  {
-    /* Send all the matching channels in the bucket. */
-    for (chptr = channelTable[args->bucket]; chptr; chptr = chptr->hnext)
-    {
-      if (chptr->users > args->min_users
-          && chptr->users < args->max_users
-          && chptr->creationtime > args->min_time
-          && chptr->creationtime < args->max_time
-          && (!args->wildcard[0] || (args->flags & LISTARG_NEGATEWILDCARD) ||
-              (!match(args->wildcard, chptr->chname)))
-          && (!(args->flags & LISTARG_NEGATEWILDCARD) ||
-              match(args->wildcard, chptr->chname))
-          && (!(args->flags & LISTARG_TOPICLIMITS)
-              || (chptr->topic[0]
-                  && chptr->topic_time > args->min_topic_time
-                  && chptr->topic_time < args->max_topic_time))
+      /* Send the channel if it matches. */
+      if (list_match_channel(args, chptr)
           && ((args->flags & LISTARG_SHOWSECRET)
               || ShowChannel(cptr, chptr)))
       {
-        if (args->flags & LISTARG_SHOWMODES) {
-          char modebuf[MODEBUFLEN];
-          char parabuf[MODEBUFLEN];
-
-          modebuf[0] = modebuf[1] = parabuf[0] = '\0';
-          channel_modes(cptr, modebuf, parabuf, sizeof(parabuf), chptr, NULL);
-          send_reply(cptr, RPL_LIST | SND_EXPLICIT, "%s %u %s %s :%s",
-                     chptr->chname, chptr->users, modebuf, parabuf, chptr->topic);
-        } else {
-          send_reply(cptr, RPL_LIST, chptr->chname, chptr->users, chptr->topic);
-        }
+        list_send_channel(cptr, args, chptr);
+
+        /* If client sendq is more than half full, stop. */
+        if (MsgQLength(&cli_sendQ(cptr)) > cli_max_sendq(cptr) / 2)
+          break;
       }
     }
-    /* If, at the end of the bucket, client sendq is more than half
-     * full, stop. */
-    if (MsgQLength(&cli_sendQ(cptr)) > cli_max_sendq(cptr) / 2)
-      break;
+    done = args->found ? args->pos >= args->nfound : !args->chptr;
   }
 
-  /* If we did all buckets, clean the client and send RPL_LISTEND. */
-  if (args->bucket >= HASHSIZE)
+  /* If we did all channels, clean the client and send RPL_LISTEND. */
+  if (done)
   {
-    MyFree(cli_listing(cptr));
-    cli_listing(cptr) = NULL;
+    list_end_channels(cptr);
     send_reply(cptr, RPL_LISTEND);
   }
 }
@@ -0,0 +1,378 @@
+/*
+ * IRC - Internet Relay Chat, ircd/ident_cache.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/** @file
+ * @brief Cache of ident (RFC 1413) lookup outcomes by source network.
+ * @version $Id$
+ *
+ * Some networks silently drop connections to port 113, so every
+ * client from them waits AUTH_TIMEOUT seconds for an ident reply that
+ * never comes.  This remembers how recent lookups to each address and
+ * to each IPv4 /24 or IPv6 /64 ended, and lets start_auth_query() skip
+ * the lookup for addresses and networks that keep timing out.  The
+ * counts halve every IDENT_CACHE_DECAY seconds, so a network that
+ * starts answering is soon probed again.
+ *
+ * Entries are kept in a chained hash table and a least recently used
+ * list, limited to IDENT_CACHE_SIZE entries.
+ */
+#include "config.h"
+
+#include "ident_cache.h"
+#include "client.h"
+#include "ircd.h"
+#include "ircd_alloc.h"
+#include "ircd_features.h"
+#include "ircd_log.h"
+#include "ircd_reply.h"
+#include "numeric.h"
+#include "res.h"
+#include "s_stats.h"
+#include "send.h"
+
+/* #include <assert.h> -- Now using assert in ircd_log.h */
+#include <string.h>
+
+/** Recent ident outcomes for one address or network. */
+struct IdentCacheEntry {
+  struct IdentCacheEntry *hnext;    /**< Next entry in the same bucket. */
+  struct IdentCacheEntry *lru_prev; /**< Next more recently used entry. */
+  struct IdentCacheEntry *lru_next; /**< Next less recently used entry. */
+  struct irc_in_addr addr;          /**< Address, masked to #bits. */
+  time_t decayed;                   /**< When #counts were last halved. */
+  unsigned int hashv;               /**< Hash value of #addr and #bits. */
+  unsigned short counts[3];         /**< Recent outcomes, by IdentOutcome. */
+  unsigned char bits;               /**< Prefix length; 128 for an address. */
+};
+
+/** Smallest number of buckets in the hash table. */
+#define IDENT_CACHE_BUCKETS 64
+
+/** Prefix length of an IPv4 network (a /24 in IPv4-mapped form). */
+#define IDENT_NET_BITS_V4 120
+
+/** Prefix length of an IPv6 network. */
+#define IDENT_NET_BITS_V6 64
+
+/** Number of recent timeouts after which a single address is skipped. */
+#define IDENT_ADDR_TIMEOUTS 2
+
+/** Hash table of entries. */
+static struct IdentCacheEntry **identTable;
+/** Number of buckets in #identTable minus one. */
+static unsigned int identMask;
+/** Head of the LRU list; most recently used entries follow it. */
+static struct IdentCacheEntry identLru = { 0, &identLru, &identLru };
+/** Number of entries. */
+static unsigned int identCount;
+/** Counters reported by ident_cache_stats(). */
+static struct {
+  unsigned int outcomes[3];   /**< Lookups that ended each way. */
+  unsigned int skipped;       /**< Lookups not attempted. */
+  unsigned int evicted;       /**< Entries dropped to stay under the size limit. */
+  unsigned long waited;       /**< Seconds spent on lookups that timed out. */
+  unsigned long saved;        /**< Estimated seconds saved by skipping. */
+} identStats;
+
+/** Build the key for an address or network.
+ * @param[out] key Receives the masked address.
+ * @param[in] addr Client address.
+ * @param[in] bits Prefix length (a multiple of 8).
+ */
+static void
+ident_cache_key(struct irc_in_addr *key, const struct irc_in_addr *addr,
+                unsigned int bits)
+{
+  unsigned char *cp = (unsigned char *)key;
+  unsigned int ii;
+
+  /* Use one form for IPv4 addresses so ::a.b.c.d and ::ffff:a.b.c.d
+   * share their entries. */
+  if (irc_in_addr_is_ipv4(addr)) {
+    memset(key, 0, sizeof(*key));
+    key->in6_16[6] = addr->in6_16[6];
+    key->in6_16[7] = addr->in6_16[7];
+  } else
+    memcpy(key, addr, sizeof(*key));
+  for (ii = bits / 8; ii < sizeof(*key); ii++)
+    cp[ii] = 0;
+}
+
+/** Calculate the hash value of a key.
+ * @param[in] key Masked address.
+ * @param[in] bits Prefix length.
+ * @return Hash value.
+ */
+static unsigned int
+ident_cache_hash(const struct irc_in_addr *key, unsigned int bits)
+{
+  const unsigned char *cp = (const unsigned char *)key;
+  unsigned int hashv = 2166136261U ^ bits;
+  unsigned int ii;
+
+  for (ii = 0; ii < sizeof(*key); ii++)
+    hashv = (hashv ^ cp[ii]) * 16777619U;
+  return hashv;
+}
+
+/** Unlink an entry from the LRU list.
+ * @param[in] entry Entry to unlink.
+ */
+static void
+ident_cache_unlink_lru(struct IdentCacheEntry *entry)
+{
+  entry->lru_prev->lru_next = entry->lru_next;
+  entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+/** Make an entry the most recently used one.
+ * @param[in] entry Entry to link at the head of the LRU list.
+ */
+static void
+ident_cache_link_lru(struct IdentCacheEntry *entry)
+{
+  entry->lru_prev = &identLru;
+  entry->lru_next = identLru.lru_next;
+  identLru.lru_next->lru_prev = entry;
+  identLru.lru_next = entry;
+}
+
+/** Remove an entry from the cache and free it.
+ * @param[in] entry Entry to remove.
+ */
+static void
+ident_cache_remove(struct IdentCacheEntry *entry)
+{
+  struct IdentCacheEntry **pp;
+
+  for (pp = &identTable[entry->hashv & identMask]; *pp != entry;
+       pp = &(*pp)->hnext)
+    assert(*pp != NULL);
+  *pp = entry->hnext;
+  ident_cache_unlink_lru(entry);
+  MyFree(entry);
+  identCount--;
+}
+
+/** Apply the configured cache size.  Drops the least recently used
+ * entries when the cache has become too big, and resizes the hash
+ * table to have about one bucket per entry.  Also used as the
+ * notification callback for FEAT_IDENT_CACHE_SIZE.
+ */
+void
+ident_cache_resize(void)
+{
+  struct IdentCacheEntry *entry;
+  unsigned int size, buckets;
+
+  size = feature_int(FEAT_IDENT_CACHE_SIZE) > 0
+    ? (unsigned int)feature_int(FEAT_IDENT_CACHE_SIZE) : 0;
+  while (identCount > size) {
+    ident_cache_remove(identLru.lru_prev);
+    identStats.evicted++;
+  }
+
+  if (size == 0) {
+    MyFree(identTable);
+    identTable = NULL;
+    identMask = 0;
+    return;
+  }
+
+  for (buckets = IDENT_CACHE_BUCKETS; buckets < size; buckets <<= 1)
+    ;
+  if (identTable && buckets == identMask + 1)
+    return;
+
+  MyFree(identTable);
+  identTable = (struct IdentCacheEntry **)MyCalloc(buckets, sizeof(*identTable));
+  identMask = buckets - 1;
+  for (entry = identLru.lru_next; entry != &identLru; entry = entry->lru_next) {
+    entry->hnext = identTable[entry->hashv & identMask];
+    identTable[entry->hashv & identMask] = entry;
+  }
+}
+
+/** Halve the counts of an entry once for each IDENT_CACHE_DECAY
+ * seconds since they were last halved.
+ * @param[in] entry Entry to update.
+ */
+static void
+ident_cache_decay(struct IdentCacheEntry *entry)
+{
+  time_t period = feature_int(FEAT_IDENT_CACHE_DECAY);
+  time_t halvings;
+  unsigned int ii;
+
+  if (period < 1)
+    period = 1;
+  halvings = (CurrentTime - entry->decayed) / period;
+  if (halvings <= 0)
+    return;
+  for (ii = 0; ii < sizeof(entry->counts) / sizeof(entry->counts[0]); ii++)
+    entry->counts[ii] = halvings >= 16 ? 0 : entry->counts[ii] >> halvings;
+  entry->decayed += halvings * period;
+}
+
+/** Find the entry for an address or network.
+ * @param[in] addr Client address.
+ * @param[in] bits Prefix length to look up.
+ * @param[in] create If non-zero, create the entry if it is missing.
+ * @return Entry with up-to-date counts, or NULL.
+ */
+static struct IdentCacheEntry *
+ident_cache_find(const struct irc_in_addr *addr, unsigned int bits,
+                 int create)
+{
+  struct IdentCacheEntry *entry;
+  struct irc_in_addr key;
+  unsigned int hashv;
+
+  if (!identTable)
+    return NULL;
+
+  ident_cache_key(&key, addr, bits);
+  hashv = ident_cache_hash(&key, bits);
+  for (entry = identTable[hashv & identMask]; entry; entry = entry->hnext)
+    if (entry->hashv == hashv && entry->bits == bits
+        && !memcmp(&entry->addr, &key, sizeof(key)))
+      break;
+
+  if (entry) {
+    ident_cache_decay(entry);
+    ident_cache_unlink_lru(entry);
+  } else if (!create)
+    return NULL;
+  else {
+    if (identCount >= (unsigned int)feature_int(FEAT_IDENT_CACHE_SIZE)) {
+      ident_cache_remove(identLru.lru_prev);
+      identStats.evicted++;
+    }
+    entry = (struct IdentCacheEntry *)MyCalloc(1, sizeof(*entry));
+    memcpy(&entry->addr, &key, sizeof(entry->addr));
+    entry->decayed = CurrentTime;
+    entry->hashv = hashv;
+    entry->bits = bits;
+    entry->hnext = identTable[hashv & identMask];
+    identTable[hashv & identMask] = entry;
+    identCount++;
+  }
+  ident_cache_link_lru(entry);
+  return entry;
+}
+
+/** Decide whether to skip the ident lookup for a client.  A lookup is
+ * skipped if recent lookups to the same address timed out, or if at
+ * least IDENT_SKIP_TIMEOUTS recent lookups to its network timed out
+ * and few were answered, unless the address itself recently answered.
+ * @param[in] addr Client address.
+ * @return Non-zero if the lookup should not be attempted.
+ */
+int
+ident_cache_skip(const struct irc_in_addr *addr)
+{
+  struct IdentCacheEntry *entry;
+  int threshold = feature_int(FEAT_IDENT_SKIP_TIMEOUTS);
+  int skip = 0;
+
+  if (threshold <= 0)
+    return 0;
+
+  if ((entry = ident_cache_find(addr, 128, 0))) {
+    if (entry->counts[IDENT_ANSWERED])
+      return 0;
+    skip = entry->counts[IDENT_TIMEDOUT] >= IDENT_ADDR_TIMEOUTS;
+  }
+
+  if (!skip && (entry = ident_cache_find(addr, irc_in_addr_is_ipv4(addr)
+                                         ? IDENT_NET_BITS_V4
+                                         : IDENT_NET_BITS_V6, 0)))
+    skip = entry->counts[IDENT_TIMEDOUT] >= threshold
+      && entry->counts[IDENT_ANSWERED] * 4 < entry->counts[IDENT_TIMEDOUT];
+
+  if (!skip)
+    return 0;
+
+  identStats.skipped++;
+  identStats.saved += identStats.outcomes[IDENT_TIMEDOUT]
+    ? identStats.waited / identStats.outcomes[IDENT_TIMEDOUT]
+    : (unsigned long)feature_int(FEAT_AUTH_TIMEOUT);
+  return 1;
+}
+
+/** Remember how an ident lookup ended.
+ * @param[in] addr Client address.
+ * @param[in] outcome How the lookup ended.
+ * @param[in] wait Seconds spent waiting (only used for timeouts).
+ */
+void
+ident_cache_record(const struct irc_in_addr *addr, enum IdentOutcome outcome,
+                   time_t wait)
+{
+  struct IdentCacheEntry *entry;
+
+  identStats.outcomes[outcome]++;
+  if (outcome == IDENT_TIMEDOUT && wait > 0)
+    identStats.waited += wait;
+
+  if (!identTable)
+    ident_cache_resize();
+
+  if ((entry = ident_cache_find(addr, 128, 1))
+      && entry->counts[outcome] < 65535)
+    entry->counts[outcome]++;
+  if ((entry = ident_cache_find(addr, irc_in_addr_is_ipv4(addr)
+                                ? IDENT_NET_BITS_V4 : IDENT_NET_BITS_V6, 1))
+      && entry->counts[outcome] < 65535)
+    entry->counts[outcome]++;
+}
+
+/** Report ident cache statistics to a client.
+ * @param[in] to Client requesting statistics.
+ * @param[in] sd Stats descriptor for request (ignored).
+ * @param[in] param Extra parameter from user (ignored).
+ */
+void
+ident_cache_stats(struct Client *to, const struct StatDesc *sd, char *param)
+{
+  struct IdentCacheEntry *entry;
+  unsigned int addresses = 0;
+  size_t memory;
+
+  for (entry = identLru.lru_next; entry != &identLru; entry = entry->lru_next)
+    if (entry->bits == 128)
+      addresses++;
+  memory = identCount * sizeof(struct IdentCacheEntry);
+  if (identTable)
+    memory += (identMask + 1) * sizeof(*identTable);
+
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":Ident cache: entries %u (addresses %u networks %u) "
+             "evicted %u memory %zu", identCount, addresses,
+             identCount - addresses, identStats.evicted, memory);
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":Ident lookups: answered %u refused %u timed out %u "
+             "skipped %u", identStats.outcomes[IDENT_ANSWERED],
+             identStats.outcomes[IDENT_REFUSED],
+             identStats.outcomes[IDENT_TIMEDOUT], identStats.skipped);
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":Ident waits: timed out %lu s (average %lu s) "
+             "saved by skipping about %lu s", identStats.waited,
+             identStats.outcomes[IDENT_TIMEDOUT]
+             ? identStats.waited / identStats.outcomes[IDENT_TIMEDOUT] : 0,
+             identStats.saved);
+}
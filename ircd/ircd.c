@@ -29,6 +29,7 @@
 #include "client.h"
 #include "crule.h"
 #include "destruct_event.h"
+#include "gline.h"
 #include "hash.h"
 #include "ircd_alloc.h"
 #include "ircd_events.h"
@@ -135,6 +136,7 @@ void server_die(const char *message)
   /* log_write will send out message to both log file and as server notice */
   log_write(LS_SYSTEM, L_CRIT, 0, "Server terminating: %s", message);
   flush_connections(0);
+  log_close();
   close_connections(1);
   running = 0;
 }
@@ -312,7 +314,7 @@ static void try_connections(struct Event* ev) {
   }
 
   Debug((DEBUG_NOTICE, "Next connection check : %s", myctime(next)));
-  timer_add(&connect_timer, try_connections, 0, TT_ABSOLUTE, next);
+  timer_add_named(&connect_timer, try_connections, 0, TT_ABSOLUTE, next);
 }
 
 
@@ -450,7 +452,7 @@ static void check_pings(struct Event* ev) {
   Debug((DEBUG_DEBUG, "[%i] check_pings() again in %is",
 	 CurrentTime, next_check-CurrentTime));
   
-  timer_add(&ping_timer, check_pings, 0, TT_ABSOLUTE, next_check);
+  timer_add_named(&ping_timer, check_pings, 0, TT_ABSOLUTE, next_check);
 }
 
 
@@ -728,12 +730,17 @@ int main(int argc, char **argv) {
 
   uping_init();
 
+  send_init();
+  gline_init();
+  auth_init();
+
   stats_init();
 
   IPcheck_init();
-  timer_add(timer_init(&connect_timer), try_connections, 0, TT_RELATIVE, 1);
-  timer_add(timer_init(&ping_timer), check_pings, 0, TT_RELATIVE, 1);
-  timer_add(timer_init(&destruct_event_timer), exec_expired_destruct_events, 0, TT_PERIODIC, 60);
+  timer_add_named(timer_init(&connect_timer), try_connections, 0,
+                  TT_RELATIVE, 1);
+  timer_add_named(timer_init(&ping_timer), check_pings, 0, TT_RELATIVE, 1);
+  timer_add_named(timer_init(&destruct_event_timer), exec_expired_destruct_events, 0, TT_PERIODIC, 60);
 
   CurrentTime = time(NULL);
 
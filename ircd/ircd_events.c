@@ -26,6 +26,7 @@
 
 #include "ircd.h"
 #include "ircd_alloc.h"
+#include "ircd_features.h"
 #include "ircd_log.h"
 #include "ircd_snprintf.h"
 #include "s_debug.h"
@@ -33,6 +34,8 @@
 /* #include <assert.h> -- Now using assert in ircd_log.h */
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #define SIGS_PER_SOCK	10	/**< number of signals to process per socket
@@ -90,6 +93,9 @@ static struct {
   struct Socket	sock;	/**< and its struct Socket */
 } sigInfo = { -1 };
 
+/** List of handlers to run at the end of each event loop pass. */
+static struct Tick* tickList;
+
 /** All the thread info */
 static struct {
   struct Generators    gens;		/**< List of all generators */
@@ -102,13 +108,187 @@ static struct {
   unsigned int	       genq_count;	/**< count of generators on queue */
 #endif
 } evInfo = {
-  { 0, 0, 0 },
+  { 0 },
   0, 0, 0
 #ifdef IRCD_THREADED
   , 0, 0, 0
 #endif
 };
 
+/** Number of hash buckets used to find a callback's statistics. */
+#define LOOP_CALLBACK_HASH	(2 * LOOP_CALLBACK_MAX)
+
+/** Event loop timing statistics. */
+static struct LoopStats loopStats;
+
+/** Stall profiler state for the current event loop pass. */
+static struct {
+  uint64_t	pass_start;	/**< when the pass started, or 0 */
+  unsigned long	pass_seq;	/**< sequence number of the pass */
+  unsigned long	pass_events;	/**< events executed during the pass */
+  struct CallbackStats* pass_list; /**< entries charged during the pass */
+  uint64_t	nested;		/**< time used by nested callbacks */
+  unsigned char	hash[LOOP_CALLBACK_HASH]; /**< ls_callbacks index plus one */
+} profInfo = { 0, 1 };
+
+/** Read the stall profiler's clock.
+ * @return Current wall clock time in microseconds.
+ */
+static uint64_t
+prof_now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, 0);
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/** Find the run time statistics for a callback, adding them if needed.
+ * Once the table is full, new callbacks share its last entry.
+ * @param[in] call Callback function.
+ * @return Statistics to charge for \a call.
+ */
+static struct CallbackStats*
+prof_callback(EventCallBack call)
+{
+  struct CallbackStats* cs;
+  unsigned int hash;
+
+  hash = (((unsigned long) call >> 2) * 2654435761u) % LOOP_CALLBACK_HASH;
+  while (profInfo.hash[hash]) {
+    cs = &loopStats.ls_callbacks[profInfo.hash[hash] - 1];
+    if (cs->cs_call == call)
+      return cs;
+    hash = (hash + 1) % LOOP_CALLBACK_HASH;
+  }
+
+  if (loopStats.ls_ncallbacks >= LOOP_CALLBACK_MAX - 1) {
+    cs = &loopStats.ls_callbacks[LOOP_CALLBACK_MAX - 1];
+    cs->cs_name = "other callbacks";
+    loopStats.ls_ncallbacks = LOOP_CALLBACK_MAX;
+    return cs;
+  }
+
+  cs = &loopStats.ls_callbacks[loopStats.ls_ncallbacks++];
+  cs->cs_call = call;
+  profInfo.hash[hash] = loopStats.ls_ncallbacks;
+  return cs;
+}
+
+/** Start timing a callback.
+ * @param[out] nested Saved time used by callbacks nested in the caller.
+ * @return Start time to pass to prof_leave().
+ */
+static uint64_t
+prof_enter(uint64_t* nested)
+{
+  *nested = profInfo.nested;
+  profInfo.nested = 0;
+  return prof_now();
+}
+
+/** Finish timing a callback.
+ * @param[in] start Start time from prof_enter().
+ * @param[in] nested Saved value from prof_enter().
+ * @return Microseconds used by the callback itself.
+ */
+static unsigned long
+prof_leave(uint64_t start, uint64_t nested)
+{
+  uint64_t now = prof_now(), elapsed;
+
+  elapsed = now > start ? now - start : 0; /* clock may step backward */
+  now = profInfo.nested; /* time used by nested callbacks */
+  profInfo.nested = nested + elapsed;
+
+  return elapsed > now ? elapsed - now : 0;
+}
+
+/** Charge time to a statistics entry.
+ * @param[in,out] cs Entry to update.
+ * @param[in] usec Microseconds to charge.
+ * @param[in] pass If non-zero, also charge the time to the current pass.
+ */
+static void
+prof_charge(struct CallbackStats* cs, unsigned long usec, int pass)
+{
+  cs->cs_calls++;
+  cs->cs_total += usec;
+  if (usec > cs->cs_max)
+    cs->cs_max = usec;
+
+  if (!pass)
+    return;
+  if (cs->cs_pass_seq != profInfo.pass_seq) { /* first use this pass */
+    cs->cs_pass_seq = profInfo.pass_seq;
+    cs->cs_pass = 0;
+    cs->cs_pass_next = profInfo.pass_list;
+    profInfo.pass_list = cs;
+  }
+  cs->cs_pass += usec;
+}
+
+/** Finish the statistics for an event loop pass, recording and
+ * logging it if it took longer than FEAT_STALL_THRESHOLD.
+ */
+static void
+prof_pass_end(void)
+{
+  struct LoopStall stall;
+  struct CallbackStats* cs;
+  unsigned long attributed = 0, threshold;
+  uint64_t now;
+  char buf[256];
+  int ii;
+
+  if (profInfo.pass_start) {
+    memset(&stall, 0, sizeof(stall));
+    now = prof_now();
+    stall.ls_when = CurrentTime;
+    stall.ls_usec = now > profInfo.pass_start ? now - profInfo.pass_start : 0;
+    stall.ls_events = profInfo.pass_events;
+
+    /* find the callbacks that used the most time */
+    for (cs = profInfo.pass_list; cs; cs = cs->cs_pass_next) {
+      attributed += cs->cs_pass;
+      for (ii = LOOP_STALL_TOP; ii > 0; ii--) {
+	if (stall.ls_top[ii - 1] && stall.ls_top_usec[ii - 1] >= cs->cs_pass)
+	  break;
+	if (ii < LOOP_STALL_TOP) {
+	  stall.ls_top[ii] = stall.ls_top[ii - 1];
+	  stall.ls_top_usec[ii] = stall.ls_top_usec[ii - 1];
+	}
+      }
+      if (ii < LOOP_STALL_TOP) {
+	stall.ls_top[ii] = cs;
+	stall.ls_top_usec[ii] = cs->cs_pass;
+      }
+    }
+    stall.ls_other = stall.ls_usec > attributed ?
+      stall.ls_usec - attributed : 0;
+
+    loopStats.ls_passes++;
+    loopStats.ls_busy += stall.ls_usec;
+    if (stall.ls_usec > loopStats.ls_worst.ls_usec)
+      loopStats.ls_worst = stall;
+
+    threshold = feature_int(FEAT_STALL_THRESHOLD) * 1000;
+    if (threshold && stall.ls_usec >= threshold) {
+      loopStats.ls_stalls++;
+      loopStats.ls_ring[loopStats.ls_ring_next] = stall;
+      loopStats.ls_ring_next = (loopStats.ls_ring_next + 1) % LOOP_STALL_RING;
+      loop_stall_describe(buf, sizeof(buf), &stall);
+      log_write(LS_STALL, L_WARNING, 0, "Event loop stalled: %s", buf);
+    }
+  }
+
+  profInfo.pass_start = 0;
+  profInfo.pass_seq++;
+  profInfo.pass_events = 0;
+  profInfo.pass_list = 0;
+  profInfo.nested = 0;
+}
+
 /** Initialize a struct GenHeader.
  * @param[in,out] gen GenHeader to initialize.
  * @param[in] call Callback for generated events.
@@ -150,6 +330,11 @@ gen_init(struct GenHeader* gen, EventCallBack call, void* data,
 static void
 event_execute(struct Event* event)
 {
+  EventCallBack call;
+  enum EventType type;
+  uint64_t start, nested;
+  unsigned long usec;
+
   assert(0 != event);
   assert(0 == event->ev_prev_p); /* must be off queue first */
   assert(event->ev_gen.gen_header->gh_flags & GEN_ACTIVE);
@@ -159,7 +344,17 @@ event_execute(struct Event* event)
   if (event->ev_type == ET_ERROR) /* turn on error flag before callback */
     event->ev_gen.gen_header->gh_flags |= GEN_ERROR;
 
-  (*event->ev_gen.gen_header->gh_call)(event); /* execute the event */
+  /* the generator may be freed by an ET_DESTROY callback */
+  call = event->ev_gen.gen_header->gh_call;
+  type = event->ev_type;
+
+  start = prof_enter(&nested);
+  (*call)(event); /* execute the event */
+  usec = prof_leave(start, nested);
+
+  prof_charge(prof_callback(call), usec, 1);
+  prof_charge(&loopStats.ls_types[type], usec, 0);
+  profInfo.pass_events++;
 
   /* The logic here is very careful; if the event was an ET_DESTROY,
    * then we must assume the generator is now invalid; fortunately, we
@@ -240,14 +435,64 @@ event_add(struct Event* event)
 }
 #endif /* IRCD_THREADED */
 
+/** Mask selecting a slot of the innermost timer wheel. */
+#define TIMER_NEAR_MASK	(TIMER_NEAR_SIZE - 1)
+/** Mask selecting a slot of an outer timer wheel. */
+#define TIMER_FAR_MASK	(TIMER_FAR_SIZE - 1)
+/** Number of bits to shift an expiration time to index outer wheel \a lvl. */
+#define TIMER_FAR_SHIFT(lvl)	(TIMER_NEAR_BITS + (lvl) * TIMER_FAR_BITS)
+/** If the clock moves further than this, rebuild the wheel rather than
+ * stepping through every second in between.
+ */
+#define TIMER_REBASE_GAP	(TIMER_NEAR_SIZE * TIMER_FAR_SIZE)
+
+/** Timer queue statistics. */
+static struct TimerStats timerStats;
+
+/** Find the wheel slot for a timer expiring at \a expire.
+ * @param[in] tw Timer wheel to search.
+ * @param[in] expire Expiration time of the timer.
+ * @return Pointer to head of the slot's list.
+ */
+static struct GenHeader**
+timer_slot(struct TimerWheel* tw, time_t expire)
+{
+  time_t delta;
+  int lvl;
+
+  if (expire < tw->tw_now)
+    return &tw->tw_due; /* overdue; run it on the next pass */
+  delta = expire - tw->tw_now;
+
+  if (delta < TIMER_NEAR_SIZE)
+    return &tw->tw_near[expire & TIMER_NEAR_MASK];
+  for (lvl = 0; lvl < TIMER_FAR_LEVELS; lvl++)
+    if (delta < (time_t) 1 << TIMER_FAR_SHIFT(lvl + 1))
+      return &tw->tw_far[lvl][(expire >> TIMER_FAR_SHIFT(lvl)) &
+			      TIMER_FAR_MASK];
+  return &tw->tw_overflow;
+}
+
+/** Link a timer into a wheel slot.
+ * @param[in,out] slot Head of the slot's list.
+ * @param[in] gen Timer generator to link in.
+ */
+static void
+timer_link(struct GenHeader** slot, struct GenHeader* gen)
+{
+  gen->gh_next = *slot;
+  gen->gh_prev_p = slot;
+  if (*slot)
+    (*slot)->gh_prev_p = &gen->gh_next;
+  *slot = gen;
+}
+
 /** Place a timer in the correct spot on the queue.
  * @param[in] timer Timer to enqueue.
  */
 static void
 timer_enqueue(struct Timer* timer)
 {
-  struct GenHeader** ptr_p;
-
   assert(0 != timer);
   assert(0 == timer->t_header.gh_prev_p); /* not already on queue */
   assert(timer->t_header.gh_flags & GEN_ACTIVE); /* timer is active */
@@ -263,18 +508,70 @@ timer_enqueue(struct Timer* timer)
     break;
   }
 
-  /* Find a slot to insert timer */
-  for (ptr_p = &evInfo.gens.g_timer; ;
-       ptr_p = &(*ptr_p)->gh_next)
-    if (!*ptr_p || timer->t_expire < ((struct Timer*)*ptr_p)->t_expire)
-      break;
+  timer_link(timer_slot(&evInfo.gens.g_timer, timer->t_expire),
+	     &timer->t_header);
+  timerStats.ts_enqueued++;
+}
 
-  /* link it in the right place */
-  timer->t_header.gh_next = *ptr_p;
-  timer->t_header.gh_prev_p = ptr_p;
-  if (*ptr_p)
-    (*ptr_p)->gh_prev_p = &timer->t_header.gh_next;
-  *ptr_p = &timer->t_header;
+/** Move every timer in a wheel slot to where it now belongs.
+ * @param[in] tw Timer wheel the slot belongs to.
+ * @param[in,out] slot Head of the slot's list.
+ */
+static void
+timer_cascade(struct TimerWheel* tw, struct GenHeader** slot)
+{
+  struct GenHeader* list = *slot;
+  struct GenHeader* gen;
+
+  /* Detach the list first, since timers may land back in this slot. */
+  *slot = 0;
+  if (list)
+    list->gh_prev_p = &list;
+
+  while ((gen = list)) {
+    gen_dequeue(gen);
+    timer_link(timer_slot(tw, ((struct Timer*) gen)->t_expire), gen);
+    timerStats.ts_cascaded++;
+  }
+}
+
+/** Move timers inward when the innermost wheel wraps around.
+ * @param[in] tw Timer wheel to update.
+ */
+static void
+timer_cascade_all(struct TimerWheel* tw)
+{
+  unsigned int lvl, idx;
+
+  for (lvl = 0; lvl < TIMER_FAR_LEVELS; lvl++) {
+    idx = (tw->tw_now >> TIMER_FAR_SHIFT(lvl)) & TIMER_FAR_MASK;
+    timer_cascade(tw, &tw->tw_far[lvl][idx]);
+    if (idx)
+      return; /* outer wheels have not wrapped */
+  }
+  timer_cascade(tw, &tw->tw_overflow);
+}
+
+/** Rebuild the timer wheel around the current time.
+ * This is used at startup and whenever the clock jumps, so that the
+ * wheel never has to be stepped through a long span of empty seconds.
+ * @param[in] tw Timer wheel to rebuild.
+ */
+static void
+timer_rebase(struct TimerWheel* tw)
+{
+  unsigned int lvl, idx;
+
+  tw->tw_now = CurrentTime;
+  timerStats.ts_rebased++;
+
+  timer_cascade(tw, &tw->tw_due);
+  for (idx = 0; idx < TIMER_NEAR_SIZE; idx++)
+    timer_cascade(tw, &tw->tw_near[idx]);
+  for (lvl = 0; lvl < TIMER_FAR_LEVELS; lvl++)
+    for (idx = 0; idx < TIMER_FAR_SIZE; idx++)
+      timer_cascade(tw, &tw->tw_far[lvl][idx]);
+  timer_cascade(tw, &tw->tw_overflow);
 }
 
 /** &Signal handler for writing signal notification to pipe.
@@ -342,8 +639,17 @@ gen_dequeue(void* arg)
 void
 event_init(int max_sockets)
 {
+  static const char* type_names[] = {
+    "read", "write", "accept", "connect", "eof", "error", "signal",
+    "expire", "destroy"
+  };
   int i, p[2];
 
+  for (i = 0; i <= ET_DESTROY; i++) /* name the stall profiler entries */
+    loopStats.ls_types[i].cs_name = type_names[i];
+  loopStats.ls_timers.cs_name = "timer_run";
+  loopStats.ls_ticks.cs_name = "tick_run";
+
   for (i = 0; evEngines[i]; i++) { /* look for an engine... */
     assert(0 != evEngines[i]->eng_name);
     assert(0 != evEngines[i]->eng_init);
@@ -355,6 +661,7 @@ event_init(int max_sockets)
   assert(0 != evEngines[i]);
 
   evInfo.engine = evEngines[i]; /* save engine */
+  evInfo.gens.g_timer.tw_now = CurrentTime; /* start the timer wheel */
 
   if (!evInfo.engine->eng_signal) { /* engine can't do signals */
     if (pipe(p)) {
@@ -363,8 +670,8 @@ event_init(int max_sockets)
     }
 
     sigInfo.fd = p[1]; /* write end of pipe */
-    socket_add(&sigInfo.sock, signal_callback, 0, SS_NOTSOCK,
-	       SOCK_EVENT_READABLE, p[0]); /* read end of pipe */
+    socket_add_named(&sigInfo.sock, signal_callback, 0, SS_NOTSOCK,
+		     SOCK_EVENT_READABLE, p[0]); /* read end of pipe */
   }
 }
 
@@ -378,6 +685,80 @@ event_loop(void)
   (*evInfo.engine->eng_loop)(&evInfo.gens);
 }
 
+/** Note that the engine has finished waiting for events and is
+ * starting a new event loop pass.  The pass ends when tick_run()
+ * returns.
+ */
+void
+event_pass_start(void)
+{
+  profInfo.pass_start = prof_now();
+}
+
+/** Remember the name of an event callback for loop_stats().
+ * This is normally called through the timer_add_named(),
+ * signal_add_named() and socket_add_named() macros.
+ * @param[in] call Callback function.
+ * @param[in] name Name of the callback function.
+ */
+void
+event_name_callback(EventCallBack call, const char* name)
+{
+  struct CallbackStats* cs = prof_callback(call);
+
+  if (cs->cs_call == call)
+    cs->cs_name = name;
+}
+
+/** Get a printable name for an entry in loop_stats().
+ * @param[in] cs Statistics entry.
+ * @return Name of the callback, or its address if the name is unknown.
+ */
+const char*
+loop_callback_name(const struct CallbackStats* cs)
+{
+  static char buf[32];
+
+  if (cs->cs_name)
+    return cs->cs_name;
+  ircd_snprintf(0, buf, sizeof(buf), "0x%lx", (unsigned long) cs->cs_call);
+  return buf;
+}
+
+/** Describe a slow event loop pass.
+ * @param[out] buf Output buffer.
+ * @param[in] len Length of \a buf.
+ * @param[in] stall Pass to describe.
+ */
+void
+loop_stall_describe(char* buf, size_t len, const struct LoopStall* stall)
+{
+  size_t pos;
+  int ii;
+
+  pos = ircd_snprintf(0, buf, len, "%lu.%03lu ms, %lu events",
+		      stall->ls_usec / 1000, stall->ls_usec % 1000,
+		      stall->ls_events);
+  for (ii = 0; ii < LOOP_STALL_TOP && stall->ls_top_usec[ii] && pos < len;
+       ii++)
+    pos += ircd_snprintf(0, buf + pos, len - pos, "; %s %lu.%03lu ms",
+			 loop_callback_name(stall->ls_top[ii]),
+			 stall->ls_top_usec[ii] / 1000,
+			 stall->ls_top_usec[ii] % 1000);
+  if (pos < len)
+    ircd_snprintf(0, buf + pos, len - pos, "; other %lu.%03lu ms",
+		  stall->ls_other / 1000, stall->ls_other % 1000);
+}
+
+/** Get the event loop timing statistics.
+ * @return Pointer to the statistics.
+ */
+const struct LoopStats*
+loop_stats(void)
+{
+  return &loopStats;
+}
+
 /** Generate an event and add it to the queue (or execute it).
  * @param[in] type Type of event to generate.
  * @param[in] arg Pointer to an event generator (GenHeader).
@@ -415,29 +796,40 @@ event_generate(enum EventType type, void* arg, int data)
 }
 
 #if 0
-/* Try to verify the timer list */
-void
-timer_verify(void)
+/* Try to verify the timer wheel */
+static void
+timer_verify_slot(struct GenHeader** slot)
 {
-  struct Timer* ptr;
-  struct Timer** ptr_p = &evInfo.gens.g_timer;
-  time_t lasttime = 0;
-
-  for (ptr = evInfo.gens.g_timer; ptr;
-       ptr = (struct Timer*) ptr->t_header.gh_next) {
-    /* verify timer is supposed to be in the list */
-    assert(ptr->t_header.gh_prev_p);
-    /* verify timer is correctly ordered */
-    assert((struct Timer**) ptr->t_header.gh_prev_p == ptr_p);
+  struct GenHeader* ptr;
+  struct GenHeader** ptr_p = slot;
+
+  for (ptr = *slot; ptr; ptr = ptr->gh_next) {
+    /* verify timer is correctly linked */
+    assert(ptr->gh_prev_p == ptr_p);
     /* verify timer is active */
-    assert(ptr->t_header.gh_flags & GEN_ACTIVE);
-    /* verify timer ordering is correct */
-    assert(lasttime <= ptr->t_expire);
+    assert(ptr->gh_flags & GEN_ACTIVE);
+    /* verify timer is in the slot it belongs in */
+    assert(timer_slot(&evInfo.gens.g_timer, ((struct Timer*) ptr)->t_expire)
+	   == slot);
 
-    lasttime = ptr->t_expire; /* store time for ordering check */
-    ptr_p = (struct Timer**) &ptr->t_header.gh_next; /* store prev pointer */
+    ptr_p = &ptr->gh_next; /* store prev pointer */
   }
 }
+
+void
+timer_verify(void)
+{
+  struct TimerWheel* tw = &evInfo.gens.g_timer;
+  unsigned int lvl, idx;
+
+  timer_verify_slot(&tw->tw_due);
+  for (idx = 0; idx < TIMER_NEAR_SIZE; idx++)
+    timer_verify_slot(&tw->tw_near[idx]);
+  for (lvl = 0; lvl < TIMER_FAR_LEVELS; lvl++)
+    for (idx = 0; idx < TIMER_FAR_SIZE; idx++)
+      timer_verify_slot(&tw->tw_far[lvl][idx]);
+  timer_verify_slot(&tw->tw_overflow);
+}
 #endif
 
 /** Initialize a timer structure.
@@ -541,20 +933,19 @@ timer_chg(struct Timer* timer, enum TimerType type, time_t value)
   timer_enqueue(timer); /* re-queue the timer */
 }
 
-/** Execute all expired timers. */
-void
-timer_run(void)
+/** Execute all timers in a wheel slot.
+ * @param[in,out] slot Head of the slot's list.
+ */
+static void
+timer_expire(struct GenHeader** slot)
 {
   struct Timer* ptr;
 
-  /* go through queue... */
-  while ((ptr = (struct Timer*)evInfo.gens.g_timer)) {
-    if (CurrentTime < ptr->t_expire)
-      break; /* processed all pending timers */
-
+  while ((ptr = (struct Timer*) *slot)) {
     gen_dequeue(ptr); /* must dequeue timer here */
     ptr->t_header.gh_flags |= (GEN_MARKED |
 			       (ptr->t_type == TT_PERIODIC ? GEN_READD : 0));
+    timerStats.ts_expired++;
 
     event_generate(ET_EXPIRE, ptr, 0); /* generate expire event */
 
@@ -571,6 +962,125 @@ timer_run(void)
   }
 }
 
+/** Execute all expired timers. */
+void
+timer_run(void)
+{
+  struct TimerWheel* tw = &evInfo.gens.g_timer;
+  uint64_t start, nested;
+
+  start = prof_enter(&nested);
+
+  /* Rebuild the wheel at startup or if the clock jumped. */
+  if (CurrentTime < tw->tw_now - 1 || CurrentTime - tw->tw_now > TIMER_REBASE_GAP)
+    timer_rebase(tw);
+
+  timer_expire(&tw->tw_due); /* run timers that were added already due */
+
+  /* step through each second up to the current time... */
+  for (; tw->tw_now <= CurrentTime; tw->tw_now++) {
+    if (!(tw->tw_now & TIMER_NEAR_MASK))
+      timer_cascade_all(tw); /* innermost wheel wrapped */
+    timer_expire(&tw->tw_near[tw->tw_now & TIMER_NEAR_MASK]);
+  }
+  prof_charge(&loopStats.ls_timers, prof_leave(start, nested), 1);
+}
+
+/** Find when the event loop next needs to wake up for timers.
+ * This may be earlier than the first timer expiration if timers must
+ * be moved in from an outer wheel first.
+ * @param[in] gen Generators holding the timer wheel.
+ * @return Time of next timer processing, or 0 if no timers are queued.
+ */
+time_t
+timer_next(struct Generators* gen)
+{
+  struct TimerWheel* tw = &gen->g_timer;
+  unsigned int lvl, idx;
+  time_t when;
+
+  if (tw->tw_due || tw->tw_now <= CurrentTime)
+    return CurrentTime; /* timer_run() has not caught up yet */
+  if (!(tw->tw_now & TIMER_NEAR_MASK))
+    return tw->tw_now; /* outer wheels are due to cascade */
+
+  /* look for a timer due before the innermost wheel next wraps */
+  for (when = tw->tw_now; ; when++) {
+    if (tw->tw_near[when & TIMER_NEAR_MASK])
+      return when;
+    if (!((when + 1) & TIMER_NEAR_MASK))
+      break;
+  }
+
+  /* otherwise wake up for the wrap if any timer is queued at all */
+  for (idx = 0; idx < TIMER_NEAR_SIZE; idx++)
+    if (tw->tw_near[idx])
+      return when + 1;
+  for (lvl = 0; lvl < TIMER_FAR_LEVELS; lvl++)
+    for (idx = 0; idx < TIMER_FAR_SIZE; idx++)
+      if (tw->tw_far[lvl][idx])
+	return when + 1;
+  return tw->tw_overflow ? when + 1 : 0;
+}
+
+/** Collect timer queue statistics.
+ * @return Pointer to a static structure with current statistics.
+ */
+const struct TimerStats*
+timer_stats(void)
+{
+  struct TimerWheel* tw = &evInfo.gens.g_timer;
+  struct GenHeader* gen;
+  unsigned int lvl, idx;
+
+  timerStats.ts_pending = 0;
+  for (gen = tw->tw_due; gen; gen = gen->gh_next)
+    timerStats.ts_pending++;
+  for (idx = 0; idx < TIMER_NEAR_SIZE; idx++)
+    for (gen = tw->tw_near[idx]; gen; gen = gen->gh_next)
+      timerStats.ts_pending++;
+  for (lvl = 0; lvl < TIMER_FAR_LEVELS; lvl++)
+    for (idx = 0; idx < TIMER_FAR_SIZE; idx++)
+      for (gen = tw->tw_far[lvl][idx]; gen; gen = gen->gh_next)
+	timerStats.ts_pending++;
+  for (gen = tw->tw_overflow; gen; gen = gen->gh_next)
+    timerStats.ts_pending++;
+
+  return &timerStats;
+}
+
+/** Register work to be done at the end of every event loop pass.
+ * This lets callers batch up per-event work (such as socket flushes)
+ * and perform it once after the engine has dispatched all ready events.
+ * @param[in] tick Tick handler structure to link in.
+ * @param[in] call Function to call once per loop pass.
+ */
+void
+tick_add(struct Tick* tick, TickCallBack call)
+{
+  assert(0 != tick);
+  assert(0 != call);
+
+  tick->tk_call = call;
+  tick->tk_next = tickList;
+  tickList = tick;
+}
+
+/** Run all registered tick handlers and finish the event loop pass. */
+void
+tick_run(void)
+{
+  struct Tick* ptr;
+  uint64_t start, nested;
+
+  start = prof_enter(&nested);
+  for (ptr = tickList; ptr; ptr = ptr->tk_next)
+    (*ptr->tk_call)();
+  prof_charge(&loopStats.ls_ticks, prof_leave(start, nested), 1);
+
+  prof_pass_end();
+}
+
 /** Adds a signal to the event callback system.
  * @param[in] signal Signal event generator to use.
  * @param[in] call Callback function to use.
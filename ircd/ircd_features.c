@@ -23,10 +23,12 @@
 #include "config.h"
 
 #include "ircd_features.h"
-#include "channel.h"	/* list_set_default */
+#include "accept_pool.h"
+#include "channel.h"	/* list_set_default, ban_ident_flush */
 #include "class.h"
 #include "client.h"
 #include "hash.h"
+#include "ident_cache.h"	/* ident_cache_resize */
 #include "ircd.h"
 #include "ircd_alloc.h"
 #include "ircd_log.h"
@@ -38,10 +40,12 @@
 #include "numeric.h"
 #include "numnicks.h"
 #include "random.h"	/* random_seed_set */
+#include "res.h"	/* res_cache_resize */
 #include "s_bsd.h"
 #include "s_debug.h"
 #include "s_misc.h"
 #include "s_stats.h"
+#include "s_user.h"	/* welcome_reset */
 #include "send.h"
 #include "struct.h"
 #include "sys.h"    /* FALSE bleah */
@@ -299,6 +303,8 @@ static struct FeatureDesc {
   /* Misc. features */
   F_N(LOG, FEAT_MYOPER, feature_log_set, feature_log_reset, feature_log_get,
       0, log_feature_unmark, log_feature_mark, log_feature_report),
+  F_B(LOG_ASYNC, 0, 0, log_async_update),
+  F_I(LOG_BUFFER_SIZE, 0, 65536, log_async_update),
   F_S(DOMAINNAME, 0, DOMAINNAME, 0),
   F_B(RELIABLE_CLOCK, 0, 0, 0),
   F_I(BUFFERPOOL, 0, 27000000, 0),
@@ -306,8 +312,8 @@ static struct FeatureDesc {
   F_I(CLIENT_FLOOD, 0, 1024, 0),
   F_I(SERVER_PORT, FEAT_OPER, 4400, 0),
   F_B(NODEFAULTMOTD, 0, 1, 0),
-  F_S(MOTD_BANNER, FEAT_NULL, 0, 0),
-  F_S(PROVIDER, FEAT_NULL, 0, 0),
+  F_S(MOTD_BANNER, FEAT_NULL, 0, motd_recache),
+  F_S(PROVIDER, FEAT_NULL, 0, welcome_reset),
   F_B(KILL_IPMISMATCH, FEAT_OPER, 0, 0),
   F_B(IDLE_FROM_MSG, 0, 1, 0),
   F_B(HUB, 0, 0, feature_notify_hub),
@@ -315,25 +321,26 @@ static struct FeatureDesc {
   F_B(NODNS, 0, 0, 0),
   F_N(RANDOM_SEED, FEAT_NODISP, random_seed_set, 0, 0, 0, 0, 0, 0),
   F_S(DEFAULT_LIST_PARAM, FEAT_NULL, 0, list_set_default),
+  F_I(LIST_CACHE, 0, 5, list_set_default),
   F_I(NICKNAMEHISTORYLENGTH, 0, 800, whowas_realloc),
   F_B(HOST_HIDING, 0, 1, 0),
-  F_S(HIDDEN_HOST, FEAT_CASE, "users.undernet.org", 0),
+  F_S(HIDDEN_HOST, FEAT_CASE, "users.undernet.org", ban_ident_flush),
   F_S(HIDDEN_IP, 0, "127.0.0.1", 0),
   F_B(CONNEXIT_NOTICES, 0, 0, 0),
-  F_B(OPLEVELS, 0, 0, 0),
+  F_B(OPLEVELS, 0, 0, welcome_reset),
   F_B(ZANNELS, 0, 0, 0),
-  F_B(LOCAL_CHANNELS, 0, 1, 0),
+  F_B(LOCAL_CHANNELS, 0, 1, welcome_reset),
   F_B(TOPIC_BURST, 0, 0, 0),
   F_B(DISABLE_GLINES, 0, 0, 0),
   F_B(JOIN_TARGET, 0, 0, 0),
 
   /* features that probably should not be touched */
   F_I(KILLCHASETIMELIMIT, 0, 30, 0),
-  F_I(MAXCHANNELSPERUSER, 0, 10, 0),
-  F_I(NICKLEN, 0, 12, 0),
+  F_I(MAXCHANNELSPERUSER, 0, 10, welcome_reset),
+  F_I(NICKLEN, 0, 12, welcome_reset),
   F_I(AVBANLEN, 0, 40, 0),
-  F_I(MAXBANS, 0, 100, 0),
-  F_I(MAXSILES, 0, 25, 0),
+  F_I(MAXBANS, 0, 100, welcome_reset),
+  F_I(MAXSILES, 0, 25, welcome_reset),
   F_I(HANGONGOODLINK, 0, 300, 0),
   F_I(HANGONRETRYDELAY, 0, 10, 0),
   F_I(CONNECTTIMEOUT, 0, 90, 0),
@@ -348,7 +355,8 @@ static struct FeatureDesc {
   F_I(IPCHECK_48_CLONE_LIMIT, 0, 50, 0),
   F_I(IPCHECK_48_CLONE_PERIOD, 0, 10, 0),
   F_I(IPCHECK_CLONE_DELAY, 0, 600, 0),
-  F_I(CHANNELLEN, 0, 200, 0),
+  F_I(IPCHECK_IPV6_PREFIX, 0, 64, 0),
+  F_I(CHANNELLEN, 0, 200, welcome_reset),
 
   /* Some misc. default paths */
   F_S(MPATH, FEAT_CASE | FEAT_MYOPER, "ircd.motd", motd_init),
@@ -359,9 +367,20 @@ static struct FeatureDesc {
   F_I(TOS_SERVER, 0, 0x08, 0),
   F_I(TOS_CLIENT, 0, 0x08, 0),
   F_I(POLLS_PER_LOOP, 0, 200, 0),
+  F_I(ACCEPT_THREADS, 0, 0, accept_pool_update),
+  F_I(STALL_THRESHOLD, 0, 200, 0),
+  F_I(BURST_BUDGET, 0, 65536, 0),
+  F_I(SENDQ_COALESCE, 0, 16384, 0),
   F_I(IRCD_RES_RETRIES, 0, 2, 0),
   F_I(IRCD_RES_TIMEOUT, 0, 4, 0),
+  F_I(IRCD_RES_CACHE_SIZE, 0, 4096, res_cache_resize),
+  F_I(IRCD_RES_CACHE_TTL, 0, 600, 0),
+  F_I(IRCD_RES_NEGATIVE_TTL, 0, 60, 0),
   F_I(AUTH_TIMEOUT, 0, 9, 0),
+  F_I(IDENT_CACHE_SIZE, 0, 4096, ident_cache_resize),
+  F_I(IDENT_CACHE_DECAY, 0, 900, 0),
+  F_I(IDENT_SKIP_TIMEOUTS, 0, 5, 0),
+  F_B(IAUTH_BATCH, 0, 1, 0),
   F_B(ANNOUNCE_INVITES, 0, 0, 0),
 
   /* features that affect all operators */
@@ -405,6 +424,10 @@ static struct FeatureDesc {
   F_B(HIS_STATS_y, 0, 1, 0),
   F_B(HIS_STATS_z, 0, 1, 0),
   F_B(HIS_STATS_IAUTH, 0, 1, 0),
+  F_B(HIS_STATS_HASH, 0, 1, 0),
+  F_B(HIS_STATS_IPCHECK, 0, 1, 0),
+  F_B(HIS_STATS_IDENT, 0, 1, 0),
+  F_B(HIS_STATS_LOGS, 0, 1, 0),
   F_B(HIS_WEBIRC, 0, 1, 0),
   F_B(HIS_WHOIS_SERVERNAME, 0, 1, 0),
   F_B(HIS_WHOIS_IDLETIME, 0, 1, 0),
@@ -422,7 +445,7 @@ static struct FeatureDesc {
   F_S(HIS_URLSERVERS, 0, "http://www.undernet.org/servers.php", 0),
 
   /* Misc. random stuff */
-  F_S(NETWORK, 0, "UnderNet", 0),
+  F_S(NETWORK, 0, "UnderNet", welcome_reset),
   F_S(URL_CLIENTS, 0, "ftp://ftp.undernet.org/pub/irc/clients", 0),
   F_S(URLREG, 0, "http://cservice.undernet.org/live/", 0),
 
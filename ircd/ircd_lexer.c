@@ -171,6 +171,7 @@ static const struct lexer_token tokens[] = {
   { "weeks", WEEKS },
   { "whox", TPRIV_WHOX },
   { "wide_gline", TPRIV_WIDE_GLINE },
+  { "workers", WORKERS },
   { "years", YEARS },
   { "yes", YES },
   { NULL, 0 }
@@ -23,12 +23,22 @@
 /** @file
  * @brief IRC logging implementation.
  * @version $Id$
+ *
+ * When FEAT_LOG_ASYNC is set, lines for log files are not written
+ * directly.  They are copied into a ring buffer for each file, which a
+ * background writer thread empties (or, on systems without threads,
+ * the end of each event loop pass).  A line that does not fit in its
+ * ring is dropped and counted instead of making the server wait for
+ * the disk, and a note with the number of dropped lines is written
+ * once there is room again.
  */
 #include "config.h"
 
 #include "ircd_log.h"
 #include "client.h"
 #include "ircd_alloc.h"
+#include "ircd_events.h"
+#include "ircd_features.h"
 #include "ircd_reply.h"
 #include "ircd_snprintf.h"
 #include "ircd_string.h"
@@ -52,6 +62,13 @@
 #include <time.h>
 #include <unistd.h>
 
+#if defined(HAVE_PTHREADS) && defined(HAVE_PTHREAD_H)
+/** Buffered log files can be written by a background thread. */
+#define LOG_THREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+
 int log_inassert = 0;
 
 #define LOG_BUFSIZE 2048 /**< Maximum length for a log message. */
@@ -163,6 +180,7 @@ static struct LogDesc {
   S(RESOLVER, -1, 0),
   S(SOCKET, -1, 0),
   S(IAUTH, -1, SNO_NETWORK),
+  S(STALL, -1, 0),
   S(DEBUG, -1, SNO_DEBUG),
 #undef S
   { LS_LAST_SYSTEM, 0, 0, -1, 0, -1, 0 }
@@ -175,6 +193,12 @@ struct LogFile {
   int		   fd;	   /**< file's descriptor-- -1 if not open */
   int		   ref;	   /**< how many things refer to us? */
   char		  *file;   /**< file name */
+  char		  *buf;	   /**< ring of lines waiting to be written */
+  size_t	   size;   /**< size of ring; a power of two */
+  size_t	   head;   /**< total bytes put into the ring */
+  size_t	   tail;   /**< total bytes taken out of the ring */
+  int		   busy;   /**< writer thread is writing from the ring */
+  unsigned long	   dropped; /**< lines dropped since the last note */
 };
 
 /** Modifiable static information. */
@@ -186,6 +210,42 @@ static struct {
   struct LogFile *dbfile;   /**< debug file */
 } logInfo = { 0, 0, LOG_USER, "ircd", 0 };
 
+/** Smallest ring buffer for a log file. */
+#define LOG_RING_MIN	4096
+/** Largest ring buffer for a log file. */
+#define LOG_RING_MAX	(16 << 20)
+
+/** State of the buffered log writer. */
+static struct {
+  int		  active;  /**< log files are buffered */
+  int		  pending; /**< lines were queued during this loop pass */
+  size_t	  size;	   /**< ring size for log files */
+  unsigned long	  queued;  /**< lines put into rings */
+  unsigned long	  dropped; /**< lines dropped because a ring was full */
+  unsigned long	  writes;  /**< write() calls made from rings */
+  unsigned long	  errors;  /**< failed write() calls */
+  struct Tick	  tick;	   /**< end of loop pass handler */
+#ifdef LOG_THREAD
+  pthread_mutex_t lock;	   /**< protects rings, counters and file list */
+  pthread_cond_t  wake;	   /**< signalled when the writer has work */
+  pthread_cond_t  idle;	   /**< signalled when the writer finishes a write */
+  pthread_t	  thread;  /**< writer thread */
+  int		  running; /**< writer thread was started */
+  int		  waiting; /**< writer thread is waiting for work */
+  int		  stop;	   /**< writer thread should exit */
+#endif
+} logAsync;
+
+#ifdef LOG_THREAD
+/** Lock the rings against the writer thread. */
+#define log_lock()	pthread_mutex_lock(&logAsync.lock)
+/** Release the lock taken by log_lock(). */
+#define log_unlock()	pthread_mutex_unlock(&logAsync.lock)
+#else
+#define log_lock()	((void)0)
+#define log_unlock()	((void)0)
+#endif
+
 /** Helper routine to open a log file if needed.
  * If the log file is already open, do nothing.
  * @param[in,out] lf Log file to open.
@@ -248,6 +308,7 @@ log_debug_init(int usetty)
   logInfo.dbfile->prev_p = 0;
   logInfo.dbfile->fd = -1;
   logInfo.dbfile->ref = 1;
+  logInfo.dbfile->buf = 0; /* the debug log is never buffered */
 
   if (usetty) /* store pathname to use */
     logInfo.dbfile->file = 0;
@@ -286,6 +347,367 @@ log_debug_file(const char *file)
   return 0;
 }
 
+/** Build the timestamp that starts each line in a log file.
+ * The text is only formatted again when TStime() changes.
+ * @param[out] len Receives the length of the timestamp.
+ * @return Timestamp text, such as "[2000-11-28 16:11:20] ".
+ */
+static const char *
+log_timestamp(size_t *len)
+{
+  static time_t last = -1;
+  static size_t last_len;
+  /* 1234567890123456789012 3 */
+  /* [2000-11-28 16:11:20] \0 */
+  static char timebuf[23];
+  struct tm *tstamp;
+  time_t curtime;
+
+  curtime = TStime();
+  if (curtime != last) {
+    tstamp = localtime(&curtime); /* build the timestamp */
+
+    last_len =
+      ircd_snprintf(0, timebuf, sizeof(timebuf), "[%d-%d-%d %d:%02d:%02d] ",
+		    tstamp->tm_year + 1900, tstamp->tm_mon + 1,
+		    tstamp->tm_mday, tstamp->tm_hour, tstamp->tm_min,
+		    tstamp->tm_sec);
+    last = curtime;
+  }
+
+  *len = last_len;
+  return timebuf;
+}
+
+/** Account for a write() of data from a log file's ring.
+ * Must be called with the log lock held.
+ * @param[in,out] lf Log file that was written.
+ * @param[in] res Return value from write().
+ */
+static void
+log_written(struct LogFile *lf, ssize_t res)
+{
+  logAsync.writes++;
+  if (res >= 0)
+    lf->tail += res;
+  else if (errno != EINTR && errno != EAGAIN) {
+    logAsync.errors++;
+    lf->tail = lf->head; /* throw away what we could not write */
+  }
+}
+
+/** Get the next contiguous run of bytes waiting in a log file's ring.
+ * @param[in] lf Log file with a non-empty ring.
+ * @param[out] len Receives the number of bytes in the run.
+ * @return Start of the run.
+ */
+static const char *
+log_ring_chunk(const struct LogFile *lf, size_t *len)
+{
+  size_t off = lf->tail & (lf->size - 1);
+
+  *len = lf->head - lf->tail;
+  if (*len > lf->size - off)
+    *len = lf->size - off;
+  return lf->buf + off;
+}
+
+/** Write everything buffered for a log file before returning.
+ * Must be called with the log lock held.
+ * @param[in,out] lf Log file to drain.
+ */
+static void
+log_drain(struct LogFile *lf)
+{
+  const char *data;
+  size_t len;
+
+#ifdef LOG_THREAD
+  while (lf->busy) /* let the writer thread finish its write first */
+    pthread_cond_wait(&logAsync.idle, &logAsync.lock);
+#endif
+
+  while (lf->head != lf->tail) {
+    data = log_ring_chunk(lf, &len);
+    log_written(lf, write(lf->fd, data, len));
+  }
+}
+
+/** Copy bytes into a log file's ring.
+ * The caller must have checked that there is room for them.
+ * @param[in,out] lf Log file to append to.
+ * @param[in] data Bytes to copy.
+ * @param[in] len Number of bytes to copy.
+ */
+static void
+log_ring_put(struct LogFile *lf, const char *data, size_t len)
+{
+  size_t off = lf->head & (lf->size - 1);
+  size_t part = lf->size - off;
+
+  if (part > len)
+    part = len;
+  memcpy(lf->buf + off, data, part);
+  memcpy(lf->buf, data + part, len - part);
+  lf->head += len;
+}
+
+/** Append one line, with its timestamp, to a log file's ring.
+ * If the ring is full, the line is dropped and counted.
+ * @param[in,out] lf Log file to append to.
+ * @param[in] stamp Timestamp from log_timestamp().
+ * @param[in] stamplen Length of \a stamp.
+ * @param[in] line Text of the log line, without a newline.
+ * @param[in] len Length of \a line.
+ */
+static void
+log_buffer_line(struct LogFile *lf, const char *stamp, size_t stamplen,
+		const char *line, size_t len)
+{
+  char note[80];
+  size_t notelen = 0;
+  char *buf = 0;
+
+  if (!lf->buf) /* only this thread assigns the ring; allocate it unlocked */
+    buf = (char*) MyMalloc(logAsync.size);
+  if (lf->dropped)
+    notelen = ircd_snprintf(0, note, sizeof(note),
+			    "%s [%s]: %lu log lines dropped\n",
+			    logDesc[LS_SYSTEM].name,
+			    levelData[L_WARNING].string, lf->dropped);
+
+  log_lock();
+  if (buf) {
+    lf->buf = buf;
+    lf->size = logAsync.size;
+    lf->head = lf->tail = 0;
+  }
+
+  /* say how much was lost as soon as there is room for it */
+  if (notelen && lf->size - (lf->head - lf->tail) >= stamplen + notelen) {
+    log_ring_put(lf, stamp, stamplen);
+    log_ring_put(lf, note, notelen);
+    lf->dropped = 0;
+  }
+
+  if (lf->size - (lf->head - lf->tail) >= stamplen + len + 1) {
+    log_ring_put(lf, stamp, stamplen);
+    log_ring_put(lf, line, len);
+    log_ring_put(lf, "\n", 1);
+    logAsync.queued++;
+  } else {
+    lf->dropped++;
+    logAsync.dropped++;
+  }
+
+#ifdef LOG_THREAD
+  /* don't wait for the end of the loop pass if the ring is filling up */
+  if (logAsync.waiting && lf->head - lf->tail > lf->size / 2)
+    pthread_cond_signal(&logAsync.wake);
+#endif
+  log_unlock();
+
+  logAsync.pending = 1;
+}
+
+#ifdef LOG_THREAD
+/** Background thread that writes log file rings to disk.
+ * @param[in] arg Unused.
+ * @return Always NULL.
+ */
+static void *
+log_writer(void *arg)
+{
+  struct LogFile *lf;
+  const char *data;
+  size_t len;
+  ssize_t res;
+  int fd, work;
+
+  log_lock();
+  while (!logAsync.stop) {
+    work = 0;
+    for (lf = logInfo.filelist; lf; lf = lf->next) {
+      if (lf->head == lf->tail)
+	continue;
+
+      /* lf->busy keeps the file open and linked while we are unlocked */
+      data = log_ring_chunk(lf, &len);
+      fd = lf->fd;
+      lf->busy = 1;
+      log_unlock();
+
+      res = write(fd, data, len);
+
+      log_lock();
+      lf->busy = 0;
+      log_written(lf, res);
+      pthread_cond_broadcast(&logAsync.idle);
+      work = 1;
+    }
+
+    if (!work) {
+      logAsync.waiting = 1;
+      pthread_cond_wait(&logAsync.wake, &logAsync.lock);
+      logAsync.waiting = 0;
+    }
+  }
+  log_unlock();
+
+  return 0;
+}
+#endif /* LOG_THREAD */
+
+/** Flush log file rings at the end of an event loop pass.
+ * With a writer thread, this only wakes it up; otherwise the rings are
+ * written here, so that each file gets at most a few writes per pass.
+ */
+static void
+log_flush(void)
+{
+  struct LogFile *lf;
+
+  if (!logAsync.pending)
+    return;
+  logAsync.pending = 0;
+
+#ifdef LOG_THREAD
+  if (logAsync.running) {
+    log_lock();
+    if (logAsync.waiting)
+      pthread_cond_signal(&logAsync.wake);
+    log_unlock();
+    return;
+  }
+#endif
+
+  log_lock();
+  for (lf = logInfo.filelist; lf; lf = lf->next)
+    if (lf->buf)
+      log_drain(lf);
+  log_unlock();
+}
+
+/** Stop the writer thread, then write out and free all log file rings. */
+static void
+log_async_stop(void)
+{
+  struct LogFile *lf;
+
+#ifdef LOG_THREAD
+  if (logAsync.running) {
+    log_lock();
+    logAsync.stop = 1;
+    pthread_cond_signal(&logAsync.wake);
+    log_unlock();
+
+    pthread_join(logAsync.thread, 0);
+    logAsync.running = 0;
+    logAsync.stop = 0;
+  }
+#endif
+
+  log_lock();
+  for (lf = logInfo.filelist; lf; lf = lf->next) {
+    if (!lf->buf)
+      continue;
+    log_drain(lf);
+    MyFree(lf->buf);
+    lf->size = lf->head = lf->tail = 0;
+    lf->dropped = 0;
+  }
+  log_unlock();
+  logAsync.pending = 0;
+}
+
+/** Start the writer thread for buffered log files.
+ * Without thread support, or if the thread cannot be created, log_flush()
+ * writes the rings at the end of each loop pass instead.
+ */
+static void
+log_async_start(void)
+{
+#ifdef LOG_THREAD
+  sigset_t all, old;
+
+  /* the writer thread should never handle signals */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  logAsync.running = !pthread_create(&logAsync.thread, 0, log_writer, 0);
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+
+  if (!logAsync.running)
+    log_write(LS_SYSTEM, L_ERROR, 0, "Unable to create log writer thread; "
+	      "log files will be written once per loop pass");
+#endif
+}
+
+/** Apply the LOG_ASYNC and LOG_BUFFER_SIZE features. */
+void
+log_async_update(void)
+{
+  int active = feature_bool(FEAT_LOG_ASYNC);
+  int want = feature_int(FEAT_LOG_BUFFER_SIZE);
+  size_t size = LOG_RING_MIN;
+
+  if (!logAsync.tick.tk_call) /* log_init() has not been called yet */
+    return;
+
+  while (size < LOG_RING_MAX && want > 0 && (size_t) want > size)
+    size <<= 1; /* rings are a power of two in size */
+  if (!active)
+    size = 0;
+
+  if (active == logAsync.active && size == logAsync.size)
+    return;
+
+  log_async_stop();
+  logAsync.active = active;
+  logAsync.size = size;
+  if (active)
+    log_async_start();
+}
+
+/** Report statistics about buffered log files.
+ * @param[in] to Client requesting statistics.
+ * @param[in] sd Stats descriptor for request (ignored).
+ * @param[in] param Extra parameter from user (ignored).
+ */
+void
+log_report_buffers(struct Client *to, const struct StatDesc *sd,
+		   char *param)
+{
+  struct LogFile *lf;
+  unsigned long queued, dropped, writes, errors, lost;
+  size_t pending;
+
+  log_lock();
+  queued = logAsync.queued;
+  dropped = logAsync.dropped;
+  writes = logAsync.writes;
+  errors = logAsync.errors;
+  log_unlock();
+
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG, ":Log buffering %s, %zu "
+	     "bytes per file: %lu lines queued, %lu dropped, %lu writes, "
+	     "%lu errors", !logAsync.active ? "off" :
+#ifdef LOG_THREAD
+	     logAsync.running ? "threaded" :
+#endif
+	     "per loop pass", logAsync.size, queued, dropped, writes, errors);
+
+  for (lf = logInfo.filelist; lf; lf = lf->next) {
+    log_lock();
+    pending = lf->head - lf->tail;
+    lost = lf->dropped;
+    log_unlock();
+
+    send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG, ":Log file %s: %zu bytes "
+	       "pending, %lu lines dropped since last note", lf->file,
+	       pending, lost);
+  }
+}
+
 /** Initialize logging subsystem.
  * @param[in] process_name Process name to interactions with syslog.
  */
@@ -298,6 +720,14 @@ log_init(const char *process_name)
 
   /* ok, open syslog; default facility: LOG_USER */
   openlog(logInfo.procname, LOG_PID | LOG_NDELAY, logInfo.facility);
+
+#ifdef LOG_THREAD
+  pthread_mutex_init(&logAsync.lock, 0);
+  pthread_cond_init(&logAsync.wake, 0);
+  pthread_cond_init(&logAsync.idle, 0);
+#endif
+  tick_add(&logAsync.tick, log_flush);
+  log_async_update();
 }
 
 /** Reopen log files (so admins can do things like rotate log files). */
@@ -322,12 +752,17 @@ log_close(void)
 
   closelog(); /* close syslog */
 
+  log_lock();
   for (ptr = logInfo.filelist; ptr; ptr = ptr->next) {
+    if (ptr->buf)
+      log_drain(ptr); /* write out anything still buffered */
+
     if (ptr->fd >= 0)
       close(ptr->fd); /* close all the files... */
 
     ptr->fd = -1;
   }
+  log_unlock();
 
   if (logInfo.dbfile && logInfo.dbfile->file) {
     if (logInfo.dbfile->fd >= 0)
@@ -368,13 +803,8 @@ log_vwrite(enum LogSys subsys, enum LogLevel severity, unsigned int flags,
   struct VarData vd;
   struct LogDesc *desc;
   struct LevelData *ldata;
-  struct tm *tstamp;
   struct iovec vector[3];
-  time_t curtime;
   char buf[LOG_BUFSIZE];
-  /* 1234567890123456789012 3 */
-  /* [2000-11-28 16:11:20] \0 */
-  char timebuf[23];
 
   /* check basic assumptions */
   assert(-1 < (int)subsys);
@@ -426,17 +856,22 @@ log_vwrite(enum LogSys subsys, enum LogLevel severity, unsigned int flags,
 
   /* if we have something to write to... */
   if (flags & LOG_DOFILELOG) {
-    curtime = TStime();
-    tstamp = localtime(&curtime); /* build the timestamp */
-
-    vector[0].iov_len =
-      ircd_snprintf(0, timebuf, sizeof(timebuf), "[%d-%d-%d %d:%02d:%02d] ",
-		    tstamp->tm_year + 1900, tstamp->tm_mon + 1,
-		    tstamp->tm_mday, tstamp->tm_hour, tstamp->tm_min,
-		    tstamp->tm_sec);
+    vector[0].iov_base = (void*) log_timestamp(&vector[0].iov_len);
+
+    /* buffered files are written later, unless we are about to abort */
+    if (logAsync.active && !log_inassert && desc->file != logInfo.dbfile) {
+      log_buffer_line(desc->file, vector[0].iov_base, vector[0].iov_len,
+		      buf, vector[1].iov_len);
+      flags &= ~LOG_DOFILELOG;
+    } else if (desc->file->buf) {
+      log_lock(); /* keep the file's lines in order */
+      log_drain(desc->file);
+      log_unlock();
+    }
+  }
 
+  if (flags & LOG_DOFILELOG) {
     /* set up the remaining parts of the writev vector... */
-    vector[0].iov_base = timebuf;
     vector[1].iov_base = buf;
 
     vector[2].iov_base = (void*) "\n"; /* terminate lines with a \n */
@@ -504,12 +939,18 @@ log_file_create(const char *file)
   tmp->fd = -1; /* initialize the structure */
   tmp->ref = 1;
   DupString(tmp->file, file);
+  tmp->buf = 0;
+  tmp->size = tmp->head = tmp->tail = 0;
+  tmp->busy = 0;
+  tmp->dropped = 0;
 
+  log_lock(); /* the writer thread walks the list */
   tmp->next = logInfo.filelist; /* link it into the list... */
   tmp->prev_p = &logInfo.filelist;
   if (logInfo.filelist)
     logInfo.filelist->prev_p = &tmp->next;
   logInfo.filelist = tmp;
+  log_unlock();
 
   return tmp;
 }
@@ -525,15 +966,24 @@ log_file_destroy(struct LogFile *lf)
   assert(0 != lf);
 
   if (--lf->ref == 0) {
+    log_lock();
+    if (lf->buf)
+      log_drain(lf); /* write out anything still buffered */
+
     if (lf->next) /* clip it out of the list */
       lf->next->prev_p = lf->prev_p;
     *lf->prev_p = lf->next;
+    log_unlock();
 
     lf->prev_p = 0; /* we won't use it for the free list */
     if (lf->fd >= 0)
       close(lf->fd);
     lf->fd = -1;
     MyFree(lf->file); /* free the file name */
+    if (lf->buf)
+      MyFree(lf->buf);
+    lf->size = lf->head = lf->tail = 0;
+    lf->dropped = 0;
 
     lf->next = logInfo.freelist; /* stack it onto the free list */
     logInfo.freelist = lf;
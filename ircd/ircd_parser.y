@@ -75,7 +75,7 @@
 
   int yylex(void);
   /* Now all the globals we need :/... */
-  int tping, tconn, maxlinks, sendq, port, invert, stringno, flags;
+  int tping, tconn, maxlinks, sendq, port, invert, stringno, flags, workers;
   char *name, *pass, *host, *ip, *username, *origin, *hub_limit;
   struct SLink *hosts;
   char *stringlist[MAX_STRINGS];
@@ -214,6 +214,7 @@ static void free_slist(struct SLink **link) {
 %token FAST
 %token AUTOCONNECT
 %token PROGRAM
+%token WORKERS
 %token TOK_IPV4 TOK_IPV6
 %token DNS
 %token WEBIRC
@@ -1225,8 +1226,12 @@ pseudoflags: FAST ';'
 
 iauthblock: IAUTH {
   if (!permitted(BLOCK_IAUTH)) YYERROR;
+  workers = 1;
 } '{' iauthitems '}' ';' {
-  auth_spawn(stringno, stringlist);
+  if (!stringno)
+    parse_error("Missing program in iauth block");
+  else
+    auth_spawn(stringno, stringlist, workers);
   while (stringno > 0)
   {
     --stringno;
@@ -1235,7 +1240,7 @@ iauthblock: IAUTH {
 };
 
 iauthitems: iauthitem iauthitems | iauthitem;
-iauthitem: iauthprogram;
+iauthitem: iauthprogram | iauthworkers;
 iauthprogram: PROGRAM '='
 {
   while (stringno > 0)
@@ -1244,6 +1249,13 @@ iauthprogram: PROGRAM '='
     MyFree(stringlist[stringno]);
   }
 } stringlist ';';
+iauthworkers: WORKERS '=' expr ';'
+{
+  if ($3 < 1 || $3 > 64)
+    parse_error("Invalid number of iauth workers %d", $3);
+  else
+    workers = $3;
+};
 
 webircblock: WEBIRC
 {
@@ -114,5 +114,55 @@ int send_reply(struct Client *to, int reply, ...)
   return 0; /* convenience return */
 }
 
+/** Append a generic reply to a message template.
+ * The reply is formatted once, here; send_template() fills in the
+ * nick of each local user it is sent to.  Pass TPL_NICK as an
+ * argument wherever that nick also appears in the reply text.
+ * @param[in,out] tpl Template to append to.
+ * @param[in] reply Numeric of message to append.
+ * @return Zero.
+ */
+int template_reply(struct MsgTemplate *tpl, int reply, ...)
+{
+  struct VarData vd;
+  const struct Numeric *num;
+  char buf[BUFSIZE];
+  char *text, *mark;
+  int len;
+
+  assert(0 != tpl);
+  assert(0 != reply);
+
+  num = get_error_numeric(reply & ~SND_EXPLICIT); /* get reply... */
+
+  va_start(vd.vd_args, reply);
+
+  if (reply & SND_EXPLICIT) /* get right pattern */
+    vd.vd_format = (const char *) va_arg(vd.vd_args, char *);
+  else
+    vd.vd_format = num->format;
+
+  assert(0 != vd.vd_format);
+
+  /* the prefix is the same for everyone; then comes the nick */
+  len = ircd_snprintf(0, buf, sizeof(buf), "%:#C %s ", &me, num->str);
+  msgq_tpl_text(tpl, buf, len);
+  msgq_tpl_nick(tpl);
+
+  /* leave room for the longest nick, so no line exceeds BUFSIZE */
+  ircd_snprintf(0, buf, BUFSIZE - 1 - len - NICKLEN, " %v", &vd);
+
+  va_end(vd.vd_args);
+
+  for (text = buf; (mark = strchr(text, '\n')); text = mark + 1) {
+    msgq_tpl_text(tpl, text, mark - text);
+    msgq_tpl_nick(tpl);
+  }
+  msgq_tpl_text(tpl, text, strlen(text));
+  msgq_tpl_text(tpl, "\r\n", 2);
+
+  return 0; /* convenience return */
+}
+
 
 
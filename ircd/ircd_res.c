@@ -92,7 +92,8 @@ typedef enum
   REQ_A,     /**< Looking up an A, possibly because AAAA failed. */
   REQ_AAAA,  /**< Looking up an AAAA. */
   REQ_CNAME, /**< We got a CNAME in response, we better get a real answer next. */
-  REQ_INT    /**< ip6.arpa failed, falling back to ip6.int. */
+  REQ_INT,   /**< ip6.arpa failed, falling back to ip6.int. */
+  REQ_CACHED /**< Answered from the cache; waiting to run the callback. */
 } request_state;
 
 /** Doubly linked list node. */
@@ -117,6 +118,8 @@ struct reslist
   char resend;             /**< Send flag; 0 == don't resend. */
   time_t sentat;           /**< Timestamp we last sent this request. */
   time_t timeout;          /**< When this request times out. */
+  unsigned long ttl;       /**< Smallest TTL of the records in the answer. */
+  int qtype;               /**< Type of the first query (cache key). */
   struct irc_in_addr addr; /**< Address for this request. */
   char *name;              /**< Hostname for this request. */
   dns_callback_f callback; /**< Callback function on completion. */
@@ -126,6 +129,40 @@ struct reslist
 /** Base of request list. */
 static struct dlink request_list;
 
+/** A cached answer to a PTR query (keyed by address) or to an A or
+ * AAAA query (keyed by name).
+ */
+struct ResCache
+{
+  struct dlink lru;        /**< Link in LRU list; must be first. */
+  struct ResCache *hnext;  /**< Next entry in the same hash bucket. */
+  time_t expires;          /**< When this entry goes stale. */
+  unsigned int hashv;      /**< Full hash value of the key. */
+  int type;                /**< T_PTR, T_A or T_AAAA. */
+  int negative;            /**< Non-zero if the name or address did not resolve. */
+  struct irc_in_addr addr; /**< Address (key for PTR, answer otherwise). */
+  char name[HOSTLEN + 1];  /**< Hostname (answer for PTR, key otherwise). */
+};
+
+/** Smallest number of buckets in the cache hash table. */
+#define RES_CACHE_BUCKETS 64
+
+/** Hash table of cached answers. */
+static struct ResCache **cacheTable;
+/** Number of buckets in #cacheTable minus one. */
+static unsigned int cacheMask;
+/** Cached answers, most recently used first. */
+static struct dlink cacheLru = { &cacheLru, &cacheLru };
+/** Number of cached answers. */
+static unsigned int cacheCount;
+/** Counters for the cache, reported by cres_mem(). */
+static struct {
+  unsigned int hits;       /**< Lookups answered from the cache. */
+  unsigned int negative;   /**< Of those, how many were negative answers. */
+  unsigned int misses;     /**< Lookups that had to be sent. */
+  unsigned int evicted;    /**< Entries dropped to stay under the size limit. */
+} cacheStats;
+
 static void rem_request(struct reslist *request);
 static struct reslist *make_request(dns_callback_f callback, void *ctx);
 static void do_query_name(dns_callback_f callback, void *ctx,
@@ -141,6 +178,7 @@ static int proc_answer(struct reslist *request, HEADER *header, char *, char *);
 static struct reslist *find_id(int id);
 static void res_readreply(struct Event *ev);
 static void timeout_resolver(struct Event *notused);
+static void res_cache_flush(void);
 
 extern struct irc_sockaddr irc_nsaddr_list[IRCD_MAXNS];
 extern int irc_nscount;
@@ -175,7 +213,8 @@ res_ourserver(const struct irc_sockaddr *inp)
 
 /** Start (or re-start) resolver.
  * This means read resolv.conf, initialize the list of pending
- * requests, open the resolver socket and initialize its timeout.
+ * requests, empty the answer cache, open the resolver socket and
+ * initialize its timeout.
  */
 void
 restart_resolver(void)
@@ -185,6 +224,8 @@ restart_resolver(void)
   int ns;
 
   irc_res_init();
+  res_cache_flush();
+  res_cache_resize();
 
   if (!request_list.next)
     request_list.next = request_list.prev = &request_list;
@@ -203,8 +244,8 @@ restart_resolver(void)
   {
     int fd = os_socket(&VirtualHost_dns_v4, SOCK_DGRAM, "Resolver UDPv4 socket", AF_INET);
     if (fd >= 0)
-      socket_add(&res_socket_v4, res_readreply, NULL,
-                 SS_DATAGRAM, SOCK_EVENT_READABLE, fd);
+      socket_add_named(&res_socket_v4, res_readreply, NULL,
+                       SS_DATAGRAM, SOCK_EVENT_READABLE, fd);
   }
 
 #ifdef AF_INET6
@@ -213,8 +254,8 @@ restart_resolver(void)
   {
     int fd = os_socket(&VirtualHost_dns_v6, SOCK_DGRAM, "Resolver UDPv6 socket", AF_INET6);
     if (fd >= 0)
-      socket_add(&res_socket_v6, res_readreply, NULL,
-                 SS_DATAGRAM, SOCK_EVENT_READABLE, fd);
+      socket_add_named(&res_socket_v6, res_readreply, NULL,
+                       SS_DATAGRAM, SOCK_EVENT_READABLE, fd);
   }
 #endif
 
@@ -312,12 +353,209 @@ check_resolver_timeout(time_t when)
     when = CurrentTime + AR_TTL;
   /* TODO after 2.10.12: Rewrite the timer API because there should be
    * no need for clients to know this kind of implementation detail. */
-  if (when > t_expire(&res_timeout))
+  if (t_onqueue(&res_timeout) && when >= t_expire(&res_timeout))
     /* do nothing */;
   else if (t_onqueue(&res_timeout) && !(res_timeout.t_header.gh_flags & GEN_MARKED))
     timer_chg(&res_timeout, TT_ABSOLUTE, when);
   else
-    timer_add(&res_timeout, timeout_resolver, NULL, TT_ABSOLUTE, when);
+    timer_add_named(&res_timeout, timeout_resolver, NULL, TT_ABSOLUTE, when);
+}
+
+/** Calculate the hash value of a cache key.
+ * @param[in] type T_PTR, T_A or T_AAAA.
+ * @param[in] addr Address to hash (for T_PTR).
+ * @param[in] name Hostname to hash (for T_A and T_AAAA).
+ * @return Hash value for the key.
+ */
+static unsigned int
+res_cache_hash(int type, const struct irc_in_addr *addr, const char *name)
+{
+  unsigned int hashv = 2166136261U ^ type;
+  const unsigned char *cp;
+  size_t len;
+
+  if (type == T_PTR) {
+    /* Hash only the low 32 bits of IPv4 addresses, since
+     * irc_in_addr_cmp() accepts both IPv4 encodings as equal. */
+    if (irc_in_addr_is_ipv4(addr)) {
+      cp = (const unsigned char *)&addr->in6_16[6];
+      len = 4;
+    } else {
+      cp = (const unsigned char *)&addr->in6_16[0];
+      len = sizeof(*addr);
+    }
+    while (len--)
+      hashv = (hashv ^ *cp++) * 16777619U;
+  } else {
+    for (; *name; name++)
+      hashv = (hashv ^ (unsigned char)ToLower(*name)) * 16777619U;
+  }
+  return hashv;
+}
+
+/** Remove an entry from the cache and free it.
+ * @param[in] entry Entry to remove.
+ */
+static void
+res_cache_remove(struct ResCache *entry)
+{
+  struct ResCache **pp;
+
+  for (pp = &cacheTable[entry->hashv & cacheMask]; *pp != entry; pp = &(*pp)->hnext)
+    assert(*pp != NULL);
+  *pp = entry->hnext;
+  entry->lru.prev->next = entry->lru.next;
+  entry->lru.next->prev = entry->lru.prev;
+  MyFree(entry);
+  cacheCount--;
+}
+
+/** Apply the configured cache size.  Drops the least recently used
+ * entries when the cache has become too big, and resizes the hash
+ * table to have about one bucket per entry.  Also used as the
+ * notification callback for FEAT_IRCD_RES_CACHE_SIZE.
+ */
+void
+res_cache_resize(void)
+{
+  struct ResCache *entry;
+  struct dlink *ptr;
+  unsigned int size, buckets;
+
+  size = feature_int(FEAT_IRCD_RES_CACHE_SIZE) > 0
+    ? (unsigned int)feature_int(FEAT_IRCD_RES_CACHE_SIZE) : 0;
+  while (cacheCount > size) {
+    res_cache_remove((struct ResCache *)cacheLru.prev);
+    cacheStats.evicted++;
+  }
+
+  if (size == 0) {
+    MyFree(cacheTable);
+    cacheTable = NULL;
+    cacheMask = 0;
+    return;
+  }
+
+  for (buckets = RES_CACHE_BUCKETS; buckets < size; buckets <<= 1)
+    ;
+  if (cacheTable && buckets == cacheMask + 1)
+    return;
+
+  MyFree(cacheTable);
+  cacheTable = (struct ResCache **)MyCalloc(buckets, sizeof(*cacheTable));
+  cacheMask = buckets - 1;
+  for (ptr = cacheLru.next; ptr != &cacheLru; ptr = ptr->next) {
+    entry = (struct ResCache *)ptr;
+    entry->hnext = cacheTable[entry->hashv & cacheMask];
+    cacheTable[entry->hashv & cacheMask] = entry;
+  }
+}
+
+/** Look up a cached answer.  Stale entries are dropped as they are
+ * found; a fresh entry becomes the most recently used.
+ * @param[in] type T_PTR, T_A or T_AAAA.
+ * @param[in] addr Address to look up (for T_PTR).
+ * @param[in] name Hostname to look up (for T_A and T_AAAA).
+ * @return Matching cache entry, or NULL if there is none.
+ */
+static struct ResCache *
+res_cache_find(int type, const struct irc_in_addr *addr, const char *name)
+{
+  struct ResCache *entry;
+  unsigned int hashv;
+
+  if (!cacheTable)
+    return NULL;
+
+  hashv = res_cache_hash(type, addr, name);
+  for (entry = cacheTable[hashv & cacheMask]; entry; entry = entry->hnext) {
+    if (entry->hashv != hashv || entry->type != type
+        || (type == T_PTR ? irc_in_addr_cmp(&entry->addr, addr)
+            : ircd_strcmp(entry->name, name)))
+      continue;
+    if (entry->expires <= CurrentTime) {
+      res_cache_remove(entry);
+      return NULL;
+    }
+    entry->lru.prev->next = entry->lru.next;
+    entry->lru.next->prev = entry->lru.prev;
+    add_dlink(&entry->lru, cacheLru.next);
+    return entry;
+  }
+  return NULL;
+}
+
+/** Remember the answer (or lack of one) to a query.
+ * @param[in] type T_PTR, T_A or T_AAAA.
+ * @param[in] addr Address that was looked up, or that a name resolved to.
+ * @param[in] name Hostname that was looked up, or that an address resolved to.
+ * @param[in] negative Non-zero if the query failed.
+ * @param[in] ttl Number of seconds the answer may be used for.
+ */
+static void
+res_cache_add(int type, const struct irc_in_addr *addr, const char *name,
+              int negative, unsigned long ttl)
+{
+  struct ResCache *entry;
+
+  if (ttl > (unsigned long)feature_int(FEAT_IRCD_RES_CACHE_TTL))
+    ttl = feature_int(FEAT_IRCD_RES_CACHE_TTL);
+  if (!cacheTable || ttl == 0)
+    return;
+
+  if (!(entry = res_cache_find(type, addr, name))) {
+    if (cacheCount >= (unsigned int)feature_int(FEAT_IRCD_RES_CACHE_SIZE)) {
+      res_cache_remove((struct ResCache *)cacheLru.prev);
+      cacheStats.evicted++;
+    }
+    entry = (struct ResCache *)MyMalloc(sizeof(*entry));
+    entry->hashv = res_cache_hash(type, addr, name);
+    entry->type = type;
+    entry->hnext = cacheTable[entry->hashv & cacheMask];
+    cacheTable[entry->hashv & cacheMask] = entry;
+    add_dlink(&entry->lru, cacheLru.next);
+    cacheCount++;
+  }
+
+  entry->expires = CurrentTime + ttl;
+  entry->negative = negative;
+  memcpy(&entry->addr, addr, sizeof(entry->addr));
+  ircd_strncpy(entry->name, name, HOSTLEN);
+}
+
+/** Drop all cached answers. */
+static void
+res_cache_flush(void)
+{
+  while (cacheLru.next != &cacheLru)
+    res_cache_remove((struct ResCache *)cacheLru.next);
+}
+
+/** Queue a cached answer for delivery.  The callback runs from the
+ * next timeout_resolver() call rather than immediately, so callers
+ * see the same sequence of events as for an answer from the network,
+ * and delete_resolver_queries() can still cancel it.
+ * @param[in] callback Callback function on completion.
+ * @param[in] ctx Context pointer for callback.
+ * @param[in] entry Cached answer for an A or AAAA query, or a negative
+ *   answer for any query.
+ */
+static void
+res_cache_deliver(dns_callback_f callback, void *ctx,
+                  const struct ResCache *entry)
+{
+  struct reslist *request;
+
+  cacheStats.hits++;
+  request = make_request(callback, ctx);
+  request->state = REQ_CACHED;
+  if (entry->negative)
+    cacheStats.negative++;
+  else {
+    memcpy(&request->addr, &entry->addr, sizeof(request->addr));
+    DupString(request->name, entry->name);
+  }
+  check_resolver_timeout(CurrentTime);
 }
 
 /** Drop pending DNS lookups which have timed out.
@@ -338,6 +576,18 @@ timeout_resolver(struct Event *ev)
   {
     next_ptr = ptr->next;
     request = (struct reslist*)ptr;
+
+    if (request->state == REQ_CACHED)
+    {
+      Debug((DEBUG_DNS, "Request %p answered from cache", request));
+      if (request->name)
+        (*request->callback)(request->callback_ctx, &request->addr, request->name);
+      else
+        (*request->callback)(request->callback_ctx, NULL, NULL);
+      rem_request(request);
+      continue;
+    }
+
     timeout = request->sentat + request->timeout;
 
     if (CurrentTime >= timeout)
@@ -434,7 +684,7 @@ find_id(int id)
   {
     request = (struct reslist*)ptr;
 
-    if (request->id == id) {
+    if (request->id == id && request->state != REQ_CACHED) {
       Debug((DEBUG_DNS, "find_id(%d) -> %p", id, request));
       return(request);
     }
@@ -461,7 +711,23 @@ gethost_byname(const char *name, dns_callback_f callback, void *ctx)
 void
 gethost_byaddr(const struct irc_in_addr *addr, dns_callback_f callback, void *ctx)
 {
-  do_query_number(callback, ctx, addr, NULL);
+  struct ResCache *entry;
+
+  if (!(entry = res_cache_find(T_PTR, addr, NULL)))
+    do_query_number(callback, ctx, addr, NULL);
+  else if (entry->negative)
+    res_cache_deliver(callback, ctx, entry);
+  else
+  {
+    /* Skip straight to the forward lookup of the cached name. */
+    cacheStats.hits++;
+#ifdef IPV6
+    if (!irc_in_addr_is_ipv4(addr))
+      do_query_name(callback, ctx, entry->name, NULL, T_AAAA);
+    else
+#endif
+    do_query_name(callback, ctx, entry->name, NULL, T_A);
+  }
 }
 
 /** Send a query to look up the address for a name.
@@ -481,7 +747,16 @@ do_query_name(dns_callback_f callback, void *ctx, const char *name,
 
   if (request == NULL)
   {
+    struct ResCache *entry;
+
+    if ((entry = res_cache_find(type, NULL, host_name)))
+    {
+      res_cache_deliver(callback, ctx, entry);
+      return;
+    }
+    cacheStats.misses++;
     request       = make_request(callback, ctx);
+    request->qtype = type;
     DupString(request->name, host_name);
 #ifdef IPV6
     if (type != T_A)
@@ -547,11 +822,14 @@ do_query_number(dns_callback_f callback, void *ctx, const struct irc_in_addr *ad
   }
   if (request == NULL)
   {
+    cacheStats.misses++;
     request       = make_request(callback, ctx);
     request->state= REQ_PTR;
     request->type = T_PTR;
+    request->qtype = T_PTR;
     memcpy(&request->addr, addr, sizeof(request->addr));
     request->name = (char *)MyMalloc(HOSTLEN + 1);
+    request->name[0] = '\0';
   }
   Debug((DEBUG_DNS, "Requesting DNS PTR %s as %p", ipbuf, request));
   query_name(ipbuf, C_IN, T_PTR, request);
@@ -638,6 +916,7 @@ proc_answer(struct reslist *request, HEADER* header, char* buf, char* eob)
   int rd_length;
 
   current = (unsigned char *)buf + sizeof(HEADER);
+  request->ttl = ~0UL;
 
   for (; header->qdcount > 0; --header->qdcount)
   {
@@ -686,8 +965,11 @@ proc_answer(struct reslist *request, HEADER* header, char* buf, char* eob)
     type = irc_ns_get16(current);
     current += TYPE_SIZE;
 
-    /* We do not use the class or TTL values. */
+    /* We do not use the class value.  The answer may be cached for
+     * as long as the shortest-lived record in it. */
     current += CLASS_SIZE;
+    if (irc_ns_get32(current) < request->ttl)
+      request->ttl = irc_ns_get32(current);
     current += TTL_SIZE;
 
     rd_length = irc_ns_get16(current);
@@ -820,6 +1102,8 @@ res_readreply(struct Event *ev)
          * send any more (no retries granted).
          */
         Debug((DEBUG_DNS, "Request %p has bad response (state %d type %d rcode %d)", request, request->state, request->type, header->rcode));
+        res_cache_add(request->qtype, &request->addr, request->name ? request->name : "",
+                      1, feature_int(FEAT_IRCD_RES_NEGATIVE_TTL));
         (*request->callback)(request->callback_ctx, NULL, NULL);
 	rem_request(request);
     }
@@ -856,7 +1140,7 @@ res_readreply(struct Event *ev)
   {
     if (request->type == T_PTR)
     {
-      if (request->name == NULL)
+      if (request->name == NULL || request->name[0] == '\0')
       {
         /*
          * got a PTR response with no name, something bogus is happening
@@ -872,6 +1156,7 @@ res_readreply(struct Event *ev)
        * Lookup the 'authoritative' name that we were given for the
        * ip#.
        */
+      res_cache_add(T_PTR, &request->addr, request->name, 0, request->ttl);
 #ifdef IPV6
       if (!irc_in_addr_is_ipv4(&request->addr))
         do_query_name(request->callback, request->callback_ctx, request->name, NULL, T_AAAA);
@@ -886,6 +1171,8 @@ res_readreply(struct Event *ev)
       /*
        * got a name and address response, client resolved
        */
+      if (irc_in_addr_valid(&request->addr))
+        res_cache_add(request->qtype, &request->addr, request->name, 0, request->ttl);
       (*request->callback)(request->callback_ctx, &request->addr, request->name);
       Debug((DEBUG_DNS, "Request %p got forward resolution", request));
       rem_request(request);
@@ -924,7 +1211,7 @@ report_dns_servers(struct Client *source_p, const struct StatDesc *sd, char *par
 
 /** Report memory usage to a client.
  * @param[in] sptr Client requesting information.
- * @return Total memory used by pending requests.
+ * @return Total memory used by pending requests and cached answers.
  */
 size_t
 cres_mem(struct Client* sptr)
@@ -932,6 +1219,7 @@ cres_mem(struct Client* sptr)
   struct dlink *dlink;
   struct reslist *request;
   size_t request_mem   = 0;
+  size_t cache_mem;
   int    request_count = 0;
 
   if (request_list.next) {
@@ -944,7 +1232,15 @@ cres_mem(struct Client* sptr)
     }
   }
 
+  cache_mem = cacheCount * sizeof(struct ResCache);
+  if (cacheTable)
+    cache_mem += (cacheMask + 1) * sizeof(*cacheTable);
+
   send_reply(sptr, SND_EXPLICIT | RPL_STATSDEBUG,
 	     ":Resolver: requests %d(%d)", request_count, request_mem);
-  return request_mem;
+  send_reply(sptr, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":Resolver: cache %u(%zu) hits %u (negative %u) misses %u "
+             "evicted %u", cacheCount, cache_mem, cacheStats.hits,
+             cacheStats.negative, cacheStats.misses, cacheStats.evicted);
+  return request_mem + cache_mem;
 }
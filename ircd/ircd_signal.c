@@ -243,10 +243,10 @@ void setup_signals(void)
   act.sa_flags = SA_RESTART;
   sigaction(SIGALRM, &act, 0);
 
-  signal_add(&sig_hup, sighup_callback, 0, SIGHUP);
-  signal_add(&sig_int, sigint_callback, 0, SIGINT);
-  signal_add(&sig_term, sigterm_callback, 0, SIGTERM);
-  signal_add(&sig_chld, sigchld_callback, 0, SIGCHLD);
+  signal_add_named(&sig_hup, sighup_callback, 0, SIGHUP);
+  signal_add_named(&sig_int, sigint_callback, 0, SIGINT);
+  signal_add_named(&sig_term, sigterm_callback, 0, SIGTERM);
+  signal_add_named(&sig_chld, sigchld_callback, 0, SIGCHLD);
 }
 
 /** Kill and clean up all child processes. */
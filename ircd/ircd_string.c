@@ -33,6 +33,12 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+/** Build the SSE2 and AVX2 line splitters. */
+#define EOL_SIMD
+#endif
+
 /*
  * include the character attribute tables here
  */
@@ -659,3 +665,103 @@ ipmask_parse(const char *input, struct irc_in_addr *ip, unsigned char *pbits)
     return pos;
   } else return 0; /* parse failed */
 }
+
+/** Find the first CR or LF in a buffer, one byte at a time.
+ * @param[in] start Start of buffer.
+ * @param[in] end End of buffer.
+ * @return Pointer to the first end-of-line character, or \a end.
+ */
+static const char *
+find_eol_scalar(const char *start, const char *end)
+{
+  while (start < end && !IsEol(*start))
+    start++;
+  return start;
+}
+
+#ifdef EOL_SIMD
+/** Find the first CR or LF in a buffer, sixteen bytes at a time.
+ * @param[in] start Start of buffer.
+ * @param[in] end End of buffer.
+ * @return Pointer to the first end-of-line character, or \a end.
+ */
+static const char *
+find_eol_sse2(const char *start, const char *end)
+{
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  __m128i chunk;
+  int mask;
+
+  for (; end - start >= 16; start += 16) {
+    chunk = _mm_loadu_si128((const __m128i *)start);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, cr),
+                                          _mm_cmpeq_epi8(chunk, lf)));
+    if (mask)
+      return start + __builtin_ctz(mask);
+  }
+  return find_eol_scalar(start, end);
+}
+
+/** Find the first CR or LF in a buffer, thirty-two bytes at a time.
+ * @param[in] start Start of buffer.
+ * @param[in] end End of buffer.
+ * @return Pointer to the first end-of-line character, or \a end.
+ */
+__attribute__((target("avx2")))
+static const char *
+find_eol_avx2(const char *start, const char *end)
+{
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  __m256i chunk;
+  unsigned int mask;
+
+  for (; end - start >= 32; start += 32) {
+    chunk = _mm256_loadu_si256((const __m256i *)start);
+    mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr),
+                                                _mm256_cmpeq_epi8(chunk, lf)));
+    if (mask)
+      return start + __builtin_ctz(mask);
+  }
+  return find_eol_sse2(start, end);
+}
+#endif /* EOL_SIMD */
+
+static const char *find_eol_select(const char *start, const char *end);
+
+/** Line splitter picked for this CPU by find_eol_select(). */
+static const char *(*find_eol)(const char *start, const char *end) =
+  find_eol_select;
+
+/** Pick the fastest line splitter the CPU supports, then use it.
+ * @param[in] start Start of buffer.
+ * @param[in] end End of buffer.
+ * @return Pointer to the first end-of-line character, or \a end.
+ */
+static const char *
+find_eol_select(const char *start, const char *end)
+{
+#ifdef EOL_SIMD
+  __builtin_cpu_init();
+  find_eol = __builtin_cpu_supports("avx2") ? find_eol_avx2 : find_eol_sse2;
+#else
+  find_eol = find_eol_scalar;
+#endif
+  return find_eol(start, end);
+}
+
+/** Find the first end-of-line character (CR or LF) in a buffer.
+ * Uses SSE2 or AVX2 where the CPU has them, so it is much faster
+ * than an IsEol() loop over long runs of input such as a netburst.
+ * @param[in] start Start of buffer.
+ * @param[in] end End of buffer.
+ * @return Pointer to the first end-of-line character, or \a end if
+ * there is none.
+ */
+const char *
+ircd_find_eol(const char *start, const char *end)
+{
+  assert(start <= end);
+  return find_eol(start, end);
+}
@@ -40,9 +40,11 @@
 #include "s_conf.h"
 #include "s_debug.h"
 #include "s_misc.h"
+#include "s_serv.h"
 #include "s_user.h"
 #include "send.h"
 #include "struct.h"
+#include "whocmds.h"
 #include "whowas.h"
 
 /* #include <assert.h> -- Now using assert in ircd_log.h */
@@ -320,6 +322,23 @@ struct Server *make_server(struct Client *cptr)
   return cli_serv(cptr);
 }
 
+/** Unlink \a cptr from #GlobalClientList, moving any netburst or
+ * WHO that was about to visit it on to the next client.
+ * @param[in] cptr Client in the global list.
+ */
+static void unlink_client(struct Client *cptr)
+{
+  server_burst_forget_client(cptr);
+  who_forget_client(cptr);
+  if (cli_prev(cptr))
+    cli_next(cli_prev(cptr)) = cli_next(cptr);
+  else {
+    GlobalClientList = cli_next(cptr);
+    cli_prev(GlobalClientList) = 0;
+  }
+  cli_prev(cli_next(cptr)) = cli_prev(cptr);
+}
+
 /** Remove \a cptr from lists that it is a member of.
  * Specifically, this delinks \a cptr from #GlobalClientList, updates
  * the whowas history list, frees its Client::cli_user and
@@ -339,15 +358,7 @@ void remove_client_from_list(struct Client *cptr)
    * the list, and we never remove &me.    -GW 
    */
   if(cli_next(cptr))
-  {
-    if (cli_prev(cptr))
-      cli_next(cli_prev(cptr)) = cli_next(cptr);
-    else {
-      GlobalClientList = cli_next(cptr);
-      cli_prev(GlobalClientList) = 0;
-    }
-    cli_prev(cli_next(cptr)) = cli_prev(cptr);
-  }
+    unlink_client(cptr);
   cli_next(cptr) = cli_prev(cptr) = 0;
 
   if (IsUser(cptr) && cli_user(cptr)) {
@@ -379,6 +390,8 @@ void remove_client_from_list(struct Client *cptr)
  */
 void add_client_to_list(struct Client *cptr)
 {
+  static unsigned long serial;
+
   assert(cli_verify(cptr));
   assert(cli_next(cptr) == 0);
   assert(cli_prev(cptr) == 0);
@@ -390,11 +403,28 @@ void add_client_to_list(struct Client *cptr)
    */
   cli_prev(cptr) = 0;
   cli_next(cptr) = GlobalClientList;
+  cli_serial(cptr) = ++serial;
   GlobalClientList = cptr;
   if (cli_next(cptr))
     cli_prev(cli_next(cptr)) = cptr;
 }
 
+/** Move \a cptr to the head of #GlobalClientList, as if it had just
+ * been added.  This is done when a local client registers, so that
+ * netbursts already in progress leave it to the NICK that is
+ * propagated then.
+ * @param[in] cptr Client to move.
+ */
+void move_client_to_list_head(struct Client *cptr)
+{
+  assert(cli_verify(cptr));
+  assert(cli_next(cptr) != 0);
+
+  unlink_client(cptr);
+  cli_next(cptr) = cli_prev(cptr) = 0;
+  add_client_to_list(cptr);
+}
+
 #if 0
 /** Perform a very CPU-intensive verification of %GlobalClientList.
  * This checks the Client::cli_magic and Client::cli_prev field for
@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include "listener.h"
+#include "accept_pool.h"
 #include "client.h"
 #include "ircd.h"
 #include "ircd_alloc.h"
@@ -252,8 +253,10 @@ static int inetport(struct Listener* listener, int family)
   if (!set_listener_options(listener, fd, family))
     return -1;
   sock = (family == AF_INET) ? &listener->socket_v4 : &listener->socket_v6;
-  if (!socket_add(sock, accept_connection, (void*) listener,
-		  SS_LISTENING, 0, fd)) {
+  /* acceptor threads pick up new sockets when the configuration is done */
+  if (!accept_pool_running() && !socket_add_named(sock, accept_connection,
+                                                  (void*) listener,
+                                                  SS_LISTENING, 0, fd)) {
     /* Error should already have been reported to the logs */
     close(fd);
     return -1;
@@ -262,6 +265,25 @@ static int inetport(struct Listener* listener, int family)
   return fd;
 }
 
+/** Close one of a listener's sockets.
+ * @param[in,out] fd Listening file descriptor; set to -1.
+ * @param[in] sock Event system socket for \a fd.
+ */
+static void close_listener_socket(int *fd, struct Socket *sock)
+{
+  int old_fd = *fd;
+
+  *fd = -1;
+  if (s_active(sock)) {
+    close(old_fd);
+    socket_del(sock);
+  } else {
+    /* make sure no acceptor thread is still polling it */
+    accept_pool_update();
+    close(old_fd);
+  }
+}
+
 /** Find the listener (if any) for a particular port and address.
  * @param[in] port Port number to search for.
  * @param[in] addr Local address to search for.
@@ -334,11 +356,8 @@ void add_listener(int port, const char* vhost_ip, const char* mask,
       listener->fd_v6 = fd;
       okay = 1;
     }
-  } else if (-1 < listener->fd_v6) {
-    close(listener->fd_v6);
-    socket_del(&listener->socket_v6);
-    listener->fd_v6 = -1;
-  }
+  } else if (-1 < listener->fd_v6)
+    close_listener_socket(&listener->fd_v6, &listener->socket_v6);
 #endif
 
   if (FlagHas(&listener->flags, LISTEN_IPV4)
@@ -350,11 +369,8 @@ void add_listener(int port, const char* vhost_ip, const char* mask,
       listener->fd_v4 = fd;
       okay = 1;
     }
-  } else if (-1 < listener->fd_v4) {
-    close(listener->fd_v4);
-    socket_del(&listener->socket_v4);
-    listener->fd_v4 = -1;
-  }
+  } else if (-1 < listener->fd_v4)
+    close_listener_socket(&listener->fd_v4, &listener->socket_v4);
 
   if (!okay)
     free_listener(listener);
@@ -394,16 +410,11 @@ void close_listener(struct Listener* listener)
       }
     }
   }
-  if (-1 < listener->fd_v4) {
-    close(listener->fd_v4);
-    socket_del(&listener->socket_v4);
-    listener->fd_v4 = -1;
-  }
-  if (-1 < listener->fd_v6) {
-    close(listener->fd_v6);
-    socket_del(&listener->socket_v6);
-    listener->fd_v6 = -1;
-  }
+  if (-1 < listener->fd_v4)
+    close_listener_socket(&listener->fd_v4, &listener->socket_v4);
+  if (-1 < listener->fd_v6)
+    close_listener_socket(&listener->fd_v6, &listener->socket_v6);
+  accept_pool_forget(listener);
   free_listener(listener);
 }
 
@@ -433,6 +444,56 @@ void release_listener(struct Listener* listener)
     close_listener(listener);
 }
 
+/** Tell a connection we will not take it, and close it.
+ * @param[in] fd Accepted file descriptor.
+ * @param[in] msg Reason for rejecting the connection.
+ */
+void reject_connection(int fd, const char* msg)
+{
+  char msgbuf[BUFSIZE];
+  int  len;
+
+  len = snprintf(msgbuf, sizeof(msgbuf), ":%s ERROR :%s\r\n",
+    cli_name(&me), msg);
+  if (len < sizeof(msgbuf))
+    send(fd, msgbuf, len, 0);
+  close(fd);
+}
+
+/** Add or remove one listening socket from the event loop.
+ * @param[in] listener Listener that owns the socket.
+ * @param[in] fd Listening file descriptor (or -1).
+ * @param[in] sock Event system socket for \a fd.
+ * @param[in] in_loop Non-zero to have the event loop watch it.
+ */
+static void watch_listener_socket(struct Listener* listener, int fd,
+                                  struct Socket* sock, int in_loop)
+{
+  if (fd < 0)
+    return;
+  if (in_loop && !s_active(sock))
+    socket_add_named(sock, accept_connection, (void*) listener,
+                     SS_LISTENING, 0, fd);
+  else if (!in_loop && s_active(sock))
+    socket_del(sock);
+}
+
+/** Add or remove all listening sockets from the event loop.
+ * They are removed while acceptor threads are polling them instead.
+ * @param[in] in_loop Non-zero to have the event loop watch them.
+ */
+void watch_listeners(int in_loop)
+{
+  struct Listener* listener;
+
+  for (listener = ListenerPollList; listener; listener = listener->next) {
+    watch_listener_socket(listener, listener->fd_v4, &listener->socket_v4,
+                          in_loop);
+    watch_listener_socket(listener, listener->fd_v6, &listener->socket_v6,
+                          in_loop);
+  }
+}
+
 /** Accept a connection on a listener.
  * @param[in] ev Socket callback structure.
  */
@@ -443,8 +504,6 @@ static void accept_connection(struct Event* ev)
   struct irc_sockaddr addr;
   const char*         msg;
   int                 fd;
-  int                 len;
-  char                msgbuf[BUFSIZE];
 
   assert(0 != ev_socket(ev));
   assert(0 != s_data(ev_socket(ev)));
@@ -474,11 +533,7 @@ static void accept_connection(struct Event* ev)
       msg = "All connections in use";
       ++ServerStats->is_all_inuse;
     reject:
-      len = snprintf(msgbuf, sizeof(msgbuf), ":%s ERROR :%s\r\n",
-        cli_name(&me), msg);
-      if (len < sizeof(msgbuf))
-        send(fd, msgbuf, len, 0);
-      close(fd);
+      reject_connection(fd, msg);
       continue;
     }
     /*
@@ -502,8 +557,25 @@ static void accept_connection(struct Event* ev)
       goto reject;
     }
 
+    if (!os_set_nonblocking(fd))
+    {
+      ++ServerStats->is_bad_socket;
+      close(fd);
+      continue;
+    }
+    /*
+     * Disable IP (*not* TCP) options.  In particular, this makes it impossible
+     * to use source routing to connect to the server.  If we didn't do this
+     * (and if intermediate networks didn't drop source-routed packets), an
+     * attacker could successfully IP spoof us...and even return the anti-spoof
+     * ping, because the options would cause the packet to be routed back to
+     * the spoofer's machine.  When we disable the IP options, we delete the
+     * source route, and the normal routing takes over.
+     */
+    os_disable_options(fd);
+
     ++ServerStats->is_ac;
-    add_connection(listener, fd);
+    add_connection(listener, fd, &addr);
   }
 
   if ((errno != EAGAIN)
@@ -80,6 +80,7 @@
  */
 #include "config.h"
 
+#include "channel.h"
 #include "client.h"
 #include "ircd.h"
 #include "ircd_log.h"
@@ -137,6 +138,7 @@ int ms_account(struct Client* cptr, struct Client* sptr, int parc,
   }
 
   ircd_strncpy(cli_user(acptr)->account, parv[2], ACCOUNTLEN);
+  ban_ident_invalidate(acptr);
   hide_hostmask(acptr, FLAG_ACCOUNT);
 
   sendcmdto_serv_butone(sptr, CMD_ACCOUNT, cptr,
@@ -191,6 +191,7 @@ do_clearmode(struct Client *cptr, struct Client *sptr, struct Channel *chptr,
     }
 
     chptr->banlist = 0;
+    mode_ban_invalidate(chptr);
   }
 
   /* Deal with users on the channel */
@@ -199,9 +200,6 @@ do_clearmode(struct Client *cptr, struct Client *sptr, struct Channel *chptr,
       if (IsZombie(member)) /* we ignore zombies */
 	continue;
 
-      if (del_mode & MODE_BAN) /* If we cleared bans, clear the valid flags */
-	ClearBanValid(member);
-
       /* Drop channel operator status */
       if (IsChanOp(member) && del_mode & MODE_CHANOP) {
 	modebuf_mode_client(&mbuf, MODE_DEL | MODE_CHANOP, member->user, MAXOPLEVEL + 1);
@@ -113,7 +113,7 @@ static struct ListingArgs la_init = {
   0,                          /* flags */
   2147483647,                 /* max_topic_time */
   0,                          /* min_topic_time */
-  0,                          /* bucket */
+  0,                          /* chptr */
   {0}                         /* wildcard */
 };
 
@@ -125,7 +125,7 @@ static struct ListingArgs la_default = {
   0,                          /* flags */
   2147483647,                 /* max_topic_time */
   0,                          /* min_topic_time */
-  0,                          /* bucket */
+  0,                          /* chptr */
   {0}                         /* wildcard */
 };
 
@@ -341,6 +341,8 @@ list_set_default(void)
   if (param_parse(0, feature_str(FEAT_DEFAULT_LIST_PARAM), &la_default, 0) !=
       LPARAM_SUCCESS)
     la_default = la_init; /* recover from error by switching to default */
+
+  list_drop_cache(); /* the shared default listing may be out of date */
 }
 
 /*
@@ -359,18 +361,17 @@ int m_list(struct Client* cptr, struct Client* sptr, int parc, char* parv[])
 
   if (cli_listing(sptr))            /* Already listing ? */
   {
-    if (cli_listing(sptr))
-    MyFree(cli_listing(sptr));
-    cli_listing(sptr) = 0;
+    list_end_channels(sptr);
     send_reply(sptr, RPL_LISTEND);
     update_write(sptr);
     if (parc < 2 || 0 == ircd_strcmp("STOP", parv[1]))
       return 0;                 /* Let LIST or LIST STOP abort a listing. */
   }
 
-  if (parc < 2)                 /* No arguments given to /LIST ? */
+  if (parc < 2) {               /* No arguments given to /LIST ? */
     args = la_default;
-  else {
+    args.flags |= LISTARG_DEFAULT;
+  } else {
     args = la_init; /* initialize argument to blank slate */
 
     for (param = 1; parv[param]; param++) { /* process each parameter */
@@ -395,10 +396,7 @@ int m_list(struct Client* cptr, struct Client* sptr, int parc, char* parv[])
     if (args.max_users > args.min_users + 1 && args.max_time > args.min_time &&
         args.max_topic_time > args.min_topic_time)      /* Sanity check */
     {
-      cli_listing(sptr) = (struct ListingArgs*) MyMalloc(sizeof(struct ListingArgs));
-      assert(0 != cli_listing(sptr));
-      memcpy(cli_listing(sptr), &args, sizeof(struct ListingArgs));
-      list_next_channels(sptr);
+      list_start_channels(sptr, &args);
       return 0;
     }
     send_reply(sptr, RPL_LISTEND);
@@ -93,6 +93,7 @@
 #include "match.h"
 #include "numeric.h"
 #include "numnicks.h"
+#include "s_bsd.h"
 #include "send.h"
 #include "whocmds.h"
 
@@ -156,6 +157,12 @@ int m_who(struct Client* cptr, struct Client* sptr, int parc, char* parv[])
   char *qrt;                    /* Pointer to the query type                */
   static char mymask[512];      /* To save the mask before corrupting it    */
 
+  /* A WHO still sending replies from a search of all users ends here */
+  if (cli_who(sptr)) {
+    who_end(sptr, 1);
+    update_write(sptr);
+  }
+
   /* Let's find where is our mask, and if actually contains something */
   mask = ((parc > 1) ? parv[1] : 0);
   if (parc > 3 && parv[3])
@@ -363,31 +370,12 @@ int m_who(struct Client* cptr, struct Client* sptr, int parc, char* parv[])
      real mask and try to match all relevant fields */
   if (!(commas || (counter < 1)))
   {
-    struct irc_in_addr imask;
-    int minlen, cset;
-    unsigned char ibits;
+    struct WhoMatch wm;
 
-    if (mask)
-    {
-      matchcomp(mymask, &minlen, &cset, mask);
-      if (!ipmask_parse(mask, &imask, &ibits))
-        matchsel &= ~WHO_FIELD_NIP;
-      if ((minlen > NICKLEN) || !(cset & NTL_IRCNK))
-        matchsel &= ~WHO_FIELD_NIC;
-      if ((matchsel & WHO_FIELD_SER) &&
-          ((minlen > HOSTLEN) || (!(cset & NTL_IRCHN))
-          || (!markMatchexServer(mymask, minlen))))
-        matchsel &= ~WHO_FIELD_SER;
-      if ((minlen > USERLEN) || !(cset & NTL_IRCUI))
-        matchsel &= ~WHO_FIELD_UID;
-      if ((minlen > HOSTLEN) || !(cset & NTL_IRCHN))
-        matchsel &= ~WHO_FIELD_HOS;
-      if ((minlen > ACCOUNTLEN))
-        matchsel &= ~WHO_FIELD_ACC;
-    }
+    who_match_init(&wm, mask, matchsel);
 
     /* First of all loop through the clients in common channels */
-    if ((!(counter < 1)) && matchsel) {
+    if ((!(counter < 1)) && wm.wm_matchsel) {
       struct Membership* member;
       struct Membership* chan;
       for (chan = cli_user(sptr)->channel; chan; chan = chan->next_channel) {
@@ -400,26 +388,7 @@ int m_who(struct Client* cptr, struct Client* sptr, int parc, char* parv[])
                                    we'll never have to show this acptr in this query */
  	  if ((bitsel & WHOSELECT_OPER) && !SeeOper(sptr,acptr))
 	    continue;
-          if ((mask) &&
-              ((!(matchsel & WHO_FIELD_NIC))
-              || matchexec(cli_name(acptr), mymask, minlen))
-              && ((!(matchsel & WHO_FIELD_UID))
-              || matchexec(cli_user(acptr)->username, mymask, minlen))
-              && ((!(matchsel & WHO_FIELD_SER))
-              || (!(HasFlag(cli_user(acptr)->server, FLAG_MAP))))
-              && ((!(matchsel & WHO_FIELD_HOS))
-              || matchexec(cli_user(acptr)->host, mymask, minlen))
-              && ((!(matchsel & WHO_FIELD_HOS))
-	      || !HasHiddenHost(acptr)
-	      || !IsAnOper(sptr)
-              || matchexec(cli_user(acptr)->realhost, mymask, minlen))
-              && ((!(matchsel & WHO_FIELD_REN))
-              || matchexec(cli_info(acptr), mymask, minlen))
-              && ((!(matchsel & WHO_FIELD_NIP))
-	      || (HasHiddenHost(acptr) && !IsAnOper(sptr))
-              || !ipmask_check(&cli_ip(acptr), &imask, ibits))
-              && ((!(matchsel & WHO_FIELD_ACC))
-              || matchexec(cli_user(acptr)->account, mymask, minlen)))
+          if (!who_match(&wm, sptr, acptr))
             continue;
           if (!SHOW_MORE(sptr, counter))
             break;
@@ -428,41 +397,15 @@ int m_who(struct Client* cptr, struct Client* sptr, int parc, char* parv[])
       }
     }
     /* Loop through all clients :-\, if we still have something to match to 
-       and we can show more clients */
-    if ((!(counter < 1)) && matchsel)
-      for (acptr = cli_prev(&me); acptr; acptr = cli_prev(acptr))
-      {
-        if (!(IsUser(acptr) && Process(acptr)))
-          continue;
-	if ((bitsel & WHOSELECT_OPER) && !SeeOper(sptr,acptr))
-	  continue;
-        if (!(SEE_USER(sptr, acptr, bitsel)))
-          continue;
-        if ((mask) &&
-            ((!(matchsel & WHO_FIELD_NIC))
-            || matchexec(cli_name(acptr), mymask, minlen))
-            && ((!(matchsel & WHO_FIELD_UID))
-            || matchexec(cli_user(acptr)->username, mymask, minlen))
-            && ((!(matchsel & WHO_FIELD_SER))
-                || (!(HasFlag(cli_user(acptr)->server, FLAG_MAP))))
-            && ((!(matchsel & WHO_FIELD_HOS))
-            || matchexec(cli_user(acptr)->host, mymask, minlen))
-            && ((!(matchsel & WHO_FIELD_HOS))
-	    || !HasHiddenHost(acptr)
-	    || !IsAnOper(sptr)
-            || matchexec(cli_user(acptr)->realhost, mymask, minlen))
-            && ((!(matchsel & WHO_FIELD_REN))
-            || matchexec(cli_info(acptr), mymask, minlen))
-            && ((!(matchsel & WHO_FIELD_NIP))
-	    || (HasHiddenHost(acptr) && !IsAnOper(sptr))
-            || !ipmask_check(&cli_ip(acptr), &imask, ibits))
-            && ((!(matchsel & WHO_FIELD_ACC))
-            || matchexec(cli_user(acptr)->account, mymask, minlen)))
-          continue;
-        if (!SHOW_MORE(sptr, counter))
-          break;
-        do_who(sptr, acptr, 0, fields, qrt);
-      }
+       and we can show more clients; this goes on as the sendQ drains */
+    if ((!(counter < 1)) && wm.wm_matchsel)
+    {
+      if (mask && (p = strchr(mask, ' ')))
+        *p = '\0';
+      who_start(sptr, &wm, bitsel, fields, qrt, counter, who_marker,
+                BadPtr(mask) ? "*" : mask);
+      return 0;
+    }
   }
 
   /* Make a clean mask suitable to be sent in the "end of" */
@@ -132,7 +132,7 @@ int m_whowas(struct Client* cptr, struct Client* sptr, int parc, char* parv[])
   {
     /* Search through bucket, finding all nicknames that match */
     found = 0;
-    for (temp = whowashash[hash_whowas_name(nick)]; temp; temp = temp->hnext)
+    for (temp = whowas_bucket(nick); temp; temp = temp->hnext)
     {
       if (0 == ircd_strcmp(nick, temp->name))
       {
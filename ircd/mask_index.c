@@ -0,0 +1,681 @@
+/*
+ * IRC - Internet Relay Chat, ircd/mask_index.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/** @file
+ * @brief Index of host and IP masks for fast ban lookups.
+ * @version $Id$
+ *
+ * A MaskIndex sorts masks into four kinds.  CIDR masks go into a
+ * path-compressed binary trie, so a lookup only visits the prefixes
+ * of the client's address.  Hostnames without wildcards go into a
+ * hash table keyed on the whole name.  Masks of the form *.domain go
+ * into a second hash table keyed on the domain; a lookup probes it
+ * once for each label suffix of the client's hostname.  Everything
+ * else is kept on a list and checked one at a time.
+ *
+ * Each entry carries an order value.  Every list of entries is kept
+ * sorted with the highest order first, and mask_index_find() returns
+ * the matching entry with the highest order, which lets callers
+ * reproduce the first-match semantics of their original lists.
+ */
+#include "config.h"
+
+#include "mask_index.h"
+#include "ircd_alloc.h"
+#include "ircd_chattr.h"
+#include "ircd_log.h"
+#include "ircd_string.h"
+#include "res.h"
+
+/* #include <assert.h> -- Now using assert in ircd_log.h */
+#include <netinet/in.h>
+#include <string.h>
+
+/** Initial number of buckets in a MaskHostTable. */
+#define MASK_HOST_MIN_SIZE 256
+
+/** One indexed mask. */
+struct MaskEntry {
+  struct MaskEntry *me_next;    /**< Next entry with the same key. */
+  void *me_data;                /**< Owner's pointer. */
+  unsigned long me_order;       /**< Precedence; higher wins. */
+};
+
+/** Node in the CIDR prefix trie. */
+struct MaskNode {
+  struct MaskNode *mn_child[2]; /**< Children, by the bit after mn_bits. */
+  struct MaskEntry *mn_entries; /**< Masks for exactly this prefix. */
+  struct irc_in_addr mn_addr;   /**< Prefix, with bits past mn_bits zeroed. */
+  unsigned char mn_bits;        /**< Length of prefix. */
+};
+
+/** Hostname key in a MaskHostTable. */
+struct MaskHost {
+  struct MaskHost *mh_next;     /**< Next key in hash chain. */
+  struct MaskEntry *mh_entries; /**< Masks for this key. */
+  unsigned int mh_hash;         /**< Full hash value of mh_key. */
+  char mh_key[1];               /**< Hostname or domain (allocated larger). */
+};
+
+/** Best match found so far by mask_index_find(). */
+struct MaskMatch {
+  void *mm_data;                /**< Owner's pointer, or NULL. */
+  unsigned long mm_order;       /**< Order of mm_data. */
+  MaskIndexCheck mm_check;      /**< Caller's match function. */
+  void *mm_ctx;                 /**< Caller's context for mm_check. */
+};
+
+/** Add an entry to a list, keeping the list sorted by order.
+ * @param[in,out] pp Head of entry list.
+ * @param[in] data Owner's pointer.
+ * @param[in] order Precedence of entry.
+ */
+static void
+entry_add(struct MaskEntry **pp, void *data, unsigned long order)
+{
+  struct MaskEntry *me;
+
+  while (*pp && (*pp)->me_order > order)
+    pp = &(*pp)->me_next;
+  me = (struct MaskEntry *)MyMalloc(sizeof(*me));
+  me->me_data = data;
+  me->me_order = order;
+  me->me_next = *pp;
+  *pp = me;
+}
+
+/** Remove an entry from a list.
+ * @param[in,out] pp Head of entry list.
+ * @param[in] data Owner's pointer to remove.
+ * @return Non-zero if the entry was found and removed.
+ */
+static int
+entry_del(struct MaskEntry **pp, void *data)
+{
+  struct MaskEntry *me;
+
+  for (; (me = *pp); pp = &me->me_next)
+    if (me->me_data == data) {
+      *pp = me->me_next;
+      MyFree(me);
+      return 1;
+    }
+  return 0;
+}
+
+/** Free a whole list of entries.
+ * @param[in] me Head of entry list.
+ */
+static void
+entry_free(struct MaskEntry *me)
+{
+  struct MaskEntry *next;
+
+  for (; me; me = next) {
+    next = me->me_next;
+    MyFree(me);
+  }
+}
+
+/** Check a sorted list of entries for a better match.
+ * @param[in] me Head of entry list.
+ * @param[in,out] mm Best match so far.
+ */
+static void
+entry_scan(const struct MaskEntry *me, struct MaskMatch *mm)
+{
+  for (; me && (!mm->mm_data || me->me_order > mm->mm_order);
+       me = me->me_next)
+    if (mm->mm_check(me->me_data, mm->mm_ctx)) {
+      mm->mm_data = me->me_data;
+      mm->mm_order = me->me_order;
+      break;
+    }
+}
+
+/** Decide which kind of index a hostname mask belongs in.
+ * @param[in] host Hostname mask (may be NULL).
+ * @return MASK_KIND_EXACT, MASK_KIND_SUFFIX or MASK_KIND_WILD.
+ */
+static enum MaskKind
+host_kind(const char *host)
+{
+  const char *s;
+
+  if (!host)
+    return MASK_KIND_WILD;
+  s = (host[0] == '*' && host[1] == '.') ? host + 2 : host;
+  if (!*s)
+    return MASK_KIND_WILD;
+  for (; *s; s++)
+    if (*s == '*' || *s == '?' || *s == '\\')
+      return MASK_KIND_WILD;
+  return host[0] == '*' ? MASK_KIND_SUFFIX : MASK_KIND_EXACT;
+}
+
+/** Hash a hostname the same way match() compares it.
+ * @param[in] key Hostname to hash.
+ * @return Hash value.
+ */
+static unsigned int
+host_hash(const char *key)
+{
+  unsigned int hash = 2166136261u;
+
+  for (; *key; key++)
+    hash = (hash ^ (unsigned char)ToLower(*key)) * 16777619u;
+  return hash;
+}
+
+/** Find the slot that holds (or would hold) a key.
+ * @param[in] mt Hash table to search.
+ * @param[in] key Hostname to look for.
+ * @param[in] hash host_hash() of \a key.
+ * @return Pointer to the chain link that points at the key, or at NULL.
+ */
+static struct MaskHost **
+host_slot(const struct MaskHostTable *mt, const char *key, unsigned int hash)
+{
+  struct MaskHost **pp;
+
+  for (pp = &mt->mt_buckets[hash & mt->mt_mask]; *pp; pp = &(*pp)->mh_next)
+    if ((*pp)->mh_hash == hash && !ircd_strcmp((*pp)->mh_key, key))
+      break;
+  return pp;
+}
+
+/** Double the number of buckets in a hash table.
+ * @param[in,out] mt Hash table to grow.
+ */
+static void
+host_grow(struct MaskHostTable *mt)
+{
+  struct MaskHost **buckets, *mh, *next;
+  unsigned int size, ii;
+
+  size = mt->mt_buckets ? (mt->mt_mask + 1) * 2 : MASK_HOST_MIN_SIZE;
+  buckets = (struct MaskHost **)MyCalloc(size, sizeof(*buckets));
+  if (mt->mt_buckets) {
+    for (ii = 0; ii <= mt->mt_mask; ii++)
+      for (mh = mt->mt_buckets[ii]; mh; mh = next) {
+        next = mh->mh_next;
+        mh->mh_next = buckets[mh->mh_hash & (size - 1)];
+        buckets[mh->mh_hash & (size - 1)] = mh;
+      }
+    MyFree(mt->mt_buckets);
+  }
+  mt->mt_buckets = buckets;
+  mt->mt_mask = size - 1;
+}
+
+/** Add an entry under a hostname key.
+ * @param[in,out] mt Hash table to add to.
+ * @param[in] key Hostname or domain.
+ * @param[in] data Owner's pointer.
+ * @param[in] order Precedence of entry.
+ */
+static void
+host_add(struct MaskHostTable *mt, const char *key, void *data,
+         unsigned long order)
+{
+  struct MaskHost **pp, *mh;
+  unsigned int hash;
+
+  if (!mt->mt_buckets || mt->mt_count > mt->mt_mask)
+    host_grow(mt);
+  hash = host_hash(key);
+  if (!(mh = *(pp = host_slot(mt, key, hash)))) {
+    mh = (struct MaskHost *)MyMalloc(sizeof(*mh) + strlen(key));
+    mh->mh_next = NULL;
+    mh->mh_entries = NULL;
+    mh->mh_hash = hash;
+    strcpy(mh->mh_key, key);
+    *pp = mh;
+    mt->mt_count++;
+  }
+  entry_add(&mh->mh_entries, data, order);
+}
+
+/** Remove an entry from under a hostname key.
+ * @param[in,out] mt Hash table to remove from.
+ * @param[in] key Hostname or domain.
+ * @param[in] data Owner's pointer.
+ * @return Non-zero if the entry was found and removed.
+ */
+static int
+host_del(struct MaskHostTable *mt, const char *key, void *data)
+{
+  struct MaskHost **pp, *mh;
+
+  if (!mt->mt_buckets || !(mh = *(pp = host_slot(mt, key, host_hash(key))))
+      || !entry_del(&mh->mh_entries, data))
+    return 0;
+  if (!mh->mh_entries) {
+    *pp = mh->mh_next;
+    MyFree(mh);
+    mt->mt_count--;
+  }
+  return 1;
+}
+
+/** Check the entries under one hostname key.
+ * @param[in] mt Hash table to search.
+ * @param[in] key Hostname or domain of the client.
+ * @param[in,out] mm Best match so far.
+ */
+static void
+host_scan(const struct MaskHostTable *mt, const char *key,
+          struct MaskMatch *mm)
+{
+  struct MaskHost *mh;
+
+  if (mt->mt_count && (mh = *host_slot(mt, key, host_hash(key))))
+    entry_scan(mh->mh_entries, mm);
+}
+
+/** Free a hash table and everything in it.
+ * @param[in,out] mt Hash table to empty.
+ */
+static void
+host_clear(struct MaskHostTable *mt)
+{
+  struct MaskHost *mh, *next;
+  unsigned int ii;
+
+  if (mt->mt_buckets) {
+    for (ii = 0; ii <= mt->mt_mask; ii++)
+      for (mh = mt->mt_buckets[ii]; mh; mh = next) {
+        next = mh->mh_next;
+        entry_free(mh->mh_entries);
+        MyFree(mh);
+      }
+    MyFree(mt->mt_buckets);
+  }
+  memset(mt, 0, sizeof(*mt));
+}
+
+/** Count memory used by a hash table.
+ * @param[in] mt Hash table to count.
+ * @return Number of bytes used by buckets, keys and entries.
+ */
+static size_t
+host_memory(const struct MaskHostTable *mt)
+{
+  const struct MaskHost *mh;
+  const struct MaskEntry *me;
+  unsigned int ii;
+  size_t total = 0;
+
+  if (!mt->mt_buckets)
+    return 0;
+  total += (mt->mt_mask + 1) * sizeof(*mt->mt_buckets);
+  for (ii = 0; ii <= mt->mt_mask; ii++)
+    for (mh = mt->mt_buckets[ii]; mh; mh = mh->mh_next) {
+      total += sizeof(*mh) + strlen(mh->mh_key);
+      for (me = mh->mh_entries; me; me = me->me_next)
+        total += sizeof(*me);
+    }
+  return total;
+}
+
+/** Return one bit of an address.
+ * @param[in] addr Address to examine.
+ * @param[in] bit Bit number, counting from the most significant.
+ * @return Zero or one.
+ */
+static unsigned int
+addr_bit(const struct irc_in_addr *addr, unsigned int bit)
+{
+  return (ntohs(addr->in6_16[bit >> 4]) >> (15 - (bit & 15))) & 1;
+}
+
+/** Count the leading bits two addresses have in common.
+ * @param[in] a First address.
+ * @param[in] b Second address.
+ * @param[in] max Maximum number of bits to compare.
+ * @return Length of the common prefix, at most \a max.
+ */
+static unsigned int
+addr_common(const struct irc_in_addr *a, const struct irc_in_addr *b,
+            unsigned int max)
+{
+  unsigned int ii, len = 0, diff;
+
+  for (ii = 0; ii < 8 && len < max; ii++) {
+    if ((diff = ntohs(a->in6_16[ii] ^ b->in6_16[ii]))) {
+      for (; !(diff & 0x8000); diff <<= 1)
+        len++;
+      break;
+    }
+    len += 16;
+  }
+  return len < max ? len : max;
+}
+
+/** Allocate a trie node for a prefix.
+ * @param[in,out] mi Index that will own the node.
+ * @param[in] addr Address to take the prefix from.
+ * @param[in] bits Length of the prefix.
+ * @return Newly allocated node.
+ */
+static struct MaskNode *
+node_new(struct MaskIndex *mi, const struct irc_in_addr *addr,
+         unsigned int bits)
+{
+  struct MaskNode *node;
+  unsigned int ii;
+
+  node = (struct MaskNode *)MyCalloc(1, sizeof(*node));
+  for (ii = 0; ii < 8; ii++) {
+    if (bits >= 16 * (ii + 1))
+      node->mn_addr.in6_16[ii] = addr->in6_16[ii];
+    else if (bits > 16 * ii)
+      node->mn_addr.in6_16[ii] = addr->in6_16[ii]
+        & htons(0xffff << (16 * (ii + 1) - bits));
+  }
+  node->mn_bits = bits;
+  mi->mi_nodes++;
+  return node;
+}
+
+/** Find or create the trie node for a prefix.
+ * @param[in,out] mi Index to search.
+ * @param[in] addr Address to take the prefix from.
+ * @param[in] bits Length of the prefix.
+ * @return Trie node for exactly that prefix.
+ */
+static struct MaskNode *
+trie_add(struct MaskIndex *mi, const struct irc_in_addr *addr,
+         unsigned int bits)
+{
+  struct MaskNode **pp, *node, *glue, *leaf;
+  unsigned int common;
+
+  for (pp = &mi->mi_root; (node = *pp); ) {
+    common = addr_common(addr, &node->mn_addr,
+                         bits < node->mn_bits ? bits : node->mn_bits);
+    if (common == node->mn_bits) {
+      if (common == bits)
+        return node;
+      pp = &node->mn_child[addr_bit(addr, common)];
+      continue;
+    }
+    if (common == bits) {
+      /* The new prefix is a prefix of this node; insert above it. */
+      leaf = node_new(mi, addr, bits);
+      leaf->mn_child[addr_bit(&node->mn_addr, bits)] = node;
+      return *pp = leaf;
+    }
+    /* The prefixes diverge; join them with a glue node. */
+    glue = node_new(mi, addr, common);
+    leaf = node_new(mi, addr, bits);
+    glue->mn_child[addr_bit(addr, common)] = leaf;
+    glue->mn_child[addr_bit(&node->mn_addr, common)] = node;
+    *pp = glue;
+    return leaf;
+  }
+  return *pp = node_new(mi, addr, bits);
+}
+
+/** Remove an entry from the trie, pruning nodes that become useless.
+ * @param[in,out] mi Index to remove from.
+ * @param[in,out] pp Link to the subtree to search.
+ * @param[in] addr Address of the mask.
+ * @param[in] bits Length of the mask.
+ * @param[in] data Owner's pointer.
+ * @return Non-zero if the entry was found and removed.
+ */
+static int
+trie_del(struct MaskIndex *mi, struct MaskNode **pp,
+         const struct irc_in_addr *addr, unsigned int bits, void *data)
+{
+  struct MaskNode *node = *pp;
+
+  if (!node || node->mn_bits > bits
+      || addr_common(addr, &node->mn_addr, node->mn_bits) < node->mn_bits)
+    return 0;
+  if (node->mn_bits == bits) {
+    if (!entry_del(&node->mn_entries, data))
+      return 0;
+  } else if (!trie_del(mi, &node->mn_child[addr_bit(addr, node->mn_bits)],
+                       addr, bits, data))
+    return 0;
+
+  if (!node->mn_entries && !(node->mn_child[0] && node->mn_child[1])) {
+    *pp = node->mn_child[0] ? node->mn_child[0] : node->mn_child[1];
+    MyFree(node);
+    mi->mi_nodes--;
+  }
+  return 1;
+}
+
+/** Free a trie.
+ * @param[in] node Root of subtree to free.
+ */
+static void
+trie_free(struct MaskNode *node)
+{
+  if (!node)
+    return;
+  trie_free(node->mn_child[0]);
+  trie_free(node->mn_child[1]);
+  entry_free(node->mn_entries);
+  MyFree(node);
+}
+
+/** Count memory used by trie entries.
+ * @param[in] node Root of subtree to count.
+ * @return Number of bytes used by entries in the subtree.
+ */
+static size_t
+trie_memory(const struct MaskNode *node)
+{
+  const struct MaskEntry *me;
+  size_t total = 0;
+
+  if (!node)
+    return 0;
+  for (me = node->mn_entries; me; me = me->me_next)
+    total += sizeof(*me);
+  return total + trie_memory(node->mn_child[0])
+    + trie_memory(node->mn_child[1]);
+}
+
+/** Add a mask to an index.
+ * If \a addr is not NULL, the mask is an IP mask of \a bits bits and
+ * \a host is ignored.  Otherwise \a host is a hostname mask; NULL
+ * means the entry has no host restriction at all.
+ * @param[in,out] mi Index to add to.
+ * @param[in] host Hostname mask.
+ * @param[in] addr Address for IP masks.
+ * @param[in] bits Number of bits in IP mask.
+ * @param[in] data Owner's pointer to return from mask_index_find().
+ * @param[in] order Precedence of this mask over others that match.
+ * @return Kind of index the mask was placed in.
+ */
+enum MaskKind
+mask_index_add(struct MaskIndex *mi, const char *host,
+               const struct irc_in_addr *addr, unsigned char bits,
+               void *data, unsigned long order)
+{
+  enum MaskKind kind;
+
+  assert(0 != mi);
+  assert(bits <= 128);
+
+  kind = addr ? MASK_KIND_IP : host_kind(host);
+  switch (kind) {
+  case MASK_KIND_IP:
+    entry_add(&trie_add(mi, addr, bits)->mn_entries, data, order);
+    break;
+  case MASK_KIND_EXACT:
+    host_add(&mi->mi_exact, host, data, order);
+    break;
+  case MASK_KIND_SUFFIX:
+    host_add(&mi->mi_suffix, host + 2, data, order);
+    break;
+  default:
+    entry_add(&mi->mi_wild, data, order);
+    break;
+  }
+  mi->mi_count[kind]++;
+  return kind;
+}
+
+/** Remove a mask from an index.
+ * The \a host, \a addr and \a bits arguments must be the same as
+ * when the mask was added.
+ * @param[in,out] mi Index to remove from.
+ * @param[in] host Hostname mask.
+ * @param[in] addr Address for IP masks.
+ * @param[in] bits Number of bits in IP mask.
+ * @param[in] data Owner's pointer.
+ */
+void
+mask_index_del(struct MaskIndex *mi, const char *host,
+               const struct irc_in_addr *addr, unsigned char bits,
+               void *data)
+{
+  enum MaskKind kind;
+  int found;
+
+  assert(0 != mi);
+
+  kind = addr ? MASK_KIND_IP : host_kind(host);
+  switch (kind) {
+  case MASK_KIND_IP:
+    found = trie_del(mi, &mi->mi_root, addr, bits, data);
+    break;
+  case MASK_KIND_EXACT:
+    found = host_del(&mi->mi_exact, host, data);
+    break;
+  case MASK_KIND_SUFFIX:
+    found = host_del(&mi->mi_suffix, host + 2, data);
+    break;
+  default:
+    found = entry_del(&mi->mi_wild, data);
+    break;
+  }
+  assert(found);
+  if (found)
+    mi->mi_count[kind]--;
+}
+
+/** Find the best mask in an index that applies to a client.
+ * Only masks that could match \a host or \a addr are passed to \a
+ * check; of those it accepts, the one with the highest order wins.
+ * @param[in] mi Index to search.
+ * @param[in] host Client's hostname (may be NULL).
+ * @param[in] addr Client's address (may be NULL).
+ * @param[in] check Function that does the full comparison.
+ * @param[in] ctx Context pointer for \a check.
+ * @return Owner's pointer for the best match, or NULL.
+ */
+void *
+mask_index_find(const struct MaskIndex *mi, const char *host,
+                const struct irc_in_addr *addr, MaskIndexCheck check,
+                void *ctx)
+{
+  return mask_index_find_hosts(mi, &host, host ? 1 : 0, addr, check, ctx);
+}
+
+/** Find the best mask in an index that applies to a client known by
+ * several hostnames.
+ * Like mask_index_find(), but masks that could match any of \a hosts
+ * are checked, and masks that need a linear check are only checked
+ * once.
+ * @param[in] mi Index to search.
+ * @param[in] hosts Client's hostnames.
+ * @param[in] nhosts Number of entries in \a hosts.
+ * @param[in] addr Client's address (may be NULL).
+ * @param[in] check Function that does the full comparison.
+ * @param[in] ctx Context pointer for \a check.
+ * @return Owner's pointer for the best match, or NULL.
+ */
+void *
+mask_index_find_hosts(const struct MaskIndex *mi, const char *const *hosts,
+                      unsigned int nhosts, const struct irc_in_addr *addr,
+                      MaskIndexCheck check, void *ctx)
+{
+  struct MaskMatch mm;
+  const struct MaskNode *node;
+  const char *host, *dot;
+  unsigned int ii;
+
+  assert(0 != mi);
+  assert(0 != check);
+
+  mm.mm_data = NULL;
+  mm.mm_order = 0;
+  mm.mm_check = check;
+  mm.mm_ctx = ctx;
+
+  if (addr)
+    for (node = mi->mi_root; node;
+         node = node->mn_child[addr_bit(addr, node->mn_bits)]) {
+      if (addr_common(addr, &node->mn_addr, node->mn_bits) < node->mn_bits)
+        break;
+      entry_scan(node->mn_entries, &mm);
+      if (node->mn_bits == 128)
+        break;
+    }
+
+  for (ii = 0; ii < nhosts; ii++) {
+    host = hosts[ii];
+    host_scan(&mi->mi_exact, host, &mm);
+    if (mi->mi_suffix.mt_count)
+      for (dot = host; (dot = strchr(dot, '.')); )
+        host_scan(&mi->mi_suffix, ++dot, &mm);
+  }
+
+  entry_scan(mi->mi_wild, &mm);
+  return mm.mm_data;
+}
+
+/** Remove every mask from an index.
+ * @param[in,out] mi Index to empty.
+ */
+void
+mask_index_clear(struct MaskIndex *mi)
+{
+  assert(0 != mi);
+
+  trie_free(mi->mi_root);
+  host_clear(&mi->mi_exact);
+  host_clear(&mi->mi_suffix);
+  entry_free(mi->mi_wild);
+  memset(mi, 0, sizeof(*mi));
+}
+
+/** Count memory used by an index.
+ * @param[in] mi Index to count.
+ * @return Number of bytes allocated for the index.
+ */
+size_t
+mask_index_memory(const struct MaskIndex *mi)
+{
+  const struct MaskEntry *me;
+  size_t total;
+
+  assert(0 != mi);
+
+  total = mi->mi_nodes * sizeof(struct MaskNode) + trie_memory(mi->mi_root)
+    + host_memory(&mi->mi_exact) + host_memory(&mi->mi_suffix);
+  for (me = mi->mi_wild; me; me = me->me_next)
+    total += sizeof(*me);
+  return total;
+}
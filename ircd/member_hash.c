@@ -0,0 +1,274 @@
+/*
+ * IRC - Internet Relay Chat, ircd/member_hash.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/** @file
+ * @brief Hash tables of the memberships of large channels and clients.
+ * @version $Id$
+ *
+ * Most channels have a few members and most users are on a few
+ * channels, so find_member_link() normally walks a short list.  A
+ * channel with at least #MEMBER_HASH_CHANNEL_MIN users gets a table
+ * of its memberships keyed by client, and a client on at least
+ * #MEMBER_HASH_CLIENT_MIN channels (such as a +k service) gets a
+ * table of its memberships keyed by channel.  A table is freed again
+ * when it holds fewer than half that many memberships.
+ *
+ * The tables use open addressing with linear probing and are kept
+ * at most half full.
+ */
+#include "config.h"
+
+#include "member_hash.h"
+#include "channel.h"
+#include "client.h"
+#include "ircd_alloc.h"
+#include "ircd_log.h"
+#include "struct.h"
+
+/* #include <assert.h> -- Now using assert in ircd_log.h */
+
+/** Open-addressed table of memberships. */
+struct MemberHash {
+  unsigned int mh_count;        /**< Number of memberships in the table. */
+  unsigned int mh_mask;         /**< Number of slots minus one. */
+  int mh_bychannel;             /**< Keyed by channel rather than by user. */
+  struct Membership *mh_table[1]; /**< Slots (allocated larger). */
+};
+
+/** Smallest number of slots in a table. */
+#define MEMBER_HASH_SLOTS 16
+
+/** Get the key of a membership in a table. */
+#define mh_key(mh, m) ((mh)->mh_bychannel ? (const void *) (m)->channel \
+                       : (const void *) (m)->user)
+
+/** Number of bytes to allocate for a table. */
+#define mh_size(slots) (sizeof(struct MemberHash) \
+  + ((slots) - 1) * sizeof(struct Membership *))
+
+/** Number of tables allocated. */
+static unsigned int hashCount;
+/** Number of bytes allocated for tables. */
+static size_t hashMemory;
+
+/** Find the first slot to probe for a key.
+ * @param[in] key Channel or client pointer.
+ * @param[in] mask Number of slots minus one.
+ * @return Slot number.
+ */
+static unsigned int
+mh_hash(const void *key, unsigned int mask)
+{
+  unsigned int h = (unsigned int) ((unsigned long) key >> 4);
+
+  h *= 2654435761U;
+  return (h ^ (h >> 16)) & mask;
+}
+
+/** Allocate an empty table.
+ * @param[in] slots Number of slots (a power of two).
+ * @param[in] bychannel Non-zero to key the table by channel.
+ * @return New table.
+ */
+static struct MemberHash *
+mh_alloc(unsigned int slots, int bychannel)
+{
+  struct MemberHash *mh;
+
+  mh = (struct MemberHash *) MyCalloc(1, mh_size(slots));
+  mh->mh_mask = slots - 1;
+  mh->mh_bychannel = bychannel;
+  hashCount++;
+  hashMemory += mh_size(slots);
+  return mh;
+}
+
+/** Free a table.
+ * @param[in] mh Table to free.
+ */
+static void
+mh_free(struct MemberHash *mh)
+{
+  hashCount--;
+  hashMemory -= mh_size(mh->mh_mask + 1);
+  MyFree(mh);
+}
+
+/** Put a membership into a table that has room for it.
+ * @param[in] mh Table to insert into.
+ * @param[in] member Membership to insert.
+ */
+static void
+mh_insert(struct MemberHash *mh, struct Membership *member)
+{
+  unsigned int ii = mh_hash(mh_key(mh, member), mh->mh_mask);
+
+  while (mh->mh_table[ii]) {
+    assert(mh->mh_table[ii] != member);
+    ii = (ii + 1) & mh->mh_mask;
+  }
+  mh->mh_table[ii] = member;
+  mh->mh_count++;
+}
+
+/** Move the contents of a table into one of a different size.
+ * @param[in] mh Table to replace; it is freed.
+ * @param[in] slots Number of slots in the new table.
+ * @return New table.
+ */
+static struct MemberHash *
+mh_resize(struct MemberHash *mh, unsigned int slots)
+{
+  struct MemberHash *nmh = mh_alloc(slots, mh->mh_bychannel);
+  unsigned int ii;
+
+  for (ii = 0; ii <= mh->mh_mask; ii++)
+    if (mh->mh_table[ii])
+      mh_insert(nmh, mh->mh_table[ii]);
+  assert(nmh->mh_count == mh->mh_count);
+  mh_free(mh);
+  return nmh;
+}
+
+/** Add a membership to a table, growing it if needed.
+ * @param[in,out] mhp Table to add to.
+ * @param[in] member Membership to add.
+ */
+static void
+mh_add(struct MemberHash **mhp, struct Membership *member)
+{
+  if (((*mhp)->mh_count + 1) * 2 > (*mhp)->mh_mask + 1)
+    *mhp = mh_resize(*mhp, ((*mhp)->mh_mask + 1) * 2);
+  mh_insert(*mhp, member);
+}
+
+/** Remove a membership from a table, shrinking or freeing it if it
+ * becomes sparse.
+ * @param[in,out] mhp Table to remove from.
+ * @param[in] member Membership to remove.
+ * @param[in] min Size at which this kind of table is created.
+ */
+static void
+mh_remove(struct MemberHash **mhp, struct Membership *member,
+          unsigned int min)
+{
+  struct MemberHash *mh = *mhp;
+  struct Membership *other;
+  unsigned int ii, jj, home;
+
+  ii = mh_hash(mh_key(mh, member), mh->mh_mask);
+  while (mh->mh_table[ii] != member) {
+    assert(mh->mh_table[ii] != 0);
+    ii = (ii + 1) & mh->mh_mask;
+  }
+
+  /* Move later entries of the same run back into the gap if their
+   * probe sequence passes through it.
+   */
+  for (jj = ii; (other = mh->mh_table[jj = (jj + 1) & mh->mh_mask]); ) {
+    home = mh_hash(mh_key(mh, other), mh->mh_mask);
+    if (ii <= jj ? (home <= ii || home > jj) : (home <= ii && home > jj)) {
+      mh->mh_table[ii] = other;
+      ii = jj;
+    }
+  }
+  mh->mh_table[ii] = 0;
+  mh->mh_count--;
+
+  if (mh->mh_count < min / 2) {
+    mh_free(mh);
+    *mhp = 0;
+  } else if (mh->mh_count * 8 < mh->mh_mask + 1
+             && mh->mh_mask + 1 > MEMBER_HASH_SLOTS)
+    *mhp = mh_resize(mh, (mh->mh_mask + 1) / 2);
+}
+
+/** Look up a membership.
+ * @param[in] mh Table of a channel (keyed by client) or of a client
+ * (keyed by channel).
+ * @param[in] key Client or channel to look for.
+ * @return Matching membership, or NULL if there is none.
+ */
+struct Membership *
+member_hash_find(const struct MemberHash *mh, const void *key)
+{
+  struct Membership *member;
+  unsigned int ii = mh_hash(key, mh->mh_mask);
+
+  while ((member = mh->mh_table[ii])) {
+    if (mh_key(mh, member) == key)
+      return member;
+    ii = (ii + 1) & mh->mh_mask;
+  }
+  return 0;
+}
+
+/** Add a new membership to the tables of its channel and client,
+ * creating them if they have become large enough.
+ * Called after the membership is linked into both lists and the
+ * channel's user count has been updated.
+ * @param[in] member New membership.
+ */
+void
+member_hash_link(struct Membership *member)
+{
+  struct Channel *chptr = member->channel;
+  struct User *user = cli_user(member->user);
+  struct Membership *other;
+
+  if (chptr->member_hash)
+    mh_add(&chptr->member_hash, member);
+  else if (chptr->users >= MEMBER_HASH_CHANNEL_MIN) {
+    chptr->member_hash = mh_alloc(MEMBER_HASH_SLOTS, 0);
+    for (other = chptr->members; other; other = other->next_member)
+      mh_add(&chptr->member_hash, other);
+  }
+
+  if (user->chan_hash)
+    mh_add(&user->chan_hash, member);
+  else if (user->joined >= MEMBER_HASH_CLIENT_MIN) {
+    user->chan_hash = mh_alloc(MEMBER_HASH_SLOTS, 1);
+    for (other = user->channel; other; other = other->next_channel)
+      mh_add(&user->chan_hash, other);
+  }
+}
+
+/** Remove a membership from the tables of its channel and client.
+ * @param[in] member Membership that is being removed.
+ */
+void
+member_hash_unlink(struct Membership *member)
+{
+  struct User *user = cli_user(member->user);
+
+  if (member->channel->member_hash)
+    mh_remove(&member->channel->member_hash, member,
+              MEMBER_HASH_CHANNEL_MIN);
+  if (user->chan_hash)
+    mh_remove(&user->chan_hash, member, MEMBER_HASH_CLIENT_MIN);
+}
+
+/** Report memory used by membership tables.
+ * @param[out] count Receives number of tables.
+ * @return Number of bytes allocated for tables.
+ */
+size_t
+member_hash_memory(unsigned int *count)
+{
+  *count = hashCount;
+  return hashMemory;
+}
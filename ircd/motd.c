@@ -39,6 +39,7 @@
 #include "ircd_string.h"
 #include "match.h"
 #include "msg.h"
+#include "msgq.h"
 #include "numeric.h"
 #include "numnicks.h"
 #include "s_conf.h"
@@ -158,6 +159,8 @@ motd_cache(struct Motd *motd)
   cache->maxcount = motd->maxcount;
 
   cache->modtime = *localtime((time_t *) &sb.st_mtime); /* store modtime */
+  cache->forward = 0; /* templates are built when first sent */
+  cache->signon = 0;
 
   cache->count = 0;
   while (cache->count < cache->maxcount && fbgets(line, sizeof(line), file)) {
@@ -213,6 +216,15 @@ motd_decache(struct Motd *motd)
 
     MyFree(cache->path); /* free path info... */
 
+    if (cache->forward) { /* and the pre-formatted replies */
+      msgq_tpl_clear(cache->forward);
+      MyFree(cache->forward);
+    }
+    if (cache->signon) {
+      msgq_tpl_clear(cache->signon);
+      MyFree(cache->signon);
+    }
+
     MyFree(cache); /* very simple for a reason... */
   }
 }
@@ -274,6 +286,37 @@ motd_lookup(struct Client *cptr)
   return MotdList.local; /* Ok, return the default motd */
 }
 
+/** Get the pre-formatted full MOTD for local users, building it if
+ * needed.
+ * @param[in] cache MOTD body to send.
+ * @return Message template with the same replies as motd_forward().
+ */
+static struct MsgTemplate *
+motd_template(struct MotdCache *cache)
+{
+  struct MsgTemplate *tpl;
+  int i;
+
+  if ((tpl = cache->forward))
+    return tpl;
+
+  tpl = cache->forward = (struct MsgTemplate *)MyMalloc(sizeof(*tpl));
+  msgq_tpl_init(tpl);
+
+  template_reply(tpl, RPL_MOTDSTART, cli_name(&me));
+  template_reply(tpl, SND_EXPLICIT | RPL_MOTD, ":- %d-%d-%d %d:%02d",
+		 cache->modtime.tm_year + 1900, cache->modtime.tm_mon + 1,
+		 cache->modtime.tm_mday, cache->modtime.tm_hour,
+		 cache->modtime.tm_min);
+
+  for (i = 0; i < cache->count; i++)
+    template_reply(tpl, RPL_MOTD, cache->motd[i]);
+
+  template_reply(tpl, RPL_ENDOFMOTD);
+
+  return tpl;
+}
+
 /** Send the content of a MotdCache to a user.
  * If \a cache is NULL, simply send ERR_NOMOTD to the client.
  * @param[in] cptr Client to send MOTD to.
@@ -289,6 +332,11 @@ motd_forward(struct Client *cptr, struct MotdCache *cache)
   if (!cache) /* no motd to send */
     return send_reply(cptr, ERR_NOMOTD);
 
+  if (MyConnect(cptr)) { /* local users get the pre-formatted copy */
+    send_template(cptr, motd_template(cache));
+    return 0;
+  }
+
   /* send the motd */
   send_reply(cptr, RPL_MOTDSTART, cli_name(&me));
   send_reply(cptr, SND_EXPLICIT | RPL_MOTD, ":- %d-%d-%d %d:%02d",
@@ -323,6 +371,7 @@ void
 motd_signon(struct Client* cptr)
 {
   struct MotdCache *cache;
+  struct MsgTemplate *tpl;
   const char *banner = NULL;
 
   cache = motd_cache(motd_lookup(cptr));
@@ -330,16 +379,23 @@ motd_signon(struct Client* cptr)
   if (!feature_bool(FEAT_NODEFAULTMOTD) || !cache)
     motd_forward(cptr, cache);
   else {
-    send_reply(cptr, RPL_MOTDSTART, cli_name(&me));
-    if ((banner = feature_str(FEAT_MOTD_BANNER)))
-      send_reply(cptr, SND_EXPLICIT | RPL_MOTD, ":%s", banner);
-    send_reply(cptr, SND_EXPLICIT | RPL_MOTD, ":\002Type /MOTD to read the "
-	       "AUP before continuing using this service.\002");
-    send_reply(cptr, SND_EXPLICIT | RPL_MOTD, ":The message of the day was "
-	       "last changed: %d-%d-%d %d:%d", cache->modtime.tm_year + 1900,
-	       cache->modtime.tm_mon + 1, cache->modtime.tm_mday,
-	       cache->modtime.tm_hour, cache->modtime.tm_min);
-    send_reply(cptr, RPL_ENDOFMOTD);
+    if (!(tpl = cache->signon)) { /* format the notice only once */
+      tpl = cache->signon = (struct MsgTemplate *)MyMalloc(sizeof(*tpl));
+      msgq_tpl_init(tpl);
+
+      template_reply(tpl, RPL_MOTDSTART, cli_name(&me));
+      if ((banner = feature_str(FEAT_MOTD_BANNER)))
+	template_reply(tpl, SND_EXPLICIT | RPL_MOTD, ":%s", banner);
+      template_reply(tpl, SND_EXPLICIT | RPL_MOTD, ":\002Type /MOTD to read "
+		     "the AUP before continuing using this service.\002");
+      template_reply(tpl, SND_EXPLICIT | RPL_MOTD, ":The message of the day "
+		     "was last changed: %d-%d-%d %d:%d",
+		     cache->modtime.tm_year + 1900, cache->modtime.tm_mon + 1,
+		     cache->modtime.tm_mday, cache->modtime.tm_hour,
+		     cache->modtime.tm_min);
+      template_reply(tpl, RPL_ENDOFMOTD);
+    }
+    send_template(cptr, tpl);
   }
 }
 
@@ -478,6 +534,10 @@ motd_memory_count(struct Client *cptr)
     mtc++;
     mtcm += sizeof(struct MotdCache) + (MOTD_LINESIZE * (cache->count - 1));
     mtcm += cache->path ? (strlen(cache->path) + 1) : 0;
+    if (cache->forward)
+      mtcm += sizeof(struct MsgTemplate) + cache->forward->length;
+    if (cache->signon)
+      mtcm += sizeof(struct MsgTemplate) + cache->signon->length;
   }
 
   if (MotdList.freelist)
@@ -38,11 +38,22 @@
 /* #include <assert.h> -- Now using assert in ircd_log.h */
 #include <stdarg.h>
 #include <string.h>
+#include <sys/mman.h>	/* mmap(), munmap() */
 #include <sys/types.h>
 #include <sys/uio.h>	/* struct iovec */
 
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
 #define MB_BASE_SHIFT	5 /**< Log2 of smallest message body to allocate. */
 #define MB_MAX_SHIFT	9 /**< Log2 of largest message body to allocate. */
+/** Number of size classes for MsgBufs. */
+#define MB_CLASSES	(MB_MAX_SHIFT - MB_BASE_SHIFT + 1)
+#define MSG_CLASS	MB_CLASSES /**< Slab class used for struct Msg. */
+
+#define MSG_SLAB_SIZE	65536 /**< Size of each chunk objects are carved from. */
+#define MSG_MAG_SIZE	32 /**< Number of freed objects cached per class. */
 
 /** Buffer for a single message. */
 struct MsgBuf {
@@ -65,6 +76,39 @@ struct Msg {
   struct MsgBuf *msg;		/**< actual message in queue */
 };
 
+/** Chunk of memory that MsgBufs or Msgs of a single size are carved
+ * from.  Each object is preceded by a pointer back to its slab.
+ */
+struct MsgSlab {
+  struct MsgSlab *next;		/**< next slab in class's list */
+  struct MsgSlab **prev_p;	/**< what points to us in linked list */
+  struct MsgSlabClass *cls;	/**< size class this slab belongs to */
+  unsigned int used;		/**< objects not on the slab's free list */
+  unsigned int carved;		/**< objects carved from the slab so far */
+  void *free;			/**< free list of carved objects */
+};
+
+/** Space at the start of a slab that is taken by its header. */
+#define SLAB_HDRSIZE	((sizeof(struct MsgSlab) + 15) & ~15)
+/** Return the slab that \a obj was carved from. */
+#define obj_slab(obj)	(((struct MsgSlab **)(obj))[-1])
+/** Return the free list link of \a obj. */
+#define obj_next(obj)	(*(void **)(obj))
+
+/** Set of slabs holding objects of one size. */
+struct MsgSlabClass {
+  unsigned int objsize;		/**< bytes per object, with slab pointer */
+  unsigned int per_slab;	/**< objects that fit in one slab */
+  unsigned int slabs;		/**< number of slabs allocated */
+  unsigned int empty_slabs;	/**< number of slabs on empty list */
+  unsigned int used;		/**< objects handed out to callers */
+  struct MsgSlab *partial;	/**< slabs with some objects available */
+  struct MsgSlab *full;		/**< slabs with no objects available */
+  struct MsgSlab *empty;	/**< slabs with no objects in use */
+  unsigned int nmag;		/**< number of objects in magazine */
+  void *mag[MSG_MAG_SIZE];	/**< recently freed objects */
+};
+
 /** Statistics tracking for message sizes. */
 struct MsgSizes {
   unsigned int msgs;		/**< total number of messages */
@@ -74,21 +118,195 @@ struct MsgSizes {
 /** Global tracking data for message buffers. */
 static struct {
   struct MsgBuf *msglist;	/**< list of in-use MsgBuf's */
-  struct {
-    unsigned int alloc;		/**< number of Msg's allocated */
-    unsigned int used;		/**< number of Msg's in use */
-    struct Msg *free;		/**< freelist of Msg's */
-  } msgs;                       /**< tracking info for Msg structs */
-  size_t tot_bufsize;		/**< total amount of memory in buffers */
-  /** Array of MsgBuf information, one entry for each used bucket size. */
-  struct {
-    unsigned int alloc;		/**< total MsgBuf's of this size */
-    unsigned int used;		/**< number of MsgBuf's of this size in use */
-    struct MsgBuf *free;	/**< list of free MsgBuf's */
-  } msgBufs[MB_MAX_SHIFT - MB_BASE_SHIFT + 1];
+  size_t tot_bufsize;		/**< total amount of memory in MsgBuf slabs */
+  size_t used_bufsize;		/**< memory in MsgBufs handed out to callers */
+  /** Slab classes, one for each MsgBuf bucket size and one for Msg's. */
+  struct MsgSlabClass classes[MB_CLASSES + 1];
   struct MsgSizes sizes;	/**< histogram of message sizes */
 } MQData;
 
+/** Get a slab class, working out its object size on first use.
+ * @param[in] idx Index of the class; MSG_CLASS for struct Msg.
+ * @return Slab class.
+ */
+static struct MsgSlabClass *
+slab_class(int idx)
+{
+  struct MsgSlabClass *cls = &MQData.classes[idx];
+  size_t size;
+
+  if (!cls->objsize) {
+    if (idx == MSG_CLASS)
+      size = sizeof(struct Msg);
+    else
+      size = sizeof(struct MsgBuf) + (1 << (idx + MB_BASE_SHIFT));
+    size += sizeof(struct MsgSlab *); /* room for the back pointer */
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    cls->objsize = size;
+    cls->per_slab = (MSG_SLAB_SIZE - SLAB_HDRSIZE) / size;
+  }
+
+  return cls;
+}
+
+/** Link a slab onto the head of a list.
+ * @param[in,out] list List to add to.
+ * @param[in] slab Slab to add.
+ */
+static void
+slab_link(struct MsgSlab **list, struct MsgSlab *slab)
+{
+  if ((slab->next = *list))
+    slab->next->prev_p = &slab->next;
+  slab->prev_p = list;
+  *list = slab;
+}
+
+/** Remove a slab from whatever list it is on.
+ * @param[in] slab Slab to remove.
+ */
+static void
+slab_unlink(struct MsgSlab *slab)
+{
+  if ((*slab->prev_p = slab->next))
+    slab->next->prev_p = slab->prev_p;
+}
+
+/** Get a fresh slab from the operating system.
+ * @return New slab, or NULL if none could be had.
+ */
+static struct MsgSlab *
+slab_map(void)
+{
+  void *slab;
+
+#ifdef MAP_ANONYMOUS
+  slab = mmap(0, MSG_SLAB_SIZE, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (slab == MAP_FAILED)
+    slab = 0;
+#else
+  slab = malloc(MSG_SLAB_SIZE);
+#endif
+
+  return (struct MsgSlab *)slab;
+}
+
+/** Give an empty slab back to the operating system.
+ * @param[in] slab Slab to release.
+ */
+static void
+slab_unmap(struct MsgSlab *slab)
+{
+#ifdef MAP_ANONYMOUS
+  munmap((void *)slab, MSG_SLAB_SIZE);
+#else
+  free(slab);
+#endif
+}
+
+/** Allocate an object from a slab class.
+ * @param[in] idx Index of the class to allocate from.
+ * @param[in] grow If non-zero, a new slab may be added to the class.
+ * @return New object, or NULL if none is available.
+ */
+static void *
+slab_alloc(int idx, int grow)
+{
+  struct MsgSlabClass *cls = slab_class(idx);
+  struct MsgSlab *slab;
+  void *obj;
+
+  if (cls->nmag) { /* recently freed objects are still in cache */
+    cls->used++;
+    if (idx != MSG_CLASS)
+      MQData.used_bufsize += cls->objsize;
+    return cls->mag[--cls->nmag];
+  }
+
+  if (!(slab = cls->partial)) {
+    if ((slab = cls->empty)) { /* reuse an empty slab */
+      slab_unlink(slab);
+      cls->empty_slabs--;
+    } else if (!grow || !(slab = slab_map()))
+      return 0;
+    else {
+      Debug((DEBUG_MALLOC, "Allocating slab for objects of size %u",
+	     cls->objsize));
+      slab->cls = cls;
+      slab->used = 0;
+      slab->carved = 0;
+      slab->free = 0;
+      cls->slabs++;
+      if (idx != MSG_CLASS)
+	MQData.tot_bufsize += MSG_SLAB_SIZE;
+    }
+    slab_link(&cls->partial, slab);
+  }
+
+  if ((obj = slab->free)) /* pop one off the slab's free list */
+    slab->free = obj_next(obj);
+  else { /* carve out a new one */
+    assert(slab->carved < cls->per_slab);
+    obj = (char *)slab + SLAB_HDRSIZE + slab->carved++ * cls->objsize +
+      sizeof(struct MsgSlab *);
+    obj_slab(obj) = slab;
+  }
+
+  if (++slab->used == cls->per_slab) { /* slab is now full */
+    slab_unlink(slab);
+    slab_link(&cls->full, slab);
+  }
+  cls->used++;
+  if (idx != MSG_CLASS)
+    MQData.used_bufsize += cls->objsize;
+
+  return obj;
+}
+
+/** Return an object to the slab it was carved from.
+ * @param[in] obj Object to return.
+ */
+static void
+slab_release(void *obj)
+{
+  struct MsgSlab *slab = obj_slab(obj);
+  struct MsgSlabClass *cls = slab->cls;
+
+  obj_next(obj) = slab->free;
+  slab->free = obj;
+
+  if (slab->used-- == cls->per_slab) { /* was full */
+    slab_unlink(slab);
+    slab_link(&cls->partial, slab);
+  }
+  if (!slab->used) { /* nothing left in use */
+    slab_unlink(slab);
+    slab_link(&cls->empty, slab);
+    cls->empty_slabs++;
+  }
+}
+
+/** Free an object, keeping it in its class's magazine if there is room.
+ * @param[in] obj Object to free.
+ */
+static void
+slab_free(void *obj)
+{
+  struct MsgSlabClass *cls = obj_slab(obj)->cls;
+
+  assert(0 < cls->used);
+  cls->used--;
+  if (cls != &MQData.classes[MSG_CLASS])
+    MQData.used_bufsize -= cls->objsize;
+
+  if (cls->nmag < MSG_MAG_SIZE)
+    cls->mag[cls->nmag++] = obj;
+  else
+    slab_release(obj);
+}
+
 /*
  * This routine is used to remove a certain amount of data from a given
  * queue and release the Msg (and MsgBuf) structure if needed
@@ -126,10 +344,7 @@ msgq_delmsg(struct MsgQ *mq, struct MsgQList *qlist, unsigned int *length_p)
     else
       qlist->head = m->next; /* just shift the list down some */
 
-    MQData.msgs.used--; /* struct Msg is not in use anymore */
-
-    m->next = MQData.msgs.free; /* throw it onto the free list */
-    MQData.msgs.free = m;
+    slab_free(m); /* struct Msg is not in use anymore */
   } else {
     mq->length -= *length_p; /* decrement queue length */
     m->sent += *length_p; /* this much of the message has been sent */
@@ -246,6 +461,66 @@ msgq_mapiov(const struct MsgQ *mq, struct iovec *iov, int count,
   return i;
 }
 
+/** Copy part of a message into a send buffer.
+ * @param[out] buf Buffer being filled.
+ * @param[in] size Size of \a buf.
+ * @param[in,out] len Bytes already in \a buf; updated.
+ * @param[in] m Message to copy from.
+ * @return Non-zero if \a buf is now full.
+ */
+static int
+msgq_copymsg(char *buf, unsigned int size, unsigned int *len,
+	     const struct Msg *m)
+{
+  unsigned int n = m->msg->length - m->sent;
+
+  if (n > size - *len) /* only part of it fits */
+    n = size - *len;
+  memcpy(buf + *len, m->msg->msg + m->sent, n);
+  *len += n;
+  return *len == size;
+}
+
+/** Copy data from the head of a message queue into one buffer.
+ * Messages are taken in the same order as by msgq_mapiov(), but with
+ * no limit on their number, so a queue of many short messages can
+ * fill the whole buffer.
+ * @param[in] mq Message queue to send from.
+ * @param[out] buf Buffer to copy into.
+ * @param[in] size Size of \a buf.
+ * @return Number of bytes copied into \a buf.
+ */
+unsigned int
+msgq_copy(const struct MsgQ *mq, char *buf, unsigned int size)
+{
+  struct Msg *queue;
+  struct Msg *prio;
+  unsigned int len = 0;
+
+  assert(0 != mq);
+  assert(0 != buf);
+
+  if (mq->length < 1 || size < 1) /* no data to copy */
+    return 0;
+
+  queue = mq->queue.head;
+  if (queue && queue->sent > 0) { /* partial msg on norm q */
+    if (msgq_copymsg(buf, size, &len, queue))
+      return len;
+    queue = queue->next;
+  }
+
+  for (prio = mq->prio.head; prio; prio = prio->next) /* go through prio queue */
+    if (msgq_copymsg(buf, size, &len, prio))
+      return len;
+
+  for (; queue; queue = queue->next) /* go through normal queue */
+    if (msgq_copymsg(buf, size, &len, queue))
+      return len;
+
+  return len;
+}
+
 /** Allocate a message buffer large enough to hold \a length bytes.
  *
  * @param[in] in_mb Buffer containing the desired message.
@@ -272,22 +547,14 @@ msgq_alloc(struct MsgBuf *in_mb, int length)
     return in_mb;
   }
 
-  /* Try popping one off the freelist first */
-  if ((mb = MQData.msgBufs[power - MB_BASE_SHIFT].free)) {
-    MQData.msgBufs[power - MB_BASE_SHIFT].free = mb->next;
-  } else if (MQData.tot_bufsize < feature_int(FEAT_BUFFERPOOL)) {
-    /* Allocate another if we won't bust the BUFFERPOOL */
-    Debug((DEBUG_MALLOC, "Allocating MsgBuf of length %d (total size %zu)",
-	   length, sizeof(struct MsgBuf) + length));
-    mb = (struct MsgBuf *)MyMalloc(sizeof(struct MsgBuf) + length);
-    MQData.msgBufs[power - MB_BASE_SHIFT].alloc++;
-    mb->power = power; /* remember size */
-    MQData.tot_bufsize += length;
-  }
+  /* Take one from the slabs, adding a slab if we won't bust the BUFFERPOOL.
+   * Count the buffers in use rather than the slabs, so that free room
+   * in other size classes does not stop this one from growing. */
+  mb = (struct MsgBuf *)slab_alloc(power - MB_BASE_SHIFT, MQData.used_bufsize <
+				   (size_t)feature_int(FEAT_BUFFERPOOL));
 
   if (mb) {
-    MQData.msgBufs[power - MB_BASE_SHIFT].used++; /* how many are we using? */
-
+    mb->power = power; /* remember size */
     mb->real = 0; /* essential initializations */
     mb->ref = 1;
 
@@ -299,39 +566,45 @@ msgq_alloc(struct MsgBuf *in_mb, int length)
   return mb; /* return the buffer */
 }
 
-/** Deallocate unused message buffers.
+/** Give empty slabs back to the operating system.
+ * Cached objects are returned to their slabs first, so that slabs
+ * with nothing in use can be released.
  */
 static void
 msgq_clear_freembs(void)
 {
-  struct MsgBuf *mb;
+  struct MsgSlabClass *cls;
+  struct MsgSlab *slab;
   int i;
 
   /* Walk through the various size classes */
-  for (i = MB_BASE_SHIFT; i < MB_MAX_SHIFT + 1; i++)
-    /* walk down the free list */
-    while ((mb = MQData.msgBufs[i - MB_BASE_SHIFT].free)) {
-      MQData.msgBufs[i - MB_BASE_SHIFT].free = mb->next; /* shift free list */
-      MQData.msgBufs[i - MB_BASE_SHIFT].alloc--; /* reduce allocation count */
-      MQData.tot_bufsize -= 1 << i; /* reduce total buffer allocation count */
-      MyFree(mb); /* and free the buffer */
+  for (i = 0; i <= MSG_CLASS; i++) {
+    cls = &MQData.classes[i];
+
+    while (cls->nmag) /* empty the magazine */
+      slab_release(cls->mag[--cls->nmag]);
+
+    while ((slab = cls->empty)) { /* release the empty slabs */
+      slab_unlink(slab);
+      cls->empty_slabs--;
+      cls->slabs--;
+      if (i != MSG_CLASS)
+	MQData.tot_bufsize -= MSG_SLAB_SIZE;
+      slab_unmap(slab);
     }
+  }
 }
 
-/** Format a message buffer for a client from a format string.
- * @param[in] dest %Client that receives the data (may be NULL).
- * @param[in] format Format string for message.
- * @param[in] vl Argument list for \a format.
- * @return Allocated MsgBuf.
+/** Try to make memory available for message buffers.
+ * Each stage is more drastic than the one before it.
+ * @param[in] stage Number of stages already tried.
+ * @return Zero if there is nothing left to try.
  */
-struct MsgBuf *
-msgq_vmake(struct Client *dest, const char *format, va_list vl)
+static int
+msgq_reclaim(int stage)
 {
-  struct MsgBuf *mb;
-
-  assert(0 != format);
-
-  if (!(mb = msgq_alloc(0, BUFSIZE))) {
+  switch (stage) {
+  case 0:
     if (feature_bool(FEAT_HAS_FERGUSON_FLUSHER)) {
       /*
        * from "Married With Children" episode were Al bought a REAL toilet
@@ -351,29 +624,62 @@ msgq_vmake(struct Client *dest, const char *format, va_list vl)
        * bailing this may help servers running out of memory
        */
       flush_connections(0);
-      mb = msgq_alloc(0, BUFSIZE);
     }
-    if (!mb) { /* OK, try clearing the buffer free list */
-      msgq_clear_freembs();
-      mb = msgq_alloc(0, BUFSIZE);
-    }
-    if (!mb) { /* OK, try killing a client */
-      kill_highest_sendq(0); /* Don't kill any server connections */
-      msgq_clear_freembs();  /* Release whatever was just freelisted */
-      mb = msgq_alloc(0, BUFSIZE);
-    }
-    if (!mb) { /* hmmm... */
-      kill_highest_sendq(1); /* Try killing a server connection now */
-      msgq_clear_freembs();  /* Clear freelist again */
-      mb = msgq_alloc(0, BUFSIZE);
-    }
-    if (!mb) /* AIEEEE! */
-      server_panic("Unable to allocate buffers!");
+    return 1;
+  case 1: /* OK, try clearing the buffer free list */
+    msgq_clear_freembs();
+    return 1;
+  case 2: /* OK, try killing a client */
+    kill_highest_sendq(0); /* Don't kill any server connections */
+    msgq_clear_freembs();  /* Release whatever was just freelisted */
+    return 1;
+  case 3: /* hmmm... */
+    kill_highest_sendq(1); /* Try killing a server connection now */
+    msgq_clear_freembs();  /* Clear freelist again */
+    return 1;
   }
+  return 0;
+}
+
+/** Allocate a message buffer, releasing memory if none is available.
+ * @param[in] length Number of bytes the buffer must hold.
+ * @return Message buffer, linked into the list of active MsgBufs.
+ */
+static struct MsgBuf *
+msgq_getbuf(int length)
+{
+  struct MsgBuf *mb;
+  int stage;
+
+  for (stage = 0; !(mb = msgq_alloc(0, length)); stage++)
+    if (!msgq_reclaim(stage)) /* AIEEEE! */
+      server_panic("Unable to allocate buffers!");
 
   mb->next = MQData.msglist; /* initialize the msgbuf */
   mb->prev_p = &MQData.msglist;
 
+  if (MQData.msglist) /* link it into the list */
+    MQData.msglist->prev_p = &mb->next;
+  MQData.msglist = mb;
+
+  return mb;
+}
+
+/** Format a message buffer for a client from a format string.
+ * @param[in] dest %Client that receives the data (may be NULL).
+ * @param[in] format Format string for message.
+ * @param[in] vl Argument list for \a format.
+ * @return Allocated MsgBuf.
+ */
+struct MsgBuf *
+msgq_vmake(struct Client *dest, const char *format, va_list vl)
+{
+  struct MsgBuf *mb;
+
+  assert(0 != format);
+
+  mb = msgq_getbuf(BUFSIZE);
+
   /* fill the buffer */
   mb->length = ircd_vsnprintf(dest, mb->msg, bufsize(mb) - 1, format, vl);
 
@@ -386,9 +692,29 @@ msgq_vmake(struct Client *dest, const char *format, va_list vl)
 
   assert(mb->length <= bufsize(mb));
 
-  if (MQData.msglist) /* link it into the list */
-    MQData.msglist->prev_p = &mb->next;
-  MQData.msglist = mb;
+  return mb;
+}
+
+/** Make a close-fitting message buffer holding exactly \a length bytes.
+ * Unlike msgq_make(), no \r\n is added; the buffer is one piece of a
+ * message that is queued together with its other pieces.
+ * @param[in] text Bytes to copy into the buffer.
+ * @param[in] length Number of bytes to copy; less than BUFSIZE.
+ * @return Allocated MsgBuf.
+ */
+static struct MsgBuf *
+msgq_raw(const char *text, unsigned int length)
+{
+  struct MsgBuf *mb;
+
+  assert(0 < length);
+  assert(length < BUFSIZE);
+
+  mb = msgq_getbuf(length + 1);
+  mb->real = mb; /* already close-fitting; msgq_add() need not copy it */
+  memcpy(mb->msg, text, length);
+  mb->length = length;
+  mb->msg[length] = '\0'; /* for Debug() output */
 
   return mb;
 }
@@ -464,11 +790,9 @@ msgq_clean(struct MsgBuf *mb)
     if (mb->real && mb->real != mb) /* clean up the real buffer */
       msgq_clean(mb->real);
 
-    mb->next = MQData.msgBufs[mb->power - MB_BASE_SHIFT].free;
-    MQData.msgBufs[mb->power - MB_BASE_SHIFT].free = mb;
-    MQData.msgBufs[mb->power - MB_BASE_SHIFT].used--;
-
     mb->prev_p = 0;
+
+    slab_free(mb);
   }
 }
 
@@ -482,6 +806,7 @@ msgq_add(struct MsgQ *mq, struct MsgBuf *mb, int prio)
 {
   struct MsgQList *qlist;
   struct Msg *msg;
+  int stage;
 
   assert(0 != mq);
   assert(0 != mb);
@@ -493,13 +818,9 @@ msgq_add(struct MsgQ *mq, struct MsgBuf *mb, int prio)
 
   qlist = prio ? &mq->prio : &mq->queue;
 
-  if (!(msg = MQData.msgs.free)) { /* do I need to allocate one? */
-    msg = (struct Msg *)MyMalloc(sizeof(struct Msg));
-    MQData.msgs.alloc++; /* we allocated another */
-  } else /* shift the free list */
-    MQData.msgs.free = MQData.msgs.free->next;
-
-  MQData.msgs.used++; /* we're using another */
+  for (stage = 0; !(msg = (struct Msg *)slab_alloc(MSG_CLASS, 1)); stage++)
+    if (!msgq_reclaim(stage))
+      server_panic("Unable to allocate message queue entries!");
 
   msg->next = 0; /* initialize the msg */
   msg->sent = 0;
@@ -549,6 +870,180 @@ msgq_add(struct MsgQ *mq, struct MsgBuf *mb, int prio)
   mq->count++; /* and the queue count */
 }
 
+/** Move one message list to the end of another.
+ * @param[in,out] dest List to append to.
+ * @param[in,out] src List to take messages from.
+ */
+static void
+msgq_movelist(struct MsgQList *dest, struct MsgQList *src)
+{
+  if (!src->head)
+    return;
+
+  if (!dest->head)
+    dest->head = src->head;
+  else
+    dest->tail->next = src->head;
+  dest->tail = src->tail;
+
+  src->head = src->tail = 0;
+}
+
+/** Move every message in one queue to the end of another.
+ * Messages keep their priority.  No message in \a src may be
+ * partially sent.
+ * @param[in,out] dest Message queue to append to.
+ * @param[in,out] src Message queue to take messages from; left empty.
+ */
+void
+msgq_move(struct MsgQ *dest, struct MsgQ *src)
+{
+  assert(0 != dest);
+  assert(0 != src);
+  assert(!src->queue.head || !src->queue.head->sent);
+  assert(!src->prio.head || !src->prio.head->sent);
+
+  msgq_movelist(&dest->queue, &src->queue);
+  msgq_movelist(&dest->prio, &src->prio);
+
+  dest->length += src->length;
+  dest->count += src->count;
+  src->length = 0;
+  src->count = 0;
+}
+
+/** Add a text piece or nick slot to the end of a template.
+ * @param[in,out] tpl Template to extend.
+ * @param[in] mb Text piece, or NULL for a nick slot.
+ */
+static void
+msgq_tpl_push(struct MsgTemplate *tpl, struct MsgBuf *mb)
+{
+  if (tpl->count == tpl->size) {
+    tpl->size = tpl->size ? tpl->size * 2 : 16;
+    tpl->parts = (struct MsgBuf **)MyRealloc(tpl->parts, tpl->size *
+					     sizeof(tpl->parts[0]));
+  }
+  tpl->parts[tpl->count++] = mb;
+}
+
+/** Turn text waiting in a template into a shared text piece.
+ * @param[in,out] tpl Template to flush.
+ */
+static void
+msgq_tpl_flush(struct MsgTemplate *tpl)
+{
+  if (tpl->pending) {
+    msgq_tpl_push(tpl, msgq_raw(tpl->pend, tpl->pending));
+    tpl->pending = 0;
+  }
+}
+
+/** Initialize an empty message template.
+ * @param[out] tpl Template to initialize.
+ */
+void
+msgq_tpl_init(struct MsgTemplate *tpl)
+{
+  assert(0 != tpl);
+
+  memset(tpl, 0, sizeof(*tpl));
+}
+
+/** Append text to a message template.
+ * Lines must be complete, including their \r\n, before the template
+ * is sent.
+ * @param[in,out] tpl Template to append to.
+ * @param[in] text Text to append.
+ * @param[in] length Number of bytes in \a text.
+ */
+void
+msgq_tpl_text(struct MsgTemplate *tpl, const char *text, unsigned int length)
+{
+  unsigned int n;
+
+  assert(0 != tpl);
+  assert(0 != text);
+
+  tpl->length += length;
+  for (n = 0; n < length; n++)
+    if (text[n] == '\n')
+      tpl->lines++;
+
+  while (length > 0) {
+    if (tpl->pending == sizeof(tpl->pend) - 1) /* piece is full */
+      msgq_tpl_flush(tpl);
+
+    n = sizeof(tpl->pend) - 1 - tpl->pending;
+    if (n > length)
+      n = length;
+    memcpy(tpl->pend + tpl->pending, text, n);
+    tpl->pending += n;
+    text += n;
+    length -= n;
+  }
+}
+
+/** Append a slot for the recipient's nick to a message template.
+ * @param[in,out] tpl Template to append to.
+ */
+void
+msgq_tpl_nick(struct MsgTemplate *tpl)
+{
+  assert(0 != tpl);
+
+  msgq_tpl_flush(tpl);
+  msgq_tpl_push(tpl, 0);
+  tpl->slots++;
+}
+
+/** Release everything held by a message template and make it empty.
+ * @param[in,out] tpl Template to clear.
+ */
+void
+msgq_tpl_clear(struct MsgTemplate *tpl)
+{
+  unsigned int i;
+
+  assert(0 != tpl);
+
+  for (i = 0; i < tpl->count; i++)
+    if (tpl->parts[i])
+      msgq_clean(tpl->parts[i]);
+  if (tpl->parts)
+    MyFree(tpl->parts);
+  msgq_tpl_init(tpl);
+}
+
+/** Append a message template to a message queue.
+ * Each text piece is shared with every other queue that holds the
+ * template; only the nick is copied.
+ * @param[in,out] mq Message queue to append to.
+ * @param[in,out] tpl Template to append.
+ * @param[in] nick Text to put in the template's nick slots.
+ */
+void
+msgq_tpl_add(struct MsgQ *mq, struct MsgTemplate *tpl, const char *nick)
+{
+  struct MsgBuf *mb = 0;
+  unsigned int i;
+
+  assert(0 != mq);
+  assert(0 != tpl);
+  assert(0 != nick);
+
+  msgq_tpl_flush(tpl); /* make sure the last piece is out of pend */
+
+  if (tpl->slots)
+    mb = msgq_raw(nick, strlen(nick));
+
+  for (i = 0; i < tpl->count; i++)
+    msgq_add(mq, tpl->parts[i] ? tpl->parts[i] : mb, 0);
+
+  if (mb)
+    msgq_clean(mb);
+}
+
 /** Report memory statistics for message buffers.
  * @param[in] cptr Client requesting information.
  * @param[out] msg_alloc Receives number of bytes allocated in Msg structs.
@@ -557,36 +1052,37 @@ msgq_add(struct MsgQ *mq, struct MsgBuf *mb, int prio)
 void
 msgq_count_memory(struct Client *cptr, size_t *msg_alloc, size_t *msgbuf_alloc)
 {
+  struct MsgSlabClass *cls;
   int i;
-  size_t total = 0, size;
+  size_t total = 0;
 
   assert(0 != cptr);
   assert(0 != msg_alloc);
   assert(0 != msgbuf_alloc);
 
   /* Data for Msg's is simple, so just send it */
+  cls = slab_class(MSG_CLASS);
   send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG,
-	     ":Msgs allocated %d(%zu) used %d(%zu) text %zu",
-             MQData.msgs.alloc, MQData.msgs.alloc * sizeof(struct Msg),
-             MQData.msgs.used,  MQData.msgs.used * sizeof(struct Msg),
-             MQData.tot_bufsize);
+	     ":Msgs allocated %u(%zu) used %u(%zu) text %zu",
+	     cls->slabs * cls->per_slab, (size_t)cls->slabs * MSG_SLAB_SIZE,
+	     cls->used, cls->used * sizeof(struct Msg),
+	     MQData.tot_bufsize);
   /* count_memory() wants to know the total */
-  *msg_alloc = MQData.msgs.alloc * sizeof(struct Msg);
+  *msg_alloc = (size_t)cls->slabs * MSG_SLAB_SIZE;
 
   /* Ok, now walk through each size class */
-  for (i = MB_BASE_SHIFT; i < MB_MAX_SHIFT + 1; i++) {
-    size = sizeof(struct MsgBuf) + (1 << i); /* total size of a buffer */
+  for (i = 0; i < MB_CLASSES; i++) {
+    cls = slab_class(i);
 
     /* Send information for this buffer size class */
     send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG,
-	       ":MsgBufs of size %zu allocated %d(%zu) used %d(%zu)", 1 << i,
-	       MQData.msgBufs[i - MB_BASE_SHIFT].alloc,
-	       MQData.msgBufs[i - MB_BASE_SHIFT].alloc * size,
-	       MQData.msgBufs[i - MB_BASE_SHIFT].used,
-	       MQData.msgBufs[i - MB_BASE_SHIFT].used * size);
+	       ":MsgBufs of size %u allocated %u(%zu) used %u(%zu)",
+	       1 << (i + MB_BASE_SHIFT),
+	       cls->slabs * cls->per_slab, (size_t)cls->slabs * MSG_SLAB_SIZE,
+	       cls->used, (size_t)cls->used * cls->objsize);
 
     /* count_memory() wants to know the total */
-    total += MQData.msgBufs[i - MB_BASE_SHIFT].alloc * size;
+    total += (size_t)cls->slabs * MSG_SLAB_SIZE;
   }
   *msgbuf_alloc = total;
 }
@@ -625,4 +1121,20 @@ msgq_histogram(struct Client *cptr, const struct StatDesc *sd, char *param)
 	       tmp.sizes[i +  9], tmp.sizes[i + 10], tmp.sizes[i + 11],
 	       tmp.sizes[i + 12], tmp.sizes[i + 13], tmp.sizes[i + 14],
 	       tmp.sizes[i + 15]);
+
+  /* Report how full the slabs of each class are.  Fragmentation is
+   * the share of objects in partly used slabs that sit unused. */
+  for (i = 0; i <= MSG_CLASS; i++) {
+    struct MsgSlabClass *cls = slab_class(i);
+    unsigned int held = cls->used + cls->nmag;
+    unsigned int room = (cls->slabs - cls->empty_slabs) * cls->per_slab;
+
+    send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG, ":%s %u: slabs %u "
+	       "(%u empty) objects %u/%u cached %u fragmented %u%%",
+	       i == MSG_CLASS ? "Msg" : "MsgBuf",
+	       i == MSG_CLASS ? (unsigned int)sizeof(struct Msg) :
+	       1u << (i + MB_BASE_SHIFT), cls->slabs, cls->empty_slabs,
+	       cls->used, cls->slabs * cls->per_slab, cls->nmag,
+	       room ? (room - held) * 100 / room : 0);
+  }
 }
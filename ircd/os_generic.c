@@ -45,6 +45,7 @@
 #endif
 
 #include "ircd_osdep.h"
+#include "ircd_alloc.h"
 #include "msgq.h"
 #include "ircd_log.h"
 #include "res.h"
@@ -87,6 +88,16 @@
 #define IOV_MAX 16	/**< minimum required length of an iovec array */
 #endif
 
+#define SENDV_IOV_LIMIT	1024	/**< never map more iovecs than this */
+#define SEND_COPY_SIZE	65536	/**< size of buffer for os_sendcopy_nonb() */
+
+/** Number of entries in #sendv_iov, found at first use. */
+static int sendv_iovmax;
+/** I/O vector used to map message queues for writing. */
+static struct iovec* sendv_iov;
+/** Contiguous buffer that os_sendcopy_nonb() coalesces messages into. */
+static char* send_copy;
+
 #ifdef HPUX
 #include <sys/syscall.h>
 #define getrusage(a,b) syscall(SYS_GETRUSAGE, a, b)
@@ -551,6 +562,39 @@ IOResult os_send_nonb(int fd, const char* buf, unsigned int length,
   }
 }
 
+/** Get the largest number of iovecs that one writev() may use.
+ * The kernel's limit is asked for at run time, since the compile-time
+ * IOV_MAX is often missing or smaller than what the system allows.
+ * @return Number of entries available for msgq_mapiov().
+ */
+int os_iov_max(void)
+{
+  if (!sendv_iovmax) {
+    long lim = -1;
+
+#ifdef _SC_IOV_MAX
+    lim = sysconf(_SC_IOV_MAX);
+#endif
+    if (lim < IOV_MAX)
+      lim = IOV_MAX;
+    if (lim > SENDV_IOV_LIMIT)
+      lim = SENDV_IOV_LIMIT;
+
+    sendv_iov = (struct iovec*) MyMalloc(lim * sizeof(struct iovec));
+    sendv_iovmax = lim;
+  }
+
+  return sendv_iovmax;
+}
+
+/** Get the number of bytes os_sendcopy_nonb() sends at most per call.
+ * @return Size of the coalescing buffer.
+ */
+unsigned int os_sendcopy_size(void)
+{
+  return SEND_COPY_SIZE;
+}
+
 /** Attempt a vectored write on a connected socket.
  * @param[in] fd File descriptor to write to.
  * @param[in] buf Message queue to send from.
@@ -563,16 +607,52 @@ IOResult os_sendv_nonb(int fd, struct MsgQ* buf, unsigned int* count_in,
 {
   int res;
   int count;
-  struct iovec iov[IOV_MAX];
+  int iovmax = os_iov_max(); /* allocates sendv_iov on first use */
 
   assert(0 != buf);
   assert(0 != count_in);
   assert(0 != count_out);
 
   *count_in = 0;
-  count = msgq_mapiov(buf, iov, IOV_MAX, count_in);
+  count = msgq_mapiov(buf, sendv_iov, iovmax, count_in);
+
+  if (-1 < (res = writev(fd, sendv_iov, count))) {
+    *count_out = (unsigned) res;
+    return IO_SUCCESS;
+  } else {
+    *count_out = 0;
+    return is_blocked(errno) ? IO_BLOCKED : IO_FAILURE;
+  }
+}
+
+/** Write the head of a message queue from one contiguous buffer.
+ * Queued messages are copied into a single buffer of
+ * os_sendcopy_size() bytes and sent with one send(); unlike
+ * os_sendv_nonb(), the number of messages per call is not limited by
+ * os_iov_max(), so queues of many short messages move more data per
+ * system call.
+ * @param[in] fd File descriptor to write to.
+ * @param[in] buf Message queue to send from.
+ * @param[out] count_in Number of bytes copied from \a buf.
+ * @param[out] count_out Receives number of bytes actually written.
+ * @return An IOResult value indicating status.
+ */
+IOResult os_sendcopy_nonb(int fd, struct MsgQ* buf, unsigned int* count_in,
+			  unsigned int* count_out)
+{
+  int res;
+  unsigned int len;
+
+  assert(0 != buf);
+  assert(0 != count_in);
+  assert(0 != count_out);
+
+  if (!send_copy)
+    send_copy = (char*) MyMalloc(SEND_COPY_SIZE);
+
+  *count_in = len = msgq_copy(buf, send_copy, SEND_COPY_SIZE);
 
-  if (-1 < (res = writev(fd, iov, count))) {
+  if (-1 < (res = send(fd, send_copy, len, 0))) {
     *count_out = (unsigned) res;
     return IO_SUCCESS;
   } else {
@@ -28,12 +28,14 @@
 #include "ircd.h"
 #include "ircd_chattr.h"
 #include "ircd_log.h"
+#include "ircd_string.h"
 #include "parse.h"
 #include "s_bsd.h"
 #include "s_misc.h"
 #include "send.h"
 
 /* #include <assert.h> -- Now using assert in ircd_log.h */
+#include <string.h>
 
 /** Add a certain number of bytes to a client's received statistics.
  * @param[in,out] cptr Client to update.
@@ -54,6 +56,29 @@ static void update_messages_received(struct Client* cptr)
   ++(cli_receiveM(cptr));
 }
 
+/** Append input up to the next end-of-line to a client's line buffer.
+ * Anything past BUFSIZE - 1 bytes of a line is dropped, so there is
+ * always room for the terminating NUL.
+ * @param[in] client_buffer Start of the client's line buffer.
+ * @param[in,out] endp End of the partial line in \a client_buffer.
+ * @param[in] src Start of input.
+ * @param[in] end End of input.
+ * @return Pointer to the end-of-line character in the input, or \a end.
+ */
+static const char* copy_line(char* client_buffer, char** endp,
+                             const char* src, const char* end)
+{
+  const char* eol = ircd_find_eol(src, end);
+  size_t      room = client_buffer + BUFSIZE - 1 - *endp;
+  size_t      len = eol - src;
+
+  if (len > room)
+    len = room;
+  memcpy(*endp, src, len);
+  *endp += len;
+  return eol;
+}
+
 /** Handle received data from a directly connected server.
  * @param[in] cptr Peer server that sent us data.
  * @param[in] buffer Input buffer.
@@ -63,6 +88,7 @@ static void update_messages_received(struct Client* cptr)
 int server_dopacket(struct Client* cptr, const char* buffer, int length)
 {
   const char* src;
+  const char* end;
   char*       endp;
   char*       client_buffer;
 
@@ -73,9 +99,10 @@ int server_dopacket(struct Client* cptr, const char* buffer, int length)
   client_buffer = cli_buffer(cptr);
   endp = client_buffer + cli_count(cptr);
   src = buffer;
+  end = buffer + length;
 
-  while (length-- > 0) {
-    *endp = *src++;
+  while ((src = copy_line(client_buffer, &endp, src, end)) < end) {
+    src++;
     /*
      * Yuck.  Stuck.  To make sure we stay backward compatible,
      * we must assume that either CR or LF terminates the message
@@ -83,24 +110,20 @@ int server_dopacket(struct Client* cptr, const char* buffer, int length)
      * of messages, backward compatibility is lost and major
      * problems will arise. - Avalon
      */
-    if (IsEol(*endp)) {
-      if (endp == client_buffer)
-        continue;               /* Skip extra LF/CR's */
-      *endp = '\0';
-
-      update_messages_received(cptr);
-
-      if (parse_server(cptr, cli_buffer(cptr), endp) == CPTR_KILLED)
-        return CPTR_KILLED;
-      /*
-       *  Socket is dead so exit
-       */
-      if (IsDead(cptr))
-        return exit_client(cptr, cptr, &me, cli_info(cptr));
-      endp = client_buffer;
-    }
-    else if (endp < client_buffer + BUFSIZE)
-      ++endp;                   /* There is always room for the null */
+    if (endp == client_buffer)
+      continue;                 /* Skip extra LF/CR's */
+    *endp = '\0';
+
+    update_messages_received(cptr);
+
+    if (parse_server(cptr, cli_buffer(cptr), endp) == CPTR_KILLED)
+      return CPTR_KILLED;
+    /*
+     *  Socket is dead so exit
+     */
+    if (IsDead(cptr))
+      return exit_client(cptr, cptr, &me, cli_info(cptr));
+    endp = client_buffer;
   }
   cli_count(cptr) = endp - cli_buffer(cptr);
   return 1;
@@ -115,6 +138,7 @@ int server_dopacket(struct Client* cptr, const char* buffer, int length)
 int connect_dopacket(struct Client *cptr, const char *buffer, int length)
 {
   const char* src;
+  const char* end;
   char*       endp;
   char*       client_buffer;
 
@@ -125,10 +149,11 @@ int connect_dopacket(struct Client *cptr, const char *buffer, int length)
   client_buffer = cli_buffer(cptr);
   endp = client_buffer + cli_count(cptr);
   src = buffer;
+  end = buffer + length;
 
-  while (length-- > 0)
+  while ((src = copy_line(client_buffer, &endp, src, end)) < end)
   {
-    *endp = *src++;
+    src++;
     /*
      * Yuck.  Stuck.  To make sure we stay backward compatible,
      * we must assume that either CR or LF terminates the message
@@ -136,48 +161,44 @@ int connect_dopacket(struct Client *cptr, const char *buffer, int length)
      * of messages, backward compatibility is lost and major
      * problems will arise. - Avalon
      */
-    if (IsEol(*endp))
+    /* Skip extra LF/CR's */
+    if (endp == client_buffer)
+      continue;
+    *endp = '\0';
+
+    update_messages_received(cptr);
+
+    if (parse_client(cptr, cli_buffer(cptr), endp) == CPTR_KILLED)
+      return CPTR_KILLED;
+    /* Socket is dead so exit */
+    if (IsDead(cptr))
+      return exit_client(cptr, cptr, &me, cli_info(cptr));
+    else if (IsServer(cptr))
     {
-      /* Skip extra LF/CR's */
-      if (endp == client_buffer)
-        continue;
-      *endp = '\0';
-
-      update_messages_received(cptr);
-
-      if (parse_client(cptr, cli_buffer(cptr), endp) == CPTR_KILLED)
-        return CPTR_KILLED;
-      /* Socket is dead so exit */
-      if (IsDead(cptr))
-        return exit_client(cptr, cptr, &me, cli_info(cptr));
-      else if (IsServer(cptr))
-      {
-        cli_count(cptr) = 0;
-        return server_dopacket(cptr, src, length);
-      }
-      endp = client_buffer;
+      cli_count(cptr) = 0;
+      return server_dopacket(cptr, src, end - src);
     }
-    else if (endp < client_buffer + BUFSIZE)
-      /* There is always room for the null */
-      ++endp;
+    endp = client_buffer;
   }
   cli_count(cptr) = endp - cli_buffer(cptr);
   return 1;
 }
 
-/** Handle received data from a local client.
+/** Handle one line of received data from a local client.
  * @param[in] cptr Local client that sent us data.
- * @param[in] length Total number of bytes in client's input buffer.
+ * @param[in] buffer NUL-terminated line (modified by the parser).
+ * @param[in] length Number of bytes in \a buffer.
  * @return 1 on success or CPTR_KILLED if the client is squit.
  */
-int client_dopacket(struct Client *cptr, unsigned int length)
+int client_dopacket(struct Client *cptr, char *buffer, unsigned int length)
 {
   assert(0 != cptr);
+  assert(0 != buffer);
 
   update_bytes_received(cptr, length);
   update_messages_received(cptr);
 
-  if (CPTR_KILLED == parse_client(cptr, cli_buffer(cptr), cli_buffer(cptr) + length))
+  if (CPTR_KILLED == parse_client(cptr, buffer, buffer + length))
     return CPTR_KILLED;
   else if (IsDead(cptr))
     return exit_client(cptr, cptr, &me, cli_info(cptr));
@@ -34,7 +34,9 @@
 #include "ircd_features.h"
 #include "ircd_log.h"
 #include "ircd_reply.h"
+#include "ircd_snprintf.h"
 #include "ircd_string.h"
+#include "match.h"
 #include "msg.h"
 #include "numeric.h"
 #include "numnicks.h"
@@ -46,6 +48,7 @@
 #include "s_debug.h"
 #include "s_misc.h"
 #include "s_numeric.h"
+#include "s_stats.h"
 #include "s_user.h"
 #include "send.h"
 #include "struct.h"
@@ -56,6 +59,7 @@
 /* #include <assert.h> -- Now using assert in ircd_log.h */
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 /*
  * Message Tree stuff mostly written by orabidoo, with changes by Dianora.
@@ -723,12 +727,155 @@ del_msg_element(struct MessageTree *mtree_p, char *cmd)
   return NULL;
 }
 
+/** Timer tick count when latency accounting started. */
+static uint64_t latency_epoch_ticks;
+/** Time of day when latency accounting started. */
+static struct timeval latency_epoch_tv;
+
+/** Read the timer used for command latency accounting.  This is the
+ * time stamp counter on x86, and microseconds elsewhere.
+ * @return Current timer tick count.
+ */
+static uint64_t
+latency_ticks(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  unsigned int lo, hi;
+
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, 0);
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+/** Add a handler call to a latency histogram.
+ * @param[in,out] ml Histogram to update.
+ * @param[in] ticks Timer ticks the handler took.
+ */
+static void
+latency_record(struct MessageLatency *ml, uint64_t ticks)
+{
+  uint64_t span = ticks >> (MSG_LATENCY_SHIFT + 1);
+  unsigned int bucket = 0;
+
+  while (span && bucket < MSG_LATENCY_BUCKETS - 1) {
+    span >>= 1;
+    bucket++;
+  }
+  ml->calls++;
+  ml->buckets[bucket]++;
+  ml->total += ticks;
+  if (ticks > ml->max)
+    ml->max = ticks;
+}
+
+/** Estimate the length of a timer tick from the time since
+ * initmsgtree() ran.
+ * @return Nanoseconds per timer tick.
+ */
+static double
+latency_tick_ns(void)
+{
+  struct timeval tv;
+  uint64_t ticks = latency_ticks() - latency_epoch_ticks;
+  double ns;
+
+  gettimeofday(&tv, 0);
+  ns = (tv.tv_sec - latency_epoch_tv.tv_sec) * 1e9
+    + (tv.tv_usec - latency_epoch_tv.tv_usec) * 1e3;
+  return (ticks && ns > 0) ? ns / ticks : 1.0;
+}
+
+/** Find the upper bound of the histogram bucket containing a given
+ * fraction of the calls.
+ * @param[in] ml Histogram to examine.
+ * @param[in] fraction Fraction of calls, between 0 and 1.
+ * @return Upper bound of the bucket, in timer ticks.
+ */
+static uint64_t
+latency_percentile(const struct MessageLatency *ml, double fraction)
+{
+  unsigned int ii, seen = 0, want = (unsigned int) (ml->calls * fraction);
+
+  for (ii = 0; ii < MSG_LATENCY_BUCKETS - 1; ii++)
+    if ((seen += ml->buckets[ii]) > want)
+      break;
+  return (uint64_t) 2 << (MSG_LATENCY_SHIFT + ii);
+}
+
+/** Report command handler latency.
+ * @param[in] to Client requesting statistics.
+ * @param[in] sd Stats descriptor for request; sd_funcdata is non-zero
+ * for the machine-readable format.
+ * @param[in] param Optional mask of command names to report.
+ */
+void
+report_command_latency(struct Client *to, const struct StatDesc *sd,
+                       char *param)
+{
+  static const char *source_names[MSG_SOURCE_COUNT] = { "client", "server" };
+  const struct MessageLatency *ml;
+  struct Message *mptr;
+  char buf[BUFSIZE];
+  double tick_ns = latency_tick_ns();
+  unsigned int ii, src;
+  uint64_t bound;
+  int len;
+
+  if (sd->sd_funcdata) {
+    /* LATENCY-BUCKETS <upper bound of each bucket but the last, in ns> */
+    len = ircd_snprintf(0, buf, sizeof(buf), "LATENCY-BUCKETS");
+    for (ii = 0; ii < MSG_LATENCY_BUCKETS - 1; ii++) {
+      bound = ((uint64_t) 2 << (MSG_LATENCY_SHIFT + ii)) * tick_ns;
+      len += ircd_snprintf(0, buf + len, sizeof(buf) - len, " %Lu", bound);
+    }
+    send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG, ":%s", buf);
+  } else
+    send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG, ":Command latency "
+               "(nanoseconds): calls, mean, 50th and 99th percentile "
+               "bucket limits, maximum");
+
+  for (mptr = msgtab; mptr->cmd; mptr++) {
+    if (param && match(param, mptr->cmd))
+      continue;
+    for (src = 0; src < MSG_SOURCE_COUNT; src++) {
+      ml = &mptr->latency[src];
+      if (!ml->calls)
+        continue;
+      if (sd->sd_funcdata) {
+        /* LATENCY <command> <source> <calls> <total ns> <max ns> <buckets> */
+        len = ircd_snprintf(0, buf, sizeof(buf), "LATENCY %s %s %u %Lu %Lu",
+                            mptr->cmd, source_names[src], ml->calls,
+                            (uint64_t) (ml->total * tick_ns),
+                            (uint64_t) (ml->max * tick_ns));
+        for (ii = 0; ii < MSG_LATENCY_BUCKETS; ii++)
+          len += ircd_snprintf(0, buf + len, sizeof(buf) - len, " %u",
+                               ml->buckets[ii]);
+        send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG, ":%s", buf);
+      } else
+        send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG, ":%s %s %u %Lu <%Lu "
+                   "<%Lu %Lu", mptr->cmd, source_names[src], ml->calls,
+                   (uint64_t) (ml->total * tick_ns / ml->calls),
+                   (uint64_t) (latency_percentile(ml, 0.5) * tick_ns),
+                   (uint64_t) (latency_percentile(ml, 0.99) * tick_ns),
+                   (uint64_t) (ml->max * tick_ns));
+    }
+  }
+}
+
 /** Initialize the message lookup trie with all known commands. */
 void
 initmsgtree(void)
 {
   int i;
 
+  latency_epoch_ticks = latency_ticks();
+  gettimeofday(&latency_epoch_tv, 0);
+
   memset(&msg_tree, 0, sizeof(msg_tree));
   memset(&tok_tree, 0, sizeof(tok_tree));
 
@@ -779,6 +926,7 @@ int register_mapping(struct s_map *map)
     msg->flags |= MFLG_SLOW;
   msg->bytes = 0;
   msg->extra = map;
+  memset(msg->latency, 0, sizeof(msg->latency));
 
   msg->handlers[UNREGISTERED_HANDLER] = m_ignore;
   msg->handlers[CLIENT_HANDLER] = m_pseudo;
@@ -833,6 +981,7 @@ parse_client(struct Client *cptr, char *buffer, char *bufend)
   int             paramcount;
   struct Message* mptr;
   MessageHandler  handler = 0;
+  uint64_t        start;
 
   Debug((DEBUG_DEBUG, "Client Parsing: %s", buffer));
 
@@ -954,7 +1103,10 @@ parse_client(struct Client *cptr, char *buffer, char *bufend)
       handler != m_ping && handler != m_ignore)
     cli_user(from)->last = CurrentTime;
 
-  return (*handler) (cptr, from, i, para);
+  start = latency_ticks();
+  i = (*handler) (cptr, from, i, para);
+  latency_record(&mptr->latency[MSG_FROM_CLIENT], latency_ticks() - start);
+  return i;
 }
 
 /** Parse a line of data from a server.
@@ -974,6 +1126,7 @@ int parse_server(struct Client *cptr, char *buffer, char *bufend)
   int             numeric = 0;
   int             paramcount;
   struct Message* mptr;
+  uint64_t        start;
 
   Debug((DEBUG_DEBUG, "Server Parsing: %s", buffer));
 
@@ -1253,5 +1406,8 @@ int parse_server(struct Client *cptr, char *buffer, char *bufend)
     return (do_numeric(numeric, (*buffer != ':'), cptr, from, i, para));
   mptr->count++;
 
-  return (*mptr->handlers[cli_handler(cptr)]) (cptr, from, i, para);
+  start = latency_ticks();
+  i = (*mptr->handlers[cli_handler(cptr)]) (cptr, from, i, para);
+  latency_record(&mptr->latency[MSG_FROM_SERVER], latency_ticks() - start);
+  return i;
 }
@@ -38,6 +38,7 @@
 #include "s_auth.h"
 #include "class.h"
 #include "client.h"
+#include "ident_cache.h"
 #include "IPcheck.h"
 #include "ircd.h"
 #include "ircd_alloc.h"
@@ -151,6 +152,7 @@ enum IAuthFlag
 {
   IAUTH_BLOCKED,                        /**< socket buffer full */
   IAUTH_CLOSING,                        /**< candidate to be disposed */
+  IAUTH_STATSWAIT,                      /**< owes an "s" for "? stats2" */
   /* The following flags are controlled by iauth's "O" options command. */
   IAUTH_ADDLINFO,                       /**< Send additional info
                                          * (password and username). */
@@ -176,6 +178,8 @@ struct IAuth {
   time_t started;                       /**< time that this instance was started */
   unsigned int i_recvM;                 /**< messages received */
   unsigned int i_sendM;                 /**< messages sent */
+  unsigned int i_writes;                /**< write calls made */
+  unsigned int i_index;                 /**< index in #iauth_workers */
   unsigned int i_count;                 /**< characters used in i_buffer */
   unsigned int i_errcount;              /**< characters used in i_errbuf */
   int i_debug;                          /**< debug level */
@@ -205,8 +209,14 @@ struct IAuth {
 /** Return debug level for \a iauth. */
 #define i_debug(iauth) ((iauth)->i_debug)
 
-/** Active instance of IAuth. */
-static struct IAuth *iauth;
+/** Active IAuth workers; clients are sharded across them. */
+static struct IAuth **iauth_workers;
+/** Number of entries in #iauth_workers. */
+static unsigned int iauth_count;
+/** Number of workers that still owe an "s" for "? stats2". */
+static unsigned int iauth_stats_pending;
+/** End-of-pass handler that flushes batched iauth output. */
+static struct Tick iauth_tick;
 /** Freelist of AuthRequest structures. */
 static struct AuthRequest *auth_freelist;
 /** Clients currently receiving IAuth statistics. */
@@ -217,10 +227,28 @@ static struct SLink *iauth_stats_queued;
 static void iauth_sock_callback(struct Event *ev);
 static void iauth_stderr_callback(struct Event *ev);
 static int sendto_iauth(struct Client *cptr, const char *format, ...);
+static int sendto_iauth_worker(struct IAuth *iauth, struct Client *cptr,
+                               const char *format, ...);
 static int preregister_user(struct Client *cptr);
 typedef int (*iauth_cmd_handler)(struct IAuth *iauth, struct Client *cli,
 				 int parc, char **params);
 
+/** Find the %IAuth worker responsible for a client.
+ * Clients are sharded across workers by their client identifier (the
+ * file descriptor), so every message about one client goes to the
+ * same worker.  Messages about no particular client go to the first.
+ * @param[in] cptr Client to look up, or NULL.
+ * @return Worker for \a cptr, or NULL if there is no iauth.
+ */
+static struct IAuth *iauth_for(struct Client *cptr)
+{
+  if (iauth_count == 0)
+    return NULL;
+  if (!cptr || cli_fd(cptr) < 0)
+    return iauth_workers[0];
+  return iauth_workers[cli_fd(cptr) % iauth_count];
+}
+
 /** Copies a username, cleaning it in the process.
  *
  * @param[out] dest Destination buffer for user name.
@@ -371,7 +399,7 @@ static void iauth_notify(struct AuthRequest *auth, enum AuthRequestFlag flag)
   switch (flag)
   {
   case AR_AUTH_PENDING:
-    if (IAuthHas(iauth, IAUTH_UNDERNET))
+    if (IAuthHas(iauth_for(sptr), IAUTH_UNDERNET))
       sendto_iauth(sptr, "u %s", cli_username(sptr));
     break;
 
@@ -383,14 +411,14 @@ static void iauth_notify(struct AuthRequest *auth, enum AuthRequestFlag flag)
     break;
 
   case AR_NEEDS_USER:
-    if (IAuthHas(iauth, IAUTH_UNDERNET))
+    if (IAuthHas(iauth_for(sptr), IAUTH_UNDERNET))
       sendto_iauth(sptr, "U %s :%s", cli_user(sptr)->username, cli_info(sptr));
-    else if (IAuthHas(iauth, IAUTH_ADDLINFO))
+    else if (IAuthHas(iauth_for(sptr), IAUTH_ADDLINFO))
       sendto_iauth(sptr, "U %s", cli_user(sptr)->username);
     break;
 
   case AR_NEEDS_NICK:
-    if (IAuthHas(iauth, IAUTH_UNDERNET))
+    if (IAuthHas(iauth_for(sptr), IAUTH_UNDERNET))
       sendto_iauth(auth->client, "n %s", cli_name(sptr));
     break;
 
@@ -507,7 +535,7 @@ static int check_auth_finished(struct AuthRequest *auth, int bitclr)
       hurry_up = 1;
 
       /* If iauth wants it, give client more time. */
-      if (IAuthHas(iauth, IAUTH_EXTRAWAIT))
+      if (IAuthHas(iauth_for(auth->client), IAUTH_EXTRAWAIT))
         cli_firsttime(auth->client) = CurrentTime;
     }
 
@@ -516,7 +544,7 @@ static int check_auth_finished(struct AuthRequest *auth, int bitclr)
       iauth_notify(auth, (enum AuthRequestFlag)bitclr);
 
     /* Do we need to tell IAuth to hurry up? */
-    if (hurry_up && IAuthHas(iauth, IAUTH_UNDERNET))
+    if (hurry_up && IAuthHas(iauth_for(auth->client), IAUTH_UNDERNET))
       sendto_iauth(auth->client, "H");
 
     Debug((DEBUG_INFO, "Auth %p [%d] still has flag %d", auth,
@@ -680,6 +708,7 @@ static void send_auth_query(struct AuthRequest* auth)
     socket_del(&auth->socket);
     s_fd(&auth->socket) = -1;
     ++ServerStats->is_abad;
+    ident_cache_record(&cli_ip(auth->client), IDENT_REFUSED, 0);
     if (IsUserPort(auth->client))
       sendheader(auth->client, REPORT_FAIL_ID);
     check_auth_finished(auth, AR_AUTH_PENDING);
@@ -775,7 +804,8 @@ static char* check_ident_reply(char* reply)
 static void read_auth_reply(struct AuthRequest* auth)
 {
   char*        username = 0;
-  unsigned int len;
+  unsigned int len = 0;
+  IOResult     result;
   /*
    * rfc1453 sez we MUST accept 512 bytes
    */
@@ -785,7 +815,8 @@ static void read_auth_reply(struct AuthRequest* auth)
   assert(0 != auth->client);
   assert(auth == cli_auth(auth->client));
 
-  if (IO_SUCCESS == os_recv_nonb(s_fd(&auth->socket), buf, BUFSIZE, &len)) {
+  result = os_recv_nonb(s_fd(&auth->socket), buf, BUFSIZE, &len);
+  if (IO_SUCCESS == result) {
     buf[len] = '\0';
     Debug((DEBUG_INFO, "Auth %p [%d] reply: %s", auth, cli_fd(auth->client), buf));
     username = check_ident_reply(buf);
@@ -797,6 +828,10 @@ static void read_auth_reply(struct AuthRequest* auth)
   socket_del(&auth->socket);
   s_fd(&auth->socket) = -1;
 
+  /* Any reply at all shows that the host runs an ident server. */
+  ident_cache_record(&cli_ip(auth->client), IO_SUCCESS == result && len > 0
+                     ? IDENT_ANSWERED : IDENT_REFUSED, 0);
+
   if (EmptyString(username)) {
     if (IsUserPort(auth->client))
       sendheader(auth->client, REPORT_FAIL_ID);
@@ -911,7 +946,7 @@ int auth_ping_timeout(struct Client *cptr)
 
   /* Check for iauth timeout. */
   if (FlagHas(&auth->flags, AR_IAUTH_PENDING)) {
-    if (IAuthHas(iauth, IAUTH_REQUIRED)
+    if (IAuthHas(iauth_for(cptr), IAUTH_REQUIRED)
         && !FlagHas(&auth->flags, AR_IAUTH_SOFT_DONE)) {
       sendheader(cptr, REPORT_FAIL_IAUTH);
       return exit_client_msg(cptr, cptr, &me, "Authorization Timeout");
@@ -946,6 +981,8 @@ static void auth_timeout_callback(struct Event* ev)
     /* Notify client if ident lookup failed. */
     if (FlagHas(&auth->flags, AR_AUTH_PENDING)) {
       flag = AR_AUTH_PENDING;
+      ident_cache_record(&cli_ip(auth->client), IDENT_TIMEDOUT,
+                         CurrentTime - cli_firsttime(auth->client));
       if (IsUserPort(auth->client))
         sendheader(auth->client, REPORT_FAIL_ID);
     }
@@ -1033,6 +1070,14 @@ static void start_auth_query(struct AuthRequest* auth)
   assert(0 != auth);
   assert(0 != auth->client);
 
+  /* Don't bother if recent lookups to this address or network timed out. */
+  if (ident_cache_skip(&cli_ip(auth->client))) {
+    ++ServerStats->is_abad;
+    if (IsUserPort(auth->client))
+      sendheader(auth->client, REPORT_FAIL_ID);
+    return;
+  }
+
   /*
    * get the local address of the client and bind to that to
    * make the auth request.  This used to be done only for
@@ -1055,9 +1100,9 @@ static void start_auth_query(struct AuthRequest* auth)
     sendheader(auth->client, REPORT_DO_ID);
 
   if ((result = os_connect_nonb(fd, &remote_addr)) == IO_FAILURE ||
-      !socket_add(&auth->socket, auth_sock_callback, (void*) auth,
-                  result == IO_SUCCESS ? SS_CONNECTED : SS_CONNECTING,
-                  SOCK_EVENT_READABLE, fd)) {
+      !socket_add_named(&auth->socket, auth_sock_callback, (void*) auth,
+                        result == IO_SUCCESS ? SS_CONNECTED : SS_CONNECTING,
+                        SOCK_EVENT_READABLE, fd)) {
     ++ServerStats->is_abad;
     if (IsUserPort(auth->client))
       sendheader(auth->client, REPORT_FAIL_ID);
@@ -1135,8 +1180,8 @@ void start_auth(struct Client* client)
   auth->client = client;
   cli_auth(client) = auth;
   s_fd(&auth->socket) = -1;
-  timer_add(timer_init(&auth->timeout), auth_timeout_callback, (void*) auth,
-            TT_RELATIVE, feature_int(FEAT_AUTH_TIMEOUT));
+  timer_add_named(timer_init(&auth->timeout), auth_timeout_callback,
+                  (void*) auth, TT_RELATIVE, feature_int(FEAT_AUTH_TIMEOUT));
 
   /* Try to get socket endpoint addresses. */
   if (!os_get_sockname(cli_fd(client), &auth->local)
@@ -1253,7 +1298,7 @@ int auth_set_nick(struct AuthRequest *auth, const char *nickname)
 int auth_set_password(struct AuthRequest *auth, const char *password)
 {
   assert(auth != NULL);
-  if (IAuthHas(iauth, IAUTH_ADDLINFO))
+  if (IAuthHas(iauth_for(auth->client), IAUTH_ADDLINFO))
     sendto_iauth(auth->client, "P :%s", password);
   return 0;
 }
@@ -1274,7 +1319,21 @@ void auth_send_exit(struct Client *cptr)
 void auth_send_xreply(struct Client *sptr, const char *routing,
 		      const char *reply)
 {
-  sendto_iauth(NULL, "X %#C %s :%s", sptr, routing, reply);
+  struct IAuth *iauth = iauth_for(NULL);
+  unsigned long idx;
+  char *end;
+
+  /* With several workers, the routing starts with the index of the
+   * worker that sent the query.
+   */
+  if (iauth_count > 1) {
+    idx = strtoul(routing, &end, 10);
+    if (end != routing && *end == ':' && idx < iauth_count) {
+      iauth = iauth_workers[idx];
+      routing = end + 1;
+    }
+  }
+  sendto_iauth_worker(iauth, NULL, "X %#C %s :%s", sptr, routing, reply);
 }
 
 /** Mark that a user has started capabilities negotiation.
@@ -1334,7 +1393,7 @@ int auth_spoof_user(struct AuthRequest *auth, const char *username, const char *
   }
 
   start_iauth_query(auth);
-  if (username && IAuthHas(iauth, IAUTH_UNDERNET))
+  if (username && IAuthHas(iauth_for(sptr), IAUTH_UNDERNET))
     sendto_iauth(sptr, "u %s", cli_username(sptr));
 
   return check_auth_finished(auth, 0);
@@ -1379,8 +1438,8 @@ int iauth_do_spawn(struct IAuth *iauth, int automatic)
   }
 
   /* Initialize the socket structure to talk to the child. */
-  res = socket_add(i_socket(iauth), iauth_sock_callback, iauth,
-                   SS_CONNECTED, SOCK_EVENT_READABLE, s_io[0]);
+  res = socket_add_named(i_socket(iauth), iauth_sock_callback, iauth,
+                         SS_CONNECTED, SOCK_EVENT_READABLE, s_io[0]);
   if (!res) {
     res = errno;
     Debug((DEBUG_INFO, "Unable to register IAuth socket: %s", strerror(res)));
@@ -1404,8 +1463,8 @@ int iauth_do_spawn(struct IAuth *iauth, int automatic)
   }
 
   /* And set up i_stderr(iauth). */
-  res = socket_add(i_stderr(iauth), iauth_stderr_callback, iauth,
-                   SS_CONNECTED, SOCK_EVENT_READABLE, s_err[0]);
+  res = socket_add_named(i_stderr(iauth), iauth_stderr_callback, iauth,
+                         SS_CONNECTED, SOCK_EVENT_READABLE, s_err[0]);
   if (!res) {
     res = errno;
     Debug((DEBUG_INFO, "Unable to register IAuth stderr: %s", strerror(res)));
@@ -1441,7 +1500,8 @@ int iauth_do_spawn(struct IAuth *iauth, int automatic)
      * Need to use conf_get_local() since &me may not be fully
      * initialized the first time we run.
      */
-    sendto_iauth(NULL, "M %s %d", conf_get_local()->name, MAXCONNECTIONS);
+    sendto_iauth_worker(iauth, NULL, "M %s %d", conf_get_local()->name,
+                        MAXCONNECTIONS);
     /* Indicate success (until the child dies). */
     return 0;
   }
@@ -1462,21 +1522,30 @@ int iauth_do_spawn(struct IAuth *iauth, int automatic)
   exit(EXIT_FAILURE);
 }
 
-/** See if an %IAuth program must be spawned.
- * If a process is already running with the specified options, keep it.
- * Otherwise spawn a new child process to perform the %IAuth function.
+/** See if the %IAuth programs must be spawned.
+ * If the requested number of processes is already running with the
+ * specified options, keep them (restarting any that have died).
+ * Otherwise spawn \a workers new child processes to perform the %IAuth
+ * function, each handling its own share of the clients.
  * @param[in] argc Number of parameters to use when starting process.
  * @param[in] argv Array of parameters to start process.
+ * @param[in] workers Number of processes to run.
  * @return 0 on failure, 1 on new process, 2 on reuse of existing process.
  */
-int auth_spawn(int argc, char *argv[])
+int auth_spawn(int argc, char *argv[], int workers)
 {
-  int ii;
+  struct IAuth *iauth;
+  unsigned int jj;
+  int ii, res;
+
+  if (workers < 1)
+    workers = 1;
 
-  if (iauth) {
-    int same = 1;
+  if (iauth_count) {
+    int same = (iauth_count == (unsigned int) workers);
 
     /* Check that incoming arguments all match pre-existing arguments. */
+    iauth = iauth_workers[0];
     for (ii = 0; same && (ii < argc); ++ii) {
       if (NULL == iauth->i_argv[ii]
           || 0 != strcmp(iauth->i_argv[ii], argv[ii]))
@@ -1485,35 +1554,95 @@ int auth_spawn(int argc, char *argv[])
     /* Check that we have no more pre-existing arguments. */
     if (same && iauth->i_argv[ii])
       same = 0;
-    /* If they are the same and still connected, clear the "closing" flag and exit. */
-    if (same && i_GetConnected(iauth)) {
-      Debug((DEBUG_INFO, "Reusing existing IAuth process"));
-      IAuthClr(iauth, IAUTH_CLOSING);
-      return 2;
+    /* If they are the same, clear the "closing" flags and restart any
+     * worker that is no longer connected.
+     */
+    if (same) {
+      Debug((DEBUG_INFO, "Reusing existing IAuth processes"));
+      for (res = 2, jj = 0; jj < iauth_count; ++jj) {
+        iauth = iauth_workers[jj];
+        IAuthClr(iauth, IAUTH_CLOSING);
+        if (!i_GetConnected(iauth))
+          res = iauth_do_spawn(iauth, 0) ? 0 : 1;
+      }
+      return res;
     }
+    auth_mark_closing();
     auth_close_unused();
   }
 
-  /* Need to initialize a new connection. */
-  iauth = MyCalloc(1, sizeof(*iauth));
-  msgq_init(i_sendQ(iauth));
-  /* Populate iauth's argv array. */
-  iauth->i_argv = MyCalloc(argc + 1, sizeof(iauth->i_argv[0]));
-  for (ii = 0; ii < argc; ++ii)
-    DupString(iauth->i_argv[ii], argv[ii]);
-  iauth->i_argv[ii] = NULL;
-  /* Try to spawn it, and handle the results. */
-  if (iauth_do_spawn(iauth, 0))
-    return 0;
-  IAuthClr(iauth, IAUTH_CLOSING);
-  return 1;
+  /* Need to initialize new connections. */
+  iauth_workers = MyCalloc(workers, sizeof(iauth_workers[0]));
+  iauth_count = workers;
+  for (res = 1, jj = 0; jj < iauth_count; ++jj) {
+    iauth = iauth_workers[jj] = MyCalloc(1, sizeof(*iauth));
+    msgq_init(i_sendQ(iauth));
+    iauth->i_index = jj;
+    /* Populate iauth's argv array. */
+    iauth->i_argv = MyCalloc(argc + 1, sizeof(iauth->i_argv[0]));
+    for (ii = 0; ii < argc; ++ii)
+      DupString(iauth->i_argv[ii], argv[ii]);
+    iauth->i_argv[ii] = NULL;
+    /* Try to spawn it, and handle the results. */
+    if (iauth_do_spawn(iauth, 0))
+      res = 0;
+  }
+  return res;
 }
 
 /** Mark all %IAuth connections as closing. */
 void auth_mark_closing(void)
 {
-  if (iauth)
-    IAuthSet(iauth, IAUTH_CLOSING);
+  unsigned int ii;
+
+  for (ii = 0; ii < iauth_count; ++ii)
+    IAuthSet(iauth_workers[ii], IAUTH_CLOSING);
+}
+
+/** Send the end of a "? stats2" reply to the clients waiting for it,
+ * and move any queued clients up to wait for the next one.
+ */
+static void iauth_stats_finish(void)
+{
+  struct SLink *head;
+  struct SLink *next;
+
+  for (head = iauth_stats_clients; head; head = next)
+  {
+    next = head->next;
+    send_reply(head->value.cptr, RPL_ENDOFSTATS, "iauthstats");
+    free_link(head);
+  }
+
+  iauth_stats_clients = iauth_stats_queued;
+  iauth_stats_queued = NULL;
+}
+
+/** Ask every worker that supports it for statistics on behalf of the
+ * clients in #iauth_stats_clients.  If no worker can answer, finish
+ * the request at once.
+ */
+static void iauth_request_stats2(void)
+{
+  struct IAuth *iauth;
+  unsigned int ii;
+
+  while (iauth_stats_clients)
+  {
+    for (ii = 0; ii < iauth_count; ++ii)
+    {
+      iauth = iauth_workers[ii];
+      if (IAuthHas(iauth, IAUTH_STATS2)
+          && sendto_iauth_worker(iauth, NULL, "? stats2"))
+      {
+        IAuthSet(iauth, IAUTH_STATSWAIT);
+        iauth_stats_pending++;
+      }
+    }
+    if (iauth_stats_pending)
+      return;
+    iauth_stats_finish();
+  }
 }
 
 /** Complete disconnection of an %IAuth connection.
@@ -1537,14 +1666,35 @@ static void iauth_disconnect(struct IAuth *iauth)
     socket_del(i_socket(iauth));
     s_fd(i_socket(iauth)) = -1;
   }
+
+  /* Drop output meant for this process; a new one starts afresh. */
+  msgq_delete(i_sendQ(iauth), MsgQLength(i_sendQ(iauth)));
+  IAuthClr(iauth, IAUTH_BLOCKED);
+
+  /* Do not leave a statistics request waiting on us. */
+  if (IAuthHas(iauth, IAUTH_STATSWAIT)) {
+    IAuthClr(iauth, IAUTH_STATSWAIT);
+    if (--iauth_stats_pending == 0) {
+      iauth_stats_finish();
+      iauth_request_stats2();
+    }
+  }
 }
 
 /** Close all %IAuth connections marked as closing. */
 void auth_close_unused(void)
 {
-  if (IAuthHas(iauth, IAUTH_CLOSING)) {
-    int ii;
-    iauth_disconnect(iauth);
+  struct IAuth *iauth;
+  unsigned int jj;
+  int ii;
+
+  if (!iauth_count || !IAuthHas(iauth_workers[0], IAUTH_CLOSING))
+    return;
+
+  for (jj = 0; jj < iauth_count; ++jj)
+    iauth_disconnect(iauth_workers[jj]);
+  for (jj = 0; jj < iauth_count; ++jj) {
+    iauth = iauth_workers[jj];
     if (iauth->i_argv) {
       for (ii = 0; iauth->i_argv[ii]; ++ii)
         MyFree(iauth->i_argv[ii]);
@@ -1552,6 +1702,8 @@ void auth_close_unused(void)
     }
     MyFree(iauth);
   }
+  MyFree(iauth_workers);
+  iauth_count = 0;
 }
 
 /** Send queued output to \a iauth.
@@ -1566,6 +1718,7 @@ static void iauth_write(struct IAuth *iauth)
     return;
   while (MsgQLength(i_sendQ(iauth)) > 0) {
     iores = os_sendv_nonb(s_fd(i_socket(iauth)), i_sendQ(iauth), &bytes_tried, &bytes_sent);
+    ++iauth->i_writes;
     switch (iores) {
     case IO_SUCCESS:
       msgq_delete(i_sendQ(iauth), bytes_sent);
@@ -1586,14 +1739,32 @@ static void iauth_write(struct IAuth *iauth)
   socket_events(i_socket(iauth), SOCK_ACTION_DEL | SOCK_EVENT_WRITABLE);
 }
 
-/** Send a message to iauth.
+/** Write out everything queued for the %IAuth workers during this
+ * event loop pass.  With IAUTH_BATCH enabled, this turns all the
+ * messages for one worker into a single write.
+ */
+static void iauth_flush(void)
+{
+  struct IAuth *iauth;
+  unsigned int ii;
+
+  for (ii = 0; ii < iauth_count; ++ii) {
+    iauth = iauth_workers[ii];
+    if (MsgQLength(i_sendQ(iauth)) > 0 && i_GetConnected(iauth))
+      iauth_write(iauth);
+  }
+}
+
+/** Queue a message for an %IAuth worker.
+ * Unless IAUTH_BATCH is enabled, also try to write it out at once.
+ * @param[in] iauth Worker to send to.
  * @param[in] cptr Optional client context for message.
- * @param[in] format Format string for message.
+ * @param[in] vd Format string and arguments for message.
  * @return Non-zero on successful send or buffering, zero on failure.
  */
-static int sendto_iauth(struct Client *cptr, const char *format, ...)
+static int iauth_send(struct IAuth *iauth, struct Client *cptr,
+                      struct VarData *vd)
 {
-  struct VarData vd;
   struct MsgBuf *mb;
 
   /* Do not send requests when we have no iauth. */
@@ -1601,24 +1772,64 @@ static int sendto_iauth(struct Client *cptr, const char *format, ...)
     return 0;
   /* Do not send for clients in the NORMAL state. */
   if (cptr
-      && (format[0] != 'D')
+      && (vd->vd_format[0] != 'D')
       && (!cli_auth(cptr) || !FlagHas(&cli_auth(cptr)->flags, AR_IAUTH_PENDING)))
     return 0;
 
   /* Build the message buffer. */
-  vd.vd_format = format;
-  va_start(vd.vd_args, format);
-  mb = msgq_make(NULL, "%d %v", cptr ? cli_fd(cptr) : -1, &vd);
-  va_end(vd.vd_args);
+  mb = msgq_make(NULL, "%d %v", cptr ? cli_fd(cptr) : -1, vd);
 
   /* Tack it onto the iauth sendq and try to write it. */
   ++iauth->i_sendM;
   msgq_add(i_sendQ(iauth), mb, 0);
   msgq_clean(mb);
-  iauth_write(iauth);
+  if (!feature_bool(FEAT_IAUTH_BATCH))
+    iauth_write(iauth);
   return 1;
 }
 
+/** Send a message to the %IAuth worker that handles a client.
+ * @param[in] cptr Optional client context for message.
+ * @param[in] format Format string for message.
+ * @return Non-zero on successful send or buffering, zero on failure.
+ */
+static int sendto_iauth(struct Client *cptr, const char *format, ...)
+{
+  struct VarData vd;
+  int res;
+
+  vd.vd_format = format;
+  va_start(vd.vd_args, format);
+  res = iauth_send(iauth_for(cptr), cptr, &vd);
+  va_end(vd.vd_args);
+  return res;
+}
+
+/** Send a message to a particular %IAuth worker.
+ * @param[in] iauth Worker to send to.
+ * @param[in] cptr Optional client context for message.
+ * @param[in] format Format string for message.
+ * @return Non-zero on successful send or buffering, zero on failure.
+ */
+static int sendto_iauth_worker(struct IAuth *iauth, struct Client *cptr,
+                               const char *format, ...)
+{
+  struct VarData vd;
+  int res;
+
+  vd.vd_format = format;
+  va_start(vd.vd_args, format);
+  res = iauth_send(iauth, cptr, &vd);
+  va_end(vd.vd_args);
+  return res;
+}
+
+/** Initialize the %IAuth subsystem. */
+void auth_init(void)
+{
+  tick_add(&iauth_tick, iauth_flush);
+}
+
 /** Send text to interested operators (SNO_AUTH server notice).
  * @param[in] iauth Active IAuth session.
  * @param[in] cli Client referenced by command.
@@ -1799,20 +2010,14 @@ static int iauth_cmd_newstats(struct IAuth *iauth, struct Client *cli,
   struct SLink *head;
   struct SLink *next;
 
-  if (iauth_stats_clients)
+  if (IAuthHas(iauth, IAUTH_STATSWAIT))
   {
-    for (head = iauth_stats_clients; head; head = next)
+    /* This worker has finished its "? stats2" reply. */
+    IAuthClr(iauth, IAUTH_STATSWAIT);
+    if (--iauth_stats_pending == 0)
     {
-      next = head->next;
-      send_reply(head->value.cptr, RPL_ENDOFSTATS, "iauthstats");
-      free_link(head);
-    }
-
-    iauth_stats_clients = iauth_stats_queued;
-    iauth_stats_queued = NULL;
-    if (iauth_stats_clients)
-    {
-      sendto_iauth(NULL, "? stats2");
+      iauth_stats_finish();
+      iauth_request_stats2();
     }
   }
   else
@@ -1844,7 +2049,7 @@ static int iauth_cmd_stats(struct IAuth *iauth, struct Client *cli,
   char *line;
 
   line = paste_params(parc, params);
-  if (iauth_stats_clients)
+  if (IAuthHas(iauth, IAUTH_STATSWAIT))
   {
     for (node = iauth_stats_clients; node; node = node->next)
     {
@@ -2232,13 +2437,22 @@ static int iauth_cmd_xquery(struct IAuth *iauth, struct Client *cli,
 
   /* Try to find the specified server */
   if (!(acptr = find_match_server(serv))) {
-    sendto_iauth(cli, "x %s %s :Server not online", serv, routing);
+    sendto_iauth_worker(iauth, NULL, "x %s %s :Server not online", serv,
+                        routing);
     return 0;
   }
 
   /* If it's to us, do nothing; otherwise, forward the query */
-  if (!IsMe(acptr))
-    /* The "iauth:" prefix helps ircu route the reply to iauth */
+  if (IsMe(acptr))
+    return 0;
+
+  /* The "iauth:" prefix helps ircu route the reply to iauth; with
+   * several workers, the worker's index picks which one.
+   */
+  if (iauth_count > 1)
+    sendcmdto_one(&me, CMD_XQUERY, acptr, "%C iauth:%u:%s :%s", acptr,
+                  iauth->i_index, routing, query);
+  else
     sendcmdto_one(&me, CMD_XQUERY, acptr, "%C iauth:%s :%s", acptr, routing,
 		  query);
 
@@ -2287,7 +2501,7 @@ static void iauth_parse(struct IAuth *iauth, char *message)
 	     */
   case 'K': handler = iauth_cmd_kill; has_cli = 2; break;
   case 'r': /* we handle termination directly */ return;
-  default:  sendto_iauth(NULL, "E Garbage :[%s]", message); return;
+  default:  sendto_iauth_worker(iauth, NULL, "E Garbage :[%s]", message); return;
   }
 
   while (parc < MAXPARA) {
@@ -2320,11 +2534,14 @@ static void iauth_parse(struct IAuth *iauth, char *message)
     /* Try to find the client associated with the request. */
     id = strtol(params[0], NULL, 10);
     if (parc < 3)
-      sendto_iauth(NULL, "E Missing :Need <id> <ip> <port>");
-    else if (id < 0 || id > HighestFd || !(cli = LocalClientArray[id]))
-      /* Client no longer exists (or never existed). */
-      sendto_iauth(NULL, "E Gone :[%s %s %s]", params[0], params[1],
-		   params[2]);
+      sendto_iauth_worker(iauth, NULL, "E Missing :Need <id> <ip> <port>");
+    else if (id < 0 || id > HighestFd || !(cli = LocalClientArray[id])
+             || iauth_for(cli) != iauth)
+      /* Client no longer exists (or never existed), or belongs to
+       * another worker.
+       */
+      sendto_iauth_worker(iauth, NULL, "E Gone :[%s %s %s]", params[0],
+                          params[1], params[2]);
     else if ((!(auth = cli_auth(cli)) ||
 	      !FlagHas(&auth->flags, AR_IAUTH_PENDING)) &&
 	     has_cli == 1)
@@ -2359,8 +2576,10 @@ static void iauth_parse(struct IAuth *iauth, char *message)
 /** Read input from \a iauth.
  * Reads up to SERVER_TCP_WINDOW bytes per pass.
  * @param[in] iauth Readable connection.
+ * @return Non-zero if the read filled the buffer, so more input may
+ *   be waiting.
  */
-static void iauth_read(struct IAuth *iauth)
+static int iauth_read(struct IAuth *iauth)
 {
   static char readbuf[SERVER_TCP_WINDOW];
   unsigned int length, count;
@@ -2374,7 +2593,8 @@ static void iauth_read(struct IAuth *iauth)
 				 readbuf + length,
 				 sizeof(readbuf) - length,
 				 &count))
-    return;
+    return 0;
+  iauth->i_recvB += count;
   length += count;
 
   /* Parse each complete line. */
@@ -2398,6 +2618,7 @@ static void iauth_read(struct IAuth *iauth)
       sendto_opmask_butone(NULL, SNO_AUTH, "Parsing: \"%s\"", sol);
 
     /* Parse the line... */
+    ++iauth->i_recvM;
     iauth_parse(iauth, sol);
   }
 
@@ -2406,6 +2627,7 @@ static void iauth_read(struct IAuth *iauth)
   if (iauth->i_count > BUFSIZE)
     iauth->i_count = BUFSIZE;
   memcpy(iauth->i_buffer, sol, iauth->i_count);
+  return length == sizeof(readbuf);
 }
 
 /** Handle socket activity for an %IAuth connection.
@@ -2426,7 +2648,9 @@ static void iauth_sock_callback(struct Event *ev)
       iauth_do_spawn(iauth, 1);
     break;
   case ET_READ:
-    iauth_read(iauth);
+    /* Drain the socket so a burst of replies is handled in one pass. */
+    while (iauth_read(iauth) && i_GetConnected(iauth))
+      ;
     break;
   case ET_WRITE:
     IAuthClr(iauth, IAUTH_BLOCKED);
@@ -2515,12 +2739,15 @@ static void iauth_stderr_callback(struct Event *ev)
 }
 
 /** Report active iauth's configuration to \a cptr.
+ * All workers run the same program, so only the first one's
+ * configuration is shown.
  * @param[in] cptr Client requesting statistics.
  * @param[in] sd Stats descriptor for request.
  * @param[in] param Extra parameter from user (may be NULL).
  */
 void report_iauth_conf(struct Client *cptr, const struct StatDesc *sd, char *param)
 {
+  struct IAuth *iauth = iauth_for(NULL);
   struct SLink *link;
 
   if (!iauth)
@@ -2535,26 +2762,38 @@ void report_iauth_conf(struct Client *cptr, const struct StatDesc *sd, char *par
 
   if (param && !strcmp(param, "get"))
   {
-    sendto_iauth(NULL, "? config");
+    sendto_iauth_worker(iauth, NULL, "? config");
   }
 }
 
 /** Report active iauth's statistics to \a cptr.
+ * Each worker's traffic is listed first, followed by the statistics
+ * the workers themselves report.
  * @param[in] cptr Client requesting statistics.
  * @param[in] sd Stats descriptor for request.
  * @param[in] param Extra parameter from user (may be NULL).
  */
 void report_iauth_stats(struct Client *cptr, const struct StatDesc *sd, char *param)
 {
+  struct IAuth *iauth;
   struct SLink *link;
+  unsigned int ii;
 
-  if (!iauth)
+  if (!iauth_count)
     return;
 
-  if (IAuthHas(iauth, IAUTH_STATS2))
+  for (ii = 0; ii < iauth_count; ++ii)
   {
-    struct SLink *link;
+    iauth = iauth_workers[ii];
+    send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG, ":IAuth worker %u %s: "
+               "sent %u lines (%Lu bytes) in %u writes, received %u lines "
+               "(%Lu bytes)", ii, i_GetConnected(iauth) ? "up" : "down",
+               iauth->i_sendM, iauth->i_sendB, iauth->i_writes,
+               iauth->i_recvM, iauth->i_recvB);
+  }
 
+  if (IAuthHas(iauth_for(NULL), IAUTH_STATS2))
+  {
     link = make_link();
     link->value.cptr = cptr;
     if (iauth_stats_clients)
@@ -2565,21 +2804,24 @@ void report_iauth_stats(struct Client *cptr, const struct StatDesc *sd, char *pa
     else
     {
       iauth_stats_clients = link;
-      sendto_iauth(NULL, "? stats2");
+      iauth_request_stats2();
     }
   }
   else
   {
-    for (link = iauth->i_stats; link; link = link->next)
+    for (ii = 0; ii < iauth_count; ++ii)
     {
-      send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG, ":%s", link->value.cp);
+      iauth = iauth_workers[ii];
+      for (link = iauth->i_stats; link; link = link->next)
+      {
+        send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG, ":%s", link->value.cp);
+      }
+      if (param && !strcmp(param, "get"))
+      {
+        sendto_iauth_worker(iauth, NULL, "? stats");
+      }
     }
     send_reply(cptr, RPL_ENDOFSTATS, sd->sd_name);
-
-    if (param && !strcmp(param, "get") && !IAuthHas(iauth, IAUTH_STATS2))
-    {
-        sendto_iauth(NULL, "? stats");
-    }
   }
 }
 
@@ -24,6 +24,7 @@
 #include "config.h"
 
 #include "s_bsd.h"
+#include "accept_pool.h"
 #include "client.h"
 #include "IPcheck.h"
 #include "channel.h"
@@ -51,12 +52,14 @@
 #include "s_conf.h"
 #include "s_debug.h"
 #include "s_misc.h"
+#include "s_serv.h"
 #include "s_user.h"
 #include "send.h"
 #include "struct.h"
 #include "sys.h"
 #include "uping.h"
 #include "version.h"
+#include "whocmds.h"
 
 /* #include <assert.h> -- Now using assert in ircd_log.h */
 #include <errno.h>
@@ -82,6 +85,19 @@ struct irc_sockaddr       VirtualHost_v6;
 /** Temporary buffer for reading data from a peer. */
 static char               readbuf[SERVER_TCP_WINDOW];
 
+/** Ways that deliver_it() writes a sendQ. */
+enum DeliverMode {
+  DM_WRITEV,     /**< writev() straight from the queued messages */
+  DM_COPY,       /**< send() from messages copied into one buffer */
+  DM_COUNT       /**< number of modes */
+};
+
+/** Write system calls made and bytes sent by deliver_it(), by mode. */
+static struct {
+  unsigned long calls[DM_COUNT]; /**< number of system calls */
+  unsigned long bytes[DM_COUNT]; /**< number of bytes written */
+} deliver_stats;
+
 /*
  * report_error text constants
  */
@@ -254,10 +270,10 @@ static int connect_inet(struct ConfItem* aconf, struct Client* cptr)
     cli_fd(cptr) = -1;
     return 0;
   }
-  if (!socket_add(&(cli_socket(cptr)), client_sock_callback,
-		  (void*) cli_connect(cptr),
-		  (result == IO_SUCCESS) ? SS_CONNECTED : SS_CONNECTING,
-		  SOCK_EVENT_READABLE, cli_fd(cptr))) {
+  if (!socket_add_named(&(cli_socket(cptr)), client_sock_callback,
+			(void*) cli_connect(cptr),
+			(result == IO_SUCCESS) ? SS_CONNECTED : SS_CONNECTING,
+			SOCK_EVENT_READABLE, cli_fd(cptr))) {
     cli_error(cptr) = ENFILE;
     report_error(REGISTER_ERROR_MSG, cli_name(cptr), ENFILE);
     close(cli_fd(cptr));
@@ -280,12 +296,31 @@ unsigned int deliver_it(struct Client *cptr, struct MsgQ *buf)
 {
   unsigned int bytes_written = 0;
   unsigned int bytes_count = 0;
+  unsigned int coalesce;
+  enum DeliverMode mode = DM_WRITEV;
+  IOResult res;
   assert(0 != cptr);
 
-  switch (os_sendv_nonb(cli_fd(cptr), buf, &bytes_count, &bytes_written)) {
+  /* A server with a deep queue of short messages (as during a burst)
+   * would need many writev() calls, each limited by the number of
+   * iovecs rather than by bytes; copy the messages together instead.
+   */
+  if (IsServer(cptr) && (coalesce = feature_int(FEAT_SENDQ_COALESCE)) &&
+      MsgQLength(buf) >= coalesce &&
+      MsgQLength(buf) / MsgQCount(buf) * os_iov_max() < os_sendcopy_size())
+    mode = DM_COPY;
+
+  if (mode == DM_COPY)
+    res = os_sendcopy_nonb(cli_fd(cptr), buf, &bytes_count, &bytes_written);
+  else
+    res = os_sendv_nonb(cli_fd(cptr), buf, &bytes_count, &bytes_written);
+  deliver_stats.calls[mode]++;
+
+  switch (res) {
   case IO_SUCCESS:
     ClrFlag(cptr, FLAG_BLOCKED);
 
+    deliver_stats.bytes[mode] += bytes_written;
     cli_sendB(cptr) += bytes_written;
     cli_sendB(&me)  += bytes_written;
     /* A partial write implies that future writes will block. */
@@ -303,6 +338,23 @@ unsigned int deliver_it(struct Client *cptr, struct MsgQ *buf)
   return bytes_written;
 }
 
+/** Report how much deliver_it() sends per system call.
+ * @param[in] to Client requesting statistics.
+ */
+void deliver_report(struct Client *to)
+{
+  static const char *names[DM_COUNT] = { "writev", "coalesced" };
+  int i;
+
+  for (i = 0; i < DM_COUNT; i++)
+    send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+               ":Writes: %s calls %lu bytes %lu average %lu iovecs %d",
+               names[i], deliver_stats.calls[i], deliver_stats.bytes[i],
+               deliver_stats.calls[i] ?
+               deliver_stats.bytes[i] / deliver_stats.calls[i] : 0,
+               os_iov_max());
+}
+
 /** Complete non-blocking connect()-sequence. Check access and
  * terminate connection, if trouble detected.
  * @param cptr Client to which we have connected, with all ConfItem structs attached.
@@ -464,11 +516,14 @@ int net_close_unregistered_connections(struct Client* source)
  * The sockhost field is initialized with the ip# of the host.
  * The client is not added to the linked list of clients, it is
  * passed off to the auth handler for dns and ident queries.
+ * The caller has already made \a fd non-blocking and disabled its IP
+ * options (see accept_connection()).
  * @param listener Listening socket that received the connection.
  * @param fd File descriptor of new connection.
+ * @param addr Address of the remote end of the connection.
  */
-void add_connection(struct Listener* listener, int fd) {
-  struct irc_sockaddr addr;
+void add_connection(struct Listener* listener, int fd,
+                    const struct irc_sockaddr* addr) {
   struct Client      *new_client;
   time_t             next_target = 0;
 
@@ -479,28 +534,13 @@ void add_connection(struct Listener* listener, int fd) {
          "ERROR :Unable to complete your registration\r\n";
 
   assert(0 != listener);
+  assert(0 != addr);
 
   /*
    * Removed preliminary access check. Full check is performed in m_server and
    * m_user instead. Also connection time out help to get rid of unwanted
    * connections.
    */
-  if (!os_get_peername(fd, &addr) || !os_set_nonblocking(fd)) {
-    ++ServerStats->is_bad_socket;
-    close(fd);
-    return;
-  }
-  /*
-   * Disable IP (*not* TCP) options.  In particular, this makes it impossible
-   * to use source routing to connect to the server.  If we didn't do this
-   * (and if intermediate networks didn't drop source-routed packets), an
-   * attacker could successfully IP spoof us...and even return the anti-spoof
-   * ping, because the options would cause the packet to be routed back to
-   * the spoofer's machine.  When we disable the IP options, we delete the
-   * source route, and the normal routing takes over.
-   */
-  os_disable_options(fd);
-
   if (listener_server(listener))
   {
     new_client = make_client(0, STAT_UNKNOWN_SERVER);
@@ -516,9 +556,10 @@ void add_connection(struct Listener* listener, int fd) {
      *
      * If they're throttled, murder them, but tell them why first.
      */
-    if (!IPcheck_local_connect(&addr.addr, &next_target))
+    if (!IPcheck_local_connect(&addr->addr, &next_target))
     {
       ++ServerStats->is_throttled;
+      accept_pool_throttle(&addr->addr);
       write(fd, throttle_message, strlen(throttle_message));
       close(fd);
       return;
@@ -531,16 +572,16 @@ void add_connection(struct Listener* listener, int fd) {
    * Copy ascii address to 'sockhost' just in case. Then we have something
    * valid to put into error messages...
    */
-  ircd_ntoa_r(cli_sock_ip(new_client), &addr.addr);
+  ircd_ntoa_r(cli_sock_ip(new_client), &addr->addr);
   strcpy(cli_sockhost(new_client), cli_sock_ip(new_client));
-  memcpy(&cli_ip(new_client), &addr.addr, sizeof(cli_ip(new_client)));
+  memcpy(&cli_ip(new_client), &addr->addr, sizeof(cli_ip(new_client)));
 
   if (next_target)
     cli_nexttarget(new_client) = next_target;
 
   cli_fd(new_client) = fd;
-  if (!socket_add(&(cli_socket(new_client)), client_sock_callback,
-		  (void*) cli_connect(new_client), SS_CONNECTED, 0, fd)) {
+  if (!socket_add_named(&(cli_socket(new_client)), client_sock_callback,
+			(void*) cli_connect(new_client), SS_CONNECTED, 0, fd)) {
     ++ServerStats->is_bad_socket;
     write(fd, register_message, strlen(register_message));
     close(fd);
@@ -563,12 +604,13 @@ void add_connection(struct Listener* listener, int fd) {
 void update_write(struct Client* cptr)
 {
   /* If there are messages that need to be sent along, or if the client
-   * is in the middle of a /list, then we need to tell the engine that
-   * we're interested in writable events--otherwise, we need to drop
-   * that interest.
+   * is in the middle of a /list, a /who or our burst, then we need to
+   * tell the engine that we're interested in writable events--otherwise,
+   * we need to drop that interest.
    */
   socket_events(&(cli_socket(cptr)),
-		((MsgQLength(&cli_sendQ(cptr)) || cli_listing(cptr)) ?
+		((MsgQLength(&cli_sendQ(cptr)) || cli_listing(cptr) ||
+		  cli_who(cptr) || cli_burst(cptr)) ?
 		 SOCK_ACTION_ADD : SOCK_ACTION_DEL) | SOCK_EVENT_WRITABLE);
 }
 
@@ -585,6 +627,7 @@ static int read_packet(struct Client *cptr, int socket_ready)
 {
   unsigned int dolen = 0;
   unsigned int length = 0;
+  char *start = readbuf;
 
   if (socket_ready &&
       !(IsUser(cptr) &&
@@ -619,12 +662,60 @@ static int read_packet(struct Client *cptr, int socket_ready)
     return connect_dopacket(cptr, readbuf, length);
   else
   {
+    /*
+     * If nothing is queued from an earlier read, parse complete lines
+     * straight out of readbuf rather than copying them through the
+     * receive queue.  Whatever is left -- a partial line, an overlong
+     * one, or input held back by flood control -- is queued below and
+     * handled exactly as before.  Reads that would trip the flood
+     * limit are left to the normal path so it can kill the client.
+     */
+    if (length > 0 && !DBufLength(&(cli_recvQ(cptr))) &&
+        length <= feature_int(FEAT_CLIENT_FLOOD))
+    {
+      char *end = readbuf + length;
+      char *eol;
+      char *limit;
+
+      while (start < end)
+      {
+        if (IsEol(*start)) /* skip extra LF/CR's, like dbuf_flush() */
+        {
+          start++;
+          continue;
+        }
+        if (!IsTrusted(cptr) && cli_since(cptr) - CurrentTime >= 10)
+          break;
+        limit = IRCD_MIN(end, start + BUFSIZE);
+        eol = (char *) ircd_find_eol(start, limit);
+        if (eol == limit)
+          break;
+        *eol = '\0';
+        if (client_dopacket(cptr, start, eol - start) == CPTR_KILLED)
+          return CPTR_KILLED;
+        start = eol + 1;
+        /*
+         * If it has become registered as a Server then hand the rest
+         * of the read to the server parser.
+         */
+        if (IsHandshake(cptr) || IsServer(cptr))
+        {
+          if (start == end)
+            return 1;
+          return IsServer(cptr)
+            ? server_dopacket(cptr, start, end - start)
+            : connect_dopacket(cptr, start, end - start);
+        }
+      }
+      length = end - start;
+    }
+
     /*
      * Before we even think of parsing what we just read, stick
      * it on the end of the receive queue and do it when its
      * turn comes around.
      */
-    if (length > 0 && dbuf_put(&(cli_recvQ(cptr)), readbuf, length) == 0)
+    if (length > 0 && dbuf_put(&(cli_recvQ(cptr)), start, length) == 0)
       return exit_client(cptr, cptr, &me, "dbuf_put fail");
 
     if (DBufLength(&(cli_recvQ(cptr))) > feature_int(FEAT_CLIENT_FLOOD))
@@ -655,7 +746,7 @@ static int read_packet(struct Client *cptr, int socket_ready)
           send_reply(cptr, ERR_INPUTTOOLONG);
         }
       }
-      else if (client_dopacket(cptr, dolen) == CPTR_KILLED)
+      else if (client_dopacket(cptr, cli_buffer(cptr), dolen) == CPTR_KILLED)
         return CPTR_KILLED;
       /*
        * If it has become registered as a Server
@@ -682,8 +773,8 @@ static int read_packet(struct Client *cptr, int socket_ready)
     {
       Debug((DEBUG_LIST, "Adding client process timer for %C", cptr));
       cli_freeflag(cptr) |= FREEFLAG_TIMER;
-      timer_add(&(cli_proc(cptr)), client_timer_callback, cli_connect(cptr),
-		TT_RELATIVE, 2);
+      timer_add_named(&(cli_proc(cptr)), client_timer_callback,
+		      cli_connect(cptr), TT_RELATIVE, 2);
     }
   }
   return 1;
@@ -899,6 +990,10 @@ static void client_sock_callback(struct Event* ev)
     ClrFlag(cptr, FLAG_BLOCKED);
     if (cli_listing(cptr) && MsgQLength(&(cli_sendQ(cptr))) < 2048)
       list_next_channels(cptr);
+    if (cli_who(cptr) && MsgQLength(&(cli_sendQ(cptr))) < 2048)
+      who_next(cptr);
+    if (cli_burst(cptr))
+      server_burst_next(cptr);
     Debug((DEBUG_SEND, "Sending queued data to %C", cptr));
     send_queued(cptr);
     break;
@@ -24,6 +24,7 @@
 #include "config.h"
 
 #include "s_conf.h"
+#include "accept_pool.h"
 #include "IPcheck.h"
 #include "class.h"
 #include "client.h"
@@ -42,6 +43,7 @@
 #include "ircd_string.h"
 #include "list.h"
 #include "listener.h"
+#include "mask_index.h"
 #include "match.h"
 #include "motd.h"
 #include "numeric.h"
@@ -88,6 +90,8 @@ struct LocalConf   localConf;
 struct CRuleConf*  cruleConfList;
 /** Global list of K-lines. */
 struct DenyConf*   denyConfList;
+/** Index of #denyConfList by host and IP mask. */
+static struct MaskIndex denyIndex;
 
 /** Tell a user that they are banned, dumping the message from a file.
  * @param sptr Client being rejected
@@ -772,6 +776,38 @@ void conf_erase_deny_list(void)
     MyFree(p);
   }
   denyConfList = 0;
+  mask_index_clear(&denyIndex);
+}
+
+/** Build #denyIndex from #denyConfList.  Entries earlier in the list
+ * get a higher order, so find_kill() still reports the first match.
+ */
+static void conf_index_deny_list(void)
+{
+  struct DenyConf** vec;
+  struct DenyConf*  deny;
+  unsigned int      count = 0;
+  unsigned int      ii;
+
+  mask_index_clear(&denyIndex);
+  for (deny = denyConfList; deny; deny = deny->next)
+    count++;
+  if (!count)
+    return;
+
+  /* Insert from the tail of the list so each entry lands at the
+   * head of its (descending) index chain.
+   */
+  vec = (struct DenyConf**) MyMalloc(count * sizeof(*vec));
+  for (ii = 0, deny = denyConfList; deny; deny = deny->next)
+    vec[ii++] = deny;
+  for (ii = count; ii > 0; --ii) {
+    deny = vec[ii - 1];
+    mask_index_add(&denyIndex, deny->hostmask,
+                   deny->bits > 0 ? &deny->address : NULL, deny->bits,
+                   deny, count - ii + 1);
+  }
+  MyFree(vec);
 }
 
 /** Return #denyConfList.
@@ -868,7 +904,9 @@ int read_configuration_file(void)
     return 0;
   yyparse();
   deinit_lexer();
+  conf_index_deny_list();
   feature_mark(); /* reset unmarked features */
+  accept_pool_update(); /* hand new listeners to acceptor threads */
   conf_already_read = 1;
   return 1;
 }
@@ -1080,6 +1118,36 @@ int init_conf(void)
   return 0;
 }
 
+/** Client details compared against Kill blocks by find_kill(). */
+struct DenyMatch {
+  struct Client* cptr;     /**< Client being checked. */
+  const char*    host;     /**< Client's host name. */
+  const char*    name;     /**< Client's user name. */
+  const char*    realname; /**< Client's real name. */
+};
+
+/** Check whether a Kill block applies to a client.
+ * @param data Kill block (struct DenyConf) to check.
+ * @param ctx Client details (struct DenyMatch).
+ * @return Non-zero if the Kill block matches.
+ */
+static int deny_check(void* data, void* ctx)
+{
+  struct DenyConf*  deny = data;
+  struct DenyMatch* dm = ctx;
+
+  if (deny->usermask && match(deny->usermask, dm->name))
+    return 0;
+  if (deny->realmask && match(deny->realmask, dm->realname))
+    return 0;
+  if (deny->bits > 0) {
+    if (!ipmask_check(&cli_ip(dm->cptr), &deny->address, deny->bits))
+      return 0;
+  } else if (deny->hostmask && match(deny->hostmask, dm->host))
+    return 0;
+  return 1;
+}
+
 /** Searches for a K/G-line for a client.  If one is found, notify the
  * user and disconnect them.
  * @param cptr Client to search for.
@@ -1088,9 +1156,7 @@ int init_conf(void)
  */
 int find_kill(struct Client *cptr)
 {
-  const char*      host;
-  const char*      name;
-  const char*      realname;
+  struct DenyMatch dm;
   struct DenyConf* deny;
   struct Gline*    agline = NULL;
 
@@ -1099,28 +1165,20 @@ int find_kill(struct Client *cptr)
   if (!cli_user(cptr))
     return 0;
 
-  host = cli_sockhost(cptr);
-  name = cli_user(cptr)->username;
-  realname = cli_info(cptr);
+  dm.cptr = cptr;
+  dm.host = cli_sockhost(cptr);
+  dm.name = cli_user(cptr)->username;
+  dm.realname = cli_info(cptr);
 
-  assert(strlen(host) <= HOSTLEN);
-  assert((name ? strlen(name) : 0) <= HOSTLEN);
-  assert((realname ? strlen(realname) : 0) <= REALLEN);
+  assert(strlen(dm.host) <= HOSTLEN);
+  assert((dm.name ? strlen(dm.name) : 0) <= HOSTLEN);
+  assert((dm.realname ? strlen(dm.realname) : 0) <= REALLEN);
 
-  /* 2000-07-14: Rewrote this loop for massive speed increases.
-   *             -- Isomer
+  /* Only Kill blocks whose host or IP mask could match are checked;
+   * see conf_index_deny_list().
    */
-  for (deny = denyConfList; deny; deny = deny->next) {
-    if (deny->usermask && match(deny->usermask, name))
-      continue;
-    if (deny->realmask && match(deny->realmask, realname))
-      continue;
-    if (deny->bits > 0) {
-      if (!ipmask_check(&cli_ip(cptr), &deny->address, deny->bits))
-        continue;
-    } else if (deny->hostmask && match(deny->hostmask, host))
-      continue;
-
+  if ((deny = mask_index_find(&denyIndex, dm.host, &cli_ip(cptr),
+                              deny_check, &dm))) {
     if (EmptyString(deny->message))
       send_reply(cptr, SND_EXPLICIT | ERR_YOUREBANNEDCREEP,
                  ":Connection from your host is refused on this server.");
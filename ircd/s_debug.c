@@ -38,6 +38,7 @@
 #include "jupe.h"
 #include "list.h"
 #include "listener.h"
+#include "member_hash.h"
 #include "motd.h"
 #include "msgq.h"
 #include "numeric.h"
@@ -50,6 +51,7 @@
 #include "send.h"
 #include "struct.h"
 #include "sys.h"
+#include "user_index.h"
 #include "whowas.h"
 
 /* #include <assert.h> -- Now using assert in ircd_log.h */
@@ -224,6 +226,7 @@ void count_memory(struct Client *cptr, const struct StatDesc *sd,
       chi = 0,                  /* channel invites */
       chb = 0,                  /* channel bans */
       wwu = 0,                  /* whowas users */
+      wwa = 0,                  /* whowas aways */
       cl = 0,                   /* classes */
       co = 0,                   /* conf lines */
       listeners = 0,            /* listeners */
@@ -231,10 +234,15 @@ void count_memory(struct Client *cptr, const struct StatDesc *sd,
 
   int usi = 0,                  /* users invited */
       aw = 0,                   /* aways set */
-      wwa = 0,                  /* whowas aways */
       gl = 0,                   /* glines */
       ju = 0;                   /* jupes */
 
+  unsigned int hcl = 0,         /* client hash table slots */
+      hch = 0,                  /* channel hash table slots */
+      uix = 0,                  /* user index keys */
+      wws = 0,                  /* whowas strings */
+      mhc = 0;                  /* membership hash tables */
+
   size_t chm = 0,               /* memory used by channels */
       chbm = 0,                 /* memory used by channel bans */
       cm = 0,                   /* memory used by clients */
@@ -242,8 +250,8 @@ void count_memory(struct Client *cptr, const struct StatDesc *sd,
       us = 0,                   /* user structs */
       usm = 0,                  /* memory used by user structs */
       awm = 0,                  /* memory used by aways */
-      wwam = 0,                 /* whowas away memory used */
-      wwm = 0,                  /* whowas array memory used */
+      wwsm = 0,                 /* whowas string memory used */
+      wwm = 0,                  /* whowas arena memory used */
       glm = 0,                  /* memory used by glines */
       jum = 0,                  /* memory used by jupes */
       com = 0,                  /* memory used by conf lines */
@@ -253,11 +261,12 @@ void count_memory(struct Client *cptr, const struct StatDesc *sd,
       msgbuf_allocated = 0,	/* memory used by struct MsgBuf */
       listenersm = 0,           /* memory used by listetners */
       rm = 0,                   /* res memory used */
+      hm = 0,                   /* memory used by hash tables */
+      uixm = 0,                 /* memory used by user indexes */
+      mhm = 0,                  /* memory used by membership hashes */
       totcl = 0, totch = 0, totww = 0, tot = 0;
 
-  count_whowas_memory(&wwu, &wwm, &wwa, &wwam);
-  wwm += sizeof(struct Whowas) * feature_int(FEAT_NICKNAMEHISTORYLENGTH);
-  wwm += sizeof(struct Whowas *) * WW_MAX;
+  count_whowas_memory(&wwu, &wwa, &wws, &wwsm, &wwm);
 
   for (acptr = GlobalClientList; acptr; acptr = cli_next(acptr))
   {
@@ -340,11 +349,11 @@ void count_memory(struct Client *cptr, const struct StatDesc *sd,
   totch = chm + chbm + chi * sizeof(struct SLink);
 
   send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG,
-	     ":Whowas Users %d(%zu) Away %d(%zu) Array %d(%zu)",
-             wwu, wwu * sizeof(struct User), wwa, wwam,
+	     ":Whowas Users %d Away %d Strings %u(%zu) Array %d(%zu)",
+             wwu, wwa, wws, wwsm,
              feature_int(FEAT_NICKNAMEHISTORYLENGTH), wwm);
 
-  totww = wwu * sizeof(struct User) + wwam + wwm;
+  totww = wwsm + wwm;
 
   motd_memory_count(cptr);
 
@@ -353,9 +362,17 @@ void count_memory(struct Client *cptr, const struct StatDesc *sd,
   send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG,
 	     ":Glines %d(%zu) Jupes %d(%zu)", gl, glm, ju, jum);
 
+  hm = hash_count_memory(&hcl, &hch);
+  send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG,
+	     ":Hash: client %u chan %u slots (%zu)", hcl, hch, hm);
+
+  uixm = user_index_memory(&uix);
+  send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG,
+	     ":User indexes: %u keys (%zu)", uix, uixm);
+
+  mhm = member_hash_memory(&mhc);
   send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG,
-	     ":Hash: client %d(%zu), chan is the same", HASHSIZE,
-	     sizeof(void *) * HASHSIZE);
+	     ":Membership hashes: %u tables (%zu)", mhc, mhm);
 
   count_listener_memory(&listeners, &listenersm);
   send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG,
@@ -383,7 +400,7 @@ void count_memory(struct Client *cptr, const struct StatDesc *sd,
   tot =
       totww + totch + totcl + com + cl * sizeof(struct ConnectionClass) +
       dbufs_allocated + msg_allocated + msgbuf_allocated + rm;
-  tot += sizeof(void *) * HASHSIZE * 3;
+  tot += hm + uixm + mhm;
 
 #if defined(MDEBUG)
   send_reply(cptr, SND_EXPLICIT | RPL_STATSDEBUG, ":Allocations: %zu(%zu)",
@@ -50,13 +50,16 @@
 #include "s_bsd.h"
 #include "s_conf.h"
 #include "s_debug.h"
+#include "s_serv.h"
 #include "s_stats.h"
 #include "s_user.h"
 #include "send.h"
 #include "struct.h"
 #include "sys.h"
 #include "uping.h"
+#include "user_index.h"
 #include "userload.h"
+#include "whocmds.h"
 
 /* #include <assert.h> -- Now using assert in ircd_log.h */
 #include <fcntl.h>
@@ -201,9 +204,13 @@ static void exit_one_client(struct Client* bcptr, const char* comment)
      * Stop a running /LIST clean
      */
     if (MyUser(bcptr) && cli_listing(bcptr)) {
-      MyFree(cli_listing(bcptr));
-      cli_listing(bcptr) = NULL;
+      list_end_channels(bcptr);
     }
+    /*
+     * Stop a running /WHO
+     */
+    if (MyUser(bcptr) && cli_who(bcptr))
+      who_end(bcptr, 0);
     /*
      * If a person is on a channel, send a QUIT notice
      * to every client (person) on the same channel (so
@@ -214,6 +221,8 @@ static void exit_one_client(struct Client* bcptr, const char* comment)
 
     remove_user_from_all_channels(bcptr);
 
+    user_index_del(bcptr);
+
     /* Clean up invitefield */
     while ((lp = cli_user(bcptr)->invited))
       del_invite(bcptr, lp->value.chptr);
@@ -247,6 +256,10 @@ static void exit_one_client(struct Client* bcptr, const char* comment)
     remove_dlink(&(cli_serv(cli_serv(bcptr)->up))->down, cli_serv(bcptr)->updown);
     cli_serv(bcptr)->updown = 0;
 
+    /* Stop sending it our burst */
+    if (MyConnect(bcptr) && cli_burst(bcptr))
+      server_burst_end(bcptr);
+
     if (MyConnect(bcptr))
       Count_serverdisconnects(UserStats);
     else
@@ -34,6 +34,7 @@
 #include "hash.h"
 #include "ircd.h"
 #include "ircd_alloc.h"
+#include "ircd_features.h"
 #include "ircd_log.h"
 #include "ircd_reply.h"
 #include "ircd_string.h"
@@ -67,6 +68,32 @@ unsigned int max_connection_count = 0;
 /** Maximum (local) client count since last restart. */
 unsigned int max_client_count = 0;
 
+/** Netburst that is being sent to a new server link.
+ * Users are visited oldest first, from &me towards the head of
+ * #GlobalClientList, up to the newest client when the burst started.
+ * Local users are moved to the head of the list when they register,
+ * so a user is visited only if it was registered when the burst
+ * started.
+ * Channels are visited from the head of #GlobalChannelList as it was
+ * when the burst started.  Anything created later is announced to the
+ * link by the normal propagation, which is held back until the end of
+ * the burst.
+ */
+struct BurstCursor {
+  struct BurstCursor*  next;    /**< Next burst in progress. */
+  struct BurstCursor** prev_p;  /**< What points to this burst. */
+  struct Client*       server;  /**< Link receiving the burst. */
+  struct Client*       client;  /**< Next client to send. */
+  unsigned long        serial;  /**< cli_serial() of newest client to send. */
+  struct Channel*      channel; /**< Next channel to send. */
+  int                  sending; /**< Non-zero while adding burst data. */
+  struct MsgQ          held;    /**< Other messages for the link. */
+};
+
+/** Netbursts in progress, so that exiting clients and destroyed
+ * channels can be skipped. */
+static struct BurstCursor *bursts;
+
 /** Squit a new (pre-burst) server.
  * @param cptr Local client that tried to introduce the server.
  * @param sptr Server to disconnect.
@@ -235,34 +262,173 @@ int server_estab(struct Client *cptr, struct ConfItem *aconf)
     }
   }
 
-  for (acptr = &me; acptr; acptr = cli_prev(acptr))
-  {
-    /* acptr->from == acptr for acptr == cptr */
-    if (cli_from(acptr) == cptr)
-      continue;
-    if (IsUser(acptr))
-    {
-      char xxx_buf[25];
-      char *s = umode_str(acptr);
-      sendcmdto_one(cli_user(acptr)->server, CMD_NICK, cptr,
-		    "%s %d %Tu %s %s %s%s%s%s %s%s :%s",
-		    cli_name(acptr), cli_hopcount(acptr) + 1, cli_lastnick(acptr),
-		    cli_user(acptr)->username, cli_user(acptr)->realhost,
-		    *s ? "+" : "", s, *s ? " " : "",
-		    iptobase64(xxx_buf, &cli_ip(acptr), sizeof(xxx_buf), IsIPv6(cptr)),
-		    NumNick(acptr), cli_info(acptr));
-    }
-  }
   /*
-   * Last, send the BURST.
-   * (Or for 2.9 servers: pass all channels plus statuses)
+   * Then the users, and last the BURST for each channel.  These are
+   * sent a piece at a time as the link's sendQ drains; until the END
+   * OF BURST, any other message for the link is held back, so the
+   * peer sees the same order as if everything had been queued here.
    */
   {
-    struct Channel *chptr;
-    for (chptr = GlobalChannelList; chptr; chptr = chptr->next)
-      send_channel_modes(cptr, chptr);
+    struct BurstCursor *bc;
+
+    bc = (struct BurstCursor*) MyMalloc(sizeof(struct BurstCursor));
+    bc->server = cptr;
+    bc->client = &me;
+    bc->serial = cli_serial(GlobalClientList);
+    bc->channel = GlobalChannelList;
+    bc->sending = 0;
+    msgq_init(&bc->held);
+    if ((bc->next = bursts))
+      bursts->prev_p = &bc->next;
+    bc->prev_p = &bursts;
+    bursts = bc;
+    cli_burst(cptr) = bc;
   }
-  sendcmdto_one(&me, CMD_END_OF_BURST, cptr, "");
+  server_burst_next(cptr);
   return 0;
 }
 
+/** Introduce a user to a server that is receiving our burst.
+ * @param[in] cptr Server link.
+ * @param[in] acptr User to introduce.
+ */
+static void burst_user(struct Client *cptr, struct Client *acptr)
+{
+  char xxx_buf[25];
+  char *s = umode_str(acptr);
+
+  sendcmdto_one(cli_user(acptr)->server, CMD_NICK, cptr,
+                "%s %d %Tu %s %s %s%s%s%s %s%s :%s",
+                cli_name(acptr), cli_hopcount(acptr) + 1, cli_lastnick(acptr),
+                cli_user(acptr)->username, cli_user(acptr)->realhost,
+                *s ? "+" : "", s, *s ? " " : "",
+                iptobase64(xxx_buf, &cli_ip(acptr), sizeof(xxx_buf), IsIPv6(cptr)),
+                NumNick(acptr), cli_info(acptr));
+}
+
+/** Move a burst on from the client it is about to send.
+ * @param[in,out] bc Burst to advance.
+ * @param[in] acptr Client that \a bc points at.
+ */
+static void burst_advance(struct BurstCursor *bc, struct Client *acptr)
+{
+  bc->client = cli_prev(acptr);
+  if (bc->client && cli_serial(bc->client) > bc->serial)
+    bc->client = 0; /* added after the burst started */
+}
+
+/** Send more of our burst to a server.
+ * This adds users and channels until the link's sendQ holds
+ * FEAT_BURST_BUDGET bytes, and finishes the burst once all have been
+ * sent.
+ * @param[in] cptr Server link receiving the burst.
+ */
+void server_burst_next(struct Client *cptr)
+{
+  struct BurstCursor *bc = cli_burst(cptr);
+  struct Client *acptr;
+  struct Channel *chptr;
+  unsigned int budget = feature_int(FEAT_BURST_BUDGET);
+
+  assert(0 != bc);
+
+  bc->sending = 1;
+  while (!budget || MsgQLength(&cli_sendQ(cptr)) < budget) {
+    if (IsDead(cptr)) {
+      bc->sending = 0;
+      return;
+    }
+    if ((acptr = bc->client)) {
+      burst_advance(bc, acptr);
+      /* acptr->from == acptr for acptr == cptr */
+      if (IsUser(acptr) && cli_from(acptr) != cptr)
+        burst_user(cptr, acptr);
+    } else if ((chptr = bc->channel)) {
+      bc->channel = chptr->next;
+      send_channel_modes(cptr, chptr);
+    } else {
+      sendcmdto_one(&me, CMD_END_OF_BURST, cptr, "");
+      /* now release everything that was held back */
+      msgq_move(&cli_sendQ(cptr), &bc->held);
+      server_burst_end(cptr);
+      update_write(cptr);
+      return;
+    }
+  }
+  bc->sending = 0;
+}
+
+/** Check whether a server has been sent a user's NICK.
+ * Users are sent in list order, so this holds for users who are older
+ * than the burst's next client, unless they were added or registered
+ * after the burst started; those are introduced by the held-back
+ * messages.  Users on the server's own side of the link are always
+ * known to it.
+ * @param[in] cptr Server link.
+ * @param[in] acptr User to check.
+ * @return Non-zero if \a cptr knows about \a acptr.
+ */
+int server_burst_sent(struct Client *cptr, struct Client *acptr)
+{
+  struct BurstCursor *bc = cli_burst(cptr);
+
+  if (!bc || cli_from(acptr) == cptr)
+    return 1;
+  return cli_serial(acptr) <= bc->serial
+    && (!bc->client || cli_serial(acptr) < cli_serial(bc->client));
+}
+
+/** Get the queue for messages held back from a server that is
+ * receiving our burst.
+ * @param[in] cptr Server link.
+ * @return Queue to hold messages for \a cptr in, or NULL if they
+ *   should go straight to its sendQ.
+ */
+struct MsgQ *server_burst_held(struct Client *cptr)
+{
+  struct BurstCursor *bc = cli_burst(cptr);
+
+  return (bc && !bc->sending) ? &bc->held : 0;
+}
+
+/** Stop sending a burst to a server and drop any held messages.
+ * @param[in] cptr Server link.
+ */
+void server_burst_end(struct Client *cptr)
+{
+  struct BurstCursor *bc = cli_burst(cptr);
+
+  if (!bc)
+    return;
+  if (bc->next)
+    bc->next->prev_p = bc->prev_p;
+  *bc->prev_p = bc->next;
+  MsgQClear(&bc->held);
+  MyFree(bc);
+  cli_burst(cptr) = 0;
+}
+
+/** Advance any burst that is about to visit a client being removed.
+ * @param[in] acptr Client that is being removed from #GlobalClientList.
+ */
+void server_burst_forget_client(struct Client *acptr)
+{
+  struct BurstCursor *bc;
+
+  for (bc = bursts; bc; bc = bc->next)
+    if (bc->client == acptr)
+      burst_advance(bc, acptr);
+}
+
+/** Advance any burst that is about to visit a channel being destroyed.
+ * @param[in] chptr Channel that is being removed from #GlobalChannelList.
+ */
+void server_burst_forget_channel(struct Channel *chptr)
+{
+  struct BurstCursor *bc;
+
+  for (bc = bursts; bc; bc = bc->next)
+    if (bc->channel == chptr)
+      bc->channel = chptr->next;
+}
+
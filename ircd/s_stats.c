@@ -21,10 +21,13 @@
  */
 #include "config.h"
 
+#include "IPcheck.h"
+#include "accept_pool.h"
 #include "class.h"
 #include "client.h"
 #include "gline.h"
 #include "hash.h"
+#include "ident_cache.h"
 #include "ircd.h"
 #include "ircd_chattr.h"
 #include "ircd_events.h"
@@ -41,6 +44,7 @@
 #include "msgq.h"
 #include "numeric.h"
 #include "numnicks.h"
+#include "parse.h"
 #include "querycmds.h"
 #include "res.h"
 #include "s_auth.h"
@@ -147,7 +151,7 @@ stats_crule_list(struct Client* to, const struct StatDesc *sd,
   }
 }
 
-/** Report active event engine name.
+/** Report active event engine name and timer queue statistics.
  * @param[in] to Client requesting statistics.
  * @param[in] sd Stats descriptor for request (ignored).
  * @param[in] param Extra parameter from user (ignored).
@@ -155,7 +159,100 @@ stats_crule_list(struct Client* to, const struct StatDesc *sd,
 static void
 stats_engine(struct Client *to, const struct StatDesc *sd, char *param)
 {
+  const struct TimerStats *ts = timer_stats();
+
   send_reply(to, RPL_STATSENGINE, engine_name());
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":Timers: pending %u enqueued %lu expired %lu cascaded %lu "
+             "rebased %lu", ts->ts_pending, ts->ts_enqueued, ts->ts_expired,
+             ts->ts_cascaded, ts->ts_rebased);
+  accept_pool_report(to);
+  deliver_report(to);
+}
+
+/** Order callback statistics by decreasing total time.
+ * Used for qsort(3).
+ * @param[in] a_ Pointer to first entry pointer.
+ * @param[in] b_ Pointer to second entry pointer.
+ * @return Comparison result for qsort(3).
+ */
+static int
+stall_cmp(const void *a_, const void *b_)
+{
+  const struct CallbackStats *a = *(const struct CallbackStats * const *)a_;
+  const struct CallbackStats *b = *(const struct CallbackStats * const *)b_;
+
+  return (a->cs_total < b->cs_total) - (a->cs_total > b->cs_total);
+}
+
+/** Report one callback statistics entry.
+ * @param[in] to Client requesting statistics.
+ * @param[in] kind Kind of entry ("Callback" or "Event").
+ * @param[in] cs Entry to report.
+ */
+static void
+stall_report_entry(struct Client *to, const char *kind,
+                   const struct CallbackStats *cs)
+{
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":%s %s calls %lu total %Lu.%03u ms average %Lu us "
+             "max %lu.%03lu ms", kind, loop_callback_name(cs), cs->cs_calls,
+             (uint64_t) (cs->cs_total / 1000),
+             (unsigned int) (cs->cs_total % 1000),
+             (uint64_t) (cs->cs_total / cs->cs_calls),
+             cs->cs_max / 1000, cs->cs_max % 1000);
+}
+
+/** Report where the event loop spends its time, and its recent stalls.
+ * @param[in] to Client requesting statistics.
+ * @param[in] sd Stats descriptor for request (ignored).
+ * @param[in] param Extra parameter from user (ignored).
+ */
+static void
+stats_stalls(struct Client *to, const struct StatDesc *sd, char *param)
+{
+  const struct LoopStats *ls = loop_stats();
+  const struct CallbackStats *sorted[LOOP_CALLBACK_MAX + 2];
+  const struct LoopStall *stall;
+  char buf[256];
+  unsigned int ii, count = 0;
+
+  send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG,
+             ":Event loop: passes %lu busy %Lu.%03u ms stalls %lu "
+             "threshold %d ms", ls->ls_passes, (uint64_t) (ls->ls_busy / 1000),
+             (unsigned int) (ls->ls_busy % 1000),
+             ls->ls_stalls, feature_int(FEAT_STALL_THRESHOLD));
+  if (ls->ls_worst.ls_usec) {
+    loop_stall_describe(buf, sizeof(buf), &ls->ls_worst);
+    send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG, ":Slowest pass %Tu "
+               "seconds ago: %s", CurrentTime - ls->ls_worst.ls_when, buf);
+  }
+
+  for (ii = 0; ii < ls->ls_ncallbacks; ii++)
+    if (ls->ls_callbacks[ii].cs_calls)
+      sorted[count++] = &ls->ls_callbacks[ii];
+  if (ls->ls_timers.cs_calls)
+    sorted[count++] = &ls->ls_timers;
+  if (ls->ls_ticks.cs_calls)
+    sorted[count++] = &ls->ls_ticks;
+  qsort(sorted, count, sizeof(sorted[0]), stall_cmp);
+  for (ii = 0; ii < count; ii++)
+    stall_report_entry(to, "Callback", sorted[ii]);
+
+  for (ii = 0; ii <= ET_DESTROY; ii++)
+    if (ls->ls_types[ii].cs_calls)
+      stall_report_entry(to, "Event", &ls->ls_types[ii]);
+
+  /* most recent stalls first */
+  for (ii = 1; ii <= LOOP_STALL_RING; ii++) {
+    stall = &ls->ls_ring[(ls->ls_ring_next + LOOP_STALL_RING - ii) %
+                         LOOP_STALL_RING];
+    if (!stall->ls_usec)
+      break;
+    loop_stall_describe(buf, sizeof(buf), stall);
+    send_reply(to, SND_EXPLICIT | RPL_STATSDEBUG, ":Stall %Tu seconds ago: %s",
+               CurrentTime - stall->ls_when, buf);
+  }
 }
 
 /** Report client access lists.
@@ -584,7 +681,7 @@ struct StatDesc statsinfo[] = {
     "Connection authorization lines." },
   { 'j', "histogram", (STAT_FLAG_OPERFEAT | STAT_FLAG_CASESENS), FEAT_HIS_STATS_j,
     msgq_histogram, 0,
-    "Message length histogram." },
+    "Message length histogram and buffer slab usage." },
   { 'J', "jupes", (STAT_FLAG_OPERFEAT | STAT_FLAG_CASESENS), FEAT_HIS_STATS_J,
     stats_nickjupes, 0,
     "Nickname jupes." },
@@ -602,6 +699,9 @@ struct StatDesc statsinfo[] = {
   { 'm', "commands", (STAT_FLAG_OPERFEAT | STAT_FLAG_CASESENS), FEAT_HIS_STATS_m,
     stats_commands, 0,
     "Message usage information." },
+  { 'M', "latency", (STAT_FLAG_OPERFEAT | STAT_FLAG_VARPARAM | STAT_FLAG_CASESENS), FEAT_HIS_STATS_M,
+    report_command_latency, 0,
+    "Command handler latency." },
   { 'o', "operators", STAT_FLAG_OPERFEAT, FEAT_HIS_STATS_o,
     stats_configured_links, CONF_OPERATOR,
     "Operator information." },
@@ -658,6 +758,24 @@ struct StatDesc statsinfo[] = {
   { ' ', "iauthconf", (STAT_FLAG_OPERFEAT | STAT_FLAG_VARPARAM), FEAT_HIS_STATS_IAUTH,
     report_iauth_conf, 0,
     "IAuth configuration." },
+  { ' ', "hash", STAT_FLAG_OPERFEAT, FEAT_HIS_STATS_HASH,
+    hash_stats, 0,
+    "Client and channel hash table statistics." },
+  { ' ', "ipcheck", STAT_FLAG_OPERFEAT, FEAT_HIS_STATS_IPCHECK,
+    IPcheck_stats, 0,
+    "IPcheck registry statistics." },
+  { ' ', "ident", STAT_FLAG_OPERFEAT, FEAT_HIS_STATS_IDENT,
+    ident_cache_stats, 0,
+    "Ident lookup outcomes and skipped lookups." },
+  { ' ', "logs", STAT_FLAG_OPERFEAT, FEAT_HIS_STATS_LOGS,
+    log_report_buffers, 0,
+    "Buffered log file writes and dropped log lines." },
+  { ' ', "stalls", STAT_FLAG_OPERFEAT, FEAT_HIS_STATS_e,
+    stats_stalls, 0,
+    "Event loop callback times and recent stalls." },
+  { ' ', "latencymach", (STAT_FLAG_OPERFEAT | STAT_FLAG_VARPARAM), FEAT_HIS_STATS_M,
+    report_command_latency, 1,
+    "Command handler latency histograms, machine-readable." },
   { '*', "help", STAT_FLAG_CASESENS, FEAT_LAST_F,
     stats_help, 0,
     "Send help for stats." },
@@ -60,6 +60,7 @@
 #include "struct.h"
 #include "supported.h"
 #include "sys.h"
+#include "user_index.h"
 #include "userload.h"
 #include "version.h"
 #include "whowas.h"
@@ -110,6 +111,7 @@ void free_user(struct User* user)
   if (--user->refcnt == 0) {
     if (user->away)
       MyFree(user->away);
+    MyFree(user->banident);
     /*
      * sanity check
      */
@@ -304,6 +306,49 @@ int hunt_server_prio_cmd(struct Client *from, const char *cmd, const char *tok,
   return (HUNTED_PASS);
 }
 
+/** Pre-formatted replies that start the greeting of every local user. */
+static struct MsgTemplate welcome;
+
+/** Get the pre-formatted greeting for local users, building it if needed.
+ * It holds RPL_WELCOME through RPL_ISUPPORT, which only change with
+ * the server's features.
+ * @return Message template for the greeting.
+ */
+static struct MsgTemplate *welcome_template(void)
+{
+  char featurebuf[512];
+
+  if (welcome.count)
+    return &welcome;
+
+  template_reply(&welcome,
+                 RPL_WELCOME,
+                 feature_str(FEAT_NETWORK),
+                 feature_str(FEAT_PROVIDER) ? " via " : "",
+                 feature_str(FEAT_PROVIDER) ? feature_str(FEAT_PROVIDER) : "",
+                 TPL_NICK);
+  /*
+   * This is a duplicate of the NOTICE but see below...
+   */
+  template_reply(&welcome, RPL_YOURHOST, cli_name(&me), version);
+  template_reply(&welcome, RPL_CREATED, creation);
+  template_reply(&welcome, RPL_MYINFO, cli_name(&me), version, infousermodes,
+                 infochanmodes, infochanmodeswithparams);
+
+  /* same as send_supported() */
+  ircd_snprintf(0, featurebuf, sizeof(featurebuf), FEATURES1, FEATURESVALUES1);
+  template_reply(&welcome, RPL_ISUPPORT, featurebuf);
+  ircd_snprintf(0, featurebuf, sizeof(featurebuf), FEATURES2, FEATURESVALUES2);
+  template_reply(&welcome, RPL_ISUPPORT, featurebuf);
+
+  return &welcome;
+}
+
+/** Discard the pre-formatted greeting after a feature it shows changed. */
+void welcome_reset(void)
+{
+  msgq_tpl_clear(&welcome);
+}
 
 /*
  * register_user
@@ -353,6 +398,9 @@ int register_user(struct Client *cptr, struct Client *sptr)
   {
     assert(cptr == sptr);
 
+    /* Order the user by registration, not connection, so a netburst
+     * that has already passed it does not count it as sent. */
+    move_client_to_list_head(sptr);
     Count_unknownbecomesclient(sptr, UserStats);
 
     /*
@@ -368,20 +416,11 @@ int register_user(struct Client *cptr, struct Client *sptr)
     SetUser(sptr);
     cli_handler(sptr) = CLIENT_HANDLER;
     SetLocalNumNick(sptr);
-    send_reply(sptr,
-               RPL_WELCOME,
-               feature_str(FEAT_NETWORK),
-               feature_str(FEAT_PROVIDER) ? " via " : "",
-               feature_str(FEAT_PROVIDER) ? feature_str(FEAT_PROVIDER) : "",
-               cli_name(sptr));
     /*
-     * This is a duplicate of the NOTICE but see below...
+     * WELCOME, YOURHOST, CREATED, MYINFO and ISUPPORT are the same for
+     * everyone but the nick, so they are formatted only once.
      */
-    send_reply(sptr, RPL_YOURHOST, cli_name(&me), version);
-    send_reply(sptr, RPL_CREATED, creation);
-    send_reply(sptr, RPL_MYINFO, cli_name(&me), version, infousermodes,
-               infochanmodes, infochanmodeswithparams);
-    send_supported(sptr);
+    send_template(sptr, welcome_template());
     m_lusers(sptr, sptr, 1, parv);
     update_load();
     motd_signon(sptr);
@@ -439,6 +478,7 @@ int register_user(struct Client *cptr, struct Client *sptr)
    */
   if (HasHiddenHost(sptr))
     hide_hostmask(sptr, FLAG_HIDDENHOST);
+  user_index_add(sptr);
   if (IsInvisible(sptr))
     ++UserStats.inv_clients;
   if (IsOper(sptr))
@@ -633,6 +673,7 @@ int set_nick_name(struct Client* cptr, struct Client* sptr,
       hRemClient(sptr);
     strcpy(cli_name(sptr), nick);
     hAddClient(sptr);
+    ban_ident_invalidate(sptr);
   }
   else {
     /* Local client setting NICK the first time */
@@ -900,12 +941,17 @@ hide_hostmask(struct Client *cptr, unsigned int flag)
   }
 
   SetFlag(cptr, flag);
-  if (!HasFlag(cptr, FLAG_HIDDENHOST) || !HasFlag(cptr, FLAG_ACCOUNT))
+  ban_ident_invalidate(cptr);
+  if (!HasFlag(cptr, FLAG_HIDDENHOST) || !HasFlag(cptr, FLAG_ACCOUNT)) {
+    if (flag == FLAG_ACCOUNT) /* index the new account name */
+      user_index_update(cptr);
     return 0;
+  }
 
   sendcmdto_common_channels_butone(cptr, CMD_QUIT, cptr, ":Registered");
   ircd_snprintf(0, cli_user(cptr)->host, HOSTLEN, "%s.%s",
                 cli_user(cptr)->account, feature_str(FEAT_HIDDEN_HOST));
+  user_index_update(cptr);
 
   /* ok, the client is now fully hidden, so let them know -- hikari */
   if (MyConnect(cptr))
@@ -1153,6 +1199,8 @@ int set_user_mode(struct Client *cptr, struct Client *sptr, int parc,
 	      cli_user(sptr)->acc_create));
       }
       ircd_strncpy(cli_user(sptr)->account, account, len);
+      user_index_update(sptr);
+      ban_ident_invalidate(sptr);
   }
   if (!FlagHas(&setflags, FLAG_HIDDENHOST) && do_host_hiding && allow_modes != ALLOWMODES_DEFAULT)
     hide_hostmask(sptr, FLAG_HIDDENHOST);
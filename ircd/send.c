@@ -28,6 +28,8 @@
 #include "class.h"
 #include "client.h"
 #include "ircd.h"
+#include "ircd_alloc.h"
+#include "ircd_events.h"
 #include "ircd_features.h"
 #include "ircd_log.h"
 #include "ircd_snprintf.h"
@@ -40,6 +42,7 @@
 #include "s_bsd.h"
 #include "s_debug.h"
 #include "s_misc.h"
+#include "s_serv.h"
 #include "s_user.h"
 #include "struct.h"
 #include "sys.h"
@@ -56,6 +59,29 @@ struct SLink *opsarray[32];     /* don't use highest bit unless you change
 /** Linked list of all connections with data queued to send. */
 static struct Connection *send_queues;
 
+/** Destination collected during a channel fan-out. */
+struct FanOut {
+  struct Client *to;		/**< local connection receiving the message */
+  struct MsgBuf *mb;		/**< buffer to queue for \a to */
+};
+
+/** Flat array of destinations for the channel fan-out in progress. */
+static struct {
+  struct FanOut *dest;		/**< collected destinations */
+  unsigned int count;		/**< number of entries used */
+  unsigned int size;		/**< number of entries allocated */
+} fanout;
+
+/** Connections whose flush was deferred to the end of the loop pass. */
+static struct {
+  int *fds;			/**< descriptors of deferred connections */
+  unsigned int count;		/**< number of entries used */
+  unsigned int size;		/**< number of entries allocated */
+} deferred;
+
+/** Tick handler that flushes #deferred. */
+static struct Tick send_tick;
+
 /*
  * dead_link
  *
@@ -208,39 +234,45 @@ void send_queued(struct Client *to)
   update_write(to);
 }
 
-/** Try to send a buffer to a client, queueing it if needed.
- * @param[in,out] to Client to send message to.
- * @param[in] buf Message to send.
- * @param[in] prio If non-zero, send as high priority.
+/** Append a buffer to a client's sendQ without trying to write it.
+ * While a server link is receiving our burst, the buffer is held back
+ * until the end of the burst instead.
+ * @param[in,out] to Local connection to queue message for.
+ * @param[in] buf Message to queue.
+ * @param[in] prio If non-zero, queue as high priority.
+ * @return Non-zero if the message was queued, zero if \a to is dead.
  */
-void send_buffer(struct Client* to, struct MsgBuf* buf, int prio)
+static int send_enqueue(struct Client* to, struct MsgBuf* buf, int prio)
 {
-  assert(0 != to);
-  assert(0 != buf);
-
-  if (cli_from(to))
-    to = cli_from(to);
+  struct MsgQ* held = 0;
+  unsigned int length;
 
   if (!can_send(to))
     /*
      * This socket has already been marked as dead
      */
-    return;
+    return 0;
 
-  if (MsgQLength(&(cli_sendQ(to))) > get_sendq(to)) {
+  length = MsgQLength(&(cli_sendQ(to)));
+  if (cli_burst(to) && (held = server_burst_held(to)))
+    length += MsgQLength(held);
+
+  if (length > get_sendq(to)) {
     if (IsServer(to))
       sendto_opmask_butone(0, SNO_OLDSNO, "Max SendQ limit exceeded for %C: "
-			   "%zu > %zu", to, MsgQLength(&(cli_sendQ(to))),
-			   get_sendq(to));
+			   "%u > %zu", to, length, get_sendq(to));
     dead_link(to, "Max sendQ exceeded");
-    return;
+    return 0;
   }
 
   Debug((DEBUG_SEND, "Sending [%p] to %s", buf, cli_name(to)));
 
-  msgq_add(&(cli_sendQ(to)), buf, prio);
-  client_add_sendq(cli_connect(to), &send_queues);
-  update_write(to);
+  if (held)
+    msgq_add(held, buf, prio);
+  else {
+    msgq_add(&(cli_sendQ(to)), buf, prio);
+    client_add_sendq(cli_connect(to), &send_queues);
+  }
 
   /*
    * Update statistics. The following is slightly incorrect
@@ -249,6 +281,27 @@ void send_buffer(struct Client* to, struct MsgBuf* buf, int prio)
    */
   ++(cli_sendM(to));
   ++(cli_sendM(&me));
+  return 1;
+}
+
+/** Try to send a buffer to a client, queueing it if needed.
+ * @param[in,out] to Client to send message to.
+ * @param[in] buf Message to send.
+ * @param[in] prio If non-zero, send as high priority.
+ */
+void send_buffer(struct Client* to, struct MsgBuf* buf, int prio)
+{
+  assert(0 != to);
+  assert(0 != buf);
+
+  if (cli_from(to))
+    to = cli_from(to);
+
+  if (!send_enqueue(to, buf, prio))
+    return;
+
+  update_write(to);
+
   /*
    * This little bit is to stop the sendQ from growing too large when
    * there is no need for it to. Thus we call send_queued() every time
@@ -261,6 +314,122 @@ void send_buffer(struct Client* to, struct MsgBuf* buf, int prio)
     send_queued(to);
 }
 
+/** Send a message template to a local client.
+ * The template's text is shared; only the client's nick is copied.
+ * @param[in,out] to Local client to send to.
+ * @param[in] tpl Template to send.
+ */
+void send_template(struct Client* to, struct MsgTemplate* tpl)
+{
+  assert(0 != to);
+  assert(0 != tpl);
+  assert(MyConnect(to));
+
+  if (!can_send(to))
+    return;
+
+  if (MsgQLength(&(cli_sendQ(to))) > get_sendq(to)) {
+    dead_link(to, "Max sendQ exceeded");
+    return;
+  }
+
+  msgq_tpl_add(&(cli_sendQ(to)), tpl, *cli_name(to) ? cli_name(to) : "*");
+  client_add_sendq(cli_connect(to), &send_queues);
+
+  cli_sendM(to) += tpl->lines; /* count lines, as send_enqueue() would */
+  cli_sendM(&me) += tpl->lines;
+
+  update_write(to);
+
+  /* Same as in send_buffer(): do not let the sendQ grow too large. */
+  if (MsgQLength(&(cli_sendQ(to))) / 1024 > cli_lastsq(to))
+    send_queued(to);
+}
+
+/** Queue a buffer for a client, deferring the write to the end of the
+ * current event loop pass.
+ * Many destinations of one fan-out are usually idle connections, so
+ * flushing them all at once afterwards avoids toggling write interest
+ * in the event engine for each of them.
+ * @param[in,out] to Local connection to send message to.
+ * @param[in] buf Message to send.
+ */
+static void send_buffer_deferred(struct Client* to, struct MsgBuf* buf)
+{
+  assert(0 != to);
+  assert(0 != buf);
+  assert(MyConnect(to));
+
+  if (!send_enqueue(to, buf, 0))
+    return;
+
+  if (!HasFlag(to, FLAG_SENDQ_DEFERRED)) {
+    if (deferred.count == deferred.size) {
+      deferred.size = deferred.size ? deferred.size * 2 : 64;
+      deferred.fds = (int*) MyRealloc(deferred.fds,
+                                      deferred.size * sizeof(deferred.fds[0]));
+    }
+    deferred.fds[deferred.count++] = cli_fd(to);
+    SetFlag(to, FLAG_SENDQ_DEFERRED);
+  }
+
+  /* Same as in send_buffer(): do not let one fan-out build a huge sendQ. */
+  if (MsgQLength(&(cli_sendQ(to))) / 1024 > cli_lastsq(to))
+    send_queued(to);
+}
+
+/** Flush all connections queued by send_buffer_deferred().
+ * This is run once at the end of each event loop pass.
+ */
+static void send_flush_deferred(void)
+{
+  struct Client *cptr;
+  unsigned int ii;
+
+  for (ii = 0; ii < deferred.count; ++ii) {
+    /* the connection may have gone away (or been replaced) meanwhile */
+    cptr = LocalClientArray[deferred.fds[ii]];
+    if (!cptr || !HasFlag(cptr, FLAG_SENDQ_DEFERRED))
+      continue;
+    ClrFlag(cptr, FLAG_SENDQ_DEFERRED);
+    send_queued(cptr);
+    update_write(cptr);
+  }
+  deferred.count = 0;
+}
+
+/** Add a destination to the channel fan-out in progress.
+ * @param[in] to Local connection to send to.
+ * @param[in] mb Message buffer to send it.
+ */
+static void fanout_add(struct Client *to, struct MsgBuf *mb)
+{
+  if (fanout.count == fanout.size) {
+    fanout.size = fanout.size ? fanout.size * 2 : 256;
+    fanout.dest = (struct FanOut*) MyRealloc(fanout.dest,
+                                             fanout.size * sizeof(fanout.dest[0]));
+  }
+  fanout.dest[fanout.count].to = to;
+  fanout.dest[fanout.count].mb = mb;
+  fanout.count++;
+}
+
+/** Queue the message for every destination of the current fan-out. */
+static void fanout_flush(void)
+{
+  unsigned int ii;
+
+  for (ii = 0; ii < fanout.count; ++ii)
+    send_buffer_deferred(fanout.dest[ii].to, fanout.dest[ii].mb);
+  fanout.count = 0;
+}
+
+/** Initialize the send subsystem. */
+void send_init(void)
+{
+  tick_add(&send_tick, send_flush_deferred);
+}
+
 /*
  * Send a msg to all ppl on servers/hosts that match a specified mask
  * (used for enhanced PRIVMSGs)
@@ -537,7 +706,7 @@ void sendcmdto_channel_butserv_butone(struct Client *from, const char *cmd,
   mb = msgq_make(0, "%:#C %s %v", from, cmd, &vd);
   va_end(vd.vd_args);
 
-  /* send the buffer to each local channel member */
+  /* collect each local channel member */
   for (member = to->members; member; member = member->next_member) {
     if (!MyConnect(member->user)
         || member->user == one 
@@ -546,9 +715,12 @@ void sendcmdto_channel_butserv_butone(struct Client *from, const char *cmd,
         || (skip & SKIP_NONOPS && !IsChanOp(member))
         || (skip & SKIP_NONVOICES && !IsChanOp(member) && !HasVoice(member)))
         continue;
-      send_buffer(member->user, mb, 0);
+    fanout_add(member->user, mb);
   }
 
+  /* and queue the buffer for them */
+  fanout_flush();
+
   msgq_clean(mb);
 }
 
@@ -644,11 +816,13 @@ void sendcmdto_channel_butone(struct Client *from, const char *cmd,
     cli_sentalong(member->user) = sentalong_marker;
 
     if (MyConnect(member->user)) /* pick right buffer to send */
-      send_buffer(member->user, user_mb, 0);
+      fanout_add(member->user, user_mb);
     else
-      send_buffer(member->user, serv_mb, 0);
+      fanout_add(cli_from(member->user), serv_mb);
   }
 
+  fanout_flush();
+
   msgq_clean(user_mb);
   msgq_clean(serv_mb);
 }
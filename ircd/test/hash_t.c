@@ -0,0 +1,123 @@
+/*
+ * hash_t.c - test cases for the client hash table
+ */
+
+#include "client.h"
+#include "channel.h"
+#include "hash.h"
+#include "ircd.h"
+#include "ircd_features.h"
+#include "ircd_log.h"
+#include "ircd_snprintf.h"
+#include "querycmds.h"
+#include "random.h"
+#include "send.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Enough clients to push the table past its first resize. */
+#define NUM_CLIENTS 5000
+
+/* Stubs for the parts of the server that hash.c reports through. */
+time_t CurrentTime;
+struct UserStatistics UserStats;
+struct Channel *GlobalChannelList;
+
+unsigned int ircrandom(void) { return rand(); }
+int feature_int(enum Feature feat) { return 0; }
+void send_reply(struct Client *to, int reply, ...) { }
+void sendcmdto_one(struct Client *from, const char *cmd, const char *tok,
+                   struct Client *to, const char *pattern, ...) { }
+int ircd_snprintf(struct Client *dest, char *buf, size_t buf_len,
+                  const char *format, ...) { return 0; }
+void channel_modes(struct Client *cptr, char *mbuf, char *pbuf, int buflen,
+                   struct Channel *chptr, struct Membership *member) { }
+struct Membership *find_channel_member(struct Client *cptr,
+                                       struct Channel *chptr) { return 0; }
+
+static struct Client clients[NUM_CLIENTS];
+static int live[NUM_CLIENTS];
+
+/** Check that a client can be found exactly when it is in the table. */
+static void
+check(unsigned int ii)
+{
+  struct Client *found = hSeekClient(cli_name(&clients[ii]), ~0);
+
+  if (found != (live[ii] ? &clients[ii] : NULL)) {
+    fprintf(stderr, "client %s (%s): found %p\n", cli_name(&clients[ii]),
+            live[ii] ? "live" : "removed", (void *) found);
+    abort();
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  unsigned int ii, jj, kk;
+  int res;
+
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  init_hash();
+
+  for (ii = 0; ii < NUM_CLIENTS; ii++) {
+    sprintf(cli_name(&clients[ii]), "user%u", ii);
+    cli_status(&clients[ii]) = STAT_USER;
+  }
+
+  /* Fill the table, removing some clients as it goes.  The table is
+   * resized several times, and removals made while the old slots are
+   * being migrated must not leave the client visible in either array. */
+  for (ii = 0; ii < NUM_CLIENTS; ii++) {
+    hAddClient(&clients[ii]);
+    live[ii] = 1;
+    if (rand() % 3 == 0) {
+      jj = rand() % (ii + 1);
+      if (live[jj]) {
+        res = hRemClient(&clients[jj]);
+        assert(res == 0);
+        live[jj] = 0;
+      }
+      check(jj);
+    }
+    for (jj = rand() % 64; jj <= ii; jj += 1 + rand() % 64)
+      check(jj);
+  }
+  printf("Passed: add and remove while resizing\n");
+
+  /* Churn the full table in random order. */
+  for (ii = 0; ii < NUM_CLIENTS; ii++) {
+    jj = rand() % NUM_CLIENTS;
+    if (live[jj]) {
+      res = hRemClient(&clients[jj]);
+      assert(res == 0);
+      live[jj] = 0;
+    } else {
+      res = hRemClient(&clients[jj]);
+      assert(res == -1);
+      hAddClient(&clients[jj]);
+      live[jj] = 1;
+    }
+    check(jj);
+    for (kk = 0; kk < 32; kk++)
+      check(rand() % NUM_CLIENTS);
+  }
+  for (ii = 0; ii < NUM_CLIENTS; ii++)
+    check(ii);
+  printf("Passed: churn\n");
+
+  for (ii = 0; ii < NUM_CLIENTS; ii++)
+    if (live[ii]) {
+      res = hRemClient(&clients[ii]);
+      assert(res == 0);
+      live[ii] = 0;
+      check(ii);
+    }
+  for (ii = 0; ii < NUM_CLIENTS; ii++)
+    check(ii);
+  printf("Passed: empty\n");
+
+  return 0;
+}
@@ -6,6 +6,35 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Check ircd_find_eol() against a plain loop for every alignment,
+ * length and end-of-line position up to a few SIMD widths.
+ */
+static int test_find_eol(void)
+{
+  char buf[160];
+  const char *expect, *got;
+  int start, len, pos, eol;
+
+  for (start = 0; start < 32; ++start)
+    for (len = 0; len + start <= 128; ++len)
+      for (pos = -1; pos < len; ++pos)
+        for (eol = 0; eol < 2; ++eol) {
+          memset(buf, 'x', sizeof(buf));
+          buf[start + len] = '\n'; /* must not be found past the end */
+          if (pos >= 0)
+            buf[start + pos] = eol ? '\r' : '\n';
+          expect = buf + start + (pos >= 0 ? pos : len);
+          got = ircd_find_eol(buf + start, buf + start + len);
+          if (got != expect) {
+            printf("ircd_find_eol: start %d len %d pos %d: got %d\n",
+                   start, len, pos, (int)(got - buf - start));
+            return 1;
+          }
+        }
+  printf("ircd_find_eol: ok\n");
+  return 0;
+}
+
 int main(void)
 {
   char* vector[20];
@@ -53,6 +82,6 @@ int main(void)
   printf("\n");
   free(names);
 
-  return 0;
+  return test_find_eol();
 }
   
@@ -0,0 +1,225 @@
+/*
+ * mask_index_t.c - test cases for host and IP mask indexing
+ */
+
+#include "ircd_log.h"
+#include "ircd_string.h"
+#include "mask_index.h"
+#include "match.h"
+#include "res.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_MASKS   100
+#define NUM_CLIENTS 5000
+
+/** One mask in the test set. */
+struct test_mask {
+  char host[64];              /**< Host mask text. */
+  struct irc_in_addr addr;    /**< Address for IP masks. */
+  unsigned char bits;         /**< Bits for IP masks. */
+  unsigned char is_ip;        /**< Non-zero for IP masks. */
+  unsigned char no_host;      /**< Non-zero if the mask has no host part. */
+  unsigned char enabled;      /**< Whether the check callback accepts it. */
+  unsigned char indexed;      /**< Whether it is currently in the index. */
+  unsigned long order;        /**< Order it was indexed with. */
+};
+
+/** One client to look up. */
+struct test_client {
+  char host[2][64];           /**< Host names. */
+  const char *hosts[2];       /**< Pointers to host names. */
+  unsigned int nhosts;        /**< Number of host names. */
+  struct irc_in_addr addr;    /**< IP address. */
+};
+
+static struct test_mask masks[NUM_MASKS];
+
+/** Decide whether a mask matches a client, ignoring the index. */
+static int
+mask_matches(const struct test_mask *tm, const struct test_client *tc)
+{
+  if (!tm->enabled)
+    return 0;
+  if (tm->is_ip)
+    return ipmask_check(&tc->addr, &tm->addr, tm->bits);
+  if (tm->no_host)
+    return 1;
+  return !match(tm->host, tc->host[0])
+    || (tc->nhosts > 1 && !match(tm->host, tc->host[1]));
+}
+
+/** MaskIndexCheck callback for the test masks. */
+static int
+check_mask(void *data, void *ctx)
+{
+  return mask_matches(data, ctx);
+}
+
+/** Find the expected answer by scanning every mask. */
+static struct test_mask *
+linear_find(const struct test_client *tc)
+{
+  struct test_mask *best = NULL;
+  unsigned int ii;
+
+  for (ii = 0; ii < NUM_MASKS; ii++)
+    if (masks[ii].indexed && mask_matches(&masks[ii], tc)
+        && (!best || masks[ii].order > best->order))
+      best = &masks[ii];
+  return best;
+}
+
+/** Generate a host name (or host mask) from a few small numbers. */
+static void
+make_host(char *buf, size_t len, int kind)
+{
+  static const char *tld[] = { "net", "org", "example.com", "Example.COM" };
+  int host = rand() % 16, dom = rand() % 16, top = rand() % 4;
+
+  switch (kind) {
+  case 0: /* exact */
+    snprintf(buf, len, "h%d.d%d.%s", host, dom, tld[top]);
+    break;
+  case 1: /* suffix */
+    if (rand() % 40)
+      snprintf(buf, len, "*.d%d.%s", dom, tld[top]);
+    else
+      snprintf(buf, len, "*.%s", tld[top]);
+    break;
+  default: /* wild */
+    snprintf(buf, len, "h%d*.d%d.*", host, dom);
+    break;
+  }
+}
+
+/** Generate an address in a deliberately small address space. */
+static void
+make_addr(struct irc_in_addr *addr)
+{
+  char text[64];
+
+  if (rand() % 2)
+    snprintf(text, sizeof(text), "10.%d.%d.%d", rand() % 8, rand() % 8,
+             rand() % 8);
+  else
+    snprintf(text, sizeof(text), "2001:db8:%x::%x", rand() % 8, rand() % 8);
+  ircd_aton(addr, text);
+}
+
+/** Generate a random mask. */
+static void
+make_mask(struct test_mask *tm)
+{
+  int kind = rand() % 5;
+
+  memset(tm, 0, sizeof(*tm));
+  tm->enabled = (rand() % 8) != 0;
+  if (kind == 4) {
+    static const unsigned char v4bits[] = { 112, 120, 124, 126, 128 };
+    static const unsigned char v6bits[] = { 48, 64, 112, 124, 128 };
+    tm->is_ip = 1;
+    make_addr(&tm->addr);
+    if (irc_in_addr_is_ipv4(&tm->addr))
+      tm->bits = v4bits[rand() % 5];
+    else
+      tm->bits = v6bits[rand() % 5];
+  } else if (kind == 3 && !(rand() % 40))
+    tm->no_host = 1;
+  else
+    make_host(tm->host, sizeof(tm->host), kind);
+}
+
+/** Add a mask to the index. */
+static void
+index_mask(struct MaskIndex *mi, struct test_mask *tm, unsigned long order)
+{
+  tm->order = order;
+  tm->indexed = 1;
+  mask_index_add(mi, tm->no_host ? NULL : tm->host,
+                 tm->is_ip ? &tm->addr : NULL, tm->bits, tm, order);
+}
+
+/** Compare indexed and linear lookups for many clients. */
+static void
+compare(struct MaskIndex *mi, const char *phase)
+{
+  struct test_client tc;
+  struct test_mask *expect, *got;
+  unsigned int ii, hits = 0;
+
+  for (ii = 0; ii < NUM_CLIENTS; ii++) {
+    make_host(tc.host[0], sizeof(tc.host[0]), 0);
+    make_host(tc.host[1], sizeof(tc.host[1]), 0);
+    tc.hosts[0] = tc.host[0];
+    tc.hosts[1] = tc.host[1];
+    tc.nhosts = 1 + rand() % 2;
+    make_addr(&tc.addr);
+    expect = linear_find(&tc);
+    if (tc.nhosts == 1)
+      got = mask_index_find(mi, tc.host[0], &tc.addr, check_mask, &tc);
+    else
+      got = mask_index_find_hosts(mi, tc.hosts, tc.nhosts, &tc.addr,
+                                  check_mask, &tc);
+    if (got != expect) {
+      fprintf(stderr, "%s: client %s [%s]: expected %s, got %s\n", phase,
+              tc.host[0], ircd_ntoa(&tc.addr),
+              expect ? (expect->is_ip ? ircd_ntoa(&expect->addr) : expect->host) : "(none)",
+              got ? (got->is_ip ? ircd_ntoa(&got->addr) : got->host) : "(none)");
+      assert(got == expect);
+    }
+    hits += (got != NULL);
+  }
+  printf("Passed: %s (%u/%u clients matched)\n", phase, hits, NUM_CLIENTS);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct MaskIndex mi;
+  unsigned int ii, kinds;
+
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  memset(&mi, 0, sizeof(mi));
+
+  /* Orders are handed out out of sequence to exercise sorted insertion. */
+  for (ii = 0; ii < NUM_MASKS; ii++) {
+    make_mask(&masks[ii]);
+    index_mask(&mi, &masks[ii], (ii * 7919) % NUM_MASKS + 1);
+  }
+  for (ii = kinds = 0; ii < MASK_KIND_COUNT; ii++)
+    kinds += (mi.mi_count[ii] > 0);
+  assert(kinds == MASK_KIND_COUNT);
+  compare(&mi, "insert");
+
+  /* Remove every other mask and check again. */
+  for (ii = 0; ii < NUM_MASKS; ii += 2) {
+    mask_index_del(&mi, masks[ii].no_host ? NULL : masks[ii].host,
+                   masks[ii].is_ip ? &masks[ii].addr : NULL, masks[ii].bits,
+                   &masks[ii]);
+    masks[ii].indexed = 0;
+  }
+  compare(&mi, "delete");
+
+  /* Removing everything else should leave an empty trie. */
+  for (ii = 1; ii < NUM_MASKS; ii += 2) {
+    mask_index_del(&mi, masks[ii].no_host ? NULL : masks[ii].host,
+                   masks[ii].is_ip ? &masks[ii].addr : NULL, masks[ii].bits,
+                   &masks[ii]);
+    masks[ii].indexed = 0;
+  }
+  assert(mi.mi_nodes == 0);
+  assert(mi.mi_exact.mt_count == 0 && mi.mi_suffix.mt_count == 0);
+  compare(&mi, "empty");
+
+  /* Refill and clear. */
+  for (ii = 0; ii < NUM_MASKS; ii++)
+    index_mask(&mi, &masks[ii], ii + 1);
+  compare(&mi, "refill");
+  mask_index_clear(&mi);
+  assert(mi.mi_root == NULL && mi.mi_wild == NULL);
+
+  return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * packet_bench.c - measure line splitting speed on server burst traffic
+ *
+ * Usage: packet_bench [capture-file] [passes]
+ *
+ * The capture file should hold raw bytes as received from a server
+ * link (for example, the server side of a netburst captured with
+ * tcpdump and extracted with tcpflow).  Without one, a synthetic P10
+ * burst is generated.  Each pass splits the whole input into lines
+ * the way server_dopacket() does, once with a byte-at-a-time IsEol()
+ * loop and once with ircd_find_eol(), and the throughput of each is
+ * reported.
+ */
+#include "ircd_chattr.h"
+#include "ircd_defs.h"
+#include "ircd_string.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/** Totals gathered while splitting lines, to compare methods. */
+struct split_result {
+  unsigned long lines;     /**< Number of non-empty lines. */
+  unsigned long checksum;  /**< Sum of line lengths times line number. */
+};
+
+/** Split \a buf into lines one byte at a time, like the old
+ * server_dopacket().
+ */
+static void split_scalar(const char *buf, size_t len, struct split_result *res)
+{
+  char line[BUFSIZE];
+  char *endp = line;
+  const char *src = buf;
+
+  while (len-- > 0) {
+    *endp = *src++;
+    if (IsEol(*endp)) {
+      if (endp == line)
+        continue;
+      *endp = '\0';
+      res->checksum += (endp - line) * ++res->lines;
+      endp = line;
+    } else if (endp < line + BUFSIZE - 1)
+      ++endp;
+  }
+}
+
+/** Split \a buf into lines with ircd_find_eol(), like the current
+ * server_dopacket().
+ */
+static void split_simd(const char *buf, size_t len, struct split_result *res)
+{
+  char line[BUFSIZE];
+  char *endp = line;
+  const char *src = buf, *end = buf + len, *eol;
+  size_t count;
+
+  while (src < end) {
+    eol = ircd_find_eol(src, end);
+    count = eol - src;
+    if (count > (size_t)(line + BUFSIZE - 1 - endp))
+      count = line + BUFSIZE - 1 - endp;
+    memcpy(endp, src, count);
+    endp += count;
+    if (eol == end)
+      break;
+    src = eol + 1;
+    if (endp == line)
+      continue;
+    *endp = '\0';
+    res->checksum += (endp - line) * ++res->lines;
+    endp = line;
+  }
+}
+
+/** Build a synthetic P10 netburst of about \a size bytes. */
+static char *make_burst(size_t size, size_t *len)
+{
+  char *buf = malloc(size + 1024);
+  size_t pos = 0;
+  unsigned int ii = 0;
+
+  while (pos < size) {
+    if (ii % 8 == 7)
+      pos += sprintf(buf + pos, "AB B #channel%u %u +nt AB%c%cA:o,AB%c%cB\r\n",
+                     ii / 64, 1000000000 + ii, 'A' + ii % 26,
+                     'A' + (ii / 26) % 26, 'A' + ii % 26,
+                     'A' + (ii / 26) % 26);
+    else
+      pos += sprintf(buf + pos, "AB N nick%u 1 %u user%u host%u.example.net "
+                     "+i B]AAAB AB%c%c%c :Some Real Name %u\r\n", ii, 1000000000 + ii,
+                     ii, ii, 'A' + ii % 26, 'A' + (ii / 26) % 26,
+                     'A' + (ii / 676) % 26, ii);
+    ii++;
+  }
+  *len = pos;
+  return buf;
+}
+
+/** Read a capture file into memory. */
+static char *read_file(const char *name, size_t *len)
+{
+  FILE *fp;
+  char *buf;
+  long size;
+
+  if (!(fp = fopen(name, "rb"))) {
+    perror(name);
+    exit(1);
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  buf = malloc(size + 1);
+  if (fread(buf, 1, size, fp) != (size_t)size) {
+    perror(name);
+    exit(1);
+  }
+  fclose(fp);
+  *len = size;
+  return buf;
+}
+
+/** Return the current time in seconds. */
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/** Run one splitter over the input and report its speed. */
+static void run(const char *name,
+                void (*split)(const char *, size_t, struct split_result *),
+                const char *buf, size_t len, int passes,
+                struct split_result *res)
+{
+  double start, elapsed;
+  int ii;
+
+  memset(res, 0, sizeof(*res));
+  start = now();
+  for (ii = 0; ii < passes; ii++)
+    split(buf, len, res);
+  elapsed = now() - start;
+  printf("%-8s %8.1f MB/s  (%lu lines)\n", name,
+         len * (double)passes / elapsed / (1024 * 1024), res->lines);
+}
+
+int main(int argc, char *argv[])
+{
+  struct split_result scalar, simd;
+  char *buf;
+  size_t len;
+  int passes;
+
+  if (argc > 1 && strcmp(argv[1], "-"))
+    buf = read_file(argv[1], &len);
+  else
+    buf = make_burst(64 * 1024 * 1024, &len);
+  passes = argc > 2 ? atoi(argv[2]) : 5;
+
+  printf("input: %lu bytes, %d passes\n", (unsigned long)len, passes);
+  run("scalar", split_scalar, buf, len, passes, &scalar);
+  run("find_eol", split_simd, buf, len, passes, &simd);
+
+  if (scalar.lines != simd.lines || scalar.checksum != simd.checksum) {
+    printf("MISMATCH: scalar %lu/%lu, find_eol %lu/%lu\n", scalar.lines,
+           scalar.checksum, simd.lines, simd.checksum);
+    return 1;
+  }
+  free(buf);
+  return 0;
+}
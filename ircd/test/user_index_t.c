@@ -0,0 +1,139 @@
+/*
+ * user_index_t.c - test cases for the user prefix indexes
+ */
+
+#include "ircd_log.h"
+#include "ircd_string.h"
+#include "res.h"
+#include "user_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_KEYS    2000
+#define NUM_SEARCHES 500
+
+/** One key in the test set. */
+struct test_key {
+  unsigned char key[16];      /**< Key bytes. */
+  unsigned int len;           /**< Length of key. */
+  unsigned int flags;         /**< Flags it was indexed with. */
+  struct UserIndexNode *node; /**< Node, or NULL if not indexed. */
+  unsigned int seen;          /**< Number of times a search returned it. */
+};
+
+static struct test_key keys[NUM_KEYS];
+
+/** Check whether a key starts with the first \a bits bits of \a prefix. */
+static int
+has_prefix(const struct test_key *tk, const unsigned char *prefix,
+           unsigned int bits)
+{
+  unsigned int ii;
+
+  if (tk->len * 8 < bits)
+    return 0;
+  for (ii = 0; ii < bits; ii++)
+    if ((tk->key[ii / 8] ^ prefix[ii / 8]) & (0x80 >> (ii % 8)))
+      return 0;
+  return 1;
+}
+
+/** Generate a key from a deliberately small alphabet. */
+static void
+make_key(struct test_key *tk)
+{
+  unsigned int ii;
+
+  tk->len = 1 + rand() % 16;
+  for (ii = 0; ii < tk->len; ii++)
+    tk->key[ii] = (rand() % 4) << 6 | (rand() % 2);
+  tk->flags = 1 + rand() % 3;
+}
+
+/** Search for one prefix, optionally removing keys as they are found,
+ * and compare the result with a linear scan. */
+static void
+search(struct UserIndex *ui, const unsigned char *prefix, unsigned int bits,
+       unsigned int flags, int churn)
+{
+  struct UserIndexCursor uc;
+  struct test_key *tk;
+  unsigned int ii, expect, got;
+
+  for (ii = 0; ii < NUM_KEYS; ii++)
+    keys[ii].seen = 0;
+  for (ii = expect = 0; ii < NUM_KEYS; ii++)
+    if (keys[ii].node && has_prefix(&keys[ii], prefix, bits)
+        && (!flags || (keys[ii].flags & flags)))
+      expect++;
+
+  user_index_seek(ui, &uc, prefix, bits, flags);
+  for (got = 0; (tk = user_index_next(&uc)); got++) {
+    assert(tk->node != NULL);
+    assert(has_prefix(tk, prefix, bits));
+    assert(!flags || (tk->flags & flags));
+    assert(tk->seen++ == 0);
+    if (churn && rand() % 2) {
+      /* Remove this key and re-add another to move nodes around. */
+      user_index_remove(ui, tk->node);
+      tk->node = NULL;
+      tk = &keys[rand() % NUM_KEYS];
+      if (!tk->node && !has_prefix(tk, prefix, bits))
+        tk->node = user_index_insert(ui, tk->key, tk->len, tk->flags, tk);
+    }
+  }
+  if (got != expect) {
+    fprintf(stderr, "prefix of %u bits, flags %u: expected %u, got %u\n",
+            bits, flags, expect, got);
+    assert(got == expect);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct UserIndex ui;
+  unsigned char prefix[16];
+  unsigned int ii, jj, bits;
+
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  memset(&ui, 0, sizeof(ui));
+
+  for (ii = 0; ii < NUM_KEYS; ii++) {
+    make_key(&keys[ii]);
+    keys[ii].node = user_index_insert(&ui, keys[ii].key, keys[ii].len,
+                                      keys[ii].flags, &keys[ii]);
+  }
+  assert(ui.ui_count == NUM_KEYS);
+
+  for (ii = 0; ii < NUM_SEARCHES; ii++) {
+    jj = rand() % NUM_KEYS;
+    bits = rand() % (keys[jj].len * 8 + 1);
+    memcpy(prefix, keys[jj].key, sizeof(prefix));
+    search(&ui, prefix, bits, rand() % 2 ? 0 : 1 + rand() % 3, 0);
+  }
+  printf("Passed: search\n");
+
+  for (ii = 0; ii < NUM_SEARCHES; ii++) {
+    jj = rand() % NUM_KEYS;
+    bits = rand() % (keys[jj].len * 8 + 1);
+    memcpy(prefix, keys[jj].key, sizeof(prefix));
+    search(&ui, prefix, bits, 0, 1);
+  }
+  printf("Passed: search while changing\n");
+
+  for (ii = 0; ii < NUM_KEYS; ii++)
+    if (keys[ii].node) {
+      user_index_remove(&ui, keys[ii].node);
+      keys[ii].node = NULL;
+    }
+  assert(ui.ui_count == 0 && ui.ui_memory == 0);
+  for (ii = 0; ii < USER_INDEX_LEVELS; ii++)
+    assert(ui.ui_head[ii] == NULL);
+  search(&ui, prefix, 0, 0, 0);
+  printf("Passed: empty\n");
+
+  return 0;
+}
@@ -138,8 +138,8 @@ int uping_init(void)
   fd = os_socket(&from, SOCK_DGRAM, "IPv4 uping listener", AF_INET);
   if (fd < 0)
     return -1;
-  if (!socket_add(&upingSock_v4, uping_echo_callback, 0, SS_DATAGRAM,
-                  SOCK_EVENT_READABLE, fd)) {
+  if (!socket_add_named(&upingSock_v4, uping_echo_callback, 0, SS_DATAGRAM,
+                        SOCK_EVENT_READABLE, fd)) {
     Debug((DEBUG_ERROR, "UPING: Unable to queue fd to event system"));
     close(fd);
     return -1;
@@ -152,8 +152,8 @@ int uping_init(void)
   fd = os_socket(&from, SOCK_DGRAM, "IPv6 uping listener", AF_INET6);
   if (fd < 0)
     return -1;
-  if (!socket_add(&upingSock_v6, uping_echo_callback, 0, SS_DATAGRAM,
-                  SOCK_EVENT_READABLE, fd)) {
+  if (!socket_add_named(&upingSock_v6, uping_echo_callback, 0, SS_DATAGRAM,
+                        SOCK_EVENT_READABLE, fd)) {
     Debug((DEBUG_ERROR, "UPING: Unable to queue fd to event system"));
     close(fd);
     return -1;
@@ -257,10 +257,10 @@ static void uping_start(struct UPing* pptr)
 {
   assert(0 != pptr);
 
-  timer_add(timer_init(&pptr->sender), uping_sender_callback, (void*) pptr,
-	    TT_PERIODIC, 1);
-  timer_add(timer_init(&pptr->killer), uping_killer_callback, (void*) pptr,
-	    TT_RELATIVE, UPINGTIMEOUT);
+  timer_add_named(timer_init(&pptr->sender), uping_sender_callback,
+		  (void*) pptr, TT_PERIODIC, 1);
+  timer_add_named(timer_init(&pptr->killer), uping_killer_callback,
+		  (void*) pptr, TT_RELATIVE, UPINGTIMEOUT);
   pptr->freeable |= UPING_PENDING_SENDER | UPING_PENDING_KILLER;
 
   sendcmdto_one(&me, CMD_NOTICE, pptr->client, "%C :Sending %d ping%s to %s",
@@ -400,8 +400,8 @@ int uping_server(struct Client* sptr, struct ConfItem* aconf, int port, int coun
   assert(0 != pptr);
   memset(pptr, 0, sizeof(struct UPing));
 
-  if (!socket_add(&pptr->socket, uping_read_callback, (void*) pptr,
-		  SS_DATAGRAM, SOCK_EVENT_READABLE, fd)) {
+  if (!socket_add_named(&pptr->socket, uping_read_callback, (void*) pptr,
+			SS_DATAGRAM, SOCK_EVENT_READABLE, fd)) {
     sendcmdto_one(&me, CMD_NOTICE, sptr, "%C :UPING: Can't queue fd for "
 		  "reading", sptr);
     close(fd);
@@ -0,0 +1,499 @@
+/*
+ * IRC - Internet Relay Chat, ircd/user_index.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+/** @file
+ * @brief Indexes of users by IP address, hostname and account.
+ * @version $Id$
+ *
+ * Each index is a skip list of binary keys, ordered by key and then
+ * by client pointer, so that every user is one node per key.  A
+ * search names a key prefix as a number of bits and visits every
+ * node that starts with it, which covers all three kinds of query:
+ * CIDR masks on the 16-byte addresses in the IP index, domain
+ * suffixes on the reversed hostnames in the host index, and name
+ * prefixes in the account index.  Hostnames and accounts are folded
+ * to lower case so that searches ignore case like match() does.
+ *
+ * Users are added by register_user() and removed by
+ * exit_one_client(); user_index_update() is called when the
+ * displayed host or account of a registered user changes.
+ */
+#include "config.h"
+
+#include "user_index.h"
+#include "client.h"
+#include "ircd_alloc.h"
+#include "ircd_chattr.h"
+#include "ircd_log.h"
+#include "ircd_string.h"
+#include "res.h"
+#include "struct.h"
+
+/* #include <assert.h> -- Now using assert in ircd_log.h */
+#include <string.h>
+
+/** One key in a UserIndex. */
+struct UserIndexNode {
+  void *un_data;                /**< Owner's pointer. */
+  unsigned short un_len;        /**< Length of key. */
+  unsigned char un_flags;       /**< USER_INDEX_* flags for the key. */
+  unsigned char un_level;       /**< Number of entries in un_next. */
+  struct UserIndexNode *un_next[1]; /**< Next node at each level (allocated larger). */
+};
+
+/** Get the key of a node; it is stored after the last next pointer. */
+#define node_key(node) \
+  ((unsigned char *)&(node)->un_next[(node)->un_level])
+
+/** Number of bytes to allocate for a node. */
+#define node_size(level, len) (sizeof(struct UserIndexNode) \
+  + ((level) - 1) * sizeof(struct UserIndexNode *) + (len))
+
+/** Users by IP address. */
+static struct UserIndex IPIndex;
+/** Users by reversed real and displayed hostname. */
+static struct UserIndex HostIndex;
+/** Users by account name. */
+static struct UserIndex AccountIndex;
+
+/** Pick the number of levels for a new node.
+ * Each level holds about a quarter of the nodes of the one below.
+ * @return Number of levels, from 1 to #USER_INDEX_LEVELS.
+ */
+static unsigned int
+random_level(void)
+{
+  static unsigned int seed = 0x2545f491;
+  unsigned int level = 1;
+  unsigned int bits;
+
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  for (bits = seed; level < USER_INDEX_LEVELS && !(bits & 3); bits >>= 2)
+    level++;
+  return level;
+}
+
+/** Compare a node against a key.
+ * @param[in] node Node to compare.
+ * @param[in] key Key to compare against.
+ * @param[in] len Length of \a key.
+ * @param[in] data Owner's pointer, to order nodes with equal keys.
+ * @return Less than, equal to or greater than zero as \a node sorts
+ * before, with or after the key.
+ */
+static int
+node_cmp(const struct UserIndexNode *node, const unsigned char *key,
+         unsigned int len, const void *data)
+{
+  unsigned int min = node->un_len < len ? node->un_len : len;
+  int res;
+
+  if ((res = memcmp(node_key(node), key, min)))
+    return res;
+  if (node->un_len != len)
+    return node->un_len < len ? -1 : 1;
+  if (node->un_data != data)
+    return (unsigned long)node->un_data < (unsigned long)data ? -1 : 1;
+  return 0;
+}
+
+/** Find the first node after a key.
+ * @param[in] ui Index to search.
+ * @param[in] key Key to search for.
+ * @param[in] len Length of \a key.
+ * @param[in] data Owner's pointer for the key.
+ * @param[in] after If non-zero, skip a node equal to the key.
+ * @param[out] path If not NULL, receives the link at each level that
+ * points to the node found.
+ * @return First node that sorts after (or with) the key, or NULL.
+ */
+static struct UserIndexNode *
+find_node(const struct UserIndex *ui, const unsigned char *key,
+          unsigned int len, const void *data, int after,
+          struct UserIndexNode ***path)
+{
+  struct UserIndexNode **next = (struct UserIndexNode **)ui->ui_head;
+  int level;
+
+  for (level = USER_INDEX_LEVELS - 1; level >= 0; level--) {
+    while (next[level] && node_cmp(next[level], key, len, data) < after)
+      next = next[level]->un_next;
+    if (path)
+      path[level] = &next[level];
+  }
+  return next[0];
+}
+
+/** Check whether a node's key starts with a prefix.
+ * @param[in] node Node to check.
+ * @param[in] prefix Key prefix.
+ * @param[in] bits Number of bits of \a prefix to compare.
+ * @return Non-zero if the first \a bits bits of the key match.
+ */
+static int
+node_has_prefix(const struct UserIndexNode *node, const unsigned char *prefix,
+                unsigned int bits)
+{
+  const unsigned char *key = node_key(node);
+  unsigned int bytes = bits / 8;
+
+  if (node->un_len * 8 < bits || memcmp(key, prefix, bytes))
+    return 0;
+  return !(bits % 8)
+    || !((key[bytes] ^ prefix[bytes]) & (0xff00 >> (bits % 8)) & 0xff);
+}
+
+/** Add a key to an index.
+ * @param[in,out] ui Index to add to.
+ * @param[in] key Key bytes.
+ * @param[in] len Length of \a key (at most #USER_INDEX_KEYLEN).
+ * @param[in] flags USER_INDEX_* flags to keep with the key.
+ * @param[in] data Owner's pointer to return from user_index_next().
+ * @return New node, to pass to user_index_remove().
+ */
+struct UserIndexNode *
+user_index_insert(struct UserIndex *ui, const void *key, unsigned int len,
+                  unsigned int flags, void *data)
+{
+  struct UserIndexNode **path[USER_INDEX_LEVELS];
+  struct UserIndexNode *node;
+  unsigned int level;
+  unsigned int ii;
+
+  assert(0 != ui);
+  assert(len <= USER_INDEX_KEYLEN);
+
+  level = random_level();
+  node = (struct UserIndexNode *)MyMalloc(node_size(level, len));
+  node->un_data = data;
+  node->un_len = len;
+  node->un_flags = flags;
+  node->un_level = level;
+  memcpy(node_key(node), key, len);
+
+  find_node(ui, key, len, data, 0, path);
+  for (ii = 0; ii < level; ii++) {
+    node->un_next[ii] = *path[ii];
+    *path[ii] = node;
+  }
+  ui->ui_count++;
+  ui->ui_gen++;
+  ui->ui_memory += node_size(level, len);
+  return node;
+}
+
+/** Remove a key from an index.
+ * @param[in,out] ui Index to remove from.
+ * @param[in] node Node returned by user_index_insert().
+ */
+void
+user_index_remove(struct UserIndex *ui, struct UserIndexNode *node)
+{
+  struct UserIndexNode **path[USER_INDEX_LEVELS];
+  unsigned int ii;
+
+  assert(0 != ui);
+  assert(0 != node);
+
+  if (find_node(ui, node_key(node), node->un_len, node->un_data, 0, path)
+      != node) {
+    assert(0 && "node not in index");
+    return;
+  }
+  for (ii = 0; ii < node->un_level; ii++)
+    *path[ii] = node->un_next[ii];
+  ui->ui_count--;
+  ui->ui_gen++;
+  ui->ui_memory -= node_size(node->un_level, node->un_len);
+  MyFree(node);
+}
+
+/** Start a search of an index for keys with a prefix.
+ * @param[in] ui Index to search.
+ * @param[out] uc Cursor to initialize.
+ * @param[in] prefix Key prefix.
+ * @param[in] bits Number of bits of \a prefix that must match.
+ * @param[in] flags If non-zero, only visit nodes with one of these flags.
+ */
+void
+user_index_seek(const struct UserIndex *ui, struct UserIndexCursor *uc,
+                const void *prefix, unsigned int bits, unsigned int flags)
+{
+  unsigned int len = (bits + 7) / 8;
+
+  assert(0 != ui);
+  assert(0 != uc);
+  assert(len <= USER_INDEX_KEYLEN);
+
+  memcpy(uc->uc_prefix, prefix, len);
+  if (bits % 8)
+    uc->uc_prefix[len - 1] &= 0xff00 >> (bits % 8);
+  uc->uc_index = ui;
+  uc->uc_bits = bits;
+  uc->uc_flags = flags;
+  uc->uc_last = NULL;
+  uc->uc_lastlen = 0;
+  uc->uc_node = find_node(ui, uc->uc_prefix, len, NULL, 0, NULL);
+  uc->uc_gen = ui->ui_gen;
+}
+
+/** Get the next match of a search.
+ * @param[in,out] uc Cursor from user_index_seek().
+ * @return Owner's pointer for the next matching key, or NULL when
+ * there are no more.
+ */
+void *
+user_index_next(struct UserIndexCursor *uc)
+{
+  struct UserIndexNode *node;
+
+  assert(0 != uc);
+
+  if (uc->uc_gen != uc->uc_index->ui_gen) {
+    /* The index changed, so uc_node may be gone; look it up again. */
+    if (uc->uc_last)
+      uc->uc_node = find_node(uc->uc_index, uc->uc_lastkey, uc->uc_lastlen,
+                              uc->uc_last, 1, NULL);
+    else
+      uc->uc_node = find_node(uc->uc_index, uc->uc_prefix,
+                              (uc->uc_bits + 7) / 8, NULL, 0, NULL);
+    uc->uc_gen = uc->uc_index->ui_gen;
+  }
+
+  while ((node = uc->uc_node)) {
+    if (!node_has_prefix(node, uc->uc_prefix, uc->uc_bits)) {
+      uc->uc_node = NULL;
+      break;
+    }
+    uc->uc_node = node->un_next[0];
+    if (uc->uc_flags && !(node->un_flags & uc->uc_flags))
+      continue;
+    memcpy(uc->uc_lastkey, node_key(node), node->un_len);
+    uc->uc_lastlen = node->un_len;
+    uc->uc_last = node->un_data;
+    return node->un_data;
+  }
+  return NULL;
+}
+
+/** Make the host index key for a hostname.
+ * @param[out] key Receives the hostname reversed and in lower case.
+ * @param[in] host Hostname (or the end of one).
+ * @return Length of \a key.
+ */
+static unsigned int
+host_key(unsigned char *key, const char *host)
+{
+  unsigned int len = strlen(host);
+  unsigned int ii;
+
+  if (len > USER_INDEX_KEYLEN)
+    len = USER_INDEX_KEYLEN;
+  for (ii = 0; ii < len; ii++)
+    key[ii] = ToLower(host[len - 1 - ii]);
+  return len;
+}
+
+/** Make the account index key for an account name.
+ * @param[out] key Receives the name in lower case.
+ * @param[in] account Account name (or the start of one).
+ * @param[in] len Number of characters of \a account to use.
+ * @return Length of \a key.
+ */
+static unsigned int
+account_key(unsigned char *key, const char *account, unsigned int len)
+{
+  unsigned int ii;
+
+  if (len > USER_INDEX_KEYLEN)
+    len = USER_INDEX_KEYLEN;
+  for (ii = 0; ii < len; ii++)
+    key[ii] = ToLower(account[ii]);
+  return len;
+}
+
+/** Index a user's hostnames and account.
+ * @param[in] cptr User to index.
+ */
+static void
+add_names(struct Client *cptr)
+{
+  struct User *user = cli_user(cptr);
+  unsigned char key[USER_INDEX_KEYLEN];
+  unsigned int len;
+
+  len = host_key(key, user->realhost);
+  if (0 == ircd_strcmp(user->host, user->realhost))
+    user->hostnode[0] = user_index_insert(&HostIndex, key, len,
+                                          USER_INDEX_REALHOST
+                                          | USER_INDEX_SHOWNHOST, cptr);
+  else {
+    user->hostnode[0] = user_index_insert(&HostIndex, key, len,
+                                          USER_INDEX_REALHOST, cptr);
+    len = host_key(key, user->host);
+    user->hostnode[1] = user_index_insert(&HostIndex, key, len,
+                                          USER_INDEX_SHOWNHOST, cptr);
+  }
+
+  if (user->account[0]) {
+    len = account_key(key, user->account, strlen(user->account));
+    user->accountnode = user_index_insert(&AccountIndex, key, len, 0, cptr);
+  }
+}
+
+/** Remove a user's hostnames and account from the indexes.
+ * @param[in] cptr User to remove.
+ */
+static void
+del_names(struct Client *cptr)
+{
+  struct User *user = cli_user(cptr);
+  unsigned int ii;
+
+  for (ii = 0; ii < 2; ii++)
+    if (user->hostnode[ii]) {
+      user_index_remove(&HostIndex, user->hostnode[ii]);
+      user->hostnode[ii] = NULL;
+    }
+  if (user->accountnode) {
+    user_index_remove(&AccountIndex, user->accountnode);
+    user->accountnode = NULL;
+  }
+}
+
+/** Add a newly registered user to the indexes.
+ * @param[in] cptr User to add.
+ */
+void
+user_index_add(struct Client *cptr)
+{
+  struct User *user = cli_user(cptr);
+
+  assert(0 != user);
+
+  if (user->ipnode)
+    return;
+  user->ipnode = user_index_insert(&IPIndex, &cli_ip(cptr),
+                                   sizeof(cli_ip(cptr)), 0, cptr);
+  add_names(cptr);
+}
+
+/** Remove an exiting user from the indexes.
+ * @param[in] cptr User to remove.
+ */
+void
+user_index_del(struct Client *cptr)
+{
+  struct User *user = cli_user(cptr);
+
+  assert(0 != user);
+
+  if (!user->ipnode)
+    return;
+  del_names(cptr);
+  user_index_remove(&IPIndex, user->ipnode);
+  user->ipnode = NULL;
+}
+
+/** Re-index a user whose displayed host or account changed.
+ * Does nothing for a user that has not been added yet.
+ * @param[in] cptr User to update.
+ */
+void
+user_index_update(struct Client *cptr)
+{
+  assert(0 != cli_user(cptr));
+
+  if (!cli_user(cptr)->ipnode)
+    return;
+  del_names(cptr);
+  add_names(cptr);
+}
+
+/** Start a search for users in a CIDR block.
+ * @param[out] uc Cursor to initialize.
+ * @param[in] addr Base address, as from ipmask_parse().
+ * @param[in] bits Number of bits in the mask.
+ */
+void
+user_index_ip_seek(struct UserIndexCursor *uc, const struct irc_in_addr *addr,
+                   unsigned char bits)
+{
+  user_index_seek(&IPIndex, uc, addr, bits, 0);
+}
+
+/** Start a search for users whose hostname could match a mask.
+ * Every hostname that matches \a mask ends with the text after its
+ * last wildcard, so the search visits the users whose hostname ends
+ * that way; callers must still match each one against \a mask.
+ * @param[out] uc Cursor to initialize.
+ * @param[in] mask Hostname mask.
+ * @param[in] flags USER_INDEX_REALHOST and/or USER_INDEX_SHOWNHOST.
+ * @return The literal end of \a mask that the search uses, or NULL
+ * if \a mask ends in a wildcard (or has escapes) and cannot be
+ * searched for.
+ */
+const char *
+user_index_host_seek(struct UserIndexCursor *uc, const char *mask,
+                     unsigned int flags)
+{
+  unsigned char key[USER_INDEX_KEYLEN];
+  const char *tail;
+
+  if (strchr(mask, '\\'))
+    return NULL;
+  for (tail = mask + strlen(mask); tail > mask; tail--)
+    if (tail[-1] == '*' || tail[-1] == '?')
+      break;
+  if (!*tail)
+    return NULL;
+  user_index_seek(&HostIndex, uc, key, host_key(key, tail) * 8, flags);
+  return tail;
+}
+
+/** Start a search for users whose account could match a mask.
+ * The search visits accounts that start with the text before the
+ * first wildcard of \a mask; callers must still match each one.
+ * @param[out] uc Cursor to initialize.
+ * @param[in] mask Account name mask.
+ * @return Non-zero if the search was started, or zero if \a mask
+ * starts with a wildcard.
+ */
+int
+user_index_account_seek(struct UserIndexCursor *uc, const char *mask)
+{
+  unsigned char key[USER_INDEX_KEYLEN];
+  unsigned int len;
+
+  if (!(len = strcspn(mask, "*?\\")))
+    return 0;
+  user_index_seek(&AccountIndex, uc, key, account_key(key, mask, len) * 8, 0);
+  return 1;
+}
+
+/** Count memory used by the user indexes.
+ * @param[out] count Receives the number of keys indexed.
+ * @return Number of bytes allocated for the indexes.
+ */
+size_t
+user_index_memory(unsigned int *count)
+{
+  *count = IPIndex.ui_count + HostIndex.ui_count + AccountIndex.ui_count;
+  return IPIndex.ui_memory + HostIndex.ui_memory + AccountIndex.ui_memory;
+}
@@ -31,13 +31,16 @@
 #include "client.h"
 #include "hash.h"
 #include "ircd.h"
+#include "ircd_alloc.h"
 #include "ircd_chattr.h"
 #include "ircd_features.h"
+#include "ircd_log.h"
 #include "ircd_reply.h"
 #include "ircd_snprintf.h"
 #include "ircd_string.h"
 #include "list.h"
 #include "match.h"
+#include "msgq.h"
 #include "numeric.h"
 #include "numnicks.h"
 #include "querycmds.h"
@@ -49,6 +52,7 @@
 #include "send.h"
 #include "struct.h"
 #include "sys.h"
+#include "user_index.h"
 #include "userload.h"
 #include "version.h"
 #include "whowas.h"
@@ -276,3 +280,394 @@ void do_who(struct Client* sptr, struct Client* acptr, struct Channel* repchan,
   p1 = buf1;
   send_reply(sptr, fields ? RPL_WHOSPCRPL : RPL_WHOREPLY, ++p1);
 }
+
+/** State of a /WHO whose search of all users is in progress. */
+struct WhoListing {
+  struct WhoListing*  next;      /**< Next WHO in progress. */
+  struct WhoListing** prev_p;    /**< What points to this WHO. */
+  struct Client*      acptr;     /**< Next client to look at. */
+  struct Client**     found;     /**< Users found in the user indexes, or NULL. */
+  unsigned int        nfound;    /**< Number of entries in found. */
+  unsigned int        pos;       /**< Next entry of found to look at. */
+  struct WhoMatch     match;     /**< Compiled mask. */
+  int                 bitsel;    /**< WHOSELECT_* values. */
+  int                 fields;    /**< WHO_FIELD_* values to show. */
+  int                 counter;   /**< Number of replies still allowed. */
+  int                 marker;    /**< Marker of clients already shown. */
+  char                qrt[4];    /**< Query type. */
+  char                mask[BUFSIZE]; /**< Mask for RPL_ENDOFWHO. */
+};
+
+/** WHOs in progress, so that exiting clients can be skipped. */
+static struct WhoListing *who_listings;
+
+/** Look for a literal string in another string, ignoring case.
+ * @param[in] str String to search.
+ * @param[in] lit Lower case text to look for.
+ * @param[in] litlen Length of \a lit (non-zero).
+ * @return Non-zero if \a str contains \a lit.
+ */
+static int who_has_literal(const char* str, const char* lit, int litlen)
+{
+  int i;
+
+  for (; *str; str++) {
+    for (i = 0; i < litlen && ToLower(str[i]) == lit[i]; i++)
+      ;
+    if (i == litlen)
+      return 1;
+  }
+  return 0;
+}
+
+/** Match one field of a user against a compiled /WHO mask.
+ * @param[in] wm Compiled mask.
+ * @param[in] str Field to check.
+ * @return Zero if \a str matches, non-zero otherwise (like matchexec()).
+ */
+static int who_match_field(const struct WhoMatch* wm, const char* str)
+{
+  if (wm->wm_litlen && !who_has_literal(str, wm->wm_literal, wm->wm_litlen))
+    return 1;
+  return matchexec(str, wm->wm_cmask, wm->wm_minlen);
+}
+
+/** Compile a /WHO mask.
+ * Fields that \a mask cannot match, judging by its length and the
+ * characters in it, are dropped from \a matchsel, and the longest
+ * run of literal characters is kept so most users can be rejected
+ * without running the full matcher.
+ * @param[out] wm Compiled mask.
+ * @param[in] mask Mask to compile, or NULL to match everyone.
+ * @param[in] matchsel WHO_FIELD_* values for the fields to match.
+ */
+void who_match_init(struct WhoMatch* wm, const char* mask, int matchsel)
+{
+  char run[WHO_LITERAL_LEN];
+  const char* m;
+  int len = 0;
+  int cset;
+  char ch;
+
+  memset(wm, 0, sizeof(*wm));
+  wm->wm_matchsel = matchsel;
+  if (!mask)
+    return;
+
+  matchcomp(wm->wm_cmask, &wm->wm_minlen, &cset, mask);
+  if (!ipmask_parse(mask, &wm->wm_imask, &wm->wm_ibits))
+    matchsel &= ~WHO_FIELD_NIP;
+  if ((wm->wm_minlen > NICKLEN) || !(cset & NTL_IRCNK))
+    matchsel &= ~WHO_FIELD_NIC;
+  if ((matchsel & WHO_FIELD_SER) &&
+      ((wm->wm_minlen > HOSTLEN) || (!(cset & NTL_IRCHN))
+      || (!markMatchexServer(wm->wm_cmask, wm->wm_minlen))))
+    matchsel &= ~WHO_FIELD_SER;
+  if ((wm->wm_minlen > USERLEN) || !(cset & NTL_IRCUI))
+    matchsel &= ~WHO_FIELD_UID;
+  if ((wm->wm_minlen > HOSTLEN) || !(cset & NTL_IRCHN))
+    matchsel &= ~WHO_FIELD_HOS;
+  if ((wm->wm_minlen > ACCOUNTLEN))
+    matchsel &= ~WHO_FIELD_ACC;
+  wm->wm_matchsel = matchsel;
+
+  /* Remember the longest run of characters outside of wildcards. */
+  for (m = mask; ; m++) {
+    ch = *m;
+    if (ch == '\\' && (m[1] == '?' || m[1] == '*'))
+      ch = *++m;
+    else if (!ch || ch == '*' || ch == '?') {
+      if (len > wm->wm_litlen) {
+        memcpy(wm->wm_literal, run, len);
+        wm->wm_literal[len] = '\0';
+        wm->wm_litlen = len;
+      }
+      len = 0;
+      if (!ch)
+        break;
+      continue;
+    }
+    if (len < WHO_LITERAL_LEN)
+      run[len++] = ToLower(ch);
+  }
+}
+
+/** Check whether a user matches a compiled /WHO mask.
+ * @param[in] wm Compiled mask.
+ * @param[in] sptr Client doing the /WHO.
+ * @param[in] acptr User to check.
+ * @return Non-zero if \a acptr matches.
+ */
+int who_match(const struct WhoMatch* wm, struct Client* sptr,
+              struct Client* acptr)
+{
+  int matchsel = wm->wm_matchsel;
+
+  if (!wm->wm_cmask[0]) /* no mask; everyone matches */
+    return 1;
+  if ((matchsel & WHO_FIELD_NIC)
+      && !who_match_field(wm, cli_name(acptr)))
+    return 1;
+  if ((matchsel & WHO_FIELD_UID)
+      && !who_match_field(wm, cli_user(acptr)->username))
+    return 1;
+  /* Server flags set by markMatchexServer() may be stale by now. */
+  if ((matchsel & WHO_FIELD_SER)
+      && !matchexec(cli_name(cli_user(acptr)->server), wm->wm_cmask,
+                    wm->wm_minlen))
+    return 1;
+  if ((matchsel & WHO_FIELD_HOS)
+      && !who_match_field(wm, cli_user(acptr)->host))
+    return 1;
+  if ((matchsel & WHO_FIELD_HOS) && HasHiddenHost(acptr) && IsAnOper(sptr)
+      && !who_match_field(wm, cli_user(acptr)->realhost))
+    return 1;
+  if ((matchsel & WHO_FIELD_REN)
+      && !who_match_field(wm, cli_info(acptr)))
+    return 1;
+  if ((matchsel & WHO_FIELD_NIP)
+      && !(HasHiddenHost(acptr) && !IsAnOper(sptr))
+      && ipmask_check(&cli_ip(acptr), &wm->wm_imask, wm->wm_ibits))
+    return 1;
+  if ((matchsel & WHO_FIELD_ACC)
+      && !who_match_field(wm, cli_user(acptr)->account))
+    return 1;
+  return 0;
+}
+
+/** Compare two client pointers for qsort() and bsearch().
+ * @param[in] a_ Pointer to first client pointer.
+ * @param[in] b_ Pointer to second client pointer.
+ * @return Less than, equal to or greater than zero.
+ */
+static int who_cmp_client(const void* a_, const void* b_)
+{
+  unsigned long a = (unsigned long) *(struct Client* const*)a_;
+  unsigned long b = (unsigned long) *(struct Client* const*)b_;
+
+  return (a > b) - (a < b);
+}
+
+/** Check whether two users share a channel.
+ * @param[in] sptr Client doing the /WHO.
+ * @param[in] acptr User to check.
+ * @return Non-zero if \a acptr is on a channel with \a sptr.
+ */
+static int who_common_channel(struct Client* sptr, struct Client* acptr)
+{
+  struct Membership* chan;
+
+  for (chan = cli_user(acptr)->channel; chan; chan = chan->next_channel)
+    if (find_member_link(chan->channel, sptr))
+      return 1;
+  return 0;
+}
+
+/** Find the users a /WHO could match from the user indexes.
+ * This works when the mask only applies to the hostname, IP address
+ * and account fields, and each of those can be searched for; the
+ * users found are checked against the mask and remembered, sorted,
+ * so that they can be sent as the sendQ drains.
+ * @param[in] sptr Client doing the /WHO.
+ * @param[in,out] wl WHO to find users for.
+ * @return Non-zero if the users were found, zero if every user has
+ * to be searched instead.
+ */
+static int who_collect(struct Client* sptr, struct WhoListing* wl)
+{
+  struct UserIndexCursor uc[3];
+  struct Client *acptr;
+  int matchsel = wl->match.wm_matchsel;
+  unsigned int limit;
+  unsigned int size;
+  int ncur = 0;
+  int ii;
+
+  if (!wl->match.wm_cmask[0]
+      || (matchsel & ~(WHO_FIELD_HOS | WHO_FIELD_NIP | WHO_FIELD_ACC)))
+    return 0;
+  if ((matchsel & WHO_FIELD_HOS)
+      && !user_index_host_seek(&uc[ncur++], wl->mask, IsAnOper(sptr)
+                               ? USER_INDEX_SHOWNHOST | USER_INDEX_REALHOST
+                               : USER_INDEX_SHOWNHOST))
+    return 0;
+  if ((matchsel & WHO_FIELD_ACC)
+      && !user_index_account_seek(&uc[ncur++], wl->mask))
+    return 0;
+  if (matchsel & WHO_FIELD_NIP)
+    user_index_ip_seek(&uc[ncur++], &wl->match.wm_imask, wl->match.wm_ibits);
+
+  /* One more than the replies allowed, to report ERR_QUERYTOOLONG */
+  limit = HasPriv(sptr, PRIV_UNLIMIT_QUERY) ? ~0U : wl->counter + 1;
+  size = 16;
+  wl->found = (struct Client**) MyMalloc(size * sizeof(*wl->found));
+  wl->nfound = 0;
+  for (ii = 0; ii < ncur && wl->nfound < limit; ii++)
+    while (wl->nfound < limit && (acptr = user_index_next(&uc[ii])))
+    {
+      /* Users shown from common channels, or already found, are marked */
+      if (!IsUser(acptr) || cli_marker(acptr) == wl->marker)
+        continue;
+      if ((wl->bitsel & WHOSELECT_OPER) && !SeeOper(sptr, acptr))
+        continue;
+      if (!(SEE_USER(sptr, acptr, wl->bitsel)))
+        continue;
+      if (!who_match(&wl->match, sptr, acptr))
+        continue;
+      cli_marker(acptr) = wl->marker;
+      if (wl->nfound == size) {
+        size *= 2;
+        wl->found = (struct Client**) MyRealloc(wl->found,
+                                                size * sizeof(*wl->found));
+      }
+      wl->found[wl->nfound++] = acptr;
+    }
+  qsort(wl->found, wl->nfound, sizeof(*wl->found), who_cmp_client);
+  return 1;
+}
+
+/** Get the next user for a /WHO to look at.
+ * @param[in,out] wl WHO in progress.
+ * @return Next user, or NULL if there are no more.
+ */
+static struct Client* who_advance(struct WhoListing* wl)
+{
+  struct Client *acptr;
+
+  if (wl->found)
+    return (wl->pos < wl->nfound) ? wl->found[wl->pos++] : 0;
+  while ((acptr = wl->acptr)) {
+    wl->acptr = cli_prev(acptr);
+    if (cli_marker(acptr) != wl->marker)
+      return acptr;
+  }
+  return 0;
+}
+
+/** Start searching all users for a /WHO.
+ * Replies are sent a part at a time as the client's sendQ drains,
+ * followed by RPL_ENDOFWHO.  Masks that only apply to hostnames, IP
+ * addresses or accounts are looked up in the user indexes; anything
+ * else walks the whole client list.
+ * @param[in] sptr Client doing the /WHO.
+ * @param[in] wm Compiled mask (copied).
+ * @param[in] bitsel WHOSELECT_* values.
+ * @param[in] fields WHO_FIELD_* values for the fields to show.
+ * @param[in] qrt Query type, or NULL.
+ * @param[in] counter Number of replies still allowed.
+ * @param[in] marker Marker of clients that were already shown.
+ * @param[in] mask Mask to show in RPL_ENDOFWHO.
+ */
+void who_start(struct Client* sptr, const struct WhoMatch* wm,
+               int bitsel, int fields, const char* qrt, int counter,
+               int marker, const char* mask)
+{
+  struct WhoListing *wl;
+
+  assert(0 == cli_who(sptr));
+
+  wl = (struct WhoListing*) MyMalloc(sizeof(struct WhoListing));
+  wl->acptr = cli_prev(&me);
+  wl->found = 0;
+  wl->pos = 0;
+  memcpy(&wl->match, wm, sizeof(wl->match));
+  wl->bitsel = bitsel;
+  wl->fields = fields;
+  wl->counter = counter;
+  wl->marker = marker;
+  ircd_strncpy(wl->qrt, qrt ? qrt : "", sizeof(wl->qrt) - 1);
+  ircd_strncpy(wl->mask, mask, sizeof(wl->mask) - 1);
+  who_collect(sptr, wl);
+  if ((wl->next = who_listings))
+    who_listings->prev_p = &wl->next;
+  wl->prev_p = &who_listings;
+  who_listings = wl;
+  cli_who(sptr) = wl;
+
+  who_next(sptr);
+}
+
+/** Send more replies to a client in mid-WHO.
+ * @param[in] sptr Client doing the /WHO.
+ */
+void who_next(struct Client* sptr)
+{
+  struct WhoListing *wl = cli_who(sptr);
+  struct Client *acptr;
+
+  assert(0 != wl);
+
+  while ((acptr = who_advance(wl)))
+  {
+    if (!IsUser(acptr))
+      continue;
+    if ((wl->bitsel & WHOSELECT_OPER) && !SeeOper(sptr, acptr))
+      continue;
+    if (!(SEE_USER(sptr, acptr, wl->bitsel)))
+      continue;
+    if (!who_match(&wl->match, sptr, acptr))
+      continue;
+    /* Another WHO may have moved the marks set for common channels */
+    if (!wl->found && who_common_channel(sptr, acptr))
+      continue;
+    if (!SHOW_MORE(sptr, wl->counter)) {
+      acptr = 0;
+      break;
+    }
+    do_who(sptr, acptr, 0, wl->fields, wl->qrt);
+
+    /* If client sendq is more than half full, stop. */
+    if (MsgQLength(&cli_sendQ(sptr)) > cli_max_sendq(sptr) / 2)
+      break;
+  }
+
+  if (!acptr)
+    who_end(sptr, 1);
+}
+
+/** Stop sending replies to a /WHO.
+ * @param[in] sptr Client whose WHO should be released.
+ * @param[in] reply If non-zero, send RPL_ENDOFWHO.
+ */
+void who_end(struct Client* sptr, int reply)
+{
+  struct WhoListing *wl = cli_who(sptr);
+
+  if (!wl)
+    return;
+  if (wl->next)
+    wl->next->prev_p = wl->prev_p;
+  *wl->prev_p = wl->next;
+  cli_who(sptr) = 0;
+
+  if (reply) {
+    /* Notify the user if we decided that his query was too long */
+    if (wl->counter < 0)
+      send_reply(sptr, ERR_QUERYTOOLONG, wl->mask);
+    send_reply(sptr, RPL_ENDOFWHO, wl->mask);
+  }
+  if (wl->found)
+    MyFree(wl->found);
+  MyFree(wl);
+}
+
+/** Make any WHO in progress skip a client that is being removed.
+ * @param[in] acptr Client that is being removed from #GlobalClientList.
+ */
+void who_forget_client(struct Client* acptr)
+{
+  struct WhoListing *wl;
+  struct Client **found;
+
+  for (wl = who_listings; wl; wl = wl->next)
+    if (wl->found) {
+      found = bsearch(&acptr, wl->found + wl->pos, wl->nfound - wl->pos,
+                      sizeof(*wl->found), who_cmp_client);
+      if (found) { /* drop it, keeping the rest sorted */
+        wl->nfound--;
+        memmove(found, found + 1,
+                (wl->found + wl->nfound - found) * sizeof(*found));
+      }
+    } else if (wl->acptr == acptr)
+      wl->acptr = cli_prev(acptr);
+}
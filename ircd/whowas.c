@@ -53,19 +53,47 @@
 #include "msg.h"
 
 /* #include <assert.h> -- Now using assert in ircd_log.h */
+#include <stddef.h>  /* offsetof */
 #include <stdlib.h>
 #include <string.h>
 
 
+/** Chunk of whowas entries in the arena. */
+struct WhowasChunk {
+  unsigned int used;                 /**< Number of entries in use. */
+  struct Whowas entries[WW_CHUNK];   /**< The entries. */
+};
+
 /** Keeps track of whowas least-recently-used list. */
 static struct {
   struct Whowas *ww_list;	/**< list of whowas structures */
   struct Whowas *ww_tail;	/**< tail of list for getting structures */
-  unsigned int	 ww_alloc;	/**< alloc count */
-} wwList = { 0, 0, 0 };
+  struct Whowas *ww_free;	/**< list of unused structures */
+  unsigned int	 ww_alloc;	/**< number of structures in use */
+  unsigned int	 ww_chunks;	/**< number of chunks allocated */
+} wwList = { 0, 0, 0, 0, 0 };
 
 /** Hash table of Whowas entries by nickname. */
-struct Whowas* whowashash[WW_MAX];
+static struct {
+  struct Whowas **wh_table;     /**< Chains of entries. */
+  unsigned int wh_mask;         /**< Number of chains minus one. */
+} wwHash = { 0, 0 };
+
+/** Interned string shared by whowas entries. */
+struct WhowasString {
+  struct WhowasString *ws_next; /**< Next string in the hash chain. */
+  unsigned int ws_hashv;        /**< Hash value of the text. */
+  unsigned int ws_refcnt;       /**< Number of references to the text. */
+  char ws_text[1];              /**< Text of the string (allocated larger). */
+};
+
+/** Hash table of interned strings. */
+static struct {
+  struct WhowasString **ws_table; /**< Chains of strings. */
+  unsigned int ws_mask;         /**< Number of chains minus one. */
+  unsigned int ws_count;        /**< Number of strings. */
+  size_t ws_memory;             /**< Bytes allocated for strings. */
+} wwStrings = { 0, 0, 0, 0 };
 
 /** @file
  * @brief Manipulation functions for the whowas list.
@@ -103,7 +131,7 @@ struct Whowas* whowashash[WW_MAX];
  * is not anymore maintained (and hopefully not used anymore either ;).
  *
  * So now we have two ways of accessing this database:
- * @li Given a &lt;nick> we can calculate a hashv and then whowashash[hashv] will
+ * @li Given a &lt;nick> we can calculate a hashv and then the hash table will
  *    point to the start of the 'hash list': all entries with the same hashv.
  *    We'll have to search this list to find the entry with the correct &lt;nick>.
  *    Once we found the correct whowas entry, we have a pointer to the
@@ -141,10 +169,119 @@ struct Whowas* whowashash[WW_MAX];
  * I incorporated these considerations into the code below.
  *
  * --Run
+ *
+ * The entries now live in an arena of #WW_CHUNK entry chunks: once
+ * the history is full, add_history() recycles the oldest entry in
+ * place, so a NICK or QUIT does not allocate or free an entry.  All
+ * strings except the nickname are interned with reference counts, so
+ * the server name and repeated user names, hosts and realnames are
+ * stored once.  The nick hash table is sized to the history length;
+ * changing FEAT_NICKNAMEHISTORYLENGTH rehashes the table and releases
+ * or adds chunks without touching the surviving entries.
+ */
+
+/** Calculate a case-sensitive hash value for a string.
+ * @param[in] text String to hash.
+ * @return Hash value.
+ */
+static unsigned int
+ww_hash_string(const char *text)
+{
+  unsigned int hash = 2166136261U;
+
+  while (*text)
+    hash = (hash ^ (unsigned char) *text++) * 16777619U;
+  return hash;
+}
+
+/** Calculate a case-insensitive hash value for a nickname.
+ * @param[in] name Nickname to calculate hash over.
+ * @return Calculated hash value.
  */
+static unsigned int
+ww_hash_name(const char *name)
+{
+  unsigned int hash = 2166136261U;
+
+  while (*name)
+    hash = (hash ^ ToLower(*name++)) * 16777619U;
+  return hash;
+}
 
-/** Unlink a Whowas structure and free everything inside it.
- * @param[in,out] ww The whowas record to free.
+/** Get a shared copy of a string.
+ * @param[in] text String to intern.
+ * @return Interned copy of \a text.
+ */
+static char *
+ww_intern(const char *text)
+{
+  struct WhowasString *ws, **old;
+  unsigned int hashv = ww_hash_string(text);
+  unsigned int ii, size;
+
+  if (wwStrings.ws_table)
+    for (ws = wwStrings.ws_table[hashv & wwStrings.ws_mask]; ws;
+         ws = ws->ws_next)
+      if (ws->ws_hashv == hashv && !strcmp(ws->ws_text, text)) {
+        ws->ws_refcnt++;
+        return ws->ws_text;
+      }
+
+  if (wwStrings.ws_count >= wwStrings.ws_mask) {
+    /* keep chains short by doubling the table */
+    size = wwStrings.ws_table ? (wwStrings.ws_mask + 1) * 2 : WW_HASH_MIN;
+    old = wwStrings.ws_table;
+    wwStrings.ws_table = (struct WhowasString **)
+      MyCalloc(size, sizeof(struct WhowasString *));
+    if (old) {
+      for (ii = 0; ii <= wwStrings.ws_mask; ii++)
+        while ((ws = old[ii])) {
+          old[ii] = ws->ws_next;
+          ws->ws_next = wwStrings.ws_table[ws->ws_hashv & (size - 1)];
+          wwStrings.ws_table[ws->ws_hashv & (size - 1)] = ws;
+        }
+      MyFree(old);
+    }
+    wwStrings.ws_mask = size - 1;
+  }
+
+  size = sizeof(struct WhowasString) + strlen(text);
+  ws = (struct WhowasString *) MyMalloc(size);
+  ws->ws_hashv = hashv;
+  ws->ws_refcnt = 1;
+  strcpy(ws->ws_text, text);
+  ws->ws_next = wwStrings.ws_table[hashv & wwStrings.ws_mask];
+  wwStrings.ws_table[hashv & wwStrings.ws_mask] = ws;
+  wwStrings.ws_count++;
+  wwStrings.ws_memory += size;
+  return ws->ws_text;
+}
+
+/** Drop a reference to an interned string, freeing it if unused.
+ * @param[in] text String returned by ww_intern(), or NULL.
+ */
+static void
+ww_release(char *text)
+{
+  struct WhowasString *ws, **pp;
+
+  if (!text)
+    return;
+  ws = (struct WhowasString *) (text - offsetof(struct WhowasString, ws_text));
+  if (--ws->ws_refcnt)
+    return;
+
+  for (pp = &wwStrings.ws_table[ws->ws_hashv & wwStrings.ws_mask]; *pp != ws;
+       pp = &(*pp)->ws_next)
+    assert(*pp != 0);
+  *pp = ws->ws_next;
+  wwStrings.ws_count--;
+  wwStrings.ws_memory -= sizeof(struct WhowasString) + strlen(ws->ws_text);
+  MyFree(ws);
+}
+
+/** Unlink a Whowas structure and release the strings inside it.
+ * @param[in,out] ww The whowas record to clean.
  * @return The pointer \a ww.
  */
 static struct Whowas *
@@ -169,72 +306,144 @@ whowas_clean(struct Whowas *ww)
     ww->wnext->wprev = ww->wprev;
   if (ww->wprev)
     ww->wprev->wnext = ww->wnext;
+  else
+    wwList.ww_list = ww->wnext;
 
   if (wwList.ww_tail == ww) /* update tail pointer appropriately */
     wwList.ww_tail = ww->wprev;
 
-  /* Free old info */
-  if (ww->name)
-    MyFree(ww->name);
-  if (ww->username)
-    MyFree(ww->username);
-  if (ww->hostname)
-    MyFree(ww->hostname);
-  if (ww->realhost)
-    MyFree(ww->realhost);
-  if (ww->servername)
-    MyFree(ww->servername);
-  if (ww->realname)
-    MyFree(ww->realname);
-  if (ww->away)
-    MyFree(ww->away);
+  /* Release old info */
+  ww_release(ww->username);
+  ww_release(ww->hostname);
+  ww_release(ww->realhost);
+  ww_release(ww->servername);
+  ww_release(ww->realname);
+  ww_release(ww->away);
 
   return ww;
 }
 
-/** Clean and free a whowas record.
+/** Remove a record from the free list.
+ * @param[in] ww Unused whowas record.
+ */
+static void
+whowas_unfree(struct Whowas *ww)
+{
+  if (ww->wnext)
+    ww->wnext->wprev = ww->wprev;
+  if (ww->wprev)
+    ww->wprev->wnext = ww->wnext;
+  else
+    wwList.ww_free = ww->wnext;
+}
+
+/** Clean a whowas record and return it to the free list.  If that
+ * leaves its chunk empty, release the chunk.
  * @param[in] ww Whowas record to free.
  */
 static void
 whowas_free(struct Whowas *ww)
 {
-  if (!ww)
-    return;
+  struct WhowasChunk *chunk = ww->chunk;
+  unsigned int ii;
 
   Debug((DEBUG_LIST, "Destroying whowas structure for %s", ww->name));
 
   whowas_clean(ww);
-  MyFree(ww);
-
   wwList.ww_alloc--;
+
+  if (--chunk->used == 0) {
+    /* every other entry of the chunk is already on the free list */
+    for (ii = 0; ii < WW_CHUNK; ii++)
+      if (&chunk->entries[ii] != ww)
+        whowas_unfree(&chunk->entries[ii]);
+    MyFree(chunk);
+    wwList.ww_chunks--;
+    return;
+  }
+
+  ww->wprev = 0;
+  if ((ww->wnext = wwList.ww_free))
+    ww->wnext->wprev = ww;
+  wwList.ww_free = ww;
 }
 
 /** Return a fresh Whowas record.
  * If the total number of records is smaller than determined by
- * FEAT_NICKNAMEHISTORYLENGTH, allocate a new one.  Otherwise,
- * reuse the oldest record in use.
- * @return A pointer to a clean Whowas.
+ * FEAT_NICKNAMEHISTORYLENGTH, take one from the free list, adding a
+ * chunk to the arena if necessary.  Otherwise, reuse the oldest
+ * record in use.
+ * @return A pointer to a clean Whowas, or NULL if the history is
+ * disabled.
  */
 static struct Whowas *
 whowas_alloc(void)
 {
+  struct WhowasChunk *chunk;
   struct Whowas *ww;
+  unsigned int ii;
 
   if (wwList.ww_alloc >= feature_int(FEAT_NICKNAMEHISTORYLENGTH)) {
     /* reclaim the oldest whowas entry */
-    ww = whowas_clean(wwList.ww_tail);
+    if (!(ww = whowas_clean(wwList.ww_tail)))
+      return 0;
   } else {
-    /* allocate a new one */
+    if (!wwList.ww_free) {
+      /* add a chunk to the arena */
+      chunk = (struct WhowasChunk *) MyMalloc(sizeof(struct WhowasChunk));
+      chunk->used = 0;
+      for (ii = 0; ii < WW_CHUNK; ii++) {
+        chunk->entries[ii].chunk = chunk;
+        chunk->entries[ii].wprev = ii ? &chunk->entries[ii - 1] : 0;
+        chunk->entries[ii].wnext =
+          (ii + 1 < WW_CHUNK) ? &chunk->entries[ii + 1] : 0;
+      }
+      wwList.ww_free = &chunk->entries[0];
+      wwList.ww_chunks++;
+    }
+    ww = wwList.ww_free;
+    whowas_unfree(ww);
+    ww->chunk->used++;
     wwList.ww_alloc++;
-    ww = (struct Whowas *) MyMalloc(sizeof(struct Whowas));
   }
 
-  assert(ww != NULL);
+  chunk = ww->chunk;
   memset(ww, 0, sizeof(*ww));
+  ww->chunk = chunk;
   return ww;
 }
 
-/** If necessary, trim the whowas list.
+/** Resize the nick hash table to suit the history length. */
+static void
+whowas_rehash(void)
+{
+  struct Whowas **old = wwHash.wh_table;
+  struct Whowas *ww;
+  unsigned int size = WW_HASH_MIN;
+  unsigned int ii;
+
+  while (size < (unsigned int) feature_int(FEAT_NICKNAMEHISTORYLENGTH) / 2)
+    size *= 2;
+  if (old && size == wwHash.wh_mask + 1)
+    return;
+
+  wwHash.wh_table = (struct Whowas **) MyCalloc(size, sizeof(struct Whowas *));
+  wwHash.wh_mask = size - 1;
+  if (!old)
+    return;
+
+  /* Relink oldest entries first so chains stay newest-first. */
+  for (ww = wwList.ww_tail; ww; ww = ww->wprev) {
+    ii = ww->hashv & wwHash.wh_mask;
+    if ((ww->hnext = wwHash.wh_table[ii]))
+      ww->hnext->hprevnextp = &ww->hnext;
+    ww->hprevnextp = &wwHash.wh_table[ii];
+    wwHash.wh_table[ii] = ww;
+  }
+  MyFree(old);
+}
+
+/** If necessary, trim the whowas list and resize its hash table.
  * This function trims the whowas list until it contains no more than
  * FEAT_NICKNAMEHISTORYLENGTH records.
  */
@@ -249,11 +458,14 @@ whowas_realloc(void)
     if (!wwList.ww_tail) { /* list is empty... */
       Debug((DEBUG_LIST, "whowas list emptied with alloc count %d",
 	     wwList.ww_alloc));
-      return;
+      break;
     }
 
     whowas_free(wwList.ww_tail); /* free oldest element of whowas list */
   }
+
+  if (wwHash.wh_table)
+    whowas_rehash();
 }
 
 /** Add a client to the whowas list.
@@ -263,21 +475,22 @@ whowas_realloc(void)
 void add_history(struct Client *cptr, int still_on)
 {
   struct Whowas *ww;
+  unsigned int ii;
 
   if (!(ww = whowas_alloc()))
     return; /* couldn't get a structure */
 
-  ww->hashv = hash_whowas_name(cli_name(cptr)); /* initialize struct */
+  ww->hashv = ww_hash_name(cli_name(cptr)); /* initialize struct */
   ww->logoff = CurrentTime;
-  DupString(ww->name, cli_name(cptr));
-  DupString(ww->username, cli_user(cptr)->username);
-  DupString(ww->hostname, cli_user(cptr)->host);
+  ircd_strncpy(ww->name, cli_name(cptr), NICKLEN);
+  ww->username = ww_intern(cli_user(cptr)->username);
+  ww->hostname = ww_intern(cli_user(cptr)->host);
   if (HasHiddenHost(cptr))
-    DupString(ww->realhost, cli_user(cptr)->realhost);
-  DupString(ww->servername, cli_name(cli_user(cptr)->server));
-  DupString(ww->realname, cli_info(cptr));
+    ww->realhost = ww_intern(cli_user(cptr)->realhost);
+  ww->servername = ww_intern(cli_name(cli_user(cptr)->server));
+  ww->realname = ww_intern(cli_info(cptr));
   if (cli_user(cptr)->away)
-    DupString(ww->away, cli_user(cptr)->away);
+    ww->away = ww_intern(cli_user(cptr)->away);
 
   if (still_on) { /* user changed nicknames... */
     ww->online = cptr;
@@ -298,10 +511,13 @@ void add_history(struct Client *cptr, int still_on)
     wwList.ww_tail = ww;
 
   /* Now link it into the hash table */
-  if ((ww->hnext = whowashash[ww->hashv]))
+  if (!wwHash.wh_table)
+    whowas_rehash();
+  ii = ww->hashv & wwHash.wh_mask;
+  if ((ww->hnext = wwHash.wh_table[ii]))
     ww->hnext->hprevnextp = &ww->hnext;
-  ww->hprevnextp = &whowashash[ww->hashv];
-  whowashash[ww->hashv] = ww;
+  ww->hprevnextp = &wwHash.wh_table[ii];
+  wwHash.wh_table[ii] = ww;
 }
 
 /** Clear all Whowas::online pointers that point to a client.
@@ -315,17 +531,35 @@ void off_history(const struct Client *cptr)
     temp->online = NULL;
 }
 
+/** Find the hash chain that holds the history of a nickname.
+ * Entries in the chain are ordered from newest to oldest, and may be
+ * for other nicknames.
+ * @param[in] nick Nickname to look up.
+ * @return First whowas entry in the chain, or NULL if it is empty.
+ */
+struct Whowas *whowas_bucket(const char *nick)
+{
+  if (!wwHash.wh_table)
+    return NULL;
+  return wwHash.wh_table[ww_hash_name(nick) & wwHash.wh_mask];
+}
+
 /** Find a client who has recently used a particular nickname.
  * @param[in] nick Nickname to find.
  * @return User's online client, or NULL if none is found.
  */
 struct Client *get_history(const char *nick)
 {
-  struct Whowas *temp = whowashash[hash_whowas_name(nick)];
+  struct Whowas *temp;
+  unsigned int hashv = ww_hash_name(nick);
   time_t timelimit = CurrentTime - feature_int(FEAT_KILLCHASETIMELIMIT);
 
-  for (; temp; temp = temp->hnext)
-    if (0 == ircd_strcmp(nick, temp->name) && temp->logoff > timelimit)
+  if (!wwHash.wh_table)
+    return NULL;
+  for (temp = wwHash.wh_table[hashv & wwHash.wh_mask]; temp;
+       temp = temp->hnext)
+    if (temp->hashv == hashv && 0 == ircd_strcmp(nick, temp->name)
+        && temp->logoff > timelimit)
       return temp->online;
 
   return NULL;
@@ -333,68 +567,38 @@ struct Client *get_history(const char *nick)
 
 /** Count memory used by whowas list.
  * @param[out] wwu Number of entries in whowas list.
- * @param[out] wwum Total number of bytes used by nickname, username,
- * hostname and servername fields.
- * @param[out] wwa Number of away strings in whowas list.
- * @param[out] wwam Total number of bytes used by away strings.
+ * @param[out] wwa Number of entries with away messages.
+ * @param[out] wws Number of interned strings.
+ * @param[out] wwsm Total number of bytes used by interned strings.
+ * @param[out] wwm Total number of bytes used by the arena and hash tables.
  */
-void count_whowas_memory(int *wwu, size_t *wwum, int *wwa, size_t *wwam)
+void count_whowas_memory(int *wwu, int *wwa, unsigned int *wws,
+                         size_t *wwsm, size_t *wwm)
 {
   struct Whowas *tmp;
-  int u = 0;
   int a = 0;
-  size_t um = 0;
-  size_t am = 0;
   assert(0 != wwu);
-  assert(0 != wwum);
   assert(0 != wwa);
-  assert(0 != wwam);
-
-  for (tmp = wwList.ww_list; tmp; tmp = tmp->wnext) {
-    u++;
-    um += (strlen(tmp->name) + 1);
-    um += (strlen(tmp->username) + 1);
-    um += (strlen(tmp->hostname) + 1);
-    um += (strlen(tmp->servername) + 1);
-    if (tmp->away) {
+  assert(0 != wws);
+  assert(0 != wwsm);
+  assert(0 != wwm);
+
+  for (tmp = wwList.ww_list; tmp; tmp = tmp->wnext)
+    if (tmp->away)
       a++;
-      am += (strlen(tmp->away) + 1);
-    }
-  }
-  *wwu = u;
-  *wwum = um;
+  *wwu = wwList.ww_alloc;
   *wwa = a;
-  *wwam = am;
+  *wws = wwStrings.ws_count;
+  *wwsm = wwStrings.ws_memory;
+  *wwm = wwList.ww_chunks * sizeof(struct WhowasChunk);
+  if (wwHash.wh_table)
+    *wwm += (wwHash.wh_mask + 1) * sizeof(struct Whowas *);
+  if (wwStrings.ws_table)
+    *wwm += (wwStrings.ws_mask + 1) * sizeof(struct WhowasString *);
 }
 
 /** Initialize whowas table. */
 void initwhowas(void)
 {
-  int i;
-
-  for (i = 0; i < WW_MAX; i++)
-    whowashash[i] = 0;
+  whowas_rehash();
 }
-
-/** Calculate a hash value for a string.
- * @param[in] name Nickname to calculate hash over.
- * @return Calculated hash value.
- */
-unsigned int hash_whowas_name(const char *name)
-{
-  unsigned int hash = 0;
-  unsigned int hash2 = 0;
-  unsigned char lower;
-
-  do
-  {
-    lower = ToLower(*name);
-    hash = (hash << 1) + lower;
-    hash2 = (hash2 >> 1) + lower;
-  }
-  while (*++name);
-
-  return ((hash & WW_MAX_INITIAL_MASK) << BITS_PER_COL) +
-      (hash2 & BITS_PER_COL_MASK);
-}
-